@@ -83,6 +83,9 @@
 #if defined AMX_RAISEERROR   || defined AMX_REGISTER    || defined AMX_SETCALLBACK
   #define AMX_EXPLIT_FUNCTIONS
 #endif
+#if defined AMX_XXXREGISTRY  || defined AMX_XXXSNAPSHOT  || defined AMX_XXXBUDGET
+  #define AMX_EXPLIT_FUNCTIONS
+#endif
 #if defined AMX_SETDEBUGHOOK || defined AMX_UTF8XXX     || defined AMX_XXXNATIVES
   #define AMX_EXPLIT_FUNCTIONS
 #endif
@@ -92,24 +95,32 @@
 #if defined AMX_XXXTAGS     || defined AMX_XXXUSERDATA  || defined AMX_VERIFYADDR
   #define AMX_EXPLIT_FUNCTIONS
 #endif
+#if defined AMX_XXXEXTSTATE  || defined AMX_INTERRUPT   || defined AMX_XXXASYNC
+  #define AMX_EXPLIT_FUNCTIONS
+#endif
 #if !defined AMX_EXPLIT_FUNCTIONS
   /* no constant set, set them all */
   #define AMX_ALIGN             /* amx_Align16(), amx_Align32() and amx_Align64() */
   #define AMX_ALLOT             /* amx_Allot() and amx_Release() */
+  #define AMX_XXXASYNC          /* amx_Async() */
+  #define AMX_XXXBUDGET         /* amx_GetBudget() and amx_SetBudget() */
   #define AMX_DEFCALLBACK       /* amx_Callback() */
   #define AMX_CLEANUP           /* amx_Cleanup() */
-  #define AMX_CLONE             /* amx_Clone() */
+  #define AMX_CLONE             /* amx_Clone(), amx_SealProgram(), amx_InitInstance() and amx_AttachInstance() */
   #define AMX_EXEC              /* amx_Exec() */
   #define AMX_FLAGS             /* amx_Flags() */
   #define AMX_INIT              /* amx_Init() and amx_InitJIT() */
+  #define AMX_INTERRUPT         /* amx_Interrupt() and amx_Interrupted() */
   #define AMX_MEMINFO           /* amx_MemInfo() */
   #define AMX_NAMELENGTH        /* amx_NameLength() */
   #define AMX_NATIVEINFO        /* amx_NativeInfo() */
   #define AMX_PUSHXXX           /* amx_Push(), amx_PushAddress(), amx_PushArray() and amx_PushString() */
   #define AMX_RAISEERROR        /* amx_RaiseError() */
   #define AMX_REGISTER          /* amx_Register() */
+  #define AMX_XXXREGISTRY       /* amx_RegistryCreate(), amx_RegistryAdd(), amx_RegistryDelete() and amx_RegisterRegistry() */
   #define AMX_SETCALLBACK       /* amx_SetCallback() */
   #define AMX_SETDEBUGHOOK      /* amx_SetDebugHook() */
+  #define AMX_XXXSNAPSHOT       /* amx_Snapshot() and amx_Restore() */
   #define AMX_UTF8XXX           /* amx_UTF8Check(), amx_UTF8Get(), amx_UTF8Len() and amx_UTF8Put() */
   #define AMX_XXXNATIVES        /* amx_NumNatives(), amx_GetNative() and amx_FindNative() */
   #define AMX_XXXPUBLICS        /* amx_NumPublics(), amx_GetPublic() and amx_FindPublic() */
@@ -117,6 +128,7 @@
   #define AMX_XXXSTRING         /* amx_StrLen(), amx_GetString() and amx_SetString() */
   #define AMX_XXXTAGS           /* amx_NumTags(), amx_GetTag() and amx_FindTagId() */
   #define AMX_XXXUSERDATA       /* amx_GetUserData() and amx_SetUserData() */
+  #define AMX_XXXEXTSTATE       /* amx_GetExtState() and amx_SetExtState() */
   #define AMX_VERIFYADDR        /* amx_VerifyAddress() */
 #endif
 #undef AMX_EXPLIT_FUNCTIONS
@@ -126,10 +138,13 @@
 #if defined AMX_NO_NATIVEINFO
   #undef AMX_NATIVEINFO
 #endif
+#if defined AMX_NO_REGISTRY
+  #undef AMX_XXXREGISTRY        /* the native registry uses malloc() */
+#endif
 #if AMX_USERNUM <= 0
   #undef AMX_XXXUSERDATA
 #endif
-#if defined AMX_JIT
+#if defined AMX_JIT && !defined AMX_JIT_X64
   /* JIT is incompatible with macro instructions, packed opcodes and overlays */
   #if !defined AMX_NO_MACRO_INSTR
     #define AMX_NO_MACRO_INSTR
@@ -141,13 +156,19 @@
     #define AMX_NO_OVERLAY
   #endif
 #endif
-#if (defined AMX_ASM || defined AMX_JIT) && !defined AMX_ALTCORE
+#if (defined AMX_ASM || (defined AMX_JIT && !defined AMX_JIT_X64)) && !defined AMX_ALTCORE
   /* do not use the standard ANSI-C amx_Exec() function */
   #define AMX_ALTCORE
 #endif
-#if !defined AMX_NO_PACKED_OPC && !defined AMX_TOKENTHREADING
+#if !defined AMX_NO_PACKED_OPC && !defined AMX_TOKENTHREADING && !defined AMX_DIRECTTHREADING
   #define AMX_TOKENTHREADING    /* packed opcodes require token threading */
 #endif
+#if defined AMX_DIRECTTHREADING && !defined AMX_ASM
+  #error Direct threading requires the GNU GCC core (AMXEXEC_GCC.C)
+#endif
+#if defined AMX_PAIRCOUNT && defined AMX_ALTCORE
+  #error Counting opcode pairs requires the ANSI-C core
+#endif
 
 #if defined __64BIT__
   #define NATIVEADDR(addr,high)  (AMX_NATIVE)((intptr_t)(addr) | ((intptr_t)((uint64_t)high<<32)))
@@ -197,13 +218,22 @@
     /* assume no specific calling conventions for other platforms than Windows */
     extern cell amx_exec_run(AMX *amx,cell *retval,unsigned char *data);
     extern int amx_exec_list(const AMX *amx,const cell **opcodelist,int *numopcodes);
-    extern cell amx_jit_compile(void *pcode, void *jumparray, void *nativecode);
-    extern cell amx_jit_run(AMX *amx,cell *retval,unsigned char *data);
-    extern int  amx_jit_list(const AMX *amx,const cell **opcodelist,int *numopcodes);
+    #if !defined AMX_JIT_X64
+      extern cell amx_jit_compile(void *pcode, void *jumparray, void *nativecode);
+      extern cell amx_jit_run(AMX *amx,cell *retval,unsigned char *data);
+      extern int  amx_jit_list(const AMX *amx,const cell **opcodelist,int *numopcodes);
+    #endif
   #endif /* __WIN32__ */
 #else
   int amx_exec_list(AMX *amx,const cell **opcodelist,int *numopcodes);
 #endif /* AMX_ALTCORE */
+#if defined AMX_JIT_X64
+  /* the x86-64 JIT (in AMXJIT_X64.C) */
+  extern int  amx_jit_compile(AMX *amx,void *reloc_table);
+  extern cell amx_jit_run(AMX *amx,cell *retval,unsigned char *data);
+  extern int  amx_jit_list(const AMX *amx,const cell **opcodelist,int *numopcodes);
+  extern void amx_jit_free(AMX *amx);
+#endif
 
 typedef enum {
   OP_NOP,
@@ -389,6 +419,23 @@ typedef enum {
   OP_FILL_P,
   OP_HALT_P,
   OP_BOUNDS_P,
+#endif
+#if !defined AMX_NO_SUPERINSTR
+  /* superinstructions (not stored in the file, see VerifyPcode()) */
+  OP_CONST_PUSH,        /* const.pri + push.pri */
+  OP_LOAD_S_PUSH,       /* load.s.pri + push.pri */
+  OP_ADDR_PUSH,         /* addr.pri + push.pri */
+  OP_LOAD_S_BOTH,       /* load.s.pri + load.s.alt */
+  OP_LOAD_S_CONST,      /* load.s.pri + const.alt */
+  OP_POP_ADD,           /* pop.alt + add */
+  OP_IDX_ADD,           /* shl.c.pri + pop.alt + add */
+  OP_ADD_LOAD_I,        /* add + load.i */
+  OP_EQ_JZER,           /* eq + jzer */
+  OP_NEQ_JZER,          /* neq + jzer */
+  OP_SLESS_JZER,        /* sless + jzer */
+  OP_SLEQ_JZER,         /* sleq + jzer */
+  OP_SGRTR_JZER,        /* sgrtr + jzer */
+  OP_SGEQ_JZER,         /* sgeq + jzer */
 #endif
   /* ----- */
   OP_NUM_OPCODES
@@ -569,7 +616,12 @@ int AMXAPI amx_Callback(AMX *amx, cell index, cell *result, const cell *params)
     /* at the point of the call, the CIP pseudo-register points directly
      * behind the SYSREQ(.N) instruction and its parameter(s)
      */
-    unsigned char *code=amx->code+(int)amx->cip-sizeof(cell);
+    #if defined AMX_DIRECTTHREADING
+      /* patch the translated code, the P-code stays unchanged */
+      unsigned char *code=(unsigned char *)amx->tcode+(int)amx->cip-sizeof(cell);
+    #else
+      unsigned char *code=amx->code+(int)amx->cip-sizeof(cell);
+    #endif
     if (amx->flags & AMX_FLAG_SYSREQN)		/* SYSREQ.N has 2 parameters */
       code-=sizeof(cell);
     assert(amx->code!=NULL);
@@ -597,7 +649,7 @@ int AMXAPI amx_Callback(AMX *amx, cell index, cell *result, const cell *params)
 #endif /* defined AMX_DEFCALLBACK */
 
 
-#if defined AMX_JIT
+#if defined AMX_JIT && !defined AMX_JIT_X64
   /* convert from relative addresses to absolute physical addresses */
   #define RELOC_ABS(base,off)   (*(ucell *)((base)+(int)(off)) += (ucell)(base)+(int)(off)-sizeof(cell))
 #else
@@ -624,6 +676,86 @@ int AMXAPI amx_Callback(AMX *amx, cell index, cell *result, const cell *params)
 
 #if defined AMX_INIT
 
+#if !defined AMX_NO_SUPERINSTR
+/* A superinstruction replaces the first opcode of a common instruction
+ * sequence. The other instructions of the sequence stay in place, so a jump
+ * into the middle of the sequence still works; the handler of the
+ * superinstruction just skips over the opcodes that follow it. The sequences
+ * are the most frequently executed opcode pairs for code compiled with the
+ * default optimization level (which only uses the core instruction set).
+ */
+static const struct {
+  OPCODE seq[3];        /* OP_NOP in the last field for a pair */
+  OPCODE fused;
+} superinstr[] = {
+  { { OP_CONST_PRI,  OP_PUSH_PRI,   OP_NOP }, OP_CONST_PUSH },
+  { { OP_LOAD_S_PRI, OP_PUSH_PRI,   OP_NOP }, OP_LOAD_S_PUSH },
+  { { OP_ADDR_PRI,   OP_PUSH_PRI,   OP_NOP }, OP_ADDR_PUSH },
+  { { OP_LOAD_S_PRI, OP_LOAD_S_ALT, OP_NOP }, OP_LOAD_S_BOTH },
+  { { OP_LOAD_S_PRI, OP_CONST_ALT,  OP_NOP }, OP_LOAD_S_CONST },
+  { { OP_POP_ALT,    OP_ADD,        OP_NOP }, OP_POP_ADD },
+  { { OP_SHL_C_PRI,  OP_POP_ALT,    OP_ADD }, OP_IDX_ADD },
+  { { OP_ADD,        OP_LOAD_I,     OP_NOP }, OP_ADD_LOAD_I },
+  { { OP_EQ,         OP_JZER,       OP_NOP }, OP_EQ_JZER },
+  { { OP_NEQ,        OP_JZER,       OP_NOP }, OP_NEQ_JZER },
+  { { OP_SLESS,      OP_JZER,       OP_NOP }, OP_SLESS_JZER },
+  { { OP_SLEQ,       OP_JZER,       OP_NOP }, OP_SLEQ_JZER },
+  { { OP_SGRTR,      OP_JZER,       OP_NOP }, OP_SGRTR_JZER },
+  { { OP_SGEQ,       OP_JZER,       OP_NOP }, OP_SGEQ_JZER },
+};
+
+static OPCODE FindSuperinstr(OPCODE op1,OPCODE op2,OPCODE op3)
+{
+  int i;
+
+  for (i=0; i<(int)(sizeof superinstr / sizeof superinstr[0]); i++)
+    if (superinstr[i].seq[0]==op1 && superinstr[i].seq[1]==op2 && superinstr[i].seq[2]==op3)
+      return superinstr[i].fused;
+  return OP_NOP;
+}
+#endif
+
+/* The "switch" instructions look up the case value with a binary search, or
+ * they index the case table directly if the case values are consecutive (see
+ * findcase()). This requires that the records in a case table are sorted on
+ * the case value. The compiler always generates sorted tables, but the file
+ * format does not demand it, so VerifyPcode() sorts any table that is out of
+ * order. An insertion sort is used, because it keeps the order of duplicate
+ * case values (the first of these must match).
+ */
+static int IsSortedCasetbl(const cell *rec,cell num)
+{
+  cell i;
+
+  for (i=1; i<num; i++)
+    if (rec[2*i]<rec[2*(i-1)])
+      return 0;
+  return 1;
+}
+
+static void SortCasetbl(cell *rec,cell num)
+{
+  cell i,j,value,jump;
+
+  /* the jump addresses are relative to the address of the jump field, make
+   * them relative to the start of the records while sorting
+   */
+  for (i=0; i<num; i++)
+    rec[2*i+1]+=(2*i+1)*sizeof(cell);
+  for (i=1; i<num; i++) {
+    value=rec[2*i];
+    jump=rec[2*i+1];
+    for (j=i; j>0 && rec[2*(j-1)]>value; j--) {
+      rec[2*j]=rec[2*(j-1)];
+      rec[2*j+1]=rec[2*(j-1)+1];
+    } /* for */
+    rec[2*j]=value;
+    rec[2*j+1]=jump;
+  } /* for */
+  for (i=0; i<num; i++)
+    rec[2*i+1]-=(2*i+1)*sizeof(cell);
+}
+
 static int VerifyPcode(AMX *amx)
 {
   AMX_HEADER *hdr;
@@ -631,11 +763,19 @@ static int VerifyPcode(AMX *amx)
   int sysreq_flg,max_opcode;
   int datasize,stacksize;
   const cell *opcode_list;
-  #if defined AMX_JIT
+  unsigned char *tcode;
+  int rocode;
+  #if defined AMX_JIT && !defined AMX_JIT_X64
     int opcode_count=0;
     int reloc_count=0;
     int jit_codesize=0;
   #endif
+  #if !defined AMX_NO_SUPERINSTR
+    int fuse;
+    OPCODE prev_op[2];  /* the two preceding instructions... */
+    cell prev_cip[2];   /* ... their addresses ... */
+    int prev_part[2];   /* ... and whether they are already part of a superinstruction */
+  #endif
 
   assert(amx!=NULL);
   hdr=(AMX_HEADER *)amx->base;
@@ -645,7 +785,12 @@ static int VerifyPcode(AMX *amx)
   datasize=hdr->hea-hdr->dat;
   stacksize=hdr->stp-hdr->hea;
 
-  #if defined AMX_ASM && defined AMX_JIT
+  #if defined AMX_JIT_X64
+    if ((amx->flags & AMX_FLAG_JITC)!=0)
+      amx_jit_list(amx,&opcode_list,&max_opcode);
+    else
+      amx_exec_list(amx,&opcode_list,&max_opcode);
+  #elif defined AMX_ASM && defined AMX_JIT
     if ((amx->flags & AMX_FLAG_JITC)!=0)
       jit_codesize=amx_jit_list(amx,&opcode_list,&max_opcode);
     else
@@ -658,6 +803,29 @@ static int VerifyPcode(AMX *amx)
   #if defined AMX_TOKENTHREADING
     opcode_list=NULL; /* avoid token translation if token threading is in effect */
   #endif
+  #if defined AMX_DIRECTTHREADING
+    /* translate the opcodes into a separate block (which has the same layout,
+     * because a cell has the size of a pointer); the P-code stays unchanged
+     */
+    assert_static(sizeof(cell)==sizeof(void*));
+    if (amx->tcode!=NULL) {
+      memcpy(amx->tcode,amx->code,(size_t)amx->codesize);
+      tcode=(unsigned char *)amx->tcode;
+    } else {
+      assert((amx->flags & AMX_FLAG_JITC)!=0);
+      tcode=amx->code;
+    } /* if */
+  #else
+    tcode=amx->code;
+  #endif
+  /* a read-only P-code (e.g. a file that is mapped in memory) must stay
+   * unchanged; only a separate block with translated code can be modified
+   */
+  rocode=(amx->flags & AMX_FLAG_ROCODE)!=0 && tcode==amx->code;
+  if (rocode && opcode_list!=NULL) {
+    amx->flags &= ~AMX_FLAG_VERIFY;
+    return AMX_ERR_INIT;  /* this core must relocate the opcodes in the P-code */
+  } /* if */
   #if defined AMX_NO_PACKED_OPC
     opmask= ~0;
   #else
@@ -693,6 +861,21 @@ static int VerifyPcode(AMX *amx)
   } /* if */
   amx->sysreq_d=0;      /* preset */
 
+  #if !defined AMX_NO_SUPERINSTR
+    /* superinstructions are only created for the interpreter, and only if
+     * the interpreter supports them
+     */
+    fuse=(amx->flags & (AMX_FLAG_JITC | AMX_FLAG_NOFUSE))==0
+         && (hdr->flags & AMX_FLAG_OVERLAY)==0 && !rocode
+         && max_opcode>=OP_NUM_OPCODES;
+    #if defined AMX_PAIRCOUNT
+      fuse=0;           /* count the pairs of the original instructions */
+    #endif
+    prev_op[0]=prev_op[1]=OP_NOP;
+    prev_cip[0]=prev_cip[1]=0;
+    prev_part[0]=prev_part[1]=1;
+  #endif
+
   /* start browsing code */
   assert(amx->code!=NULL);  /* should already have been set in amx_Init() */
   for (cip=0; cip<amx->codesize; ) {
@@ -713,11 +896,36 @@ static int VerifyPcode(AMX *amx)
         amx->flags &= ~AMX_FLAG_VERIFY;
         return AMX_ERR_INVINSTR;
       } /* if */
-      *(cell *)(amx->code+(int)cip)=opcode_list[op & opmask];
+      *(cell *)(tcode+(int)cip)=opcode_list[op & opmask];
     } /* if */
-    #if defined AMX_JIT
+    #if defined AMX_JIT && !defined AMX_JIT_X64
       opcode_count++;
     #endif
+    #if !defined AMX_NO_SUPERINSTR
+      if (fuse) {
+        /* the opcode of the first instruction in the sequence is replaced;
+         * an instruction that is already part of a superinstruction cannot
+         * start a new one (but a pair may grow into a triple)
+         */
+        OPCODE cur=(OPCODE)(op & opmask);
+        OPCODE fused;
+        int part=0;
+        if (!prev_part[0] && (fused=FindSuperinstr(prev_op[0],prev_op[1],cur))!=OP_NOP) {
+          *(cell *)(tcode+(int)prev_cip[0])=(opcode_list!=NULL) ? opcode_list[fused] : fused;
+          prev_part[1]=1;
+          part=1;
+        } else if (!prev_part[1] && (fused=FindSuperinstr(prev_op[1],cur,OP_NOP))!=OP_NOP) {
+          *(cell *)(tcode+(int)prev_cip[1])=(opcode_list!=NULL) ? opcode_list[fused] : fused;
+          part=1;
+        } /* if */
+        prev_op[0]=prev_op[1];
+        prev_cip[0]=prev_cip[1];
+        prev_part[0]=prev_part[1];
+        prev_op[1]=cur;
+        prev_cip[1]=cip;
+        prev_part[1]=part;
+      } /* if */
+    #endif
     cip+=sizeof(cell);
     switch (op & opmask) {
 #if !defined AMX_NO_MACRO_INSTR
@@ -992,7 +1200,7 @@ static int VerifyPcode(AMX *amx)
         amx->flags &= ~AMX_FLAG_VERIFY;
         return AMX_ERR_BOUNDS;
       } /* if */
-      #if defined AMX_JIT
+      #if defined AMX_JIT && !defined AMX_JIT_X64
         reloc_count++;
         RELOC_ABS(amx->code, cip);  /* change to absolute physical address */
       #endif
@@ -1024,6 +1232,17 @@ static int VerifyPcode(AMX *amx)
     case OP_CASETBL_OVL: {
       cell num;
       DBGPARAM(num);    /* number of records follows the opcode */
+      if (num<0 || cip+(2*num + 1)*sizeof(cell)>(ucell)amx->codesize) {
+        amx->flags &= ~AMX_FLAG_VERIFY;
+        return AMX_ERR_BOUNDS;
+      } /* if */
+      /* the overlays are reloaded while the script runs, so a table cannot
+       * be sorted here; refuse it instead
+       */
+      if (!IsSortedCasetbl((cell*)(amx->code+(int)cip+sizeof(cell)),num)) {
+        amx->flags &= ~AMX_FLAG_VERIFY;
+        return AMX_ERR_FORMAT;
+      } /* if */
       cip+=(2*num + 1)*sizeof(cell);
       if (amx->overlay==NULL)
         return AMX_ERR_OVERLAY;       /* no overlay callback */
@@ -1046,6 +1265,17 @@ static int VerifyPcode(AMX *amx)
       cell num,offs;
       int i;
       DBGPARAM(num);    /* number of records follows the opcode */
+      if (num<0 || cip+(2*num + 1)*sizeof(cell)>(ucell)amx->codesize) {
+        amx->flags &= ~AMX_FLAG_VERIFY;
+        return AMX_ERR_BOUNDS;
+      } /* if */
+      if (!IsSortedCasetbl((cell*)(tcode+(int)cip+sizeof(cell)),num)) {
+        if ((hdr->flags & AMX_FLAG_OVERLAY)!=0 || rocode) {
+          amx->flags &= ~AMX_FLAG_VERIFY;
+          return AMX_ERR_FORMAT;      /* see OP_CASETBL_OVL */
+        } /* if */
+        SortCasetbl((cell*)(tcode+(int)cip+sizeof(cell)),num);
+      } /* if */
       for (i=0; i<=num; i++) {
         offs=cip+2*i*sizeof(cell);
         tgt=*(cell*)(amx->code+(int)offs)+offs-sizeof(cell);
@@ -1053,7 +1283,7 @@ static int VerifyPcode(AMX *amx)
           amx->flags &= ~AMX_FLAG_VERIFY;
           return AMX_ERR_BOUNDS;
         } /* if */
-        #if defined AMX_JIT
+        #if defined AMX_JIT && !defined AMX_JIT_X64
           RELOC_ABS(amx->code, cip+2*i*sizeof(cell));
           reloc_count++;
         #endif
@@ -1072,7 +1302,7 @@ static int VerifyPcode(AMX *amx)
     /* only either type of system request opcode should be found (otherwise,
      * we probably have a non-conforming compiler
      */
-    if ((sysreq_flg==0x01 || sysreq_flg==0x02) && (amx->flags & AMX_FLAG_JITC)==0) {
+    if ((sysreq_flg==0x01 || sysreq_flg==0x02) && (amx->flags & AMX_FLAG_JITC)==0 && !rocode) {
       /* to use direct system requests, a function pointer must fit in a cell;
        * because the native function's address will be stored as the parameter
        * of SYSREQ.(N)D
@@ -1086,7 +1316,17 @@ static int VerifyPcode(AMX *amx)
     } /* if */
   #endif
 
-  #if defined AMX_JIT
+  #if defined AMX_JIT_X64
+    if ((amx->flags & AMX_FLAG_JITC)!=0) {
+      /* the native code is kept in a separate (executable) memory block; the
+       * memory block for amx_InitJIT() receives the header, the P-code and the
+       * data, and the relocation table holds a native offset for every cell
+       * of the P-code
+       */
+      amx->codesize=hdr->stp;
+      amx->reloc_size=(int)(hdr->dat - hdr->cod + sizeof(cell));
+    } /* if */
+  #elif defined AMX_JIT
     /* adjust the code size to mean: estimated code size of the native code
      * (instead of the size of the P-code)
      */
@@ -1133,6 +1373,27 @@ static int VerifyPcode(AMX *amx)
   }
 #endif
 
+#if defined AMX_XXXSNAPSHOT
+/* program_checksum() returns an FNV-1a hash of the header and the tables
+ * (before the native functions are registered) and, for a program without
+ * overlays, of the P-code (before it is verified and relocated); a snapshot
+ * stores it, so that it can only be restored into the same program
+ */
+static uint32_t program_checksum(AMX *amx)
+{
+  AMX_HEADER *hdr=(AMX_HEADER *)amx->base;
+  const unsigned char *ptr,*end;
+  uint32_t sum=2166136261u;
+
+  for (ptr=amx->base,end=ptr+(int)hdr->cod; ptr<end; ptr++)
+    sum=(sum ^ *ptr)*16777619u;
+  if ((hdr->flags & AMX_FLAG_OVERLAY)==0)
+    for (ptr=amx->code,end=ptr+(int)amx->codesize; ptr<end; ptr++)
+      sum=(sum ^ *ptr)*16777619u;
+  return sum;
+}
+#endif
+
 int AMXAPI amx_Init(AMX *amx,void *program)
 {
   AMX_HEADER *hdr;
@@ -1283,6 +1544,22 @@ int AMXAPI amx_Init(AMX *amx,void *program)
   } /* local */
   #endif
 
+  #if defined AMX_DIRECTTHREADING
+    /* the translated code is kept in a separate block; overlays are not
+     * supported, because these are loaded at run time
+     */
+    amx->tcode=NULL;
+    if ((hdr->flags & AMX_FLAG_OVERLAY)!=0)
+      return AMX_ERR_OVERLAY;
+    if ((amx->flags & AMX_FLAG_JITC)==0 && (amx->tcode=malloc((size_t)amx->codesize))==NULL)
+      return AMX_ERR_MEMORY;
+  #endif
+
+  #if defined AMX_XXXSNAPSHOT
+    /* the checksum is taken before VerifyPcode() modifies the P-code */
+    amx->checksum=program_checksum(amx);
+  #endif
+
   /* verify P-code and relocate address in the case of the JIT */
   if ((hdr->flags & AMX_FLAG_OVERLAY)==0) {
     err=VerifyPcode(amx);
@@ -1298,8 +1575,13 @@ int AMXAPI amx_Init(AMX *amx,void *program)
         err=VerifyPcode(amx);
     } /* for */
   } /* if */
-  if (err!=AMX_ERR_NONE)
+  if (err!=AMX_ERR_NONE) {
+    #if defined AMX_DIRECTTHREADING
+      free(amx->tcode);
+      amx->tcode=NULL;
+    #endif
     return err;
+  } /* if */
 
   /* load any extension modules that the AMX refers to */
   #if (defined _Windows || defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__) && !defined AMX_NODYNALOAD
@@ -1371,7 +1653,44 @@ int AMXAPI amx_Init(AMX *amx,void *program)
   return AMX_ERR_NONE;
 }
 
-#if defined AMX_JIT
+#if defined AMX_JIT_X64
+
+int AMXAPI amx_InitJIT(AMX *amx, void *reloc_table, void *native_code)
+{
+  AMX_HEADER *hdr;
+  unsigned char *image;
+  int err;
+
+  if ((amx->flags & AMX_FLAG_JITC)==0)
+    return AMX_ERR_INIT_JIT;    /* flag not set, this AMX is not prepared for JIT */
+  hdr=(AMX_HEADER *)amx->base;
+  if (hdr->file_version>MAX_FILE_VER_JIT)
+    return AMX_ERR_VERSION;     /* JIT may not support the newest file version(s) */
+  assert(amx->sysreq_d==0);     /* SYSREQ patching is disabled for the JIT */
+
+  /* the native code is stored in a block that is allocated by the JIT (the
+   * memory block of the host is not executable)
+   */
+  if ((err=amx_jit_compile(amx,reloc_table))!=AMX_ERR_NONE)
+    return err;
+
+  /* copy the header, the P-code and the data into the block of the host (the
+   * data stays where it is if it is in a separate block); the P-code remains
+   * available for the debugger and for the native functions
+   */
+  image=(unsigned char *)native_code;
+  memcpy(image,amx->base,(size_t)hdr->cod);
+  memcpy(image+(int)hdr->cod,amx->code,(size_t)(hdr->dat-hdr->cod));
+  if (amx->data==NULL) {
+    memcpy(image+(int)hdr->dat,amx->base+(int)hdr->dat,(size_t)(hdr->hea-hdr->dat));
+    *(cell *)(image+(int)(hdr->stp-sizeof(cell)))=0;  /* sentinel for strings */
+  } /* if */
+  amx->base=image;
+  amx->code=image+(int)hdr->cod;
+  return AMX_ERR_NONE;
+}
+
+#elif defined AMX_JIT
 
   #define CODESIZE_JIT    8192  /* approximate size of the code for the JIT */
 
@@ -1457,7 +1776,7 @@ int AMXAPI amx_InitJIT(AMX *amx, void *reloc_table, void *native_code)
   return (res == 0) ? AMX_ERR_NONE : AMX_ERR_INIT_JIT;
 }
 
-#else /* #if defined AMX_JIT */
+#else /* #if defined AMX_JIT_X64 || defined AMX_JIT */
 
 int AMXAPI amx_InitJIT(AMX *amx,void *compiled_program,void *reloc_table)
 {
@@ -1467,10 +1786,79 @@ int AMXAPI amx_InitJIT(AMX *amx,void *compiled_program,void *reloc_table)
   return AMX_ERR_INIT_JIT;
 }
 
-#endif  /* #if defined AMX_JIT */
+#endif  /* #if defined AMX_JIT_X64 || defined AMX_JIT */
 
 #endif  /* AMX_INIT */
 
+#if defined AMX_XXXEXTSTATE || defined AMX_CLEANUP
+/* The extension state is a list of blocks, each with a tag and an optional
+ * release function, that amx_Cleanup() calls. Unlike the user data, the number
+ * of entries is not fixed and clones and instances have their own list, so that
+ * extension modules keep their state per abstract machine rather than in
+ * global variables. An abstract machine does not inherit the extension state
+ * of the program that it is cloned from.
+ */
+typedef struct tagEXTSTATE {
+  struct tagEXTSTATE *next;
+  long tag;
+  void *state;
+  AMX_RELEASE release;
+} EXTSTATE;
+#endif
+
+#if defined AMX_XXXEXTSTATE
+int AMXAPI amx_GetExtState(AMX *amx, long tag, void **state)
+{
+  EXTSTATE *item;
+
+  assert(amx!=NULL);
+  assert(tag!=0);
+  assert(state!=NULL);
+  for (item=(EXTSTATE*)amx->extstate; item!=NULL && item->tag!=tag; item=item->next)
+    /* nothing */;
+  if (item==NULL) {
+    *state=NULL;
+    return AMX_ERR_USERDATA;
+  } /* if */
+  *state=item->state;
+  return AMX_ERR_NONE;
+}
+
+/* Setting the state to NULL removes the entry (without calling the release
+ * function).
+ */
+int AMXAPI amx_SetExtState(AMX *amx, long tag, void *state, AMX_RELEASE release)
+{
+  EXTSTATE *item,*pred;
+
+  assert(amx!=NULL);
+  assert(tag!=0);
+  pred=NULL;
+  for (item=(EXTSTATE*)amx->extstate; item!=NULL && item->tag!=tag; item=item->next)
+    pred=item;
+  if (state==NULL) {
+    if (item!=NULL) {
+      if (pred!=NULL)
+        pred->next=item->next;
+      else
+        amx->extstate=item->next;
+      free(item);
+    } /* if */
+    return AMX_ERR_NONE;
+  } /* if */
+  if (item==NULL) {
+    if ((item=(EXTSTATE*)malloc(sizeof(EXTSTATE)))==NULL)
+      return AMX_ERR_MEMORY;
+    item->tag=tag;
+    item->next=(EXTSTATE*)amx->extstate;
+    amx->extstate=item;
+  } /* if */
+  item->state=state;
+  item->release=release;
+  return AMX_ERR_NONE;
+}
+#endif /* AMX_XXXEXTSTATE */
+
 #if defined AMX_CLEANUP
 int AMXAPI amx_Cleanup(AMX *amx)
 {
@@ -1487,6 +1875,24 @@ int AMXAPI amx_Cleanup(AMX *amx)
     AMX_ENTRY libcleanup;
     int numlibraries,i;
   #endif
+  EXTSTATE *item;
+
+  /* release the state of the extension modules; every abstract machine (also
+   * a clone) has its own
+   */
+  while ((item=(EXTSTATE*)amx->extstate)!=NULL) {
+    amx->extstate=item->next;
+    if (item->release!=NULL)
+      item->release(amx,item->state);
+    free(item);
+  } /* while */
+
+  /* a clone shares the extension modules and the (native) code with the
+   * abstract machine that it was cloned from, these are cleaned up with
+   * that abstract machine
+   */
+  if ((amx->flags & AMX_FLAG_CLONE)!=0)
+    return AMX_ERR_NONE;
 
   /* unload all extension modules */
   #if (defined _Windows || defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__) && !defined AMX_NODYNALOAD
@@ -1531,12 +1937,20 @@ int AMXAPI amx_Cleanup(AMX *amx)
   #else
     (void)amx;
   #endif
+  #if defined AMX_JIT_X64
+    if ((amx->flags & AMX_FLAG_JITC)!=0)
+      amx_jit_free(amx);
+  #endif
+  #if defined AMX_DIRECTTHREADING
+    free(amx->tcode);
+    amx->tcode=NULL;
+  #endif
   return AMX_ERR_NONE;
 }
 #endif /* AMX_CLEANUP */
 
 #if defined AMX_CLONE
-int AMXAPI amx_Clone(AMX *amxClone, AMX *amxSource, void *data)
+static int clone_machine(AMX *amxClone, AMX *amxSource, void *data, int copydata)
 {
   AMX_HEADER *hdr;
   unsigned char _FAR *dataSource;
@@ -1557,6 +1971,13 @@ int AMXAPI amx_Clone(AMX *amxClone, AMX *amxSource, void *data)
   amxClone->base=amxSource->base;
   amxClone->code=amxSource->code;
   amxClone->codesize=amxSource->codesize;
+  amxClone->checksum=amxSource->checksum;
+  #if defined AMX_JIT_X64
+    amxClone->jit_code=amxSource->jit_code;   /* clones share the native code */
+  #endif
+  #if defined AMX_DIRECTTHREADING
+    amxClone->tcode=amxSource->tcode;         /* clones share the translated code */
+  #endif
   amxClone->hlw=hdr->hea - hdr->dat; /* stack and heap relative to data segment */
   amxClone->stp=hdr->stp - hdr->dat - sizeof(cell);
   amxClone->hea=amxClone->hlw;
@@ -1565,13 +1986,17 @@ int AMXAPI amx_Clone(AMX *amxClone, AMX *amxSource, void *data)
     amxClone->callback=amxSource->callback;
   if (amxClone->debug==NULL)
     amxClone->debug=amxSource->debug;
-  amxClone->flags=amxSource->flags;
+  if (amxClone->overlay==NULL)
+    amxClone->overlay=amxSource->overlay;
+  amxClone->flags=(amxSource->flags & ~(AMX_FLAG_SEALED | AMX_FLAG_BUDGET)) | AMX_FLAG_CLONE;
 
   /* copy the data segment; the stack and the heap can be left uninitialized */
   assert(data!=NULL);
   amxClone->data=(unsigned char _FAR *)data;
-  dataSource=(amxSource->data!=NULL) ? amxSource->data : amxSource->base+(int)hdr->dat;
-  memcpy(amxClone->data,dataSource,(size_t)(hdr->hea-hdr->dat));
+  if (copydata) {
+    dataSource=(amxSource->data!=NULL) ? amxSource->data : amxSource->base+(int)hdr->dat;
+    memcpy(amxClone->data,dataSource,(size_t)(hdr->hea-hdr->dat));
+  } /* if */
 
   /* Set a zero cell at the top of the stack, which functions
    * as a sentinel for strings.
@@ -1580,6 +2005,113 @@ int AMXAPI amx_Clone(AMX *amxClone, AMX *amxSource, void *data)
 
   return AMX_ERR_NONE;
 }
+
+int AMXAPI amx_Clone(AMX *amxClone, AMX *amxSource, void *data)
+{
+  return clone_machine(amxClone,amxSource,data,1);
+}
+
+/* A sealed program is loaded, verified and has all of its native functions
+ * registered; it is not run itself, but it serves as a template for any
+ * number of instances (see amx_InitInstance()). The program (the header, the
+ * P-code and the native code of the JIT) is never modified after it has been
+ * sealed, so the instances may run in different threads. Every instance has
+ * its own data, stack and heap.
+ * The program may run before it is sealed, for example to initialize its
+ * global variables; the instances start with a copy of the data as it is at
+ * the moment that the program is sealed.
+ */
+int AMXAPI amx_SealProgram(AMX *program)
+{
+  AMX_HEADER *hdr;
+  AMX_FUNCSTUB *func;
+  int i,numnatives;
+
+  if (program==NULL)
+    return AMX_ERR_PARAMS;
+  if ((program->flags & AMX_FLAG_INIT)==0)
+    return AMX_ERR_INIT;
+  hdr=(AMX_HEADER *)program->base;
+  assert(hdr!=NULL);
+  assert(hdr->magic==AMX_MAGIC);
+  /* overlays are loaded at run time, by the overlay callback that the
+   * instances inherit; that callback must allow instances in different threads
+   * (the one of aux_LoadProgram() does)
+   */
+  if ((hdr->flags & AMX_FLAG_OVERLAY)!=0 && program->overlay==NULL)
+    return AMX_ERR_OVERLAY;
+  if ((program->flags & AMX_FLAG_CLONE)!=0)
+    return AMX_ERR_PARAMS;      /* only the original can be sealed */
+
+  /* all native functions must be resolved, because instances do not
+   * register native functions
+   */
+  assert(hdr->natives<=hdr->libraries);
+  numnatives=NUMENTRIES(hdr,natives,libraries);
+  func=GETENTRY(hdr,natives,0);
+  for (i=0; i<numnatives && func->address!=0; i++)
+    func=(AMX_FUNCSTUB*)((unsigned char*)func+hdr->defsize);
+  if (i<numnatives)
+    return AMX_ERR_NOTFOUND;
+  program->flags|=AMX_FLAG_NTVREG;
+
+  /* amx_Callback() would patch SYSREQ opcodes into SYSREQ.D on the first call
+   * of each native function; disable this, so that the P-code stays
+   * unchanged (SYSREQ.D opcodes that have already been patched stay valid)
+   */
+  program->sysreq_d=0;
+  program->flags|=AMX_FLAG_SEALED;
+  return AMX_ERR_NONE;
+}
+
+/* Create an instance of a sealed program; "data" must point to a memory block
+ * for the data, the stack and the heap (see amx_MemInfo() for the size). The
+ * instance shares everything else with the program, and creating it only
+ * copies the data section. The instance must be cleaned up (amx_Cleanup())
+ * before the program is.
+ */
+int AMXAPI amx_InitInstance(AMX *instance, AMX *program, void *data)
+{
+  int err;
+
+  if (program==NULL || instance==NULL || data==NULL)
+    return AMX_ERR_PARAMS;
+  if ((program->flags & AMX_FLAG_SEALED)==0)
+    return AMX_ERR_INIT;
+  memset(instance,0,sizeof(AMX));
+  if ((err=clone_machine(instance,program,data,1))!=AMX_ERR_NONE)
+    return err;
+  assert(instance->sysreq_d==0);
+  return AMX_ERR_NONE;
+}
+
+/* Attach an instance to a data block that already holds the data section of
+ * the program, for example a copy-on-write mapping of it; nothing is copied.
+ * The same call (on the same instance) resets the instance after its data
+ * block has been restored: the registers and the execution state are reset,
+ * but the callbacks and the user data are kept.
+ */
+int AMXAPI amx_AttachInstance(AMX *instance, AMX *program, void *data)
+{
+  int err;
+
+  if (program==NULL || instance==NULL || data==NULL)
+    return AMX_ERR_PARAMS;
+  if ((program->flags & AMX_FLAG_SEALED)==0)
+    return AMX_ERR_INIT;
+  if ((err=clone_machine(instance,program,data,0))!=AMX_ERR_NONE)
+    return err;
+  instance->cip=0;
+  instance->frm=0;
+  instance->pri=0;
+  instance->alt=0;
+  instance->reset_stk=0;
+  instance->reset_hea=0;
+  instance->error=AMX_ERR_NONE;
+  instance->paramcount=0;
+  instance->sysreq_d=0;
+  return AMX_ERR_NONE;
+}
 #endif /* AMX_CLONE */
 
 #if defined AMX_MEMINFO
@@ -1606,6 +2138,140 @@ int AMXAPI amx_MemInfo(AMX *amx, long *codesize, long *datasize, long *stackheap
 }
 #endif /* AMX_MEMINFO */
 
+#if defined AMX_XXXSNAPSHOT
+#define SNAPSHOT_IMAGE  (((sizeof(AMX_SNAPSHOT)+AMX_SNAPSHOT_ALIGN-1)/AMX_SNAPSHOT_ALIGN)*AMX_SNAPSHOT_ALIGN)
+
+/* A snapshot holds the complete state of an abstract machine: the registers
+ * and the data, heap and stack. It is taken while the abstract machine is
+ * idle, or after amx_Exec() returned with AMX_ERR_SLEEP (the restored machine
+ * then continues with AMX_EXEC_CONT). A snapshot can only be restored into an
+ * abstract machine of the same program (amx_Restore() compares a checksum of
+ * the header and the P-code), e.g. an instance of a sealed program;
+ * the callbacks, the user data and the native functions are not part of it.
+ * When "snapshot" is NULL, the function only returns the required size.
+ */
+int AMXAPI amx_Snapshot(AMX *amx, void *snapshot, size_t *size)
+{
+  AMX_HEADER *hdr;
+  AMX_SNAPSHOT *snap;
+  unsigned char *data,*image;
+  size_t required;
+
+  if (amx==NULL || size==NULL)
+    return AMX_ERR_PARAMS;
+  if ((amx->flags & AMX_FLAG_INIT)==0)
+    return AMX_ERR_INIT;
+  hdr=(AMX_HEADER *)amx->base;
+  assert(hdr!=NULL);
+  assert(hdr->magic==AMX_MAGIC);
+  required=SNAPSHOT_IMAGE+(size_t)(hdr->stp-hdr->dat);
+  if (snapshot==NULL || *size<required) {
+    *size=required;
+    return (snapshot==NULL) ? AMX_ERR_NONE : AMX_ERR_PARAMS;
+  } /* if */
+  if (amx->hea<amx->hlw || amx->hea>amx->stk || amx->stk>amx->stp)
+    return AMX_ERR_STACKERR;
+
+  memset(snapshot,0,SNAPSHOT_IMAGE);
+  snap=(AMX_SNAPSHOT *)snapshot;
+  snap->size=(int32_t)required;
+  snap->magic=AMX_SNAPMAGIC;
+  snap->cellsize=(int16_t)sizeof(cell);
+  snap->image=(int32_t)SNAPSHOT_IMAGE;
+  snap->imagesize=hdr->stp-hdr->dat;
+  snap->datasize=hdr->hea-hdr->dat;
+  snap->codesize=hdr->dat-hdr->cod;
+  snap->ovl_index=amx->ovl_index;
+  snap->checksum=amx->checksum;
+  snap->pri=amx->pri;
+  snap->alt=amx->alt;
+  snap->frm=amx->frm;
+  snap->stk=amx->stk;
+  snap->hea=amx->hea;
+  snap->cip=amx->cip;
+  snap->reset_stk=amx->reset_stk;
+  snap->reset_hea=amx->reset_hea;
+
+  /* copy the data and the heap, and the stack (including the sentinel at the
+   * top); the free area between the heap and the stack is cleared
+   */
+  data=(amx->data!=NULL) ? amx->data : amx->base+(int)hdr->dat;
+  image=(unsigned char *)snapshot+SNAPSHOT_IMAGE;
+  memcpy(image,data,(size_t)amx->hea);
+  memset(image+(int)amx->hea,0,(size_t)(amx->stk-amx->hea));
+  memcpy(image+(int)amx->stk,data+(int)amx->stk,(size_t)(snap->imagesize-amx->stk));
+  *size=required;
+  return AMX_ERR_NONE;
+}
+
+/* When the memory image of the snapshot is already at the data block of the
+ * abstract machine (because the snapshot file is mapped there), only the
+ * registers are set.
+ */
+int AMXAPI amx_Restore(AMX *amx, const void *snapshot, size_t size)
+{
+  AMX_HEADER *hdr;
+  const AMX_SNAPSHOT *snap;
+  const unsigned char *image;
+  unsigned char *data;
+  ucell top;
+
+  if (amx==NULL || snapshot==NULL || size<sizeof(AMX_SNAPSHOT))
+    return AMX_ERR_PARAMS;
+  if ((amx->flags & AMX_FLAG_INIT)==0)
+    return AMX_ERR_INIT;
+  if ((amx->flags & AMX_FLAG_SEALED)!=0)
+    return AMX_ERR_PARAMS;      /* the data of a sealed program is a template */
+  hdr=(AMX_HEADER *)amx->base;
+  assert(hdr!=NULL);
+  assert(hdr->magic==AMX_MAGIC);
+
+  snap=(const AMX_SNAPSHOT *)snapshot;
+  if (snap->magic!=AMX_SNAPMAGIC || snap->cellsize!=(int16_t)sizeof(cell))
+    return AMX_ERR_FORMAT;
+  if (snap->image<(int32_t)sizeof(AMX_SNAPSHOT) || snap->imagesize<0
+      || (size_t)snap->size>size || snap->image+snap->imagesize>snap->size)
+    return AMX_ERR_FORMAT;
+  /* verify that the snapshot is of the same program and that the registers
+   * are within range
+   */
+  if (snap->imagesize!=hdr->stp-hdr->dat || snap->datasize!=hdr->hea-hdr->dat
+      || snap->codesize!=hdr->dat-hdr->cod || snap->checksum!=amx->checksum)
+    return AMX_ERR_FORMAT;
+  top=(ucell)amx->stp;
+  if (snap->hea<amx->hlw || snap->hea>snap->stk || (ucell)snap->stk>top
+      || (ucell)snap->frm>top || (ucell)snap->reset_stk>top || (ucell)snap->reset_hea>top
+      || (ucell)snap->cip>=(ucell)snap->codesize)
+    return AMX_ERR_FORMAT;
+  if ((hdr->flags & AMX_FLAG_OVERLAY)!=0) {
+    int err;
+    if (amx->overlay==NULL)
+      return AMX_ERR_OVERLAY;
+    if ((err=amx->overlay(amx,snap->ovl_index))!=AMX_ERR_NONE)
+      return err;
+  } /* if */
+
+  data=(amx->data!=NULL) ? amx->data : amx->base+(int)hdr->dat;
+  image=(const unsigned char *)snapshot+snap->image;
+  if (image!=data) {
+    memcpy(data,image,(size_t)snap->hea);
+    memcpy(data+(int)snap->stk,image+(int)snap->stk,(size_t)(snap->imagesize-snap->stk));
+  } /* if */
+  amx->pri=snap->pri;
+  amx->alt=snap->alt;
+  amx->frm=snap->frm;
+  amx->stk=snap->stk;
+  amx->hea=snap->hea;
+  amx->cip=snap->cip;
+  amx->reset_stk=snap->reset_stk;
+  amx->reset_hea=snap->reset_hea;
+  amx->ovl_index=snap->ovl_index;
+  amx->error=AMX_ERR_NONE;
+  amx->paramcount=0;
+  return AMX_ERR_NONE;
+}
+#endif /* AMX_XXXSNAPSHOT */
+
 #if defined AMX_NAMELENGTH
 int AMXAPI amx_NameLength(AMX *amx, int *length)
 {
@@ -1971,6 +2637,165 @@ int AMXAPI amx_Register(AMX *amx, const AMX_NATIVE_INFO *list, int number)
 }
 #endif /* AMX_REGISTER */
 
+#if defined AMX_XXXREGISTRY
+/* A native registry is a hash table with the native functions from one or
+ * more AMX_NATIVE_INFO lists. It is built once, and it can then be used to
+ * register the natives of any number of scripts, with a single hash lookup
+ * per native function that the script imports (amx_Register() scans the
+ * lists for every imported native). The registry only stores pointers to the
+ * names in the lists, so the lists must remain valid while the registry is
+ * in use. After it has been built, the registry is not modified, and several
+ * threads may use it at the same time.
+ */
+typedef struct tagREGISTRY_ENTRY {
+  const char *name;     /* NULL for an empty slot */
+  AMX_NATIVE func;
+  uint32_t hash;
+} REGISTRY_ENTRY;
+
+struct tagAMX_REGISTRY {
+  REGISTRY_ENTRY *table;
+  uint32_t size;        /* number of slots, always a power of 2 */
+  uint32_t count;       /* number of slots in use */
+};
+
+static uint32_t registry_hash(const char *name)
+{
+  /* FNV-1a */
+  uint32_t hash=2166136261u;
+  while (*name!='\0')
+    hash=(hash ^ (unsigned char)*name++)*16777619u;
+  return hash;
+}
+
+static REGISTRY_ENTRY *registry_find(const AMX_REGISTRY *registry,const char *name,uint32_t hash)
+{
+  uint32_t mask=registry->size-1;
+  uint32_t i=hash & mask;
+
+  /* open addressing with linear probing; the table is never full, so the
+   * search always ends at an empty slot if the name is not found
+   */
+  while (registry->table[i].name!=NULL) {
+    if (registry->table[i].hash==hash && strcmp(registry->table[i].name,name)==0)
+      break;
+    i=(i+1) & mask;
+  } /* while */
+  return &registry->table[i];
+}
+
+static int registry_grow(AMX_REGISTRY *registry)
+{
+  REGISTRY_ENTRY *oldtable=registry->table;
+  uint32_t oldsize=registry->size;
+  uint32_t i;
+
+  registry->size=(oldsize==0) ? 64 : 2*oldsize;
+  registry->table=(REGISTRY_ENTRY*)calloc(registry->size,sizeof(REGISTRY_ENTRY));
+  if (registry->table==NULL) {
+    registry->table=oldtable;
+    registry->size=oldsize;
+    return AMX_ERR_MEMORY;
+  } /* if */
+  for (i=0; i<oldsize; i++)
+    if (oldtable[i].name!=NULL)
+      *registry_find(registry,oldtable[i].name,oldtable[i].hash)=oldtable[i];
+  free(oldtable);
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI amx_RegistryCreate(AMX_REGISTRY **registry)
+{
+  assert(registry!=NULL);
+  *registry=(AMX_REGISTRY*)calloc(1,sizeof(AMX_REGISTRY));
+  if (*registry==NULL)
+    return AMX_ERR_MEMORY;
+  if (registry_grow(*registry)!=AMX_ERR_NONE) {
+    free(*registry);
+    *registry=NULL;
+    return AMX_ERR_MEMORY;
+  } /* if */
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI amx_RegistryAdd(AMX_REGISTRY *registry, const AMX_NATIVE_INFO *list, int number)
+{
+  REGISTRY_ENTRY *entry;
+  uint32_t hash;
+  int i;
+
+  if (registry==NULL || list==NULL)
+    return AMX_ERR_PARAMS;
+  for (i=0; (i<number || number==-1) && list[i].name!=NULL; i++) {
+    /* keep the load factor at 50% at most */
+    if (2*(registry->count+1)>registry->size && registry_grow(registry)!=AMX_ERR_NONE)
+      return AMX_ERR_MEMORY;
+    hash=registry_hash(list[i].name);
+    entry=registry_find(registry,list[i].name,hash);
+    /* as with consecutive calls to amx_Register(), the function that is added
+     * first takes precedence
+     */
+    if (entry->name==NULL) {
+      entry->name=list[i].name;
+      entry->func=list[i].func;
+      entry->hash=hash;
+      registry->count++;
+    } /* if */
+  } /* for */
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI amx_RegistryDelete(AMX_REGISTRY *registry)
+{
+  if (registry!=NULL) {
+    free(registry->table);
+    free(registry);
+  } /* if */
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI amx_RegisterRegistry(AMX *amx, const AMX_REGISTRY *registry)
+{
+  AMX_FUNCSTUB *func;
+  AMX_HEADER *hdr;
+  const REGISTRY_ENTRY *entry;
+  const char *name;
+  int i,numnatives,err;
+
+  assert(amx!=NULL);
+  hdr=(AMX_HEADER *)amx->base;
+  assert(hdr!=NULL);
+  assert(hdr->magic==AMX_MAGIC);
+  assert(hdr->natives<=hdr->libraries);
+  if (registry==NULL)
+    return AMX_ERR_PARAMS;
+  numnatives=NUMENTRIES(hdr,natives,libraries);
+
+  err=AMX_ERR_NONE;
+  func=GETENTRY(hdr,natives,0);
+  for (i=0; i<numnatives; i++) {
+    if (func->address==0) {
+      /* this function is not yet located */
+      name=GETENTRYNAME(hdr,func);
+      entry=registry_find(registry,name,registry_hash(name));
+      if (entry->name!=NULL) {
+        func->address=(uint32_t)(intptr_t)entry->func;
+        #if defined __64BIT__
+          /* for 64-bit version the high part of the pointer must be stored too */
+          func->nameofs=(uint32_t)((intptr_t)entry->func >> 32);
+        #endif
+      } else {
+        err=AMX_ERR_NOTFOUND;
+      } /* if */
+    } /* if */
+    func=(AMX_FUNCSTUB*)((unsigned char*)func+hdr->defsize);
+  } /* for */
+  if (err==AMX_ERR_NONE)
+    amx->flags|=AMX_FLAG_NTVREG;
+  return err;
+}
+#endif /* AMX_XXXREGISTRY */
+
 #if defined AMX_NATIVEINFO
 AMX_NATIVE_INFO * AMXAPI amx_NativeInfo(const char *name, AMX_NATIVE func)
 {
@@ -2125,6 +2950,83 @@ int amx_exec_list(AMX *amx,const cell **opcodelist,int *numopcodes)
   *numopcodes=OP_NUM_OPCODES;
   return 0;
 }
+
+/* Look up a value in a case table, whose records are sorted on the case value
+ * (see VerifyPcode()); "rec" points to the first record. If the case values
+ * are consecutive, the record is found by indexing, otherwise the function
+ * does a binary search. The function returns a pointer to the matching
+ * record, or NULL if no case matches.
+ */
+static cell *findcase(cell *rec,cell num,cell value)
+{
+  ucell range;
+  cell lo,hi,mid;
+
+  if (num<=0)
+    return NULL;
+  /* the unsigned subtractions also handle tables that span the full range
+   * of a cell
+   */
+  range=(ucell)rec[2*(num-1)]-(ucell)rec[0];
+  if ((ucell)value-(ucell)rec[0]>range)
+    return NULL;        /* below the lowest or above the highest case value */
+  if (range==(ucell)(num-1))
+    return rec+2*((ucell)value-(ucell)rec[0]);
+  lo=0;
+  hi=num-1;
+  while (lo<hi) {
+    mid=lo+(hi-lo)/2;
+    if (rec[2*mid]<value)
+      lo=mid+1;
+    else
+      hi=mid;
+  } /* while */
+  return (rec[2*lo]==value) ? rec+2*lo : NULL;
+}
+
+/* preempt() is called when the instruction budget drops to zero, or when
+ * amx_Interrupt() was called. It returns the error code if the abstract
+ * machine must suspend. If no budget was set, it refills the counter (so that
+ * the usage count stays valid) and returns AMX_ERR_NONE.
+ */
+static int preempt(AMX *amx)
+{
+  if (amx->interrupt) {
+    amx->interrupt=0;
+    return AMX_ERR_INTERRUPT;
+  } /* if */
+  if (amx->budget>0)
+    return AMX_ERR_NONE;
+  if ((amx->flags & AMX_FLAG_BUDGET)!=0)
+    return AMX_ERR_BUDGET;
+  amx->usage+=(unsigned long)(AMX_BUDGET_REFILL-amx->budget);
+  amx->budget=AMX_BUDGET_REFILL;
+  return AMX_ERR_NONE;
+}
+#endif
+
+#if defined AMX_PAIRCOUNT
+/* With AMX_PAIRCOUNT defined, the ANSI-C core counts how often each opcode
+ * follows each other opcode, over all abstract machines (the counts are not
+ * protected against concurrent updates). This histogram is the input for
+ * the table of superinstructions; superinstructions are not created in this
+ * build, so the counts are for the instructions in the P-code.
+ */
+static unsigned long paircount[OP_NUM_OPCODES*OP_NUM_OPCODES];
+static OPCODE prevopcode=OP_NOP;
+
+/* amx_PairCount() returns the histogram of opcode pairs: the count for the
+ * pair (op1, op2) is at index op1*numopcodes+op2 (the opcodes are those of
+ * the OPCODE enumeration)
+ */
+int AMXAPI amx_PairCount(const unsigned long **counts,int *numopcodes)
+{
+  assert(counts!=NULL);
+  assert(numopcodes!=NULL);
+  *counts=paircount;
+  *numopcodes=OP_NUM_OPCODES;
+  return AMX_ERR_NONE;
+}
 #endif
 
 int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
@@ -2142,6 +3044,8 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
   assert(amx!=NULL);
   if ((amx->flags & AMX_FLAG_INIT)==0)
     return AMX_ERR_INIT;
+  if ((amx->flags & AMX_FLAG_SEALED)!=0)
+    return AMX_ERR_INIT;        /* a sealed program does not run, its instances do */
   if (amx->callback==NULL)
     return AMX_ERR_CALLBACK;
 
@@ -2253,6 +3157,23 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
   if (amx->hea+STKMARGIN>amx->stk)
     return AMX_ERR_STACKERR;
 
+#if defined AMX_JIT_X64
+  if ((amx->flags & AMX_FLAG_JITC)!=0) {
+    /* run the native code; the interpreter below is for programs that were
+     * not compiled
+     */
+    i=(int)amx_jit_run(amx,retval,data);
+    if (i==AMX_ERR_SLEEP || i==AMX_ERR_BUDGET || i==AMX_ERR_INTERRUPT) {
+      amx->reset_stk=reset_stk;
+      amx->reset_hea=reset_hea;
+    } else {
+      amx->stk=reset_stk;
+      amx->hea=reset_hea;
+    } /* if */
+    return i;
+  } /* if */
+#endif
+
 #if defined AMX_ALTCORE
 
   /* start running either the ARM or 80x86 assembler abstract machine or the JIT */
@@ -2267,7 +3188,7 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
     /* also for GNU GCC and Intel C/C++ versions */
     i = amx_exec_run(amx,retval,data);
   #endif
-  if (i == AMX_ERR_SLEEP) {
+  if (i == AMX_ERR_SLEEP || i == AMX_ERR_BUDGET || i == AMX_ERR_INTERRUPT) {
     amx->reset_stk=reset_stk;
     amx->reset_hea=reset_hea;
   } else {
@@ -2290,6 +3211,23 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
   #define PUSH(v)       ( stk-=sizeof(cell), _W(data,stk,v) )
   #define POP(v)        ( v=_R(data,stk), stk+=sizeof(cell) )
 
+  /* the instruction budget is charged one unit on every call and on every
+   * backward jump, and amx_Interrupt() is polled at the same points; the
+   * abstract machine suspends after the jump or call
+   */
+  #define CHARGE()      if ((--amx->budget<=0 || amx->interrupt) \
+                            && (i=preempt(amx))!=AMX_ERR_NONE) goto __preempt
+  #define JUMP()        { cell *target=JUMPREL(cip); \
+                          if (target<cip) { cip=target; CHARGE(); } else { cip=target; } }
+
+  /* a native function that raises AMX_ERR_SWITCH has stored a new set of
+   * registers in the AMX structure (for fibers, see amxcore.c); the abstract
+   * machine continues with these registers
+   */
+  #define SWITCH()      ( amx->error=AMX_ERR_NONE, pri=amx->pri, alt=amx->alt, \
+                          frm=amx->frm, stk=amx->stk, hea=amx->hea, \
+                          cip=(cell *)(amx->code+(int)amx->cip) )
+
   /* set up registers for ANSI-C core: pri, alt, frm, cip, hea, stk */
   pri=amx->pri;
   alt=amx->alt;
@@ -2301,6 +3239,10 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
   /* start running */
   for ( ;; ) {
     op=_RCODE();
+    #if defined AMX_PAIRCOUNT
+      paircount[prevopcode*OP_NUM_OPCODES+GETOPCODE(op)]++;
+      prevopcode=GETOPCODE(op);
+    #endif
     switch (GETOPCODE(op)) {
     /* core instruction set */
     case OP_NOP:
@@ -2524,21 +3466,22 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
     case OP_CALL:
       PUSH(((unsigned char *)cip-amx->code)+sizeof(cell));/* skip address */
       cip=JUMPREL(cip);                 /* jump to the address */
+      CHARGE();
       break;
     case OP_JUMP:
       /* since the GETPARAM() macro modifies cip, you cannot
        * do GETPARAM(cip) directly */
-      cip=JUMPREL(cip);
+      JUMP();
       break;
     case OP_JZER:
       if (pri==0)
-        cip=JUMPREL(cip);
+        JUMP()
       else
         SKIPPARAM(1);
       break;
     case OP_JNZ:
       if (pri!=0)
-        cip=JUMPREL(cip);
+        JUMP()
       else
         SKIPPARAM(1);
       break;
@@ -2756,18 +3699,18 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
           amx->reset_hea=reset_hea;
           return i;
         } /* if */
+        if (i==AMX_ERR_SWITCH) {
+          SWITCH();
+          break;
+        } /* if */
         ABORT(amx,i);
       } /* if */
       break;
     case OP_SWITCH: {
       cell *cptr=JUMPREL(cip)+1;/* +1, to skip the "casetbl" opcode */
+      cell *rec=findcase(cptr+2,*cptr,pri);
       assert(*JUMPREL(cip)==OP_CASETBL);
-      cip=JUMPREL(cptr+1);      /* preset to "none-matched" case */
-      i=(int)*cptr;             /* number of records in the case table */
-      for (cptr+=2; i>0 && *cptr!=pri; i--,cptr+=2)
-        /* nothing */;
-      if (i>0)
-        cip=JUMPREL(cptr+1);    /* case found */
+      cip=JUMPREL((rec!=NULL) ? rec+1 : cptr+1);  /* case found, or "none-matched" case */
       break;
     } /* case */
     case OP_SWAP_PRI:
@@ -2818,6 +3761,10 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
           amx->reset_hea=reset_hea;
           return AMX_ERR_SLEEP;
         } /* if */
+        if (amx->error==AMX_ERR_SWITCH) {
+          SWITCH();
+          break;
+        } /* if */
         ABORT(amx,amx->error);
       } /* if */
       break;
@@ -2833,7 +3780,7 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       amx->frm=frm;
       amx->stk=stk;
       pri=((AMX_NATIVE)(intptr_t)offs)(amx,(cell*)(data+(int)stk));
-      stk+=val+4;
+      stk+=val+sizeof(cell);
       if (amx->error!=AMX_ERR_NONE) {
         if (amx->error==AMX_ERR_SLEEP) {
           amx->pri=pri;
@@ -2843,6 +3790,10 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
           amx->reset_hea=reset_hea;
           return AMX_ERR_SLEEP;
         } /* if */
+        if (amx->error==AMX_ERR_SWITCH) {
+          SWITCH();
+          break;
+        } /* if */
         ABORT(amx,amx->error);
       } /* if */
       break;
@@ -2859,6 +3810,7 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       if ((i=amx->overlay(amx,amx->ovl_index))!=AMX_ERR_NONE)
         ABORT(amx,i);
       cip=(cell*)amx->code;
+      CHARGE();
       break;
     case OP_RETN_OVL:
       assert(amx->overlay!=NULL);
@@ -2875,13 +3827,9 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       break;
     case OP_SWITCH_OVL: {
       cell *cptr=JUMPREL(cip)+1;  /* +1, to skip the "icasetbl" opcode */
+      cell *rec=findcase(cptr+2,*cptr,pri);
       assert(*JUMPREL(cip)==OP_CASETBL_OVL);
-      amx->ovl_index=*(cptr+1);   /* preset to "none-matched" case */
-      i=(int)*cptr;               /* number of records in the case table */
-      for (cptr+=2; i>0 && *cptr!=pri; i--,cptr+=2)
-        /* nothing */;
-      if (i>0)
-        amx->ovl_index=*(cptr+1); /* case found */
+      amx->ovl_index=(int)*((rec!=NULL) ? rec+1 : cptr+1);  /* case found, or "none-matched" case */
       assert(amx->overlay!=NULL);
       if ((i=amx->overlay(amx,amx->ovl_index))!=AMX_ERR_NONE)
         ABORT(amx,i);
@@ -2944,37 +3892,37 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       break;
     case OP_JEQ:
       if (pri==alt)
-        cip=JUMPREL(cip);
+        JUMP()
       else
         SKIPPARAM(1);
       break;
     case OP_JNEQ:
       if (pri!=alt)
-        cip=JUMPREL(cip);
+        JUMP()
       else
         SKIPPARAM(1);
       break;
     case OP_JSLESS:
       if (pri<alt)
-        cip=JUMPREL(cip);
+        JUMP()
       else
         SKIPPARAM(1);
       break;
     case OP_JSLEQ:
       if (pri<=alt)
-        cip=JUMPREL(cip);
+        JUMP()
       else
         SKIPPARAM(1);
       break;
     case OP_JSGRTR:
       if (pri>alt)
-        cip=JUMPREL(cip);
+        JUMP()
       else
         SKIPPARAM(1);
       break;
     case OP_JSGEQ:
       if (pri>=alt)
-        cip=JUMPREL(cip);
+        JUMP()
       else
         SKIPPARAM(1);
       break;
@@ -3078,7 +4026,7 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       amx->frm=frm;
       amx->stk=stk;
       i=amx->callback(amx,offs,&pri,(cell *)(data+(int)stk));
-      stk+=val+4;
+      stk+=val+sizeof(cell);
       if (i!=AMX_ERR_NONE) {
         if (i==AMX_ERR_SLEEP) {
           amx->pri=pri;
@@ -3088,6 +4036,10 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
           amx->reset_hea=reset_hea;
           return i;
         } /* if */
+        if (i==AMX_ERR_SWITCH) {
+          SWITCH();
+          break;
+        } /* if */
         ABORT(amx,i);
       } /* if */
       break;
@@ -3422,6 +4374,100 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       } /* if */
       break;
 #endif /* AMX_NO_PACKED_OPC */
+#if !defined AMX_NO_SUPERINSTR
+    /* superinstructions: the opcodes of the instructions that follow the
+     * first instruction of the sequence are skipped
+     */
+    case OP_CONST_PUSH:
+      GETPARAM(pri);
+      SKIPPARAM(1);
+      PUSH(pri);
+      break;
+    case OP_LOAD_S_PUSH:
+      GETPARAM(offs);
+      pri=_R(data,frm+offs);
+      SKIPPARAM(1);
+      PUSH(pri);
+      break;
+    case OP_ADDR_PUSH:
+      GETPARAM(pri);
+      pri+=frm;
+      SKIPPARAM(1);
+      PUSH(pri);
+      break;
+    case OP_LOAD_S_BOTH:
+      GETPARAM(offs);
+      pri=_R(data,frm+offs);
+      SKIPPARAM(1);
+      GETPARAM(offs);
+      alt=_R(data,frm+offs);
+      break;
+    case OP_LOAD_S_CONST:
+      GETPARAM(offs);
+      pri=_R(data,frm+offs);
+      SKIPPARAM(1);
+      GETPARAM(alt);
+      break;
+    case OP_POP_ADD:
+      POP(alt);
+      SKIPPARAM(1);
+      pri+=alt;
+      break;
+    case OP_IDX_ADD:
+      GETPARAM(offs);
+      pri<<=offs;
+      SKIPPARAM(2);
+      POP(alt);
+      pri+=alt;
+      break;
+    case OP_ADD_LOAD_I:
+      pri+=alt;
+      SKIPPARAM(1);
+      /* verify address */
+      if (pri>=hea && pri<stk || (ucell)pri>=(ucell)amx->stp)
+        ABORT(amx,AMX_ERR_MEMACCESS);
+      pri=_R(data,pri);
+      break;
+    case OP_EQ_JZER:
+      pri= pri==alt ? 1 : 0;
+      goto __jzer;
+    case OP_NEQ_JZER:
+      pri= pri!=alt ? 1 : 0;
+      goto __jzer;
+    case OP_SLESS_JZER:
+      pri= pri<alt ? 1 : 0;
+      goto __jzer;
+    case OP_SLEQ_JZER:
+      pri= pri<=alt ? 1 : 0;
+      goto __jzer;
+    case OP_SGRTR_JZER:
+      pri= pri>alt ? 1 : 0;
+      goto __jzer;
+    case OP_SGEQ_JZER:
+      pri= pri>=alt ? 1 : 0;
+    __jzer:
+      SKIPPARAM(1);
+      if (pri==0)
+        JUMP()
+      else
+        SKIPPARAM(1);
+      break;
+#endif /* AMX_NO_SUPERINSTR */
+    __preempt:
+      /* the instruction budget is used up or the abstract machine was
+       * interrupted: store the complete status, so that the abstract machine
+       * can continue with AMX_EXEC_CONT (only reached through the CHARGE()
+       * macro)
+       */
+      amx->frm=frm;
+      amx->pri=pri;
+      amx->alt=alt;
+      amx->stk=stk;
+      amx->hea=hea;
+      amx->cip=(cell)((unsigned char*)cip-amx->code);
+      amx->reset_stk=reset_stk;
+      amx->reset_hea=reset_hea;
+      return i;
     default:
       assert(0);  /* invalid instructions should already have been caught in VerifyPcode() */
       ABORT(amx,AMX_ERR_INVINSTR);
@@ -3442,6 +4488,114 @@ int AMXAPI amx_SetCallback(AMX *amx,AMX_CALLBACK callback)
 }
 #endif /* AMX_SETCALLBACK */
 
+#if defined AMX_XXXBUDGET
+/* amx_SetBudget() limits the number of units that the abstract machine runs
+ * before amx_Exec() returns with AMX_ERR_BUDGET; one unit is charged on every
+ * function call and on every backward jump (so every iteration of a loop).
+ * The abstract machine can then continue with AMX_EXEC_CONT, after a new call
+ * to amx_SetBudget(). A value of zero (or below) removes the limit.
+ * The budget is only checked by the ANSI-C core, the GNU GCC core and the
+ * x86-64 JIT.
+ */
+int AMXAPI amx_SetBudget(AMX *amx,long units)
+{
+  assert(amx!=NULL);
+  amx->usage-=(unsigned long)amx->budget;   /* keep only the units used */
+  if (units>0) {
+    amx->flags|=AMX_FLAG_BUDGET;
+    amx->budget=units;
+  } else {
+    amx->flags&=~AMX_FLAG_BUDGET;
+    amx->budget=AMX_BUDGET_REFILL;
+  } /* if */
+  amx->usage+=(unsigned long)amx->budget;
+  return AMX_ERR_NONE;
+}
+
+/* amx_GetBudget() returns the units left of the budget (-1 if no budget is
+ * set) and the total number of units that the abstract machine used since it
+ * was initialized, whether or not a budget was set; the total wraps around
+ * on overflow. Either parameter may be NULL.
+ */
+int AMXAPI amx_GetBudget(AMX *amx,long *remaining,unsigned long *usage)
+{
+  assert(amx!=NULL);
+  if (remaining!=NULL) {
+    if ((amx->flags & AMX_FLAG_BUDGET)==0)
+      *remaining=-1;
+    else
+      *remaining=(amx->budget>0) ? amx->budget : 0;
+  } /* if */
+  if (usage!=NULL)
+    *usage=amx->usage-(unsigned long)amx->budget;
+  return AMX_ERR_NONE;
+}
+#endif /* AMX_XXXBUDGET */
+
+#if defined AMX_INTERRUPT
+/* amx_Interrupt() makes the abstract machine stop at the next function call
+ * or backward jump, where amx_Exec() returns with AMX_ERR_INTERRUPT. The
+ * abstract machine can then continue with AMX_EXEC_CONT, or it can be aborted
+ * by restoring the "stk" and "hea" fields from "reset_stk" and "reset_hea".
+ * If the abstract machine is not running, it stops early in the next call to
+ * amx_Exec(). This function only sets a flag, so it may be called from a
+ * signal handler or from another thread. As with amx_SetBudget(), only the
+ * ANSI-C core, the GNU GCC core and the x86-64 JIT check for the interrupt.
+ */
+int AMXAPI amx_Interrupt(AMX *amx)
+{
+  assert(amx!=NULL);
+  amx->interrupt=1;
+  return AMX_ERR_NONE;
+}
+
+/* amx_Interrupted() tells whether amx_Interrupt() was called and the abstract
+ * machine did not stop on it yet; with "clear" set, it also withdraws the
+ * interrupt. Extension modules should use this function instead of reading
+ * the field of the AMX structure. The "pending" parameter may be NULL.
+ */
+int AMXAPI amx_Interrupted(AMX *amx,int *pending,int clear)
+{
+  assert(amx!=NULL);
+  if (pending!=NULL)
+    *pending=(amx->interrupt!=0);
+  if (clear)
+    amx->interrupt=0;
+  return AMX_ERR_NONE;
+}
+#endif /* AMX_INTERRUPT */
+
+#if defined AMX_XXXASYNC
+/* amx_Async() is for native functions that would block on I/O. The native
+ * function copies what "func" needs into "data" (which "func" must free),
+ * and returns the result of amx_Async(). If the host offers to run jobs (see
+ * AMX_ASYNC), the job is submitted and the abstract machine goes to sleep
+ * until the job completes; the result of "func" then becomes the return value
+ * of the native function. "func" may also store results in the data of the
+ * abstract machine, because the abstract machine does not run while it waits.
+ * Without host support (or when the submission fails), amx_Async() simply
+ * calls "func".
+ */
+cell AMXAPI amx_Async(AMX *amx, AMX_ASYNCFUNC func, void *data)
+{
+  #if defined AMX_XXXUSERDATA
+    AMX_ASYNC *async;
+
+    assert(amx!=NULL);
+    assert(func!=NULL);
+    if (amx_GetUserData(amx,AMX_ASYNCTAG,(void**)&async)==AMX_ERR_NONE && async!=NULL
+        && async->Submit(async,amx,func,data)==AMX_ERR_NONE)
+    {
+      amx->error=AMX_ERR_SLEEP;
+      return -1;        /* sleep until the job completes */
+    } /* if */
+  #else
+    (void)amx;
+  #endif
+  return func(data);
+}
+#endif /* AMX_XXXASYNC */
+
 #if defined AMX_SETDEBUGHOOK
 int AMXAPI amx_SetDebugHook(AMX *amx,AMX_DEBUG debug)
 {
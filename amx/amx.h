@@ -195,6 +195,13 @@ extern  "C" {
 #define MAX_FILE_VER_JIT 11     /* file version supported by the JIT */
 #define MIN_AMX_VER_JIT  11     /* AMX version supported by the JIT */
 
+#if defined AMX_JIT && (defined __x86_64__ || defined __amd64__) && !defined _WIN64
+  /* on x86-64 (System V ABI), the JIT is AMXJIT_X64.C, which is written in C
+   * and which runs next to the interpreter (instead of replacing it)
+   */
+  #define AMX_JIT_X64
+#endif
+
 #if !defined PAWN_CELL_SIZE
 # if __SIZEOF_POINTER__==8
   #define PAWN_CELL_SIZE 64     /* use 64-bit cells for 64-bit systems */
@@ -202,6 +209,9 @@ extern  "C" {
   #define PAWN_CELL_SIZE 32     /* by default, use 32-bit cells */
 # endif
 #endif
+#if defined AMX_DIRECTTHREADING && defined __SIZEOF_POINTER__ && PAWN_CELL_SIZE!=8*__SIZEOF_POINTER__
+  #error Direct threading requires that a cell has the size of a pointer
+#endif
 #if PAWN_CELL_SIZE==16
   typedef uint16_t  ucell;
   typedef int16_t   cell;
@@ -225,6 +235,8 @@ typedef int (AMXAPI *AMX_CALLBACK)(struct tagAMX *amx, cell index,
 typedef int (AMXAPI *AMX_DEBUG)(struct tagAMX *amx);
 typedef int (AMXAPI *AMX_OVERLAY)(struct tagAMX *amx, int index);
 typedef int (AMXAPI *AMX_IDLE)(struct tagAMX *amx, int AMXAPI Exec(struct tagAMX *, cell *, int));
+typedef void (AMXAPI *AMX_RELEASE)(struct tagAMX *amx, void *state);
+typedef cell (AMXAPI *AMX_ASYNCFUNC)(void *data);
 #if !defined _FAR
   #define _FAR
 #endif
@@ -274,6 +286,8 @@ typedef struct tagAMX_NATIVE_INFO {
   AMX_NATIVE func;
 } PACKED AMX_NATIVE_INFO;
 
+typedef struct tagAMX_REGISTRY AMX_REGISTRY;  /* hash table of native functions (opaque) */
+
 #if !defined AMX_USERNUM
 #define AMX_USERNUM     4
 #endif
@@ -290,6 +304,16 @@ typedef struct tagOVERLAYINFO {
   int32_t size;             /* size in bytes */
 } PACKED AMX_OVERLAYINFO;
 
+/* A program with overlays may have a table with the "likely callees" of every
+ * overlay, which an overlay manager may use to load these overlays before
+ * they are called. The table is optional; when present, it is at the start
+ * of the name table (right behind the "maximum name length" field), and it
+ * consists of 16-bit words: AMX_OVLHINTS_MAGIC, the number of overlays N,
+ * N+1 indices into the list of callees (the callees of overlay i run from
+ * index i up to index i+1), and the list of callees (overlay indices).
+ */
+#define AMX_OVLHINTS_MAGIC 0xf1e8
+
 /* The AMX structure is the internal structure for many functions. Not all
  * fields are valid at all times; many fields are cached in local variables.
  */
@@ -327,9 +351,24 @@ typedef struct tagAMX {
   /* fields for overlay support and JIT support */
   int ovl_index;            /* current overlay index */
   long codesize;            /* size of the overlay, or estimated memory footprint of the native code */
+  int reloc_size;           /* required temporary buffer for relocations (JIT only) */
+  /* per-instance state of the extension modules */
+  void _FAR *extstate;      /* see amx_GetExtState() and amx_SetExtState() */
+  /* instruction budget, see amx_SetBudget() */
+  long budget;              /* units left */
+  unsigned long usage;      /* units used, plus the units left */
+  volatile int interrupt;   /* set by amx_Interrupt() */
+  /* identifies the program in a snapshot, see amx_Snapshot() */
+  uint32_t checksum;        /* of the header and the P-code, as loaded */
+  /* fields that depend on the configuration come last, so that they do not
+   * move the fields above (the assembler cores only know the fields up to
+   * "reloc_size")
+   */
   #if defined AMX_JIT
-    /* support variables for the JIT */
-    int reloc_size;         /* required temporary buffer for relocations */
+    void _FAR *jit_code;    /* native code (x86-64 JIT only) */
+  #endif
+  #if defined AMX_DIRECTTHREADING
+    void _FAR *tcode;       /* P-code translated to handler addresses */
   #endif
 } PACKED AMX;
 
@@ -368,6 +407,38 @@ typedef struct tagAMX_HEADER {
   #define AMX_MAGIC     AMX_MAGIC_64
 #endif
 
+/* The AMX_SNAPSHOT structure is the header of a snapshot (see amx_Snapshot());
+ * the memory image (data, heap and stack) follows at offset "image", which is
+ * a multiple of AMX_SNAPSHOT_ALIGN, so that a snapshot file can be mapped in
+ * memory.
+ */
+typedef struct tagAMX_SNAPSHOT {
+  int32_t size;             /* size of the snapshot, including the header */
+  uint16_t magic;           /* signature */
+  int16_t cellsize;         /* size of a cell in bytes */
+  int32_t image;            /* offset to the memory image */
+  int32_t imagesize;        /* size of the memory image (STP - DAT of the program) */
+  int32_t datasize;         /* size of the data section (HEA - DAT of the program) */
+  int32_t codesize;         /* size of the code section (DAT - COD of the program) */
+  int32_t ovl_index;        /* current overlay index */
+  uint32_t checksum;        /* of the program (see the "checksum" field in AMX) */
+  cell pri;                 /* registers */
+  cell alt;
+  cell frm;
+  cell stk;
+  cell hea;
+  cell cip;
+  cell reset_stk;
+  cell reset_hea;
+} PACKED AMX_SNAPSHOT;
+
+#define AMX_SNAPMAGIC   0xf1e9
+#if !defined AMX_SNAPSHOT_ALIGN
+  #define AMX_SNAPSHOT_ALIGN 4096 /* alignment of the memory image in a snapshot (a page) */
+#endif
+
+#define AMX_BUDGET_REFILL 0x7fffffffL /* budget counter for an abstract machine without a budget */
+
 enum {
   AMX_ERR_NONE,
   /* reserve the first 15 error codes for exit codes of the abstract machine */
@@ -384,6 +455,8 @@ enum {
   AMX_ERR_DIVIDE,       /* divide by zero */
   AMX_ERR_SLEEP,        /* go into sleepmode - code can be restarted */
   AMX_ERR_INVSTATE,     /* no implementation for this state, no fall-back */
+  AMX_ERR_BUDGET,       /* instruction budget used up - code can be restarted */
+  AMX_ERR_INTERRUPT,    /* interrupted by amx_Interrupt() - code can be restarted */
 
   AMX_ERR_MEMORY = 16,  /* out of memory */
   AMX_ERR_FORMAT,       /* invalid file format */
@@ -397,7 +470,8 @@ enum {
   AMX_ERR_PARAMS,       /* parameter error */
   AMX_ERR_DOMAIN,       /* domain error, expression result does not fit in range */
   AMX_ERR_GENERAL,      /* general error (unknown or unspecific error) */
-  AMX_ERR_OVERLAY       /* overlays are unsupported (JIT) or uninitialized */
+  AMX_ERR_OVERLAY,      /* overlays are unsupported (JIT) or uninitialized */
+  AMX_ERR_SWITCH        /* native function switched the registers (fibers), the core continues */
 };
 
 #define AMX_FLAG_OVERLAY  0x01  /* all function calls use overlays */
@@ -406,6 +480,11 @@ enum {
 #define AMX_FLAG_SLEEP    0x08  /* script uses the sleep instruction (possible re-entry or power-down mode) */
 #define AMX_FLAG_CRYPT    0x10  /* file is encrypted */
 #define AMX_FLAG_DSEG_INIT 0x20 /* data section is explicitly initialized */
+#define AMX_FLAG_BUDGET   0x40  /* an instruction budget is set, see amx_SetBudget() */
+#define AMX_FLAG_ROCODE   0x80  /* P-code is read-only, e.g. a mapped file (set before amx_Init()) */
+#define AMX_FLAG_SEALED  0x100  /* program is sealed, it serves as a read-only template for instances */
+#define AMX_FLAG_CLONE   0x200  /* code and native code are shared with another abstract machine */
+#define AMX_FLAG_NOFUSE  0x400  /* do not create superinstructions (set before amx_Init(), for debugging) */
 #define AMX_FLAG_SYSREQN 0x800  /* script uses new (optimized) version of SYSREQ opcode */
 #define AMX_FLAG_NTVREG 0x1000  /* all native functions are registered */
 #define AMX_FLAG_JITC   0x2000  /* abstract machine is JIT compiled */
@@ -417,6 +496,18 @@ enum {
 
 #define AMX_USERTAG(a,b,c,d)    ((a) | ((b)<<8) | ((long)(c)<<16) | ((long)(d)<<24))
 
+/* A host that resumes an abstract machine after amx_Exec() returns with
+ * AMX_ERR_SLEEP (honouring the delay in "pri", and waiting for the completion
+ * of a job if "pri" is negative), sets a pointer to this structure as the user
+ * value AMX_ASYNCTAG. Submit() runs "func" on a thread of the host (not the
+ * thread that runs the abstract machine); when it returns, the host stores
+ * its result in "pri" and resumes the abstract machine. See amx_Async().
+ */
+typedef struct tagAMX_ASYNC {
+  int (AMXAPI *Submit)(struct tagAMX_ASYNC *async, struct tagAMX *amx, AMX_ASYNCFUNC func, void *data);
+} AMX_ASYNC;
+#define AMX_ASYNCTAG            AMX_USERTAG('S','l','e','p')
+
 /* for native functions that use floating point parameters, the following
  * two macros are convenient for casting a "cell" into a "float" type _without_
  * changing the bit pattern
@@ -479,6 +570,8 @@ uint32_t * AMXAPI amx_Align32(uint32_t *v);
   uint64_t * AMXAPI amx_Align64(uint64_t *v);
 #endif
 int AMXAPI amx_Allot(AMX *amx, int cells, cell **address);
+int AMXAPI amx_AttachInstance(AMX *instance, AMX *program, void *data);
+cell AMXAPI amx_Async(AMX *amx, AMX_ASYNCFUNC func, void *data);
 int AMXAPI amx_Callback(AMX *amx, cell index, cell *result, const cell *params);
 int AMXAPI amx_Cleanup(AMX *amx);
 int AMXAPI amx_Clone(AMX *amxClone, AMX *amxSource, void *data);
@@ -488,6 +581,8 @@ int AMXAPI amx_FindPublic(AMX *amx, const char *name, int *index);
 int AMXAPI amx_FindPubVar(AMX *amx, const char *name, cell **address);
 int AMXAPI amx_FindTagId(AMX *amx, cell tag_id, char *tagname);
 int AMXAPI amx_Flags(AMX *amx,uint16_t *flags);
+int AMXAPI amx_GetBudget(AMX *amx, long *remaining, unsigned long *usage);
+int AMXAPI amx_GetExtState(AMX *amx, long tag, void **state);
 int AMXAPI amx_GetNative(AMX *amx, int index, char *name);
 int AMXAPI amx_GetPublic(AMX *amx, int index, char *name, ucell *address);
 int AMXAPI amx_GetPubVar(AMX *amx, int index, char *name, cell **address);
@@ -495,7 +590,10 @@ int AMXAPI amx_GetString(char *dest,const cell *source, int use_wchar, size_t si
 int AMXAPI amx_GetTag(AMX *amx, int index, char *tagname, cell *tag_id);
 int AMXAPI amx_GetUserData(AMX *amx, long tag, void **ptr);
 int AMXAPI amx_Init(AMX *amx, void *program);
+int AMXAPI amx_InitInstance(AMX *instance, AMX *program, void *data);
 int AMXAPI amx_InitJIT(AMX *amx, void *reloc_table, void *native_code);
+int AMXAPI amx_Interrupt(AMX *amx);
+int AMXAPI amx_Interrupted(AMX *amx, int *pending, int clear);
 int AMXAPI amx_MemInfo(AMX *amx, long *codesize, long *datasize, long *stackheap);
 int AMXAPI amx_NameLength(AMX *amx, int *length);
 AMX_NATIVE_INFO * AMXAPI amx_NativeInfo(const char *name, AMX_NATIVE func);
@@ -503,17 +601,29 @@ int AMXAPI amx_NumNatives(AMX *amx, int *number);
 int AMXAPI amx_NumPublics(AMX *amx, int *number);
 int AMXAPI amx_NumPubVars(AMX *amx, int *number);
 int AMXAPI amx_NumTags(AMX *amx, int *number);
+#if defined AMX_PAIRCOUNT
+  int AMXAPI amx_PairCount(const unsigned long **counts, int *numopcodes);
+#endif
 int AMXAPI amx_Push(AMX *amx, cell value);
 int AMXAPI amx_PushAddress(AMX *amx, cell *address);
 int AMXAPI amx_PushArray(AMX *amx, cell **address, const cell array[], int numcells);
 int AMXAPI amx_PushString(AMX *amx, cell **address, const char *string, int pack, int use_wchar);
 int AMXAPI amx_RaiseError(AMX *amx, int error);
 int AMXAPI amx_Register(AMX *amx, const AMX_NATIVE_INFO *nativelist, int number);
+int AMXAPI amx_RegisterRegistry(AMX *amx, const AMX_REGISTRY *registry);
+int AMXAPI amx_RegistryAdd(AMX_REGISTRY *registry, const AMX_NATIVE_INFO *nativelist, int number);
+int AMXAPI amx_RegistryCreate(AMX_REGISTRY **registry);
+int AMXAPI amx_RegistryDelete(AMX_REGISTRY *registry);
 int AMXAPI amx_Release(AMX *amx, cell *address);
+int AMXAPI amx_Restore(AMX *amx, const void *snapshot, size_t size);
+int AMXAPI amx_SealProgram(AMX *program);
+int AMXAPI amx_SetBudget(AMX *amx, long units);
 int AMXAPI amx_SetCallback(AMX *amx, AMX_CALLBACK callback);
 int AMXAPI amx_SetDebugHook(AMX *amx, AMX_DEBUG debug);
+int AMXAPI amx_SetExtState(AMX *amx, long tag, void *state, AMX_RELEASE release);
 int AMXAPI amx_SetString(cell *dest, const char *source, int pack, int use_wchar, size_t size);
 int AMXAPI amx_SetUserData(AMX *amx, long tag, void *ptr);
+int AMXAPI amx_Snapshot(AMX *amx, void *snapshot, size_t *size);
 int AMXAPI amx_StrLen(const cell *cstring, int *length);
 int AMXAPI amx_UTF8Check(const char *string, int *length);
 int AMXAPI amx_UTF8Get(const char *string, const char **endptr, cell *value);
@@ -21,6 +21,19 @@
 #include <string.h>
 #include "amx.h"
 #include "amxaux.h"
+#if !defined AMX_NO_OVERLAY
+  #include "amxpool.h"
+#endif
+#if defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
+  #include <fcntl.h>
+  #include <pthread.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #if !defined MAP_ANONYMOUS
+    #define MAP_ANONYMOUS MAP_ANON
+  #endif
+#endif
 
 size_t AMXAPI aux_ProgramSize(const char *filename)
 {
@@ -37,10 +50,381 @@ size_t AMXAPI aux_ProgramSize(const char *filename)
   return (hdr.magic==AMX_MAGIC) ? (size_t)hdr.stp : 0;
 }
 
+#if !defined AMX_NO_OVERLAY
+/* The overlays of a program are loaded in a pool that belongs to the program
+ * (see amxpool.c), and that all abstract machines that run the program share:
+ * the program itself, its clones and the instances of a sealed program. An
+ * overlay is therefore loaded once, and every abstract machine that calls a
+ * function in it runs the same (read-only) copy. The pool is found from the
+ * program header, which all these abstract machines have in common.
+ *
+ * Every abstract machine holds on to the overlay that it is running, and the
+ * pool does not release an overlay while an abstract machine holds it. The
+ * pool must therefore be large enough for the largest overlay of every
+ * abstract machine that runs concurrently; when it is not, the call fails
+ * with AMX_ERR_OVERLAY.
+ *
+ * When the compiler stored the "likely callees" of every overlay in the
+ * program (see AMX_OVLHINTS_MAGIC), a miss on an overlay also loads the
+ * callees of that overlay that are not in the pool yet, on a thread of the
+ * pool (or directly after the overlay, on a single processor), so that a
+ * cold path does not stall on every call.
+ */
+#if defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
+  typedef pthread_mutex_t OVLMUTEX;
+  #define OVLMUTEX_INIT         PTHREAD_MUTEX_INITIALIZER
+  #define ovl_mutexinit(m)      pthread_mutex_init((m), NULL)
+  #define ovl_mutexdestroy(m)   pthread_mutex_destroy(m)
+  #define ovl_lock(m)           pthread_mutex_lock(m)
+  #define ovl_unlock(m)         pthread_mutex_unlock(m)
+  #define OVL_PREFETCHTHREAD
+#else
+  /* no threads: the abstract machines that share a pool must all run in the
+   * same thread
+   */
+  typedef int OVLMUTEX;
+  #define OVLMUTEX_INIT         0
+  #define ovl_mutexinit(m)      (void)(m)
+  #define ovl_mutexdestroy(m)   (void)(m)
+  #define ovl_lock(m)           (void)(m)
+  #define ovl_unlock(m)         (void)(m)
+#endif
+
+#define OVL_TAG   AMX_USERTAG('O','v','l','y')
+#if !defined OVL_QUEUESIZE
+  #define OVL_QUEUESIZE 16  /* overlays whose callees wait to be prefetched */
+#endif
+
+typedef struct tagOVLCACHE {
+  struct tagOVLCACHE *next;
+  unsigned char *base;  /* program header, shared by all abstract machines of the program */
+  FILE *fp;             /* the program file, to read the overlays from */
+  long codeoffset;      /* file offset of the code section */
+  int numoverlays;
+  unsigned int *holds;  /* per overlay: number of abstract machines that run it */
+  AMX_POOL pool;
+  void *poolmem;
+  unsigned short *hints;/* per overlay an index in the list of callees, then that list; or NULL */
+  OVLMUTEX lock;        /* protects the pool, "holds", the file and the queue */
+  #if defined OVL_PREFETCHTHREAD
+    pthread_t prefetcher;
+    pthread_cond_t wakeup;
+    int running, stop;
+    int queue[OVL_QUEUESIZE];
+    int qhead, qcount;
+  #endif
+} OVLCACHE;
+
+typedef struct tagOVLUSER {
+  OVLCACHE *cache;
+  int index;            /* overlay that the abstract machine holds, or -1 */
+  unsigned char *code;
+} OVLUSER;
+
+static OVLCACHE *ovlcaches = NULL;
+static OVLMUTEX ovlcaches_lock = OVLMUTEX_INIT;
+
+static void ovl_release(OVLCACHE *cache, int index)
+{
+  if (index >= 0 && --cache->holds[index] == 0)
+    amx_poolunprotect_r(&cache->pool, index);
+}
+
+static void AMXAPI ovl_detach(AMX *amx, void *state)
+{
+  OVLUSER *user = (OVLUSER *)state;
+
+  (void)amx;
+  ovl_lock(&user->cache->lock);
+  ovl_release(user->cache, user->index);
+  ovl_unlock(&user->cache->lock);
+  free(user);
+}
+
+static OVLUSER *ovl_attach(AMX *amx)
+{
+  OVLCACHE *cache;
+  OVLUSER *user;
+
+  ovl_lock(&ovlcaches_lock);
+  for (cache = ovlcaches; cache != NULL && cache->base != amx->base; cache = cache->next)
+    /* nothing */;
+  ovl_unlock(&ovlcaches_lock);
+  if (cache == NULL || (user = (OVLUSER *)malloc(sizeof(OVLUSER))) == NULL)
+    return NULL;
+  user->cache = cache;
+  user->index = -1;
+  user->code = NULL;
+  if (amx_SetExtState(amx, OVL_TAG, user, ovl_detach) != AMX_ERR_NONE) {
+    free(user);
+    return NULL;
+  } /* if */
+  return user;
+}
+
+/* ovl_load() returns the overlay from the pool, or loads it when it is not
+ * there ("loaded" is set in that case); the cache must be locked
+ */
+static unsigned char *ovl_load(OVLCACHE *cache, int index, int *loaded)
+{
+  AMX_HEADER *hdr = (AMX_HEADER *)cache->base;
+  AMX_OVERLAYINFO *tbl = (AMX_OVERLAYINFO *)(cache->base + hdr->overlays) + index;
+  unsigned char *code;
+
+  *loaded = 0;
+  if ((code = (unsigned char *)amx_poolfind_r(&cache->pool, index)) != NULL)
+    return code;
+  if ((code = (unsigned char *)amx_poolalloc_r(&cache->pool, (unsigned)tbl->size, index)) == NULL)
+    return NULL;        /* the pool is too small, or all of it is held */
+  if (fseek(cache->fp, cache->codeoffset + tbl->offset, SEEK_SET) != 0
+      || fread(code, 1, (size_t)tbl->size, cache->fp) != (size_t)tbl->size)
+  {
+    amx_poolfree_r(&cache->pool, code);
+    return NULL;
+  } /* if */
+  *loaded = 1;
+  return code;
+}
+
+/* ovl_prefetch() loads the likely callees of an overlay; it stops when these
+ * would take more than a quarter of the pool, so that the callees of a single
+ * overlay do not push out the overlays that other abstract machines run
+ */
+static void ovl_prefetch(OVLCACHE *cache, int index)
+{
+  AMX_HEADER *hdr = (AMX_HEADER *)cache->base;
+  AMX_OVERLAYINFO *tbl = (AMX_OVERLAYINFO *)(cache->base + hdr->overlays);
+  const unsigned short *callees = cache->hints + cache->numoverlays + 1;
+  unsigned long total = 0;
+  int i, loaded;
+
+  for (i = cache->hints[index]; i < cache->hints[index + 1]; i++) {
+    total += (unsigned long)tbl[callees[i]].size;
+    if (total > cache->pool.size / 4)
+      break;
+    ovl_lock(&cache->lock);
+    ovl_load(cache, callees[i], &loaded);
+    ovl_unlock(&cache->lock);
+  } /* for */
+}
+
+#if defined OVL_PREFETCHTHREAD
+static void *ovl_prefetcher(void *arg)
+{
+  OVLCACHE *cache = (OVLCACHE *)arg;
+  int index;
+
+  ovl_lock(&cache->lock);
+  for ( ;; ) {
+    while (cache->qcount == 0 && !cache->stop)
+      pthread_cond_wait(&cache->wakeup, &cache->lock);
+    if (cache->stop)
+      break;
+    index = cache->queue[cache->qhead];
+    cache->qhead = (cache->qhead + 1) % OVL_QUEUESIZE;
+    cache->qcount--;
+    ovl_unlock(&cache->lock);
+    ovl_prefetch(cache, index);
+    ovl_lock(&cache->lock);
+  } /* for */
+  ovl_unlock(&cache->lock);
+  return NULL;
+}
+#endif
+
+/* aux_Overlay() is the overlay callback of the programs that are loaded with
+ * aux_LoadProgram(); amx_Clone(), amx_InitInstance() and amx_AttachInstance()
+ * copy it to the clones and the instances.
+ */
+static int AMXAPI aux_Overlay(AMX *amx, int index)
+{
+  AMX_HEADER *hdr;
+  AMX_OVERLAYINFO *tbl;
+  OVLUSER *user;
+  OVLCACHE *cache;
+  unsigned char *code;
+  int loaded, prefetch;
+
+  hdr = (AMX_HEADER *)amx->base;
+  tbl = (AMX_OVERLAYINFO *)(amx->base + hdr->overlays) + index;
+  if (amx_GetExtState(amx, OVL_TAG, (void **)&user) != AMX_ERR_NONE && (user = ovl_attach(amx)) == NULL)
+    return AMX_ERR_OVERLAY;
+  cache = user->cache;
+  if (index < 0 || index >= cache->numoverlays)
+    return AMX_ERR_OVERLAY;
+  if (index == user->index) {
+    /* a call within the overlay that the abstract machine already holds */
+    amx->code = user->code;
+    amx->codesize = tbl->size;
+    return AMX_ERR_NONE;
+  } /* if */
+
+  ovl_lock(&cache->lock);
+  ovl_release(cache, user->index);
+  user->index = -1;
+  user->code = NULL;
+  if ((code = ovl_load(cache, index, &loaded)) == NULL) {
+    ovl_unlock(&cache->lock);
+    return AMX_ERR_OVERLAY;
+  } /* if */
+  if (cache->holds[index]++ == 0)
+    amx_poolprotect_r(&cache->pool, index);
+  /* on a miss, prefetch the callees (but not while amx_Init() browses through
+   * all overlays)
+   */
+  prefetch = loaded && cache->hints != NULL && (amx->flags & AMX_FLAG_INIT) != 0
+             && cache->hints[index] < cache->hints[index + 1];
+  #if defined OVL_PREFETCHTHREAD
+    if (prefetch && cache->running) {
+      if (cache->qcount < OVL_QUEUESIZE) {
+        cache->queue[(cache->qhead + cache->qcount) % OVL_QUEUESIZE] = index;
+        cache->qcount++;
+        pthread_cond_signal(&cache->wakeup);
+      } /* if */
+      prefetch = 0;
+    } /* if */
+  #endif
+  ovl_unlock(&cache->lock);
+  if (prefetch)
+    ovl_prefetch(cache, index);
+
+  user->index = index;
+  user->code = code;
+  amx->code = code;
+  amx->codesize = tbl->size;
+  return AMX_ERR_NONE;
+}
+
+/* ovl_hints() returns a copy of the table with the likely callees of the
+ * overlays, in native byte order, or NULL if the program has no (valid) table
+ */
+static unsigned short *ovl_hints(const unsigned char *base, const AMX_HEADER *hdr, int numoverlays)
+{
+  const unsigned char *start = base + hdr->nametable + sizeof(int16_t);
+  const unsigned char *end = base + hdr->cod;
+  uint16_t word[2];
+  unsigned short *hints;
+  size_t count, i;
+
+  if (start + sizeof word > end)
+    return NULL;
+  memcpy(word, start, sizeof word);
+  amx_Align16(&word[0]);
+  amx_Align16(&word[1]);
+  if (word[0] != AMX_OVLHINTS_MAGIC || (int)word[1] != numoverlays)
+    return NULL;
+  start += sizeof word;
+  if (start + (numoverlays + 1) * sizeof(uint16_t) > end)
+    return NULL;
+  memcpy(word, start + numoverlays * sizeof(uint16_t), sizeof(uint16_t));
+  amx_Align16(&word[0]);
+  count = numoverlays + 1 + (size_t)word[0];
+  if (start + count * sizeof(uint16_t) > end || (hints = (unsigned short *)malloc(count * sizeof(uint16_t))) == NULL)
+    return NULL;
+  memcpy(hints, start, count * sizeof(uint16_t));
+  for (i = 0; i < count; i++) {
+    amx_Align16((uint16_t *)&hints[i]);
+    if ((i > 0 && i <= (size_t)numoverlays && hints[i] < hints[i - 1])
+        || (i > (size_t)numoverlays && hints[i] >= numoverlays))
+    {
+      free(hints);
+      return NULL;
+    } /* if */
+  } /* for */
+  return hints;
+}
+
+static int ovl_create(unsigned char *base, const AMX_HEADER *hdr, FILE *fp, size_t poolsize)
+{
+  OVLCACHE *cache;
+
+  if ((cache = (OVLCACHE *)malloc(sizeof(OVLCACHE))) == NULL)
+    return AMX_ERR_MEMORY;
+  memset(cache, 0, sizeof(OVLCACHE));
+  cache->base = base;
+  cache->fp = fp;
+  cache->codeoffset = (long)hdr->cod;
+  cache->numoverlays = (int)((hdr->nametable - hdr->overlays) / sizeof(AMX_OVERLAYINFO));
+  cache->holds = (unsigned int *)calloc((size_t)cache->numoverlays + 1, sizeof(unsigned int));
+  cache->poolmem = malloc(poolsize);
+  if (cache->holds == NULL || cache->poolmem == NULL) {
+    free(cache->holds);
+    free(cache->poolmem);
+    free(cache);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  amx_poolinit_r(&cache->pool, cache->poolmem, (unsigned)poolsize);
+  ovl_mutexinit(&cache->lock);
+  cache->hints = ovl_hints(base, hdr, cache->numoverlays);
+  #if defined OVL_PREFETCHTHREAD
+    /* on a single processor, the thread costs more in switches than it saves */
+    if (cache->hints != NULL && sysconf(_SC_NPROCESSORS_ONLN) > 1) {
+      pthread_cond_init(&cache->wakeup, NULL);
+      cache->running = (pthread_create(&cache->prefetcher, NULL, ovl_prefetcher, cache) == 0);
+      if (!cache->running)
+        pthread_cond_destroy(&cache->wakeup);
+    } /* if */
+  #endif
+
+  ovl_lock(&ovlcaches_lock);
+  cache->next = ovlcaches;
+  ovlcaches = cache;
+  ovl_unlock(&ovlcaches_lock);
+  return AMX_ERR_NONE;
+}
+
+static void ovl_delete(unsigned char *base)
+{
+  OVLCACHE *cache, *pred;
+
+  ovl_lock(&ovlcaches_lock);
+  pred = NULL;
+  for (cache = ovlcaches; cache != NULL && cache->base != base; cache = cache->next)
+    pred = cache;
+  if (cache != NULL) {
+    if (pred != NULL)
+      pred->next = cache->next;
+    else
+      ovlcaches = cache->next;
+  } /* if */
+  ovl_unlock(&ovlcaches_lock);
+  if (cache != NULL) {
+    #if defined OVL_PREFETCHTHREAD
+      if (cache->running) {
+        ovl_lock(&cache->lock);
+        cache->stop = 1;
+        pthread_cond_signal(&cache->wakeup);
+        ovl_unlock(&cache->lock);
+        pthread_join(cache->prefetcher, NULL);
+        pthread_cond_destroy(&cache->wakeup);
+      } /* if */
+    #endif
+    fclose(cache->fp);
+    ovl_mutexdestroy(&cache->lock);
+    free(cache->hints);
+    free(cache->holds);
+    free(cache->poolmem);
+    free(cache);
+  } /* if */
+}
+#endif /* AMX_NO_OVERLAY */
+
 int AMXAPI aux_LoadProgram(AMX *amx, const char *filename, void *memblock)
+{
+  return aux_LoadOverlayProgram(amx, filename, memblock, AUX_OVLPOOLSIZE);
+}
+
+/* aux_LoadOverlayProgram() is like aux_LoadProgram(), but it also sets the
+ * size of the pool for the overlays of the program, in bytes; the size is
+ * ignored for a program without overlays. Only the header and the data
+ * section of a program with overlays are loaded in the memory block, and the
+ * file stays open until aux_FreeProgram().
+ */
+int AMXAPI aux_LoadOverlayProgram(AMX *amx, const char *filename, void *memblock, size_t poolsize)
 {
   FILE *fp;
   AMX_HEADER hdr;
+  size_t size;
   int result, didalloc;
 
   /* open the file, read and check the header */
@@ -48,17 +432,34 @@ int AMXAPI aux_LoadProgram(AMX *amx, const char *filename, void *memblock)
     return AMX_ERR_NOTFOUND;
   fread(&hdr, sizeof hdr, 1, fp);
   amx_Align16(&hdr.magic);
+  amx_Align16((uint16_t *)&hdr.flags);
   amx_Align32((uint32_t *)&hdr.size);
+  amx_Align32((uint32_t *)&hdr.cod);
+  amx_Align32((uint32_t *)&hdr.dat);
+  amx_Align32((uint32_t *)&hdr.hea);
   amx_Align32((uint32_t *)&hdr.stp);
+  amx_Align32((uint32_t *)&hdr.overlays);
+  amx_Align32((uint32_t *)&hdr.nametable);
   if (hdr.magic != AMX_MAGIC) {
     fclose(fp);
     return AMX_ERR_FORMAT;
   } /* if */
+  #if defined AMX_NO_OVERLAY
+    if ((hdr.flags & AMX_FLAG_OVERLAY) != 0) {
+      fclose(fp);
+      return AMX_ERR_OVERLAY;
+    } /* if */
+  #endif
 
-  /* allocate the memblock if it is NULL */
+  /* allocate the memblock if it is NULL; for a program with overlays, it
+   * holds only the header, the data, the heap and the stack
+   */
   didalloc = 0;
   if (memblock == NULL) {
-    if ((memblock = malloc(hdr.stp)) == NULL) {
+    size = (size_t)hdr.stp;
+    if ((hdr.flags & AMX_FLAG_OVERLAY) != 0)
+      size = (size_t)(hdr.cod + (hdr.stp - hdr.dat));
+    if ((memblock = malloc(size)) == NULL) {
       fclose(fp);
       return AMX_ERR_MEMORY;
     } /* if */
@@ -66,13 +467,47 @@ int AMXAPI aux_LoadProgram(AMX *amx, const char *filename, void *memblock)
     /* after amx_Init(), amx->base points to the memory block */
   } /* if */
 
-  /* read in the file */
+  memset(amx, 0, sizeof *amx);
   rewind(fp);
+  #if !defined AMX_NO_OVERLAY
+    if ((hdr.flags & AMX_FLAG_OVERLAY) != 0) {
+      /* read the header and put the data section behind it; the overlays are
+       * read from the file when they are called
+       */
+      fread(memblock, 1, (size_t)hdr.cod, fp);
+      fseek(fp, hdr.dat, SEEK_SET);
+      fread((unsigned char *)memblock + hdr.cod, 1, (size_t)(hdr.hea - hdr.dat), fp);
+      if ((result = ovl_create((unsigned char *)memblock, &hdr, fp, poolsize)) != AMX_ERR_NONE) {
+        fclose(fp);
+        if (didalloc)
+          free(memblock);
+        return result;
+      } /* if */
+      amx->data = (unsigned char *)memblock + hdr.cod;
+      amx->overlay = aux_Overlay;
+      result = amx_Init(amx, memblock);
+      if (result != AMX_ERR_NONE) {
+        void *state;
+        if (amx_GetExtState(amx, OVL_TAG, &state) == AMX_ERR_NONE) {
+          ovl_detach(amx, state);
+          amx_SetExtState(amx, OVL_TAG, NULL, NULL);
+        } /* if */
+        ovl_delete((unsigned char *)memblock);  /* also closes the file */
+        if (didalloc)
+          free(memblock);
+        amx->base = NULL;
+      } /* if */
+      return result;
+    } /* if */
+  #else
+    (void)poolsize;
+  #endif
+
+  /* read in the file */
   fread(memblock, 1, (size_t)hdr.size, fp);
   fclose(fp);
 
   /* initialize the abstract machine */
-  memset(amx, 0, sizeof *amx);
   result = amx_Init(amx, memblock);
 
   /* free the memory block on error, if it was allocated here */
@@ -88,12 +523,353 @@ int AMXAPI aux_FreeProgram(AMX *amx)
 {
   if (amx->base!=NULL) {
     amx_Cleanup(amx);
+    #if !defined AMX_NO_OVERLAY
+      if ((((AMX_HEADER *)amx->base)->flags & AMX_FLAG_OVERLAY) != 0)
+        ovl_delete(amx->base);
+    #endif
     free(amx->base);
     memset(amx, 0, sizeof(AMX));
   } /* if */
   return AMX_ERR_NONE;
 }
 
+int AMXAPI aux_SaveSnapshot(AMX *amx, const char *filename)
+{
+  FILE *fp;
+  void *snapshot;
+  size_t size;
+  int result;
+
+  if ((result = amx_Snapshot(amx, NULL, &size)) != AMX_ERR_NONE)
+    return result;
+  if ((snapshot = malloc(size)) == NULL)
+    return AMX_ERR_MEMORY;
+  if ((result = amx_Snapshot(amx, snapshot, &size)) == AMX_ERR_NONE) {
+    if ((fp = fopen(filename, "wb")) != NULL) {
+      if (fwrite(snapshot, 1, size, fp) != size)
+        result = AMX_ERR_GENERAL;
+      if (fclose(fp) != 0)
+        result = AMX_ERR_GENERAL;
+    } else {
+      result = AMX_ERR_NOTFOUND;
+    } /* if */
+  } /* if */
+  free(snapshot);
+  return result;
+}
+
+int AMXAPI aux_LoadSnapshot(AMX *amx, const char *filename)
+{
+  FILE *fp;
+  AMX_SNAPSHOT snap;
+  void *snapshot;
+  int result;
+
+  if ((fp = fopen(filename, "rb")) == NULL)
+    return AMX_ERR_NOTFOUND;
+  if (fread(&snap, sizeof snap, 1, fp) != 1 || snap.magic != AMX_SNAPMAGIC || snap.size < (int32_t)sizeof snap) {
+    fclose(fp);
+    return AMX_ERR_FORMAT;
+  } /* if */
+  if ((snapshot = malloc((size_t)snap.size)) == NULL) {
+    fclose(fp);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  rewind(fp);
+  if (fread(snapshot, 1, (size_t)snap.size, fp) == (size_t)snap.size)
+    result = amx_Restore(amx, snapshot, (size_t)snap.size);
+  else
+    result = AMX_ERR_FORMAT;
+  fclose(fp);
+  free(snapshot);
+  return result;
+}
+
+#if defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
+/* A template holds the initial data section of a sealed program in a memory
+ * file. Every instance maps this file privately (copy-on-write), so creating
+ * an instance copies nothing, and a page of the data section is only copied
+ * when the instance writes to it. The heap and the stack are anonymous memory,
+ * which is also only allocated when it is touched. Resetting an instance maps
+ * the file again (which drops the modified pages) and discards the heap and
+ * stack pages; it also releases the state of the extension modules (timers,
+ * fibers, mailbox), which refers to the data that is discarded. As for a new
+ * instance, the host calls the init functions of the modules that need one.
+ */
+static size_t pageround(size_t size)
+{
+  size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+  return (size + pagesize - 1) & ~(pagesize - 1);
+}
+
+static int memoryfile(void)
+{
+  #if defined MFD_CLOEXEC
+    return memfd_create("amxdata", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  #else
+    char name[] = "/tmp/amxdataXXXXXX";
+    int fd = mkstemp(name);
+    if (fd >= 0)
+      unlink(name);
+    return fd;
+  #endif
+}
+
+int AMXAPI aux_CreateTemplate(AUX_TEMPLATE *tmpl, AMX *program)
+{
+  AMX_HEADER *hdr;
+  unsigned char *data;
+  size_t datasize, pos;
+  ssize_t n;
+
+  if (tmpl == NULL || program == NULL)
+    return AMX_ERR_PARAMS;
+  if ((program->flags & AMX_FLAG_SEALED) == 0)
+    return AMX_ERR_INIT;
+  hdr = (AMX_HEADER *)program->base;
+  data = (program->data != NULL) ? program->data : program->base + (int)hdr->dat;
+  datasize = (size_t)(hdr->hea - hdr->dat);
+
+  tmpl->program = program;
+  tmpl->datasize = pageround(datasize);
+  tmpl->size = pageround((size_t)(hdr->stp - hdr->dat));
+  if ((tmpl->fd = memoryfile()) < 0)
+    return AMX_ERR_MEMORY;
+  if (ftruncate(tmpl->fd, (off_t)tmpl->datasize) != 0) {
+    aux_FreeTemplate(tmpl);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  for (pos = 0; pos < datasize; pos += (size_t)n) {
+    if ((n = pwrite(tmpl->fd, data + pos, datasize - pos, (off_t)pos)) <= 0) {
+      aux_FreeTemplate(tmpl);
+      return AMX_ERR_MEMORY;
+    } /* if */
+  } /* for */
+  #if defined F_ADD_SEALS
+    /* the template is immutable from here on */
+    fcntl(tmpl->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+  #endif
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI aux_FreeTemplate(AUX_TEMPLATE *tmpl)
+{
+  if (tmpl != NULL && tmpl->fd >= 0) {
+    close(tmpl->fd);
+    tmpl->fd = -1;
+  } /* if */
+  return AMX_ERR_NONE;
+}
+
+static int mapdata(unsigned char *block, const AUX_TEMPLATE *tmpl)
+{
+  void *ptr;
+
+  if (tmpl->datasize == 0)
+    return AMX_ERR_NONE;
+  ptr = mmap(block, tmpl->datasize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, tmpl->fd, 0);
+  return (ptr == (void *)block) ? AMX_ERR_NONE : AMX_ERR_MEMORY;
+}
+
+int AMXAPI aux_InitInstance(AMX *instance, const AUX_TEMPLATE *tmpl)
+{
+  unsigned char *block;
+  int result;
+
+  if (instance == NULL || tmpl == NULL || tmpl->fd < 0)
+    return AMX_ERR_PARAMS;
+  block = (unsigned char *)mmap(NULL, tmpl->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (block == (unsigned char *)MAP_FAILED)
+    return AMX_ERR_MEMORY;
+  if ((result = mapdata(block, tmpl)) == AMX_ERR_NONE) {
+    memset(instance, 0, sizeof *instance);
+    result = amx_AttachInstance(instance, tmpl->program, block);
+  } /* if */
+  if (result != AMX_ERR_NONE)
+    munmap(block, tmpl->size);
+  return result;
+}
+
+int AMXAPI aux_ResetInstance(AMX *instance, const AUX_TEMPLATE *tmpl)
+{
+  int result;
+
+  if (instance == NULL || instance->data == NULL || tmpl == NULL || tmpl->fd < 0)
+    return AMX_ERR_PARAMS;
+  /* an instance is a clone, so this only releases the extension state */
+  amx_Cleanup(instance);
+  if ((result = mapdata(instance->data, tmpl)) != AMX_ERR_NONE)
+    return result;
+  if (tmpl->size > tmpl->datasize)
+    madvise(instance->data + tmpl->datasize, tmpl->size - tmpl->datasize, MADV_DONTNEED);
+  return amx_AttachInstance(instance, tmpl->program, instance->data);
+}
+
+int AMXAPI aux_FreeInstance(AMX *instance, const AUX_TEMPLATE *tmpl)
+{
+  if (instance == NULL || tmpl == NULL)
+    return AMX_ERR_PARAMS;
+  if (instance->data != NULL) {
+    amx_Cleanup(instance);
+    munmap(instance->data, tmpl->size);
+    memset(instance, 0, sizeof(AMX));
+  } /* if */
+  return AMX_ERR_NONE;
+}
+
+/* Create an instance that starts in the state of a snapshot file, without
+ * reading the file: the memory image in the file is mapped privately as the
+ * data, heap and stack of the instance. The instance is released with
+ * aux_FreeInstance(); aux_ResetInstance() resets it to the data section of
+ * the template.
+ */
+int AMXAPI aux_MapSnapshot(AMX *instance, const AUX_TEMPLATE *tmpl, const char *filename)
+{
+  AMX_SNAPSHOT snap;
+  struct stat st;
+  unsigned char *block, *data;
+  size_t image, imagesize;
+  int fd, result;
+
+  if (instance == NULL || tmpl == NULL || tmpl->fd < 0 || filename == NULL)
+    return AMX_ERR_PARAMS;
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return AMX_ERR_NOTFOUND;
+  if (read(fd, &snap, sizeof snap) != (ssize_t)sizeof snap || fstat(fd, &st) != 0
+      || snap.magic != AMX_SNAPMAGIC || snap.image < (int32_t)sizeof snap
+      || snap.image + snap.imagesize > snap.size || (off_t)snap.size > st.st_size) {
+    close(fd);
+    return AMX_ERR_FORMAT;
+  } /* if */
+  image = (size_t)snap.image;
+  imagesize = pageround((size_t)snap.imagesize);
+  if (image != pageround(image) || imagesize != tmpl->size) {
+    close(fd);
+    return AMX_ERR_FORMAT;    /* not page aligned, or for another program */
+  } /* if */
+
+  /* reserve the range for the header and the image, then map the file over
+   * it; the image must be at the start of a page in both the file and memory
+   */
+  block = (unsigned char *)mmap(NULL, image + tmpl->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (block == (unsigned char *)MAP_FAILED) {
+    close(fd);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  data = (unsigned char *)mmap(block, (size_t)snap.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+  close(fd);
+  if (data != block) {
+    munmap(block, image + tmpl->size);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  data = block + image;
+
+  memset(instance, 0, sizeof *instance);
+  result = amx_AttachInstance(instance, tmpl->program, data);
+  if (result == AMX_ERR_NONE)
+    result = amx_Restore(instance, block, (size_t)snap.size);
+  /* drop the header, so that only the data block remains mapped */
+  munmap(block, image);
+  if (result != AMX_ERR_NONE) {
+    munmap(data, tmpl->size);
+    memset(instance, 0, sizeof *instance);
+  } /* if */
+  return result;
+}
+
+/* A mapped program runs its P-code directly from the page cache; the pages of
+ * the code section are shared by all processes that map the same file. The
+ * mapping is private, so the few pages that amx_Init() and amx_Register()
+ * modify (the header and the native function table) are copied on write. The
+ * data, heap and stack are allocated separately. When the core must rewrite
+ * the P-code (e.g. to relocate the opcodes), the program is loaded with
+ * copy-on-write code pages instead.
+ */
+int AMXAPI aux_MapProgram(AMX *amx, const char *filename)
+{
+  int fd, result;
+  AMX_HEADER hdr;
+  struct stat st;
+  unsigned char *base, *data;
+  size_t start, end;
+
+  if (amx == NULL || filename == NULL)
+    return AMX_ERR_PARAMS;
+
+  /* open the file, read and check the header */
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return AMX_ERR_NOTFOUND;
+  if (read(fd, &hdr, sizeof hdr) != (ssize_t)sizeof hdr || fstat(fd, &st) != 0) {
+    close(fd);
+    return AMX_ERR_FORMAT;
+  } /* if */
+  amx_Align16(&hdr.magic);
+  amx_Align16(&hdr.flags);
+  amx_Align32((uint32_t *)&hdr.size);
+  amx_Align32((uint32_t *)&hdr.cod);
+  amx_Align32((uint32_t *)&hdr.dat);
+  amx_Align32((uint32_t *)&hdr.stp);
+  if (hdr.magic != AMX_MAGIC || hdr.size <= 0 || (off_t)hdr.size > st.st_size
+      || hdr.cod <= 0 || hdr.cod > hdr.dat || hdr.dat > hdr.size || hdr.stp <= hdr.size) {
+    close(fd);
+    return AMX_ERR_FORMAT;
+  } /* if */
+  if ((hdr.flags & AMX_FLAG_OVERLAY) != 0) {
+    close(fd);
+    return AMX_ERR_OVERLAY;   /* overlays must be loaded with aux_LoadProgram() */
+  } /* if */
+
+  base = (unsigned char *)mmap(NULL, (size_t)hdr.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);                  /* the mapping stays valid */
+  if (base == (unsigned char *)MAP_FAILED)
+    return AMX_ERR_MEMORY;
+  if ((data = (unsigned char *)malloc((size_t)(hdr.stp - hdr.dat))) == NULL) {
+    munmap(base, (size_t)hdr.size);
+    return AMX_ERR_MEMORY;
+  } /* if */
+
+  memset(amx, 0, sizeof *amx);
+  amx->data = data;
+  amx->flags = AMX_FLAG_ROCODE;
+  result = amx_Init(amx, base);
+  if (result == AMX_ERR_INIT || result == AMX_ERR_FORMAT) {
+    /* the core (or an unsorted case table) requires changes in the P-code */
+    memset(amx, 0, sizeof *amx);
+    amx->data = data;
+    result = amx_Init(amx, base);
+  } /* if */
+  if (result != AMX_ERR_NONE) {
+    munmap(base, (size_t)hdr.size);
+    free(data);
+    memset(amx, 0, sizeof *amx);
+    return result;
+  } /* if */
+
+  /* protect the pages that hold only P-code, so that these stay shared */
+  if ((amx->flags & AMX_FLAG_ROCODE) != 0) {
+    start = pageround((size_t)hdr.cod);
+    end = (size_t)hdr.dat & ~(pageround(1) - 1);
+    if (end > start)
+      mprotect(base + start, end - start, PROT_READ);
+  } /* if */
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI aux_UnmapProgram(AMX *amx)
+{
+  if (amx == NULL)
+    return AMX_ERR_PARAMS;
+  if (amx->base != NULL) {
+    size_t size = (size_t)((AMX_HEADER *)amx->base)->size;
+    amx_Cleanup(amx);
+    munmap(amx->base, size);
+    free(amx->data);
+    memset(amx, 0, sizeof(AMX));
+  } /* if */
+  return AMX_ERR_NONE;
+}
+#endif
+
 char * AMXAPI aux_StrError(int errnum)
 {
 static char *messages[] = {
@@ -111,8 +887,8 @@ static char *messages[] = {
       /* AMX_ERR_DIVIDE    */ "Divide by zero",
       /* AMX_ERR_SLEEP     */ "(sleep mode)",
       /* AMX_ERR_INVSTATE  */ "Invalid state",
-      /* 14 */                "(reserved)",
-      /* 15 */                "(reserved)",
+      /* AMX_ERR_BUDGET    */ "Instruction budget used up",
+      /* AMX_ERR_INTERRUPT */ "Interrupted",
       /* AMX_ERR_MEMORY    */ "Out of memory",
       /* AMX_ERR_FORMAT    */ "Invalid/unsupported P-code file format",
       /* AMX_ERR_VERSION   */ "File is for a newer version of the AMX",
@@ -126,6 +902,7 @@ static char *messages[] = {
       /* AMX_ERR_DOMAIN    */ "Domain error, expression result does not fit in range",
       /* AMX_ERR_GENERAL   */ "General error (unknown or unspecific error)",
       /* AMX_ERR_OVERLAY   */ "Overlays are unsupported (JIT) or uninitialized",
+      /* AMX_ERR_SWITCH    */ "Fibers are unsupported by this abstract machine core",
     };
   if (errnum < 0 || errnum >= sizeof messages / sizeof messages[0])
     return "(unknown)";
@@ -25,11 +25,41 @@
 extern  "C" {
 #endif
 
-/* loading and freeing programs */
+/* loading and freeing programs; the overlays of a program are kept in a pool
+ * that all clones and instances of the program share
+ */
+#if !defined AUX_OVLPOOLSIZE
+  #define AUX_OVLPOOLSIZE 32768 /* default size of the overlay pool of a program */
+#endif
 size_t AMXAPI aux_ProgramSize(const char *filename);
 int AMXAPI aux_LoadProgram(AMX *amx, const char *filename, void *memblock);
+int AMXAPI aux_LoadOverlayProgram(AMX *amx, const char *filename, void *memblock, size_t poolsize);
 int AMXAPI aux_FreeProgram(AMX *amx);
 
+/* saving and restoring the state of an abstract machine (see amx_Snapshot()) */
+int AMXAPI aux_SaveSnapshot(AMX *amx, const char *filename);
+int AMXAPI aux_LoadSnapshot(AMX *amx, const char *filename);
+
+/* instances of a sealed program with copy-on-write data (see amx_SealProgram()) */
+#if defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
+typedef struct tagAUX_TEMPLATE {
+  AMX *program;         /* the sealed program */
+  int fd;               /* memory file with the initial data section */
+  size_t datasize;      /* size of the data section, rounded up to whole pages */
+  size_t size;          /* size of the data, heap and stack, rounded up to whole pages */
+} AUX_TEMPLATE;
+int AMXAPI aux_CreateTemplate(AUX_TEMPLATE *tmpl, AMX *program);
+int AMXAPI aux_FreeTemplate(AUX_TEMPLATE *tmpl);
+int AMXAPI aux_InitInstance(AMX *instance, const AUX_TEMPLATE *tmpl);
+int AMXAPI aux_ResetInstance(AMX *instance, const AUX_TEMPLATE *tmpl);
+int AMXAPI aux_FreeInstance(AMX *instance, const AUX_TEMPLATE *tmpl);
+int AMXAPI aux_MapSnapshot(AMX *instance, const AUX_TEMPLATE *tmpl, const char *filename);
+
+/* running a program from a read-only mapping of the file */
+int AMXAPI aux_MapProgram(AMX *amx, const char *filename);
+int AMXAPI aux_UnmapProgram(AMX *amx);
+#endif
+
 /* a readable error message from an error code */
 char * AMXAPI aux_StrError(int errnum);
 
@@ -75,6 +75,16 @@
 # define _tprintf       printf
 #endif
 #include "amxcons.h"
+#if !defined AMXCONSOLE_NOIDLE
+  #include "amxevent.h"
+  #if defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
+    #include <unistd.h>
+    #if !defined AMX_TERMINAL && !(defined CURSES && CURSES != 0)
+      #include <termios.h>
+      #define CONS_RAWMODE  /* the event handler puts the terminal in non-canonical mode */
+    #endif
+  #endif
+#endif
 
 #if defined AMX_TERMINAL
   #define EOL_CHAR       '\r'
@@ -1410,28 +1420,162 @@ static cell AMX_NATIVE_CALL n_console(AMX *amx,const cell *params)
 
 
 #if !defined AMXCONSOLE_NOIDLE
-static AMX_IDLE PrevIdle = NULL;
-static int idxKeyPressed = -1;
+/* the chained idle function and the @keypressed index are kept per abstract
+ * machine, so that several abstract machines may each install the hook
+ */
+#define CONS_TAG  AMX_USERTAG('C','o','n','s')
+
+typedef struct tagCONSSTATE {
+  AMX_IDLE PrevIdle;
+  AMX_EVENTHOOK PrevEvents;
+  AMX_EVENTS *events;   /* set when the host runs an event loop */
+  int idxKeyPressed;
+  int piped;            /* standard input is a pipe or a file, not a terminal */
+} CONSSTATE;
+
+#if defined CONS_RAWMODE
+  /* the terminal is a resource of the process, not of an abstract machine;
+   * the settings are also restored on exit(), which the host may call on a
+   * run-time error
+   */
+  static struct termios cons_saved;
+  static int cons_rawmode = 0;
+  static int cons_atexit = 0;
+
+  static void cons_restore(void)
+  {
+    if (cons_rawmode)
+      tcsetattr(STDIN_FILENO, TCSANOW, &cons_saved);
+    cons_rawmode = 0;
+  }
+
+  static void cons_setraw(void)
+  {
+    struct termios ios;
+    if (cons_rawmode || tcgetattr(STDIN_FILENO, &cons_saved) != 0)
+      return;
+    /* keys are reported one by one, but Ctrl-C still raises a signal */
+    ios = cons_saved;
+    ios.c_lflag &= ~(ICANON | ECHO);
+    ios.c_cc[VMIN] = 1;
+    ios.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &ios) == 0) {
+      if (!cons_atexit)
+        atexit(cons_restore);
+      cons_atexit = 1;
+      cons_rawmode = 1;
+    } /* if */
+  }
+#endif
+
+static void AMXAPI cons_release(AMX *amx, void *state)
+{
+  CONSSTATE *cs = (CONSSTATE*)state;
+
+  (void)amx;
+  #if defined STDIN_FILENO
+    if (cs->events != NULL) {
+      cs->events->RemoveFile(cs->events, STDIN_FILENO);
+      #if defined CONS_RAWMODE
+        cons_restore();
+      #endif
+    } /* if */
+  #else
+    (void)cs;
+  #endif
+  free(state);
+}
 
 static int AMXAPI amx_ConsoleIdle(AMX *amx, int AMXAPI Exec(AMX *, cell *, int))
 {
   int err=0, key;
+  CONSSTATE *cs;
 
-  assert(idxKeyPressed >= 0);
+  if (amx_GetExtState(amx, CONS_TAG, (void**)&cs) != AMX_ERR_NONE)
+    return AMX_ERR_NONE;
+  assert(cs->idxKeyPressed >= 0);
 
-  if (PrevIdle != NULL)
-    PrevIdle(amx, Exec);
+  if (cs->PrevIdle != NULL)
+    cs->PrevIdle(amx, Exec);
 
   if (amx_kbhit()) {
     key = amx_getch();
     amx_Push(amx, key);
-    err = Exec(amx, NULL, idxKeyPressed);
+    err = Exec(amx, NULL, cs->idxKeyPressed);
     while (err == AMX_ERR_SLEEP)
       err = Exec(amx, NULL, AMX_EXEC_CONT);
   } /* if */
 
   return err;
 }
+
+/* the event handler for standard input, for hosts with an event loop */
+static int AMXAPI cons_event(AMX *amx, int AMXAPI Exec(AMX *, cell *, int), void *data)
+{
+  CONSSTATE *cs = (CONSSTATE*)data;
+  int err=0, key;
+
+  #if defined STDIN_FILENO
+    if (cs->piped) {
+      /* the keys come from a pipe or a file, which the terminal functions do
+       * not read; the event loop reports it ready, so one read() does not
+       * block (but a second one might)
+       */
+      unsigned char c;
+      if (read(STDIN_FILENO, &c, 1) != 1) {
+        cs->events->RemoveFile(cs->events, STDIN_FILENO);
+        cs->events = NULL;
+        return AMX_ERR_NONE;
+      } /* if */
+      amx_Push(amx, c);
+      err = Exec(amx, NULL, cs->idxKeyPressed);
+      while (err == AMX_ERR_SLEEP)
+        err = Exec(amx, NULL, AMX_EXEC_CONT);
+      return err;
+    } /* if */
+  #endif
+  while (err == AMX_ERR_NONE && amx_kbhit()) {
+    if ((key = amx_getch()) == EOF) {
+      /* the terminal was closed, stop waiting for it */
+      cs->events->RemoveFile(cs->events, STDIN_FILENO);
+      cs->events = NULL;
+      break;
+    } /* if */
+    amx_Push(amx, key);
+    err = Exec(amx, NULL, cs->idxKeyPressed);
+    while (err == AMX_ERR_SLEEP)
+      err = Exec(amx, NULL, AMX_EXEC_CONT);
+  } /* while */
+  return err;
+}
+
+static int AMXAPI amx_ConsoleEvents(AMX *amx, AMX_EVENTS *events)
+{
+  CONSSTATE *cs;
+  int err;
+
+  if (amx_GetExtState(amx, CONS_TAG, (void**)&cs) != AMX_ERR_NONE)
+    return AMX_ERR_NONE;
+  if (cs->PrevEvents != NULL && (err = cs->PrevEvents(amx, events)) != AMX_ERR_NONE)
+    return err;
+
+  #if defined STDIN_FILENO
+    /* keys may also come from a pipe or a file; only a terminal is set up
+     * to send keys one by one
+     */
+    cs->piped = !isatty(STDIN_FILENO);
+    if (!cs->piped) {
+      CreateConsole();  /* for curses, this also ends line mode */
+      #if defined CONS_RAWMODE
+        cons_setraw();
+      #endif
+    } /* if */
+    if ((err = events->AddFile(events, amx, STDIN_FILENO, cons_event, cs)) != AMX_ERR_NONE)
+      return err;
+    cs->events = events;
+  #endif
+  return AMX_ERR_NONE;
+}
 #endif
 
 #if defined __cplusplus
@@ -1456,11 +1600,25 @@ const AMX_NATIVE_INFO console_Natives[] = {
 int AMXEXPORT AMXAPI amx_ConsoleInit(AMX *amx)
 {
   #if !defined AMXCONSOLE_NOIDLE
+    int index;
+    CONSSTATE *cs;
+
     /* see whether there is an @keypressed() function */
-    if (amx_FindPublic(amx, "@keypressed", &idxKeyPressed) == AMX_ERR_NONE) {
-      if (amx_GetUserData(amx, AMX_USERTAG('I','d','l','e'), (void**)&PrevIdle) != AMX_ERR_NONE)
-        PrevIdle = NULL;
+    if (amx_FindPublic(amx, "@keypressed", &index) == AMX_ERR_NONE) {
+      if ((cs = (CONSSTATE*)malloc(sizeof(CONSSTATE))) == NULL)
+        return AMX_ERR_MEMORY;
+      memset(cs, 0, sizeof(CONSSTATE));
+      cs->idxKeyPressed = index;
+      if (amx_GetUserData(amx, AMX_USERTAG('I','d','l','e'), (void**)&cs->PrevIdle) != AMX_ERR_NONE)
+        cs->PrevIdle = NULL;
+      if (amx_GetUserData(amx, AMX_EVENTTAG, (void**)&cs->PrevEvents) != AMX_ERR_NONE)
+        cs->PrevEvents = NULL;
+      if (amx_SetExtState(amx, CONS_TAG, cs, cons_release) != AMX_ERR_NONE) {
+        free(cs);
+        return AMX_ERR_MEMORY;
+      } /* if */
       amx_SetUserData(amx, AMX_USERTAG('I','d','l','e'), (void*)amx_ConsoleIdle);
+      amx_SetUserData(amx, AMX_EVENTTAG, (void*)amx_ConsoleEvents);
     } /* if */
   #endif
 
@@ -1469,9 +1627,14 @@ int AMXEXPORT AMXAPI amx_ConsoleInit(AMX *amx)
 
 int AMXEXPORT AMXAPI amx_ConsoleCleanup(AMX *amx)
 {
-  (void)amx;
   #if !defined AMXCONSOLE_NOIDLE
-    PrevIdle = NULL;
+    void *state;
+    if (amx_GetExtState(amx, CONS_TAG, &state) == AMX_ERR_NONE) {
+      amx_SetExtState(amx, CONS_TAG, NULL, NULL);
+      cons_release(amx, state);
+    } /* if */
+  #else
+    (void)amx;
   #endif
   return AMX_ERR_NONE;
 }
@@ -69,8 +69,6 @@ typedef struct _property_list {
   cell value;
 } proplist;
 
-static proplist proproot = { NULL, 0, NULL, 0 };
-
 static proplist *list_additem(proplist *root)
 {
   proplist *item;
@@ -135,6 +133,56 @@ static proplist *list_finditem(proplist *root,cell id,char *name,cell value,
 }
 #endif
 
+#if !defined AMX_NOPROPLIST || !defined AMX_NORANDOM
+/* The property list and the seed of the random number generator are kept per
+ * abstract machine (in the extension state), so that abstract machines that
+ * run in different threads do not share them. The state is created on first
+ * use, which also covers instances and clones that were not passed through
+ * amx_CoreInit().
+ */
+#define CORE_TAG        AMX_USERTAG('C','o','r','e')
+#define INITIAL_SEED    0xcaa938dbL
+
+typedef struct tagCORESTATE {
+  #if !defined AMX_NOPROPLIST
+    proplist proproot;
+  #endif
+  #if !defined AMX_NORANDOM
+    unsigned long seed;
+  #endif
+} CORESTATE;
+
+static void AMXAPI core_release(AMX *amx,void *state)
+{
+  #if !defined AMX_NOPROPLIST
+    CORESTATE *core=(CORESTATE *)state;
+    while (core->proproot.next!=NULL)
+      list_delete(&core->proproot,core->proproot.next);
+  #endif
+  (void)amx;
+  free(state);
+}
+
+static CORESTATE *core_state(AMX *amx)
+{
+  CORESTATE *core;
+
+  if (amx_GetExtState(amx,CORE_TAG,(void**)&core)==AMX_ERR_NONE)
+    return core;
+  if ((core=(CORESTATE *)malloc(sizeof(CORESTATE)))==NULL)
+    return NULL;
+  memset(core,0,sizeof(CORESTATE));
+  #if !defined AMX_NORANDOM
+    core->seed=INITIAL_SEED;
+  #endif
+  if (amx_SetExtState(amx,CORE_TAG,core,core_release)!=AMX_ERR_NONE) {
+    free(core);
+    return NULL;
+  } /* if */
+  return core;
+}
+#endif
+
 static cell AMX_NATIVE_CALL numargs(AMX *amx,const cell *params)
 {
   AMX_HEADER *hdr;
@@ -338,11 +386,15 @@ static cell AMX_NATIVE_CALL getproperty(AMX *amx,const cell *params)
   cell *cstr;
   char *name;
   proplist *item;
+  CORESTATE *core;
 
-  (void)amx;
+  if ((core=core_state(amx))==NULL) {
+    amx_RaiseError(amx,AMX_ERR_MEMORY);
+    return 0;
+  } /* if */
   cstr=amx_Address(amx,params[2]);
   name=MakePackedString(cstr);
-  item=list_finditem(&proproot,params[1],name,params[3],NULL);
+  item=list_finditem(&core->proproot,params[1],name,params[3],NULL);
   /* if list_finditem() found the value, store the name */
   if (item!=NULL && item->value==params[3] && strlen(name)==0) {
     cstr=amx_Address(amx,params[4]);
@@ -359,12 +411,17 @@ static cell AMX_NATIVE_CALL setproperty(AMX *amx,const cell *params)
   cell *cstr;
   char *name;
   proplist *item;
+  CORESTATE *core;
 
+  if ((core=core_state(amx))==NULL) {
+    amx_RaiseError(amx,AMX_ERR_MEMORY);
+    return 0;
+  } /* if */
   cstr=amx_Address(amx,params[2]);
   name=MakePackedString(cstr);
-  item=list_finditem(&proproot,params[1],name,params[3],NULL);
+  item=list_finditem(&core->proproot,params[1],name,params[3],NULL);
   if (item==NULL)
-    item=list_additem(&proproot);
+    item=list_additem(&core->proproot);
   if (item==NULL) {
     amx_RaiseError(amx,AMX_ERR_MEMORY);
   } else {
@@ -387,11 +444,15 @@ static cell AMX_NATIVE_CALL delproperty(AMX *amx,const cell *params)
   cell *cstr;
   char *name;
   proplist *item,*pred;
+  CORESTATE *core;
 
-  (void)amx;
+  if ((core=core_state(amx))==NULL) {
+    amx_RaiseError(amx,AMX_ERR_MEMORY);
+    return 0;
+  } /* if */
   cstr=amx_Address(amx,params[2]);
   name=MakePackedString(cstr);
-  item=list_finditem(&proproot,params[1],name,params[3],&pred);
+  item=list_finditem(&core->proproot,params[1],name,params[3],&pred);
   if (item!=NULL) {
     prev=item->value;
     list_delete(pred,item);
@@ -406,11 +467,15 @@ static cell AMX_NATIVE_CALL existproperty(AMX *amx,const cell *params)
   cell *cstr;
   char *name;
   proplist *item;
+  CORESTATE *core;
 
-  (void)amx;
+  if ((core=core_state(amx))==NULL) {
+    amx_RaiseError(amx,AMX_ERR_MEMORY);
+    return 0;
+  } /* if */
   cstr=amx_Address(amx,params[2]);
   name=MakePackedString(cstr);
-  item=list_finditem(&proproot,params[1],name,params[3],NULL);
+  item=list_finditem(&core->proproot,params[1],name,params[3],NULL);
   free(name);
   return (item!=NULL);
 }
@@ -421,9 +486,10 @@ static cell AMX_NATIVE_CALL existproperty(AMX *amx,const cell *params)
  * (ISBN 0-201-47960-5). This is a "multiplicative congruential random number
  * generator" that has been extended to 31-bits (the standard C version returns
  * only 15-bits).
+ * The seed is kept per abstract machine; it is initialized from the time and
+ * the address of the state, so that instances that start at the same time get
+ * different sequences.
  */
-#define INITIAL_SEED  0xcaa938dbL
-static unsigned long IL_StandardRandom_seed = INITIAL_SEED; /* always use a non-zero seed */
 #define IL_RMULT 1103515245L
 #if defined __BORLANDC__ || defined __WATCOMC__
   #pragma argsused
@@ -432,18 +498,22 @@ static cell AMX_NATIVE_CALL core_random(AMX *amx,const cell *params)
 {
     unsigned long lo, hi, ll, lh, hh, hl;
     unsigned long result;
+    CORESTATE *core;
+
+    if ((core = core_state(amx)) == NULL) {
+        amx_RaiseError(amx, AMX_ERR_MEMORY);
+        return 0;
+    } /* if */
 
     /* one-time initialization (or, mostly one-time) */
     #if !defined SN_TARGET_PS2 && !defined _WIN32_WCE && !defined __ICC430__
-        if (IL_StandardRandom_seed == INITIAL_SEED)
-            IL_StandardRandom_seed=(unsigned long)time(NULL);
+        if (core->seed == INITIAL_SEED)
+            core->seed = (unsigned long)time(NULL) ^ (unsigned long)(size_t)core;
     #endif
 
-    (void)amx;
-
-    lo = IL_StandardRandom_seed & 0xffff;
-    hi = IL_StandardRandom_seed >> 16;
-    IL_StandardRandom_seed = IL_StandardRandom_seed * IL_RMULT + 12345;
+    lo = core->seed & 0xffff;
+    hi = core->seed >> 16;
+    core->seed = core->seed * IL_RMULT + 12345;
     ll = lo * (IL_RMULT  & 0xffff);
     lh = lo * (IL_RMULT >> 16    );
     hl = hi * (IL_RMULT  & 0xffff);
@@ -456,6 +526,299 @@ static cell AMX_NATIVE_CALL core_random(AMX *amx,const cell *params)
 }
 #endif
 
+#if !defined AMX_NOFIBERS
+/* Fibers run public functions of the script concurrently, each on a stack of
+ * its own, inside a single call to amx_Exec(). To switch fibers, a native
+ * function stores the registers of the next fiber in the AMX structure and
+ * raises AMX_ERR_SWITCH; the core then continues with these registers,
+ * without returning from amx_Exec(). The ANSI-C core and the GNU GCC core
+ * handle AMX_ERR_SWITCH; the JIT and the assembler cores abort on it. With
+ * the JIT, fiber_spawn() already fails with a run-time error.
+ *
+ * The stacks of the fibers are slices of a block that amx_CoreInit() reserves
+ * at the bottom of the heap (half of the free stack/heap space), when the
+ * script uses fiber_spawn(). Each slice has a heap at its bottom and a stack
+ * at its top, so the usual stack and heap checks of the core apply to the
+ * fiber that runs. Fiber 0 is the main fiber: the function that amx_Exec()
+ * started, on the normal stack.
+ * A spawned fiber starts in a public function. When that function returns, it
+ * "returns" to the public function @fiberexit() in FIBER.INC, which calls
+ * fiber_exit().
+ */
+#define FIBER_TAG       AMX_USERTAG('F','i','b','r')
+#if !defined AMX_MAXFIBERS
+  #define AMX_MAXFIBERS 8       /* number of fibers, next to the main fiber */
+#endif
+#define FIBER_MINSTACK  64      /* minimum size of a slice, in cells */
+
+enum {
+  FIBER_FREE,
+  FIBER_READY,          /* registers are saved, it may be switched to */
+  FIBER_RUNNING,
+  FIBER_JOINING,        /* waiting in fiber_join() */
+  FIBER_DONE            /* finished, but not yet joined */
+};
+
+typedef struct tagFIBER {
+  int state;
+  int join;             /* fiber that it waits for (FIBER_JOINING) */
+  cell valueaddr;       /* "value" parameter of fiber_join() (FIBER_JOINING) */
+  cell value;           /* exit value (FIBER_DONE) */
+  cell pri,frm,stk,hea,cip; /* saved registers (FIBER_READY and FIBER_JOINING) */
+} FIBER;
+
+typedef struct tagFIBERSTATE {
+  cell base;            /* bottom of the first slice */
+  cell size;            /* size of a slice, in bytes */
+  FIBER fiber[AMX_MAXFIBERS+1];
+} FIBERSTATE;
+
+static void AMXAPI fiber_release(AMX *amx,void *state)
+{
+  (void)amx;
+  free(state);
+}
+
+static int fiber_init(AMX *amx)
+{
+  FIBERSTATE *fs;
+  cell size;
+
+  if (amx_GetExtState(amx,FIBER_TAG,(void**)&fs)==AMX_ERR_NONE)
+    return AMX_ERR_NONE;
+  /* without enough space, no block is reserved and fiber_spawn() fails */
+  size=(amx->stp-amx->hea)/2/AMX_MAXFIBERS;
+  size&=~(cell)(sizeof(cell)-1);
+  if (size<FIBER_MINSTACK*(cell)sizeof(cell))
+    return AMX_ERR_NONE;
+  if ((fs=(FIBERSTATE *)malloc(sizeof(FIBERSTATE)))==NULL)
+    return AMX_ERR_MEMORY;
+  memset(fs,0,sizeof(FIBERSTATE));
+  fs->base=amx->hea;
+  fs->size=size;
+  fs->fiber[0].state=FIBER_RUNNING;
+  if (amx_SetExtState(amx,FIBER_TAG,fs,fiber_release)!=AMX_ERR_NONE) {
+    free(fs);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  amx->hea+=AMX_MAXFIBERS*size;
+  return AMX_ERR_NONE;
+}
+
+static void fiber_finish(AMX *amx,FIBERSTATE *fs,int id,cell value)
+{
+  cell *cptr;
+  int i;
+
+  fs->fiber[id].state=FIBER_DONE;
+  fs->fiber[id].value=value;
+  for (i=0; i<=AMX_MAXFIBERS; i++) {
+    if (fs->fiber[i].state==FIBER_JOINING && fs->fiber[i].join==id) {
+      /* the joiner is suspended, so its "value" parameter is still valid */
+      if ((cptr=amx_Address(amx,fs->fiber[i].valueaddr))!=NULL)
+        *cptr=value;
+      fs->fiber[i].state=FIBER_READY;
+      fs->fiber[id].state=FIBER_FREE;
+    } /* if */
+  } /* for */
+}
+
+/* fiber_current() returns the fiber that runs, which follows from the stack
+ * pointer; a fiber that is marked as running while it is not (because
+ * amx_Exec() was aborted while it ran) is marked as finished
+ */
+static int fiber_current(AMX *amx,FIBERSTATE *fs)
+{
+  int cur,i;
+
+  if (amx->stk>fs->base && amx->stk<=fs->base+AMX_MAXFIBERS*fs->size)
+    cur=(int)((amx->stk-fs->base-1)/fs->size)+1;
+  else
+    cur=0;
+  for (i=0; i<=AMX_MAXFIBERS; i++)
+    if (i!=cur && fs->fiber[i].state==FIBER_RUNNING)
+      fiber_finish(amx,fs,i,0);
+  fs->fiber[cur].state=FIBER_RUNNING;
+  return cur;
+}
+
+static void fiber_save(AMX *amx,FIBER *fiber,const cell *params,int state)
+{
+  fiber->state=state;
+  fiber->pri=1;
+  fiber->frm=amx->frm;
+  fiber->hea=amx->hea;
+  fiber->cip=amx->cip;
+  fiber->stk=amx->stk;
+  if ((amx->flags & AMX_FLAG_SYSREQN)!=0)
+    fiber->stk+=params[0]+sizeof(cell); /* SYSREQ.N removes the parameters */
+}
+
+/* fiber_switch() switches to the first fiber after "from" that is ready;
+ * it returns 0 if there is none
+ */
+static int fiber_switch(AMX *amx,FIBERSTATE *fs,int from)
+{
+  FIBER *fiber;
+  int i,id;
+
+  for (i=1; i<=AMX_MAXFIBERS; i++) {
+    id=(from+i) % (AMX_MAXFIBERS+1);
+    if (fs->fiber[id].state==FIBER_READY)
+      break;
+  } /* for */
+  if (i>AMX_MAXFIBERS)
+    return 0;
+  fiber=&fs->fiber[id];
+  fiber->state=FIBER_RUNNING;
+  amx->pri=fiber->pri;
+  amx->alt=0;
+  amx->frm=fiber->frm;
+  amx->stk=fiber->stk;
+  amx->hea=fiber->hea;
+  amx->cip=fiber->cip;
+  amx_RaiseError(amx,AMX_ERR_SWITCH);
+  return 1;
+}
+
+/* fiber_spawn(const function[], ...)
+ * The extra arguments are passed to the function by value.
+ */
+static cell AMX_NATIVE_CALL fiber_spawn(AMX *amx,const cell *params)
+{
+  FIBERSTATE *fs;
+  AMX_HEADER *hdr;
+  uchar *data;
+  char name[64];
+  cell *cstr;
+  cell stk;
+  ucell address,exitaddress;
+  int index,numargs,id,i;
+
+  if (amx_GetExtState(amx,FIBER_TAG,(void**)&fs)!=AMX_ERR_NONE)
+    return 0;
+  if ((amx->flags & AMX_FLAG_JITC)!=0) {
+    /* the JIT cannot switch to another fiber; the script would run without
+     * its fibers, so stop it
+     */
+    amx_RaiseError(amx,AMX_ERR_INVSTATE);
+    return 0;
+  } /* if */
+  cstr=amx_Address(amx,params[1]);
+  amx_GetString(name,cstr,0,sizeof name);
+  if (amx_FindPublic(amx,name,&index)!=AMX_ERR_NONE)
+    return 0;
+  amx_GetPublic(amx,index,NULL,&address);
+  if (amx_FindPublic(amx,"@fiberexit",&index)!=AMX_ERR_NONE)
+    return 0;
+  amx_GetPublic(amx,index,NULL,&exitaddress);
+  fiber_current(amx,fs);
+  for (id=1; id<=AMX_MAXFIBERS && fs->fiber[id].state!=FIBER_FREE; id++)
+    /* nothing */;
+  numargs=(int)(params[0]/sizeof(cell))-1;
+  if (id>AMX_MAXFIBERS || (numargs+FIBER_MINSTACK/2)*(cell)sizeof(cell)>fs->size)
+    return 0;
+
+  /* build the stack as if @fiberexit() had called the function */
+  hdr=(AMX_HEADER *)amx->base;
+  data=amx->data ? amx->data : amx->base+(int)hdr->dat;
+  stk=fs->base+id*fs->size;
+  stk-=sizeof(cell);
+  * (cell *)(data+(int)stk) = 0;          /* parameters of @fiberexit() */
+  stk-=sizeof(cell);
+  * (cell *)(data+(int)stk) = 0;          /* return address of @fiberexit() */
+  for (i=numargs; i>0; i--) {
+    cell *arg=amx_Address(amx,params[i+1]); /* variable arguments are passed by reference */
+    stk-=sizeof(cell);
+    * (cell *)(data+(int)stk) = (arg!=NULL) ? *arg : 0;
+  } /* for */
+  stk-=sizeof(cell);
+  * (cell *)(data+(int)stk) = numargs*(cell)sizeof(cell);
+  stk-=sizeof(cell);
+  * (cell *)(data+(int)stk) = (cell)exitaddress;
+
+  fs->fiber[id].state=FIBER_READY;
+  fs->fiber[id].pri=0;
+  fs->fiber[id].frm=0;
+  fs->fiber[id].stk=stk;
+  fs->fiber[id].hea=fs->base+(id-1)*fs->size;
+  fs->fiber[id].cip=(cell)address;
+  return id;
+}
+
+/* fiber_yield()
+ * Switches to the next fiber that is ready; returns true after other fibers
+ * ran, or false if no other fiber was ready.
+ */
+static cell AMX_NATIVE_CALL fiber_yield(AMX *amx,const cell *params)
+{
+  FIBERSTATE *fs;
+  int cur;
+
+  if (amx_GetExtState(amx,FIBER_TAG,(void**)&fs)!=AMX_ERR_NONE)
+    return 0;
+  cur=fiber_current(amx,fs);
+  fiber_save(amx,&fs->fiber[cur],params,FIBER_READY);
+  if (!fiber_switch(amx,fs,cur))
+    fs->fiber[cur].state=FIBER_RUNNING;
+  return 0;
+}
+
+/* bool: fiber_join(fiber, &value=0)
+ * Waits until the fiber has finished, and releases it; "value" is the value
+ * that the fiber passed to fiber_exit(), or zero if its function returned.
+ */
+static cell AMX_NATIVE_CALL fiber_join(AMX *amx,const cell *params)
+{
+  FIBERSTATE *fs;
+  cell *cptr;
+  int cur,id,i;
+
+  if (amx_GetExtState(amx,FIBER_TAG,(void**)&fs)!=AMX_ERR_NONE)
+    return 0;
+  cur=fiber_current(amx,fs);
+  id=(int)params[1];
+  if (id<1 || id>AMX_MAXFIBERS || id==cur || fs->fiber[id].state==FIBER_FREE)
+    return 0;
+  if (fs->fiber[id].state==FIBER_DONE) {
+    if ((cptr=amx_Address(amx,params[2]))!=NULL)
+      *cptr=fs->fiber[id].value;
+    fs->fiber[id].state=FIBER_FREE;
+    return 1;
+  } /* if */
+  for (i=0; i<=AMX_MAXFIBERS; i++)
+    if (fs->fiber[i].state==FIBER_JOINING && fs->fiber[i].join==id)
+      return 0;                 /* another fiber joins it already */
+  fiber_save(amx,&fs->fiber[cur],params,FIBER_JOINING);
+  fs->fiber[cur].join=id;
+  fs->fiber[cur].valueaddr=params[2];
+  if (!fiber_switch(amx,fs,cur)) {
+    fs->fiber[cur].state=FIBER_RUNNING;
+    return 0;                   /* no fiber is ready, waiting would deadlock */
+  } /* if */
+  return 0;
+}
+
+/* fiber_exit(value=0)
+ * Finishes the fiber that runs; the main fiber cannot exit.
+ */
+static cell AMX_NATIVE_CALL fiber_exit(AMX *amx,const cell *params)
+{
+  FIBERSTATE *fs;
+  int cur;
+
+  if (amx_GetExtState(amx,FIBER_TAG,(void**)&fs)!=AMX_ERR_NONE)
+    return 0;
+  cur=fiber_current(amx,fs);
+  if (cur==0)
+    return 0;
+  fiber_finish(amx,fs,cur,params[1]);
+  if (!fiber_switch(amx,fs,cur))
+    amx_RaiseError(amx,AMX_ERR_NATIVE);  /* all other fibers wait: deadlock */
+  return 0;
+}
+#endif /* AMX_NOFIBERS */
+
 
 #if defined __cplusplus
   extern "C"
@@ -480,21 +843,46 @@ const AMX_NATIVE_INFO core_Natives[] = {
   { "setproperty",   setproperty },
   { "deleteproperty",delproperty },
   { "existproperty", existproperty },
+#endif
+#if !defined AMX_NOFIBERS
+  { "fiber_spawn",   fiber_spawn },
+  { "fiber_yield",   fiber_yield },
+  { "fiber_join",    fiber_join },
+  { "fiber_exit",    fiber_exit },
 #endif
   { NULL, NULL }        /* terminator */
 };
 
 int AMXEXPORT AMXAPI amx_CoreInit(AMX *amx)
 {
+  #if !defined AMX_NOFIBERS
+    int index,err;
+    if (amx_FindNative(amx,"fiber_spawn",&index)==AMX_ERR_NONE
+        && (err=fiber_init(amx))!=AMX_ERR_NONE)
+      return err;
+  #endif
   return amx_Register(amx, core_Natives, -1);
 }
 
 int AMXEXPORT AMXAPI amx_CoreCleanup(AMX *amx)
 {
-  (void)amx;
-  #if !defined AMX_NOPROPLIST
-    while (proproot.next!=NULL)
-      list_delete(&proproot,proproot.next);
+  #if !defined AMX_NOPROPLIST || !defined AMX_NORANDOM || !defined AMX_NOFIBERS
+    void *state;
+  #endif
+  #if !defined AMX_NOPROPLIST || !defined AMX_NORANDOM
+    if (amx_GetExtState(amx,CORE_TAG,&state)==AMX_ERR_NONE) {
+      amx_SetExtState(amx,CORE_TAG,NULL,NULL);
+      core_release(amx,state);
+    } /* if */
+  #endif
+  #if !defined AMX_NOFIBERS
+    if (amx_GetExtState(amx,FIBER_TAG,&state)==AMX_ERR_NONE) {
+      amx_SetExtState(amx,FIBER_TAG,NULL,NULL);
+      fiber_release(amx,state);
+    } /* if */
+  #endif
+  #if defined AMX_NOPROPLIST && defined AMX_NORANDOM && defined AMX_NOFIBERS
+    (void)amx;
   #endif
   return AMX_ERR_NONE;
 }
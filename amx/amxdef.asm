@@ -25,11 +25,7 @@ amx_s   STRUC
     _syscall_d  DD ?
     _ovl_index  DD ?
     _codesize   DD ?            ; memory size of the overlay or of the native code
-IFDEF JIT
-    ; the two fields below are for the JIT; they do not exist in
-    ; the non-JIT version of the abstract machine
-    _reloc_size DD ?            ; memory block for relocations
-ENDIF
+    _reloc_size DD ?            ; memory block for relocations (JIT only)
 amx_s   ENDS
 
 amxhead_s   STRUC
@@ -25,11 +25,7 @@ _reset_hea:  resd 1
 _syscall_d:  resd 1
 _ovl_index:  resd 1
 _codesize:   resd 1          ; memory size of the overlay or of the native code
-%ifdef JIT
-        ; the two fields below are for the JIT; they do not exist in
-        ; the non-JIT version of the abstract machine
-_reloc_size: resd 1          ; memory block for relocations
-%endif
+_reloc_size: resd 1          ; memory block for relocations (JIT only)
 endstruc
 
 struc amxhead_s
@@ -21,6 +21,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "osdefs.h"
 #if defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
@@ -36,6 +37,7 @@
   #include <winsock.h>
 #endif
 #include "amx.h"
+#include "amxevent.h"
 
 
 #define SRC_BUFSIZE       22
@@ -52,7 +54,21 @@
   #define SOCKET          int
 #endif
 
-static SOCKET sLocal;
+/* The socket and the port are kept per abstract machine (in the extension
+ * state), so that abstract machines in different threads do not share them.
+ */
+#define DGRAM_TAG         AMX_USERTAG('D','g','r','m')
+
+typedef struct tagDGRAMSTATE {
+  SOCKET sLocal;
+  AMX_IDLE PrevIdle;
+  AMX_EVENTHOOK PrevEvents;
+  AMX_EVENTS *events;   /* set when the host runs an event loop */
+  int idxReceiveString;
+  int idxReceivePacket;
+  short dgramPort;
+  int dgramBound;
+} DGRAMSTATE;
 
 static unsigned long udp_GetHostAddr(const char *host,int index)
 {
@@ -71,7 +87,7 @@ static unsigned long udp_GetHostAddr(const char *host,int index)
   return addr;
 }
 
-static int udp_Open(void)
+static int udp_Open(DGRAMSTATE *dg)
 {
 #if defined __WIN32 || defined _WIN32 || defined WIN32
   WORD wVersionRequested = MAKEWORD(1,1);
@@ -83,23 +99,24 @@ static int udp_Open(void)
     WSAStartup(wVersionRequested, &wsaData);
   #endif
 
-  if ((sLocal=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
+  if ((dg->sLocal=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
     return -1;
 
-  if (setsockopt(sLocal, SOL_SOCKET, SO_BROADCAST, (void*)&optval, sizeof optval) == -1)
+  if (setsockopt(dg->sLocal, SOL_SOCKET, SO_BROADCAST, (void*)&optval, sizeof optval) == -1)
     return -1;
 
-  return (int)sLocal;
+  return (int)dg->sLocal;
 }
 
-static int udp_Close(void)
+static int udp_Close(DGRAMSTATE *dg)
 {
-  if (sLocal!=INVALID_SOCKET) {
+  if (dg->sLocal!=INVALID_SOCKET) {
     #if defined __WIN32 || defined _WIN32 || defined WIN32
-      closesocket(sLocal);
+      closesocket(dg->sLocal);
     #else
-      close(sLocal);
+      close(dg->sLocal);
     #endif
+    dg->sLocal=INVALID_SOCKET;
   } /* if */
 
   #if defined __WIN32 || defined _WIN32 || defined WIN32
@@ -109,11 +126,11 @@ static int udp_Close(void)
   return 0;
 }
 
-static int udp_Send(const char *host,short port,const char *message,int size)
+static int udp_Send(DGRAMSTATE *dg,const char *host,short port,const char *message,int size)
 {
   struct sockaddr_in sRemote;
 
-  if (sLocal==INVALID_SOCKET)
+  if (dg->sLocal==INVALID_SOCKET)
     return -1;
 
   memset((void *)&sRemote,sizeof sRemote,0);
@@ -121,7 +138,7 @@ static int udp_Send(const char *host,short port,const char *message,int size)
   sRemote.sin_port=htons(port);
   sRemote.sin_addr.s_addr= (host==NULL) ? htonl(INADDR_BROADCAST) : udp_GetHostAddr(host,0);
 
-  if (sendto(sLocal,message,size,0,(struct sockaddr *)&sRemote,sizeof sRemote)==-1)
+  if (sendto(dg->sLocal,message,size,0,(struct sockaddr *)&sRemote,sizeof sRemote)==-1)
     return -1;
 
   return size;
@@ -131,16 +148,16 @@ static int udp_Send(const char *host,short port,const char *message,int size)
  * if source is not NULL, it must point to a buffer that can contain at least
  * 22 characters.
  */
-static int udp_Receive(char *message,size_t maxmsg,char *source)
+static int udp_Receive(DGRAMSTATE *dg,char *message,size_t maxmsg,char *source)
 {
   struct sockaddr_in sSource;
   unsigned slen=sizeof(sSource);
   int size;
 
-  if (sLocal==INVALID_SOCKET)
+  if (dg->sLocal==INVALID_SOCKET)
     return -1;
 
-  size=recvfrom(sLocal, message, (int)maxmsg - 1, 0, (struct sockaddr *)&sSource, &slen);
+  size=recvfrom(dg->sLocal, message, (int)maxmsg - 1, 0, (struct sockaddr *)&sSource, &slen);
   if (size==-1)
     return -1;
   assert((size_t)size < maxmsg);
@@ -151,7 +168,7 @@ static int udp_Receive(char *message,size_t maxmsg,char *source)
   return size;
 }
 
-static int udp_IsPacket(void)
+static int udp_IsPacket(DGRAMSTATE *dg)
 {
   int result;
   fd_set rdset;
@@ -164,15 +181,15 @@ static int udp_IsPacket(void)
   time.tv_sec=0;
   time.tv_usec=1;
   FD_ZERO(&rdset);
-  FD_SET(sLocal,&rdset);
-  result=select((int)(sLocal+1),&rdset,NULL,NULL,&time);
+  FD_SET(dg->sLocal,&rdset);
+  result=select((int)(dg->sLocal+1),&rdset,NULL,NULL,&time);
   if (result==SOCKET_ERROR)
     return -1;
 
   return result != 0;
 }
 
-static int udp_Listen(short port)
+static int udp_Listen(DGRAMSTATE *dg,short port)
 {
   struct sockaddr_in sFrom;
 
@@ -180,17 +197,50 @@ static int udp_Listen(short port)
   sFrom.sin_family=AF_INET;
   sFrom.sin_port=htons(port);
   sFrom.sin_addr.s_addr=htonl(INADDR_ANY);
-  if (bind(sLocal,(struct sockaddr *)&sFrom,sizeof sFrom)==-1)
+  if (bind(dg->sLocal,(struct sockaddr *)&sFrom,sizeof sFrom)==-1)
     return -1;
 
   return 0;
 }
 
-static AMX_IDLE PrevIdle = NULL;
-static int idxReceiveString = -1;
-static int idxReceivePacket = -1;
-static short dgramPort = 0;
-static int dgramBound = 0;
+static void AMXAPI dgram_release(AMX *amx,void *state)
+{
+  DGRAMSTATE *dg=(DGRAMSTATE*)state;
+
+  (void)amx;
+  if (dg->events!=NULL)
+    dg->events->RemoveFile(dg->events,(int)dg->sLocal);
+  udp_Close(dg);
+  free(state);
+}
+
+/* dgram_state() returns the state of the abstract machine, and creates it (and
+ * opens the socket) for an abstract machine that was not passed through
+ * amx_DGramInit(), such as an instance of a sealed program
+ */
+static DGRAMSTATE *dgram_state(AMX *amx)
+{
+  DGRAMSTATE *dg;
+
+  if (amx_GetExtState(amx,DGRAM_TAG,(void**)&dg)==AMX_ERR_NONE)
+    return dg;
+  if ((dg=(DGRAMSTATE*)malloc(sizeof(DGRAMSTATE)))==NULL)
+    return NULL;
+  memset(dg,0,sizeof(DGRAMSTATE));
+  dg->sLocal=INVALID_SOCKET;
+  dg->idxReceiveString=-1;
+  dg->idxReceivePacket=-1;
+  if (amx_SetExtState(amx,DGRAM_TAG,dg,dgram_release)!=AMX_ERR_NONE) {
+    free(dg);
+    return NULL;
+  } /* if */
+  if (udp_Open(dg)==-1) {
+    amx_SetExtState(amx,DGRAM_TAG,NULL,NULL);
+    dgram_release(amx,dg);
+    return NULL;
+  } /* if */
+  return dg;
+}
 
 /* sendstring(const message[], const destination[]="")
  * destination has the format "127.0.0.1:9930"; when set to an empty string,
@@ -206,7 +256,10 @@ static cell AMX_NATIVE_CALL n_sendstring(AMX *amx, const cell *params)
   cell *cstr;
   char *host, *message, *ptr;
   short port=AMX_DGRAMPORT;
+  DGRAMSTATE *dg;
 
+  if ((dg = dgram_state(amx)) == NULL)
+    return 0;
   cstr = amx_Address(amx, params[1]);
   amx_UTF8Len(cstr, &length);
 
@@ -230,7 +283,7 @@ static cell AMX_NATIVE_CALL n_sendstring(AMX *amx, const cell *params)
       *ptr++='\0';
       port=(short)atoi(ptr);
     } /* if */
-    r= (udp_Send(host,port,message,(int)strlen(message)+1) > 0);
+    r= (udp_Send(dg,host,port,message,(int)strlen(message)+1) > 0);
   } /* if */
 
   return r;
@@ -246,14 +299,17 @@ static cell AMX_NATIVE_CALL n_sendpacket(AMX *amx, const cell *params)
   cell *cstr;
   char *host, *ptr;
   short port=AMX_DGRAMPORT;
+  DGRAMSTATE *dg;
 
+  if ((dg = dgram_state(amx)) == NULL)
+    return 0;
   cstr = amx_Address(amx, params[1]);
   amx_StrParam(amx, params[3], host);
   if (host != NULL && (ptr=strchr(host,':'))!=NULL && isdigit(ptr[1])) {
     *ptr++='\0';
     port=(short)atoi(ptr);
   } /* if */
-  return (udp_Send(host,port,(const char *)cstr,params[2] * sizeof(cell)) > 0);
+  return (udp_Send(dg,host,port,(const char *)cstr,params[2] * sizeof(cell)) > 0);
 }
 
 /* listenport(port)
@@ -262,72 +318,118 @@ static cell AMX_NATIVE_CALL n_sendpacket(AMX *amx, const cell *params)
  */
 static cell AMX_NATIVE_CALL n_listenport(AMX *amx, const cell *params)
 {
-  (void)amx;
-  dgramPort = (short)params[1];
+  DGRAMSTATE *dg;
+
+  if ((dg = dgram_state(amx)) != NULL)
+    dg->dgramPort = (short)params[1];
   return 0;
 }
 
-static int AMXAPI amx_DGramIdle(AMX *amx, int AMXAPI Exec(AMX *, cell *, int))
+/* set up the listener (first call only) */
+static int dgram_bind(DGRAMSTATE *dg)
+{
+  if (!dg->dgramBound) {
+    if (dg->dgramPort==0)
+      dg->dgramPort=AMX_DGRAMPORT;  /* use default port if none was set */
+    if (udp_Listen(dg,dg->dgramPort)==-1)
+      return AMX_ERR_GENERAL;
+    dg->dgramBound=1;
+  } /* if */
+  return AMX_ERR_NONE;
+}
+
+/* receive a packet (that must be waiting) and run @receivestring() or
+ * @receivepacket()
+ */
+static int dgram_receive(AMX *amx, DGRAMSTATE *dg, int AMXAPI Exec(AMX *, cell *, int))
 {
   char message[BUFLEN], source[SRC_BUFSIZE];
   cell *amx_addr_src;
   int len, chars;
   int err=0;
 
-  assert(idxReceiveString >= 0 || idxReceivePacket >= 0);
-
-  if (PrevIdle != NULL)
-    PrevIdle(amx, Exec);
-
-  /* set up listener (first call only) */
-  if (!dgramBound) {
-    if (dgramPort==0)
-      dgramPort=AMX_DGRAMPORT;  /* use default port if none was set */
-    if (udp_Listen(dgramPort)==-1)
-      return AMX_ERR_GENERAL;
-    dgramBound=1;
-  } /* if */
-
-  if (udp_IsPacket()) {
-    len=udp_Receive(message, sizeof message / sizeof message[0], source);
-    amx_PushString(amx,&amx_addr_src,source,1,0);
-    /* check the presence of a byte order mark: if it is absent, the received
-     * packet is no string; also check the packet size against string length
-     */
-    if ((message[0]!='\xef' || message[1]!='\xbb' || message[2]!='\xbf'
-        || len!=(int)strlen(message)+1 || idxReceiveString<0) && idxReceivePacket>=0)
-    {
-      /* receive as "packet" */
-      amx_Push(amx,len);
-      amx_PushArray(amx,NULL,(cell*)message,len);
-      err=Exec(amx,NULL,idxReceivePacket);
-    } else {
-      const char *msg=message;
-      if (msg[0]=='\xef' && msg[1]=='\xbb' && msg[2]=='\xbf')
-        msg+=3;                 /* skip BOM */
-      /* optionally convert from UTF-8 to a wide string */
-      if (amx_UTF8Check(msg,&chars)==AMX_ERR_NONE) {
-        cell *array=alloca((chars+1)*sizeof(cell));
-        cell *ptr=array;
-        if (array!=NULL) {
-          while (err==AMX_ERR_NONE && *msg!='\0')
-            amx_UTF8Get(msg,&msg,ptr++);
-          *ptr=0;               /* zero-terminate */
-          amx_PushArray(amx,NULL,array,chars+1);
-        } /* if */
-      } else {
-        amx_PushString(amx,NULL,msg,1,0);
+  len=udp_Receive(dg,message, sizeof message / sizeof message[0], source);
+  amx_PushString(amx,&amx_addr_src,source,1,0);
+  /* check the presence of a byte order mark: if it is absent, the received
+   * packet is no string; also check the packet size against string length
+   */
+  if ((message[0]!='\xef' || message[1]!='\xbb' || message[2]!='\xbf'
+      || len!=(int)strlen(message)+1 || dg->idxReceiveString<0) && dg->idxReceivePacket>=0)
+  {
+    /* receive as "packet" */
+    amx_Push(amx,len);
+    amx_PushArray(amx,NULL,(cell*)message,len);
+    err=Exec(amx,NULL,dg->idxReceivePacket);
+  } else {
+    const char *msg=message;
+    if (msg[0]=='\xef' && msg[1]=='\xbb' && msg[2]=='\xbf')
+      msg+=3;                 /* skip BOM */
+    /* optionally convert from UTF-8 to a wide string */
+    if (amx_UTF8Check(msg,&chars)==AMX_ERR_NONE) {
+      cell *array=alloca((chars+1)*sizeof(cell));
+      cell *ptr=array;
+      if (array!=NULL) {
+        while (err==AMX_ERR_NONE && *msg!='\0')
+          amx_UTF8Get(msg,&msg,ptr++);
+        *ptr=0;               /* zero-terminate */
+        amx_PushArray(amx,NULL,array,chars+1);
       } /* if */
-      err=Exec(amx,NULL,idxReceiveString);
+    } else {
+      amx_PushString(amx,NULL,msg,1,0);
     } /* if */
-    while (err==AMX_ERR_SLEEP)
-      err=Exec(amx,NULL,AMX_EXEC_CONT);
-    amx_Release(amx,amx_addr_src);
+    err=Exec(amx,NULL,dg->idxReceiveString);
   } /* if */
+  while (err==AMX_ERR_SLEEP)
+    err=Exec(amx,NULL,AMX_EXEC_CONT);
+  amx_Release(amx,amx_addr_src);
 
   return err;
 }
 
+static int AMXAPI amx_DGramIdle(AMX *amx, int AMXAPI Exec(AMX *, cell *, int))
+{
+  int err=0;
+  DGRAMSTATE *dg;
+
+  if (amx_GetExtState(amx,DGRAM_TAG,(void**)&dg)!=AMX_ERR_NONE)
+    return AMX_ERR_NONE;
+  assert(dg->idxReceiveString >= 0 || dg->idxReceivePacket >= 0);
+
+  if (dg->PrevIdle != NULL)
+    dg->PrevIdle(amx, Exec);
+
+  if ((err=dgram_bind(dg))!=AMX_ERR_NONE)
+    return err;
+  if (udp_IsPacket(dg))
+    err=dgram_receive(amx,dg,Exec);
+
+  return err;
+}
+
+/* the event handler for the socket, for hosts with an event loop */
+static int AMXAPI dgram_event(AMX *amx, int AMXAPI Exec(AMX *, cell *, int), void *data)
+{
+  return dgram_receive(amx,(DGRAMSTATE*)data,Exec);
+}
+
+static int AMXAPI amx_DGramEvents(AMX *amx, AMX_EVENTS *events)
+{
+  DGRAMSTATE *dg;
+  int err;
+
+  if (amx_GetExtState(amx,DGRAM_TAG,(void**)&dg)!=AMX_ERR_NONE)
+    return AMX_ERR_NONE;
+  if (dg->PrevEvents!=NULL && (err=dg->PrevEvents(amx,events))!=AMX_ERR_NONE)
+    return err;
+
+  if ((err=dgram_bind(dg))!=AMX_ERR_NONE)
+    return err;
+  if ((err=events->AddFile(events,amx,(int)dg->sLocal,dgram_event,dg))!=AMX_ERR_NONE)
+    return err;
+  dg->events=events;
+  return AMX_ERR_NONE;
+}
+
 #if defined __cplusplus
   extern "C"
 #endif
@@ -340,17 +442,22 @@ AMX_NATIVE_INFO dgram_Natives[] = {
 
 int AMXEXPORT AMXAPI amx_DGramInit(AMX *amx)
 {
-  dgramBound = 0;
-  if (udp_Open()==-1)
+  DGRAMSTATE *dg;
+
+  if ((dg=dgram_state(amx))==NULL)
     return AMX_ERR_GENERAL;
+  dg->dgramBound=0;
 
   /* see whether there is an @receivestring() function */
-  if (amx_FindPublic(amx,"@receivestring",&idxReceiveString)==AMX_ERR_NONE
-      || amx_FindPublic(amx,"@receivepacket",&idxReceivePacket)==AMX_ERR_NONE)
+  if (amx_FindPublic(amx,"@receivestring",&dg->idxReceiveString)==AMX_ERR_NONE
+      || amx_FindPublic(amx,"@receivepacket",&dg->idxReceivePacket)==AMX_ERR_NONE)
   {
-    if (amx_GetUserData(amx,AMX_USERTAG('I','d','l','e'),(void**)&PrevIdle)!=AMX_ERR_NONE)
-      PrevIdle=NULL;
+    if (amx_GetUserData(amx,AMX_USERTAG('I','d','l','e'),(void**)&dg->PrevIdle)!=AMX_ERR_NONE)
+      dg->PrevIdle=NULL;
     amx_SetUserData(amx,AMX_USERTAG('I','d','l','e'),amx_DGramIdle);
+    if (amx_GetUserData(amx,AMX_EVENTTAG,(void**)&dg->PrevEvents)!=AMX_ERR_NONE)
+      dg->PrevEvents=NULL;
+    amx_SetUserData(amx,AMX_EVENTTAG,amx_DGramEvents);
   } /* if */
 
   return amx_Register(amx,dgram_Natives,-1);
@@ -358,7 +465,11 @@ int AMXEXPORT AMXAPI amx_DGramInit(AMX *amx)
 
 int AMXEXPORT AMXAPI amx_DGramCleanup(AMX *amx)
 {
-  (void)amx;
-  udp_Close();
+  void *state;
+
+  if (amx_GetExtState(amx,DGRAM_TAG,&state)==AMX_ERR_NONE) {
+    amx_SetExtState(amx,DGRAM_TAG,NULL,NULL);
+    dgram_release(amx,state);
+  } /* if */
   return AMX_ERR_NONE;
 }
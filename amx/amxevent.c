@@ -0,0 +1,382 @@
+/*  Event loop for hosts of the Pawn Abstract Machine
+ *
+ *  The event loop replaces the chain of idle functions (see AMX_IDLE), which
+ *  the host must call in a busy loop, with a loop that blocks until a file
+ *  descriptor is ready or a timer expires. Extension modules register their
+ *  file descriptors and timers through an event hook (see AMX_EVENTHOOK);
+ *  the event loop then calls the handler of the module, which runs the
+ *  public function for the event (such as @timer() or @receivestring()).
+ *
+ *  When the main function of the script is sleeping, the host can run the
+ *  event loop for the duration of the sleep (evloop_Run() with a timeout).
+ *  The event loop keeps the registers of a sleeping abstract machine across
+ *  the event handlers, so that the host can continue the main function
+ *  afterwards.
+ *
+ *  This module uses epoll, timerfd and eventfd, so it is for Linux only.
+ *
+ *  Copyright (c) CompuPhase, 2026
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxevent.c $
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "amx.h"
+#include "amxevent.h"
+
+#define MAXEVENTS   32  /* events handled per call to epoll_wait() */
+
+typedef struct tagSOURCE {
+  AMX *amx;
+  AMX_EVENTFUNC func;
+  void *data;
+  int fd;
+  int timer;            /* fd is a timerfd, owned by the event loop */
+  int ready;            /* fd cannot be polled (a regular file), it is always ready */
+  int removed;          /* removed while the event loop was dispatching */
+  struct tagSOURCE *next;
+} SOURCE;
+
+struct tagAMX_EVENTLOOP {
+  AMX_EVENTS events;    /* must be the first field */
+  int epfd;
+  int wakefd;           /* eventfd, for evloop_Stop() */
+  SOURCE *sources;
+  SOURCE *removed;      /* sources to free after dispatching */
+  int count;            /* number of sources */
+  int ready;            /* number of sources that are always ready */
+  int dispatching;
+};
+
+static long long now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static SOURCE *add_source(AMX_EVENTLOOP *loop, AMX *amx, int fd, AMX_EVENTFUNC func, void *data)
+{
+  struct epoll_event ev;
+  SOURCE *src;
+
+  if ((src = (SOURCE*)malloc(sizeof(SOURCE))) == NULL)
+    return NULL;
+  memset(src, 0, sizeof(SOURCE));
+  src->amx = amx;
+  src->func = func;
+  src->data = data;
+  src->fd = fd;
+  memset(&ev, 0, sizeof ev);
+  ev.events = EPOLLIN;
+  ev.data.ptr = src;
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    /* epoll refuses regular files (and some devices), but like poll() and
+     * select() do, the event loop reports these as always ready
+     */
+    if (errno != EPERM) {
+      free(src);
+      return NULL;
+    } /* if */
+    src->ready = 1;
+    loop->ready++;
+  } /* if */
+  src->next = loop->sources;
+  loop->sources = src;
+  loop->count++;
+  return src;
+}
+
+static void remove_source(AMX_EVENTLOOP *loop, SOURCE *src)
+{
+  SOURCE **ptr;
+
+  for (ptr = &loop->sources; *ptr != NULL && *ptr != src; ptr = &(*ptr)->next)
+    /* nothing */;
+  assert(*ptr == src);
+  *ptr = src->next;
+  loop->count--;
+  if (src->ready)
+    loop->ready--;
+  else
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+  if (src->timer)
+    close(src->fd);
+  if (loop->dispatching) {
+    /* the source may still be in the list of ready events */
+    src->removed = 1;
+    src->next = loop->removed;
+    loop->removed = src;
+  } else {
+    free(src);
+  } /* if */
+}
+
+static int AMXAPI ev_AddFile(AMX_EVENTS *events, AMX *amx, int fd, AMX_EVENTFUNC func, void *data)
+{
+  if (amx == NULL || fd < 0 || func == NULL)
+    return AMX_ERR_PARAMS;
+  return (add_source((AMX_EVENTLOOP*)events, amx, fd, func, data) != NULL) ? AMX_ERR_NONE : AMX_ERR_GENERAL;
+}
+
+static int AMXAPI ev_RemoveFile(AMX_EVENTS *events, int fd)
+{
+  AMX_EVENTLOOP *loop = (AMX_EVENTLOOP*)events;
+  SOURCE *src;
+
+  for (src = loop->sources; src != NULL && (src->fd != fd || src->timer); src = src->next)
+    /* nothing */;
+  if (src == NULL)
+    return AMX_ERR_NOTFOUND;
+  remove_source(loop, src);
+  return AMX_ERR_NONE;
+}
+
+static int AMXAPI ev_AddTimer(AMX_EVENTS *events, AMX *amx, AMX_EVENTFUNC func, void *data, void **timer)
+{
+  SOURCE *src;
+  int fd;
+
+  if (amx == NULL || func == NULL || timer == NULL)
+    return AMX_ERR_PARAMS;
+  if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    return AMX_ERR_GENERAL;
+  if ((src = add_source((AMX_EVENTLOOP*)events, amx, fd, func, data)) == NULL) {
+    close(fd);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  src->timer = 1;
+  *timer = src;
+  return AMX_ERR_NONE;
+}
+
+static int AMXAPI ev_SetTimer(AMX_EVENTS *events, void *timer, unsigned long interval, int repeat)
+{
+  SOURCE *src = (SOURCE*)timer;
+  struct itimerspec its;
+
+  (void)events;
+  if (src == NULL || !src->timer)
+    return AMX_ERR_PARAMS;
+  memset(&its, 0, sizeof its);
+  its.it_value.tv_sec = (time_t)(interval / 1000);
+  its.it_value.tv_nsec = (long)(interval % 1000) * 1000000L;
+  if (repeat)
+    its.it_interval = its.it_value;
+  return (timerfd_settime(src->fd, 0, &its, NULL) == 0) ? AMX_ERR_NONE : AMX_ERR_GENERAL;
+}
+
+static int AMXAPI ev_RemoveTimer(AMX_EVENTS *events, void *timer)
+{
+  SOURCE *src = (SOURCE*)timer;
+
+  if (src == NULL || !src->timer)
+    return AMX_ERR_PARAMS;
+  remove_source((AMX_EVENTLOOP*)events, src);
+  return AMX_ERR_NONE;
+}
+
+static int dispatch(SOURCE *src)
+{
+  AMX *amx = src->amx;
+  cell cip, frm, pri, alt, reset_stk, reset_hea;
+  int ovl_index, err;
+
+  /* the main function of the script may be sleeping; save its registers,
+   * because the event handler runs a public function on the same abstract
+   * machine
+   */
+  cip = amx->cip;
+  frm = amx->frm;
+  pri = amx->pri;
+  alt = amx->alt;
+  reset_stk = amx->reset_stk;
+  reset_hea = amx->reset_hea;
+  ovl_index = amx->ovl_index;
+  err = src->func(amx, amx_Exec, src->data);
+  if (ovl_index != amx->ovl_index && amx->overlay != NULL)
+    amx->overlay(amx, ovl_index);
+  amx->cip = cip;
+  amx->frm = frm;
+  amx->pri = pri;
+  amx->alt = alt;
+  amx->reset_stk = reset_stk;
+  amx->reset_hea = reset_hea;
+  amx->ovl_index = ovl_index;
+  return err;
+}
+
+/* evloop_Create() creates an empty event loop.
+ */
+int AMXAPI evloop_Create(AMX_EVENTLOOP **loop)
+{
+  AMX_EVENTLOOP *lp;
+  struct epoll_event ev;
+
+  if (loop == NULL)
+    return AMX_ERR_PARAMS;
+  if ((lp = (AMX_EVENTLOOP*)malloc(sizeof(AMX_EVENTLOOP))) == NULL)
+    return AMX_ERR_MEMORY;
+  memset(lp, 0, sizeof(AMX_EVENTLOOP));
+  lp->events.AddFile = ev_AddFile;
+  lp->events.RemoveFile = ev_RemoveFile;
+  lp->events.AddTimer = ev_AddTimer;
+  lp->events.SetTimer = ev_SetTimer;
+  lp->events.RemoveTimer = ev_RemoveTimer;
+  lp->epfd = epoll_create1(EPOLL_CLOEXEC);
+  lp->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  memset(&ev, 0, sizeof ev);
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;   /* NULL marks the wake-up event */
+  if (lp->epfd < 0 || lp->wakefd < 0 || epoll_ctl(lp->epfd, EPOLL_CTL_ADD, lp->wakefd, &ev) < 0) {
+    if (lp->epfd >= 0)
+      close(lp->epfd);
+    if (lp->wakefd >= 0)
+      close(lp->wakefd);
+    free(lp);
+    return AMX_ERR_GENERAL;
+  } /* if */
+  *loop = lp;
+  return AMX_ERR_NONE;
+}
+
+/* evloop_Delete() removes all files and timers and frees the event loop. The
+ * abstract machines that were attached should be cleaned up before the event
+ * loop is deleted, because the extension modules may still refer to it.
+ */
+int AMXAPI evloop_Delete(AMX_EVENTLOOP *loop)
+{
+  if (loop == NULL)
+    return AMX_ERR_PARAMS;
+  assert(!loop->dispatching);
+  while (loop->sources != NULL)
+    remove_source(loop, loop->sources);
+  close(loop->wakefd);
+  close(loop->epfd);
+  free(loop);
+  return AMX_ERR_NONE;
+}
+
+/* evloop_Attach() calls the event hook that the extension modules installed
+ * in the abstract machine, so that they register their files and timers. It
+ * must be called once per abstract machine, after initializing the extension
+ * modules. If there is no event hook, the abstract machine does not handle
+ * events, and this function does nothing.
+ */
+int AMXAPI evloop_Attach(AMX_EVENTLOOP *loop, AMX *amx)
+{
+  AMX_EVENTHOOK hook;
+
+  if (loop == NULL || amx == NULL)
+    return AMX_ERR_PARAMS;
+  if (amx_GetUserData(amx, AMX_EVENTTAG, (void**)&hook) != AMX_ERR_NONE || hook == NULL)
+    return AMX_ERR_NONE;
+  return hook(amx, &loop->events);
+}
+
+/* evloop_Run() waits for events and dispatches them, until "timeout"
+ * milliseconds have passed, or (if "timeout" is negative) until no files and
+ * timers are left. It returns early with the error code of an event handler
+ * that fails, or with AMX_ERR_INTERRUPT when evloop_Stop() is called.
+ */
+int AMXAPI evloop_Run(AMX_EVENTLOOP *loop, long timeout)
+{
+  struct epoll_event ev[MAXEVENTS];
+  long long deadline = (timeout >= 0) ? now() + timeout : -1;
+  int i, num, wait, stopped = 0, err = AMX_ERR_NONE;
+
+  if (loop == NULL)
+    return AMX_ERR_PARAMS;
+  for ( ;; ) {
+    if (deadline < 0) {
+      if (loop->count == 0)
+        return AMX_ERR_NONE;  /* nothing left to wait for */
+      wait = -1;
+    } else {
+      long long remaining = deadline - now();
+      wait = (remaining > 0) ? (int)remaining : 0;
+    } /* if */
+    if (loop->ready > 0)
+      wait = 0;               /* only check the other sources */
+    if ((num = epoll_wait(loop->epfd, ev, MAXEVENTS, wait)) < 0) {
+      if (errno == EINTR)
+        continue;             /* a signal handler may have called evloop_Stop() */
+      return AMX_ERR_GENERAL;
+    } /* if */
+
+    loop->dispatching = 1;
+    for (i = 0; i < num && err == AMX_ERR_NONE; i++) {
+      SOURCE *src = (SOURCE*)ev[i].data.ptr;
+      uint64_t count;
+      if (src == NULL) {
+        if (read(loop->wakefd, &count, sizeof count) == sizeof count)
+          stopped = 1;
+        continue;
+      } /* if */
+      if (src->removed)
+        continue;
+      /* read the timer, to reset it; a timer that was re-armed after
+       * epoll_wait() returned has nothing to read
+       */
+      if (src->timer && read(src->fd, &count, sizeof count) != sizeof count)
+        continue;
+      err = dispatch(src);
+    } /* for */
+    if (loop->ready > 0) {
+      SOURCE *src, *next;
+      /* a handler may remove sources; a removed source is moved to the list
+       * of removed sources, which are all skipped
+       */
+      for (src = loop->sources; src != NULL && err == AMX_ERR_NONE; src = next) {
+        next = src->next;
+        if (src->ready && !src->removed)
+          err = dispatch(src);
+      } /* for */
+    } /* if */
+    loop->dispatching = 0;
+    while (loop->removed != NULL) {
+      SOURCE *src = loop->removed;
+      loop->removed = src->next;
+      free(src);
+    } /* while */
+
+    if (err != AMX_ERR_NONE)
+      return err;
+    if (stopped)
+      return AMX_ERR_INTERRUPT;
+    if (deadline >= 0 && now() >= deadline)
+      return AMX_ERR_NONE;
+  } /* for */
+}
+
+/* evloop_Stop() makes evloop_Run() return. It may be called from another
+ * thread or from a signal handler.
+ */
+int AMXAPI evloop_Stop(AMX_EVENTLOOP *loop)
+{
+  uint64_t one = 1;
+
+  if (loop == NULL)
+    return AMX_ERR_PARAMS;
+  return (write(loop->wakefd, &one, sizeof one) == sizeof one) ? AMX_ERR_NONE : AMX_ERR_GENERAL;
+}
@@ -0,0 +1,71 @@
+/*  Event loop for hosts of the Pawn Abstract Machine
+ *
+ *  Copyright (c) CompuPhase, 2026
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxevent.h $
+ */
+#ifndef AMXEVENT_H_INCLUDED
+#define AMXEVENT_H_INCLUDED
+
+#include "amx.h"
+
+#ifdef  __cplusplus
+extern  "C" {
+#endif
+
+/* An event handler runs the public function(s) for an event. Like an idle
+ * function (AMX_IDLE), it must use the "Exec" function that it receives to
+ * run the abstract machine. A handler that returns an error code other than
+ * AMX_ERR_NONE stops the event loop.
+ */
+typedef int (AMXAPI *AMX_EVENTFUNC)(AMX *amx, int AMXAPI Exec(AMX *, cell *, int), void *data);
+
+/* The event loop passes this table to the extension modules. Extension
+ * modules are often shared libraries with their own copy of the abstract
+ * machine, so they must call the event loop through these pointers.
+ * A timer is created disarmed; SetTimer() with an interval of zero disarms it
+ * again.
+ */
+typedef struct tagAMX_EVENTS AMX_EVENTS;
+struct tagAMX_EVENTS {
+  int (AMXAPI *AddFile)(AMX_EVENTS *events, AMX *amx, int fd, AMX_EVENTFUNC func, void *data);
+  int (AMXAPI *RemoveFile)(AMX_EVENTS *events, int fd);
+  int (AMXAPI *AddTimer)(AMX_EVENTS *events, AMX *amx, AMX_EVENTFUNC func, void *data, void **timer);
+  int (AMXAPI *SetTimer)(AMX_EVENTS *events, void *timer, unsigned long interval, int repeat);
+  int (AMXAPI *RemoveTimer)(AMX_EVENTS *events, void *timer);
+};
+
+/* An extension module that handles events installs an event hook as the user
+ * value with tag "Evnt" (next to an idle function with tag "Idle", for hosts
+ * that have no event loop). The host calls the hook once, after initializing
+ * the extension modules; the hook must call the hook that it replaced, and
+ * then register its files and timers.
+ */
+typedef int (AMXAPI *AMX_EVENTHOOK)(AMX *amx, AMX_EVENTS *events);
+#define AMX_EVENTTAG  AMX_USERTAG('E','v','n','t')
+
+typedef struct tagAMX_EVENTLOOP AMX_EVENTLOOP;
+
+int AMXAPI evloop_Create(AMX_EVENTLOOP **loop);
+int AMXAPI evloop_Delete(AMX_EVENTLOOP *loop);
+int AMXAPI evloop_Attach(AMX_EVENTLOOP *loop, AMX *amx);
+int AMXAPI evloop_Run(AMX_EVENTLOOP *loop, long timeout);
+int AMXAPI evloop_Stop(AMX_EVENTLOOP *loop);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* AMXEVENT_H_INCLUDED */
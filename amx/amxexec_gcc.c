@@ -71,6 +71,13 @@
 #if !defined GETPARAM
   #define GETPARAM(v)   ( v=*cip++ )  /* read a parameter from the opcode stream */
 #endif
+#if defined AMX_DIRECTTHREADING
+  /* the parameter of a packed opcode is read from the original P-code, because
+   * the translated code holds the address of the handler at that position
+   */
+  #undef GETPARAM_P
+  #define GETPARAM_P(v,o) ( v=(*(cell *)((unsigned char *)cip-sizeof(cell)+pdelta) >> (int)(sizeof(cell)*4)) )
+#endif
 #if !defined GETPARAM_P
   #define GETPARAM_P(v,o) ( v=((cell)(o) >> (int)(sizeof(cell)*4)) )
 #endif
@@ -91,23 +98,97 @@
 
 #define JUMPREL(ip)     ((cell*)((unsigned long)(ip)+*(cell*)(ip)-sizeof(cell)))
 
+/* the instruction budget is charged one unit on every call and on every
+ * backward jump (see amx_SetBudget() in AMX.C); amx_Interrupt() is polled at
+ * the same points
+ */
+#define CHARGE()        if ((--amx->budget<=0 || amx->interrupt) \
+                            && (num=preempt(amx))!=AMX_ERR_NONE) goto __preempt
+#define JUMP()          { cell *target=JUMPREL(cip); \
+                          if (target<cip) { cip=target; CHARGE(); } else { cip=target; } }
+
 
-#if !defined AMX_NO_PACKED_OPC && !defined AMX_TOKENTHREADING
+#if !defined AMX_NO_PACKED_OPC && !defined AMX_TOKENTHREADING && !defined AMX_DIRECTTHREADING
   #define AMX_TOKENTHREADING    /* packed opcodes require token threading */
 #endif
 #if defined AMX_TOKENTHREADING
   #if defined AMX_NO_PACKED_OPC
     #define NEXT(cip,op) goto *amx_opcodelist[*cip++]
   #else
-    #define NEXT(cip,op) goto *amx_opcodelist[(op=*cip++) & ((1 << sizeof(cell)*4)-1)]
+    #define NEXT(cip,op) goto *amx_opcodelist[(op=*cip++) & (((cell)1 << sizeof(cell)*4)-1)]
   #endif
 #else
-  #if !defined AMX_NO_PACKED_OPC
+  #if !defined AMX_NO_PACKED_OPC && !defined AMX_DIRECTTHREADING
     #error Packed opcodes support requires token threading
   #endif
-  #define NEXT(cip,op)   goto **cip++
+  #define NEXT(cip,op)   goto *(void *)(intptr_t)*cip++
 #endif
 
+/* With AMX_DIRECTTHREADING, VerifyPcode() translates the P-code into a separate
+ * block (amx->tcode) that has the same layout as the P-code, but with the
+ * addresses of the handlers instead of opcodes; the code offsets in cip, in
+ * return addresses and in jumps are therefore the same for both blocks.
+ */
+#if defined AMX_DIRECTTHREADING
+  #define CODEBASE      ((unsigned char *)amx->tcode)
+#else
+  #define CODEBASE      amx->code
+#endif
+
+/* a native function that raises AMX_ERR_SWITCH has stored a new set of
+ * registers in the AMX structure (see AMX.C)
+ */
+#define SWITCH()        ( amx->error=AMX_ERR_NONE, pri=amx->pri, alt=amx->alt, \
+                          frm=amx->frm, stk=amx->stk, hea=amx->hea, \
+                          cip=(cell *)(CODEBASE+(int)amx->cip) )
+
+/* Look up a value in a case table (this is the same function as in AMX.C);
+ * the records are sorted on the case value, and "rec" points to the first
+ * record. Returns a pointer to the matching record, or NULL.
+ */
+static cell *findcase(cell *rec,cell num,cell value)
+{
+  ucell range;
+  cell lo,hi,mid;
+
+  if (num<=0)
+    return NULL;
+  range=(ucell)rec[2*(num-1)]-(ucell)rec[0];
+  if ((ucell)value-(ucell)rec[0]>range)
+    return NULL;        /* below the lowest or above the highest case value */
+  if (range==(ucell)(num-1))
+    return rec+2*((ucell)value-(ucell)rec[0]);  /* consecutive case values */
+  lo=0;
+  hi=num-1;
+  while (lo<hi) {
+    mid=lo+(hi-lo)/2;
+    if (rec[2*mid]<value)
+      lo=mid+1;
+    else
+      hi=mid;
+  } /* while */
+  return (rec[2*lo]==value) ? rec+2*lo : NULL;
+}
+
+/* Returns an error code if the abstract machine must suspend because it was
+ * interrupted or because its instruction budget is used up; refills the
+ * counter if no budget is set (this is the same function as in AMX.C).
+ */
+static int preempt(AMX *amx)
+{
+  if (amx->interrupt) {
+    amx->interrupt=0;
+    return AMX_ERR_INTERRUPT;
+  } /* if */
+  if (amx->budget>0)
+    return AMX_ERR_NONE;
+  if ((amx->flags & AMX_FLAG_BUDGET)!=0)
+    return AMX_ERR_BUDGET;
+  amx->usage+=(unsigned long)(AMX_BUDGET_REFILL-amx->budget);
+  amx->budget=AMX_BUDGET_REFILL;
+  return AMX_ERR_NONE;
+}
+
 cell amx_exec_run(AMX *amx,cell *retval,unsigned char *data)
 {
 static const void * const amx_opcodelist[] = {
@@ -166,6 +247,13 @@ static const void * const amx_opcodelist[] = {
         &&op_eq_p_c_pri,  &&op_eq_p_c_alt,  &&op_inc_p,       &&op_inc_p_s,
         &&op_dec_p,       &&op_dec_p_s,     &&op_movs_p,      &&op_cmps_p,
         &&op_fill_p,      &&op_halt_p,      &&op_bounds_p,
+#endif
+        /* superinstructions (created in VerifyPcode()) */
+#if !defined AMX_NO_SUPERINSTR
+        &&op_const_push,  &&op_load_s_push, &&op_addr_push,   &&op_load_s_both,
+        &&op_load_s_const,&&op_pop_add,     &&op_idx_add,     &&op_add_load_i,
+        &&op_eq_jzer,     &&op_neq_jzer,    &&op_sless_jzer,  &&op_sleq_jzer,
+        &&op_sgrtr_jzer,  &&op_sgeq_jzer,
 #endif
 };
   AMX_HEADER *hdr;
@@ -173,8 +261,10 @@ static const void * const amx_opcodelist[] = {
   cell reset_stk, reset_hea, *cip;
   cell offs,val;
   int num,i;
-  #if !defined AMX_NO_PACKED_OPC
-    int op;
+  #if !defined AMX_NO_PACKED_OPC && !defined AMX_DIRECTTHREADING
+    cell op;            /* full cell, the upper half holds the packed parameter */
+  #elif !defined AMX_NO_PACKED_OPC
+    ptrdiff_t pdelta;   /* offset from the translated code to the P-code */
   #endif
 
   assert(amx!=NULL);
@@ -193,18 +283,25 @@ static const void * const amx_opcodelist[] = {
   hdr=(AMX_HEADER *)amx->base;
   assert(hdr->magic==AMX_MAGIC);
   assert(hdr->file_version>=11);
-  cip=(cell*)amx->cip;
+  pri=amx->pri;   /* restored for AMX_EXEC_CONT */
+  alt=amx->alt;
+  frm=amx->frm;
   hea=amx->hea;
   stk=amx->stk;
   reset_stk=stk;
   reset_hea=hea;
-  alt=frm=pri=0;/* just to avoid compiler warnings */
   num=0;        /* just to avoid compiler warnings */
 
   /* start running */
   assert(amx->code!=NULL);
   assert(data!=NULL);
-  cip=(cell *)(amx->code+(int)amx->cip);
+  #if defined AMX_DIRECTTHREADING
+    assert(amx->tcode!=NULL);
+    #if !defined AMX_NO_PACKED_OPC
+      pdelta=amx->code-(unsigned char *)amx->tcode;
+    #endif
+  #endif
+  cip=(cell *)(CODEBASE+(int)amx->cip);
   NEXT(cip,op);
 
   op_nop:
@@ -339,7 +436,7 @@ static const void * const amx_opcodelist[] = {
       pri=frm;
       break;
     case 6:
-      pri=(cell)((unsigned char *)cip - amx->code);
+      pri=(cell)((unsigned char *)cip - CODEBASE);
       break;
     } /* switch */
     NEXT(cip,op);
@@ -361,7 +458,7 @@ static const void * const amx_opcodelist[] = {
       frm=pri;
       break;
     case 6:
-      cip=(cell *)(amx->code + (int)pri);
+      cip=(cell *)(CODEBASE + (int)pri);
       break;
     } /* switch */
     NEXT(cip,op);
@@ -414,7 +511,7 @@ static const void * const amx_opcodelist[] = {
     /* verify the return address */
     if ((long)offs>=amx->codesize)
       ABORT(amx,AMX_ERR_MEMACCESS);
-    cip=(cell *)(amx->code+(int)offs);
+    cip=(cell *)(CODEBASE+(int)offs);
     NEXT(cip,op);
   op_retn:
     POP(frm);
@@ -422,27 +519,28 @@ static const void * const amx_opcodelist[] = {
     /* verify the return address */
     if ((long)offs>=amx->codesize)
       ABORT(amx,AMX_ERR_MEMACCESS);
-    cip=(cell *)(amx->code+(int)offs);
+    cip=(cell *)(CODEBASE+(int)offs);
     stk+= _R(data,stk) + sizeof(cell);  /* remove parameters from the stack */
     NEXT(cip,op);
   op_call:
-    PUSH(((unsigned char *)cip-amx->code)+sizeof(cell));/* push address behind instruction */
+    PUSH(((unsigned char *)cip-CODEBASE)+sizeof(cell));/* push address behind instruction */
     cip=JUMPREL(cip);                   /* jump to the address */
+    CHARGE();
     NEXT(cip,op);
   op_jump:
     /* since the GETPARAM() macro modifies cip, you cannot
      * do GETPARAM(cip) directly */
-    cip=JUMPREL(cip);
+    JUMP();
     NEXT(cip,op);
   op_jzer:
     if (pri==0)
-      cip=JUMPREL(cip);
+      JUMP()
     else
       SKIPPARAM(1);
     NEXT(cip,op);
   op_jnz:
     if (pri!=0)
-      cip=JUMPREL(cip);
+      JUMP()
     else
       SKIPPARAM(1);
     NEXT(cip,op);
@@ -628,7 +726,7 @@ static const void * const amx_opcodelist[] = {
     amx->frm=frm;
     amx->pri=pri;
     amx->alt=alt;
-    amx->cip=(cell)((unsigned char*)cip-amx->code);
+    amx->cip=(cell)((unsigned char*)cip-CODEBASE);
     if (offs==AMX_ERR_SLEEP) {
       amx->stk=stk;
       amx->hea=hea;
@@ -640,14 +738,14 @@ static const void * const amx_opcodelist[] = {
   op_bounds:
     GETPARAM(offs);
     if ((ucell)pri>(ucell)offs) {
-      amx->cip=(cell)((unsigned char *)cip-amx->code);
+      amx->cip=(cell)((unsigned char *)cip-CODEBASE);
       ABORT(amx,AMX_ERR_BOUNDS);
     } /* if */
     NEXT(cip,op);
   op_sysreq:
     GETPARAM(offs);
     /* save a few registers */
-    amx->cip=(cell)((unsigned char *)cip-amx->code);
+    amx->cip=(cell)((unsigned char *)cip-CODEBASE);
     amx->hea=hea;
     amx->frm=frm;
     amx->stk=stk;
@@ -660,17 +758,17 @@ static const void * const amx_opcodelist[] = {
         amx->reset_hea=reset_hea;
         return num;
       } /* if */
+      if (num==AMX_ERR_SWITCH) {
+        SWITCH();
+        NEXT(cip,op);
+      } /* if */
       ABORT(amx,num);
     } /* if */
     NEXT(cip,op);
   op_switch: {
     cell *cptr=JUMPREL(cip)+1;  /* +1, to skip the "casetbl" opcode */
-    cip=JUMPREL(cptr+1);        /* preset to "none-matched" case */
-    num=(int)*cptr;             /* number of records in the case table */
-    for (cptr+=2; num>0 && *cptr!=pri; num--,cptr+=2)
-      /* nothing */;
-    if (num>0)
-      cip=JUMPREL(cptr+1);      /* case found */
+    cell *rec=findcase(cptr+2,*cptr,pri);
+    cip=JUMPREL((rec!=NULL) ? rec+1 : cptr+1);  /* case found, or "none-matched" case */
     NEXT(cip,op);
     }
   op_swap_pri:
@@ -690,7 +788,7 @@ static const void * const amx_opcodelist[] = {
       amx->frm=frm;
       amx->stk=stk;
       amx->hea=hea;
-      amx->cip=(cell)((unsigned char*)cip-amx->code);
+      amx->cip=(cell)((unsigned char*)cip-CODEBASE);
       num=amx->debug(amx);
       if (num!=AMX_ERR_NONE) {
         if (num==AMX_ERR_SLEEP) {
@@ -711,7 +809,7 @@ static const void * const amx_opcodelist[] = {
     #if !defined AMX_DONT_RELOCATE
       GETPARAM(offs);
       /* save a few registers */
-      amx->cip=(cell)((unsigned char *)cip-amx->code);
+      amx->cip=(cell)((unsigned char *)cip-CODEBASE);
       amx->hea=hea;
       amx->frm=frm;
       amx->stk=stk;
@@ -724,6 +822,10 @@ static const void * const amx_opcodelist[] = {
           amx->reset_hea=reset_hea;
           return AMX_ERR_SLEEP;
         } /* if */
+        if (amx->error==AMX_ERR_SWITCH) {
+          SWITCH();
+          NEXT(cip,op);
+        } /* if */
         ABORT(amx,amx->error);
       } /* if */
       NEXT(cip,op);
@@ -736,12 +838,12 @@ static const void * const amx_opcodelist[] = {
       GETPARAM(val);
       PUSH(val);
       /* save a few registers */
-      amx->cip=(cell)((unsigned char *)cip-amx->code);
+      amx->cip=(cell)((unsigned char *)cip-CODEBASE);
       amx->hea=hea;
       amx->frm=frm;
       amx->stk=stk;
       pri=((AMX_NATIVE)offs)(amx,(cell *)(data+(int)stk));
-      stk+=val+4;
+      stk+=val+sizeof(cell);
       if (amx->error!=AMX_ERR_NONE) {
         if (amx->error==AMX_ERR_SLEEP) {
           amx->pri=pri;
@@ -751,6 +853,10 @@ static const void * const amx_opcodelist[] = {
           amx->reset_hea=reset_hea;
           return AMX_ERR_SLEEP;
         } /* if */
+        if (amx->error==AMX_ERR_SWITCH) {
+          SWITCH();
+          NEXT(cip,op);
+        } /* if */
         ABORT(amx,amx->error);
       } /* if */
       NEXT(cip,op);
@@ -761,14 +867,15 @@ static const void * const amx_opcodelist[] = {
     /* overlay instructions */
 #if !defined AMX_NO_OVERLAY
   op_call_ovl:
-    offs=(unsigned char *)cip-amx->code+sizeof(cell); /* skip address */
+    offs=(unsigned char *)cip-CODEBASE+sizeof(cell); /* skip address */
     assert(offs>=0 && offs<(1<<(sizeof(cell)*4)));
     PUSH((offs<<(sizeof(cell)*4)) | amx->ovl_index);
     amx->ovl_index=(int)*cip;
     assert(amx->overlay!=NULL);
     if ((num=amx->overlay(amx,amx->ovl_index))!=AMX_ERR_NONE)
       ABORT(amx,num);
-    cip=(cell*)amx->code;
+    cip=(cell*)CODEBASE;
+    CHARGE();
     NEXT(cip,op);
   op_retn_ovl:
     assert(amx->overlay!=NULL);
@@ -781,20 +888,16 @@ static const void * const amx_opcodelist[] = {
     num=amx->overlay(amx,amx->ovl_index); /* reload overlay */
     if (num!=AMX_ERR_NONE || (long)offs>=amx->codesize)
       ABORT(amx,AMX_ERR_MEMACCESS);
-    cip=(cell *)(amx->code+(int)offs);
+    cip=(cell *)(CODEBASE+(int)offs);
     NEXT(cip,op);
   op_switch_ovl: {
     cell *cptr=JUMPREL(cip)+1;  /* +1, to skip the "icasetbl" opcode */
-    amx->ovl_index=*(cptr+1);   /* preset to "none-matched" case */
-    num=(int)*cptr;             /* number of records in the case table */
-    for (cptr+=2; num>0 && *cptr!=pri; num--,cptr+=2)
-      /* nothing */;
-    if (num>0)
-      amx->ovl_index=*(cptr+1); /* case found */
+    cell *rec=findcase(cptr+2,*cptr,pri);
+    amx->ovl_index=(int)*((rec!=NULL) ? rec+1 : cptr+1);  /* case found, or "none-matched" case */
     assert(amx->overlay!=NULL);
     if ((num=amx->overlay(amx,amx->ovl_index))!=AMX_ERR_NONE)
       ABORT(amx,num);
-    cip=(cell*)amx->code;
+    cip=(cell*)CODEBASE;
     NEXT(cip,op);
     }
 #else
@@ -861,37 +964,37 @@ static const void * const amx_opcodelist[] = {
     NEXT(cip,op);
   op_jeq:
     if (pri==alt)
-      cip=JUMPREL(cip);
+      JUMP()
     else
       SKIPPARAM(1);
     NEXT(cip,op);
   op_jneq:
     if (pri!=alt)
-      cip=JUMPREL(cip);
+      JUMP()
     else
       SKIPPARAM(1);
     NEXT(cip,op);
   op_jsless:
     if (pri<alt)
-      cip=JUMPREL(cip);
+      JUMP()
     else
       SKIPPARAM(1);
     NEXT(cip,op);
   op_jsleq:
     if (pri<=alt)
-      cip=JUMPREL(cip);
+      JUMP()
     else
       SKIPPARAM(1);
     NEXT(cip,op);
   op_jsgrtr:
     if (pri>alt)
-      cip=JUMPREL(cip);
+      JUMP()
     else
       SKIPPARAM(1);
     NEXT(cip,op);
   op_jsgeq:
     if (pri>=alt)
-      cip=JUMPREL(cip);
+      JUMP()
     else
       SKIPPARAM(1);
     NEXT(cip,op);
@@ -990,12 +1093,12 @@ static const void * const amx_opcodelist[] = {
     GETPARAM(val);
     PUSH(val);
     /* save a few registers */
-    amx->cip=(cell)((unsigned char *)cip-amx->code);
+    amx->cip=(cell)((unsigned char *)cip-CODEBASE);
     amx->hea=hea;
     amx->frm=frm;
     amx->stk=stk;
     num=amx->callback(amx,offs,&pri,(cell *)(data+(int)stk));
-    stk+=val+4;
+    stk+=val+sizeof(cell);
     if (num!=AMX_ERR_NONE) {
       if (num==AMX_ERR_SLEEP) {
         amx->pri=pri;
@@ -1005,6 +1108,10 @@ static const void * const amx_opcodelist[] = {
         amx->reset_hea=reset_hea;
         return num;
       } /* if */
+      if (num==AMX_ERR_SWITCH) {
+        SWITCH();
+        NEXT(cip,op);
+      } /* if */
       ABORT(amx,num);
     } /* if */
     NEXT(cip,op);
@@ -1334,11 +1441,105 @@ static const void * const amx_opcodelist[] = {
   op_bounds_p:
     GETPARAM_P(offs,op);
     if ((ucell)pri>(ucell)offs) {
-      amx->cip=(cell)((unsigned char *)cip-amx->code);
+      amx->cip=(cell)((unsigned char *)cip-CODEBASE);
       ABORT(amx,AMX_ERR_BOUNDS);
     } /* if */
     NEXT(cip,op);
 #endif
+#if !defined AMX_NO_SUPERINSTR
+  /* superinstructions: the opcodes of the instructions that follow the first
+   * instruction of the sequence are skipped
+   */
+  op_const_push:
+    GETPARAM(pri);
+    SKIPPARAM(1);
+    PUSH(pri);
+    NEXT(cip,op);
+  op_load_s_push:
+    GETPARAM(offs);
+    pri=_R(data,frm+offs);
+    SKIPPARAM(1);
+    PUSH(pri);
+    NEXT(cip,op);
+  op_addr_push:
+    GETPARAM(pri);
+    pri+=frm;
+    SKIPPARAM(1);
+    PUSH(pri);
+    NEXT(cip,op);
+  op_load_s_both:
+    GETPARAM(offs);
+    pri=_R(data,frm+offs);
+    SKIPPARAM(1);
+    GETPARAM(offs);
+    alt=_R(data,frm+offs);
+    NEXT(cip,op);
+  op_load_s_const:
+    GETPARAM(offs);
+    pri=_R(data,frm+offs);
+    SKIPPARAM(1);
+    GETPARAM(alt);
+    NEXT(cip,op);
+  op_pop_add:
+    POP(alt);
+    SKIPPARAM(1);
+    pri+=alt;
+    NEXT(cip,op);
+  op_idx_add:
+    GETPARAM(offs);
+    pri<<=offs;
+    SKIPPARAM(2);
+    POP(alt);
+    pri+=alt;
+    NEXT(cip,op);
+  op_add_load_i:
+    pri+=alt;
+    SKIPPARAM(1);
+    /* verify address */
+    if (pri>=hea && pri<stk || (ucell)pri>=(ucell)amx->stp)
+      ABORT(amx,AMX_ERR_MEMACCESS);
+    pri=_R(data,pri);
+    NEXT(cip,op);
+  op_eq_jzer:
+    pri= pri==alt ? 1 : 0;
+    goto __jzer;
+  op_neq_jzer:
+    pri= pri!=alt ? 1 : 0;
+    goto __jzer;
+  op_sless_jzer:
+    pri= pri<alt ? 1 : 0;
+    goto __jzer;
+  op_sleq_jzer:
+    pri= pri<=alt ? 1 : 0;
+    goto __jzer;
+  op_sgrtr_jzer:
+    pri= pri>alt ? 1 : 0;
+    goto __jzer;
+  op_sgeq_jzer:
+    pri= pri>=alt ? 1 : 0;
+  __jzer:
+    SKIPPARAM(1);
+    if (pri==0)
+      JUMP()
+    else
+      SKIPPARAM(1);
+    NEXT(cip,op);
+#endif
+
+  __preempt:
+    /* the instruction budget is used up or the abstract machine was
+     * interrupted: store the complete status, so that the abstract machine
+     * can continue with AMX_EXEC_CONT
+     */
+    amx->frm=frm;
+    amx->pri=pri;
+    amx->alt=alt;
+    amx->stk=stk;
+    amx->hea=hea;
+    amx->cip=(cell)((unsigned char*)cip-CODEBASE);
+    amx->reset_stk=reset_stk;
+    amx->reset_hea=reset_hea;
+    return num;
 }
 
 void amx_exec_list(const AMX *amx,const cell **opcodelist,int *numopcodes)
@@ -518,15 +518,58 @@ static cell AMX_NATIVE_CALL n_fclose(AMX *amx, const cell *params)
   return fclose((FILE*)params[1]) == 0;
 }
 
+/* The functions fwrite(), fread() and fcopy() may block on I/O, so they
+ * pass the I/O to amx_Async(); see there. The jobs below run while the
+ * abstract machine is suspended, so they may access its memory (but they
+ * may not call functions of the abstract machine that use the AMX structure).
+ * A job frees its own data.
+ */
+typedef struct tagIOJOB {
+  FILE *fp;
+  cell *cptr;           /* string in the abstract machine */
+  int max;              /* size of the buffer, in characters */
+  char str[1];          /* fwrite: packed string; fread: buffer (size "max") */
+} IOJOB;
+
+static cell AMXAPI job_fwrite(void *data)
+{
+  IOJOB *job=(IOJOB*)data;
+  size_t r;
+
+  if (job->cptr==NULL)
+    r=fputs(job->str,job->fp);
+  else
+    r=fputs_cell(job->fp,job->cptr,1);
+  free(job);
+  return (cell)r;
+}
+
+static cell AMXAPI job_fread(void *data)
+{
+  IOJOB *job=(IOJOB*)data;
+  size_t chars;
+
+  if (job->max>0) {
+    /* store as packed string, read an ASCII/ANSI string */
+    chars=fgets_char(job->fp,job->str,job->max);
+    assert((int)chars<job->max);
+    amx_SetString(job->cptr,job->str,1,0,job->max);
+  } else {
+    /* store and unpacked string, interpret UTF-8 */
+    chars=fgets_cell(job->fp,job->cptr,-job->max,1);
+    assert((int)chars<-job->max);
+  } /* if */
+  free(job);
+  return (cell)chars;
+}
+
 /* fwrite(File: handle, const string[]) */
 static cell AMX_NATIVE_CALL n_fwrite(AMX *amx, const cell *params)
 {
-  size_t r = 0;
+  IOJOB *job;
   cell *cptr;
-  char *str;
   int len;
 
-  (void)amx;
   cptr=amx_Address(amx,params[2]);
   amx_StrLen(cptr,&len);
   if (len==0)
@@ -534,23 +577,26 @@ static cell AMX_NATIVE_CALL n_fwrite(AMX *amx, const cell *params)
 
   if ((ucell)*cptr>UNPACKEDMAX) {
     /* the string is packed, write it as an ASCII/ANSI string */
-    if ((str=(char*)alloca(len + 1))!=NULL) {
-      amx_GetString(str,cptr,0,len);
-      r=fputs(str,(FILE*)params[1]);
-    } /* if */
+    if ((job=(IOJOB*)malloc(sizeof(IOJOB)+len))==NULL)
+      return 0;
+    amx_GetString(job->str,cptr,0,len+1);
+    job->cptr=NULL;
   } else {
     /* the string is unpacked, write it as UTF-8 */
-    r=fputs_cell((FILE*)params[1],cptr,1);
+    if ((job=(IOJOB*)malloc(sizeof(IOJOB)))==NULL)
+      return 0;
+    job->cptr=cptr;
   } /* if */
-  return (cell)r;
+  job->fp=(FILE*)params[1];
+  job->max=len;
+  return amx_Async(amx,job_fwrite,job);
 }
 
 /* fread(File: handle, string[], size=sizeof string, bool:pack=false) */
 static cell AMX_NATIVE_CALL n_fread(AMX *amx, const cell *params)
 {
-  size_t chars;
   int max;
-  char *str;
+  IOJOB *job;
   cell *cptr;
 
   max=(int)params[3];
@@ -560,24 +606,16 @@ static cell AMX_NATIVE_CALL n_fread(AMX *amx, const cell *params)
     max*=sizeof(cell);
 
   cptr=amx_Address(amx,params[2]);
-  str=(char *)alloca(max);
-  if (str==NULL || cptr==NULL) {
+  job=(IOJOB*)malloc(sizeof(IOJOB)+(params[4] ? max : 0));
+  if (job==NULL || cptr==NULL) {
+    free(job);
     amx_RaiseError(amx, AMX_ERR_NATIVE);
     return 0;
   } /* if */
-
-  if (params[4]) {
-    /* store as packed string, read an ASCII/ANSI string */
-    chars=fgets_char((FILE*)params[1],str,max);
-    assert((int)chars<max);
-    amx_SetString(cptr,str,1,0,max);
-  } else {
-    /* store and unpacked string, interpret UTF-8 */
-    chars=fgets_cell((FILE*)params[1],cptr,max,1);
-  } /* if */
-
-  assert((int)chars<max);
-  return (cell)chars;
+  job->fp=(FILE*)params[1];
+  job->cptr=cptr;
+  job->max= params[4] ? max : -max;   /* negative for an unpacked string */
+  return amx_Async(amx,job_fread,job);
 }
 
 /* fputchar(File: handle, value, bool:utf8 = true) */
@@ -725,27 +763,43 @@ static cell AMX_NATIVE_CALL n_fremove(AMX *amx, const cell *params)
   return r==0;
 }
 
+typedef struct tagCOPYJOB {
+  TCHAR oldname[_MAX_PATH];
+  TCHAR newname[_MAX_PATH];
+} COPYJOB;
+
+static cell AMXAPI job_fcopy(void *data)
+{
+  COPYJOB *job=(COPYJOB*)data;
+  int r;
+
+  #if defined __WIN32__
+    r= CopyFile(job->oldname,job->newname,FALSE)==FALSE;
+  #else
+    TCHAR cmd[2*_MAX_PATH + 10];
+    sprintf(cmd,"cp %s %s",job->oldname,job->newname);
+    r= system(cmd)<0;
+  #endif
+  free(job);
+  return r==0;
+}
+
 /* bool: fcopy(const source[], const target[]) */
 static cell AMX_NATIVE_CALL n_fcopy(AMX *amx, const cell *params)
 {
-  int r=1;
-  TCHAR *name,oldname[_MAX_PATH],newname[_MAX_PATH];
+  TCHAR *name;
+  COPYJOB *job;
 
-  (void)amx;
+  if ((job=(COPYJOB*)malloc(sizeof(COPYJOB)))==NULL)
+    return 0;
   amx_StrParam(amx,params[1],name);
-  if (name!=NULL && completename(oldname,name,sizearray(oldname))!=NULL) {
+  if (name!=NULL && completename(job->oldname,name,sizearray(job->oldname))!=NULL) {
     amx_StrParam(amx,params[2],name);
-    if (name!=NULL && completename(newname,name,sizearray(newname))!=NULL) {
-      #if defined __WIN32__
-        r= CopyFile(oldname,newname,FALSE)==FALSE;
-      #else
-        TCHAR cmd[2*_MAX_PATH + 10];
-        sprintf(cmd,"cp %s %s",oldname,newname);
-        r= system(cmd)<0;
-      #endif
-    } /* if */
+    if (name!=NULL && completename(job->newname,name,sizearray(job->newname))!=NULL)
+      return amx_Async(amx,job_fcopy,job);
   } /* if */
-  return r==0;
+  free(job);
+  return 0;
 }
 
 /* bool: frename(const oldname[], const newname[]) */
@@ -23,17 +23,98 @@
 #include "amx.h"
 #include "amxgc.h"
 
+/* An incremental cycle detects the blocks of the data section that the script
+ * (or a native function) modified after their scan, by their checksums. With
+ * GC_PAGEGUARD defined (on POSIX systems), it write protects the pages of the
+ * data section after they are scanned instead, and it catches the writes in a
+ * handler for SIGSEGV. The host must then not replace that handler, and it
+ * must not pass memory of the abstract machine to a system call that writes
+ * into it (the call fails with EFAULT instead of raising a signal); so this
+ * does not combine with the asynchronous I/O of the event loop.
+ */
+#if defined GC_PAGEGUARD
+  #if defined __linux__ || defined __APPLE__ || defined __FreeBSD__ || defined __NetBSD__ || defined __OpenBSD__
+    #include <signal.h>
+    #include <stdint.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+  #else
+    #undef GC_PAGEGUARD
+  #endif
+#endif
+
+/* The scan of a section compares the cells against the range of the values in
+ * the table with SIMD instructions, when available, and probes the table only
+ * for the cells that are in range. SSE2 is used for 32-bit cells only, because
+ * it lacks a 64-bit compare (and the emulation is not faster than plain C).
+ * Define GC_NO_SIMD to use plain C only.
+ */
+#if !defined GC_NO_SIMD && (PAWN_CELL_SIZE==32 || PAWN_CELL_SIZE==64)
+  #if defined __AVX2__
+    #include <immintrin.h>
+    #define GC_AVX2
+  #elif PAWN_CELL_SIZE==32 && (defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP>=2))
+    #include <emmintrin.h>
+    #define GC_SSE2
+  #endif
+#endif
+
 typedef struct tagGCPAIR {
   cell value;
   int count;
 } GCPAIR;
 
-typedef struct tagGCINFO {
+typedef struct tagGCSUM {
+  ucell a,b;
+} GCSUM;
+
+struct tagGCINFO {
   GCPAIR *table;
   GC_FREE callback;
   int exponent;
   int flags;
-} GCINFO;
+  unsigned items;       /* number of values in the table */
+  unsigned deleted;     /* number of deleted entries in the table */
+  /* state of an incremental cycle, see gc_step_r() */
+  int phase;
+  AMX *amx;             /* abstract machine that the cycle scans */
+  cell *data;           /* data section of that abstract machine */
+  size_t position;      /* next block of the data section, or next table entry */
+  size_t datasize;      /* size of the data section in cells */
+  size_t blockcells;    /* size of a block in cells */
+  size_t skew;          /* cells that the first block lacks (for page alignment) */
+  size_t numblocks;
+  GCSUM *sums;          /* checksums of the blocks of the data section */
+  size_t maxblocks;     /* size of the "sums" array */
+  int passes;           /* passes of the re-check phase */
+  #if defined GC_PAGEGUARD
+    volatile unsigned char *dirty;  /* blocks written to since their scan */
+    unsigned char *guardbase;       /* first byte of the guarded pages */
+    size_t guardsize;
+    size_t guardblock;  /* block at "guardbase" */
+    size_t released;    /* guarded pages that are writable again (after the scan) */
+    int guardslot;      /* position in the list of guarded cycles plus 1, or 0 */
+  #endif
+  /* filters for the scan; the sweep builds new filters for the values that
+   * survive, because values cannot be removed from a filter */
+  unsigned char *filter;  /* bloom filter of the values in the table */
+  unsigned char *nextfilter;
+  int filterbits;       /* log2 of the number of bits in a filter */
+  ucell lowest,highest; /* range of the values in the table */
+  ucell nextlowest,nexthighest;
+};
+
+#define DELETED         (-1)    /* "count" of a deleted entry (its value is 0) */
+#define BLOCKCELLS      256     /* cells per block of the data section */
+#define RECHECKPASSES   4       /* maximum passes of the re-check phase */
+
+enum {
+  PHASE_IDLE,           /* no cycle in progress */
+  PHASE_DATA,           /* scanning the data section */
+  PHASE_RECHECK,        /* re-scanning the blocks that changed */
+  PHASE_FINAL,          /* heap, stack and the last changed blocks */
+  PHASE_SWEEP,          /* sweeping the table */
+};
 
 #define SHIFT1          (sizeof(cell)*4)
 #define MASK1           (~(((cell)-1) << SHIFT1))
@@ -49,6 +130,16 @@ typedef struct tagGCINFO {
                         /* call FOLD3(c) if the table size < MASK3 */
 #define MASK(exp)       (~(((cell)-1) << (exp)))
 
+#define CELLBITS        (int)(sizeof(cell)*8)
+#define SIGNBIT         ((ucell)1 << (CELLBITS-1))
+#if PAWN_CELL_SIZE==64
+  #define HASH1         ((ucell)0x9e3779b97f4a7c15ULL)
+  #define HASH2         ((ucell)0xc2b2ae3d27d4eb4fULL)
+#else
+  #define HASH1         ((ucell)0x9e3779b1UL)
+  #define HASH2         ((ucell)0x85ebca77UL)
+#endif
+
 static const unsigned increments[17] = {
   1, 1, 1, 3, 5, 7, 17, 31, 67, 127, 257,
   509, 1021, 2053, 4099, 8191, 16381 };
@@ -72,253 +163,971 @@ static const unsigned char inverse[256] = {
    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0
 };
 
-static GCINFO SharedGC;
+static GCINFO SharedGC;   /* context for the non-re-entrant functions */
 
+#if defined GC_PAGEGUARD
+  static void unguard(GCINFO *gc);
+#endif
 
-int gc_setcallback(GC_FREE callback)
+
+static unsigned firstslot(const GCINFO *gc,cell value)
+{
+  cell v;
+  unsigned char *minorbyte;
+
+  /* first "fold" the value, to make maximum use of all bits */
+  v=value;
+  if (gc->exponent<SHIFT1)
+    v=FOLD1(v);
+  if (gc->exponent<SHIFT2)
+    v=FOLD2(v);
+  if (gc->exponent<SHIFT3)
+    v=FOLD3(v);
+  /* swap the bits of the minor byte */
+  minorbyte=(unsigned char*)&v;
+  *minorbyte=inverse[*minorbyte];
+  /* truncate the value to the required number of bits */
+  return (unsigned)(v & MASK(gc->exponent));
+}
+
+static unsigned firstincrement(const GCINFO *gc)
+{
+  unsigned incridx= (gc->exponent<sizeof increments / sizeof increments[0]) ?
+                       gc->exponent :
+                       (sizeof increments / sizeof increments[0]) - 1;
+  assert(incridx<sizeof increments / sizeof increments[0]);
+  return incridx;
+}
+
+static void setfilter(unsigned char *filter,int bits,ucell value)
+{
+  unsigned bit1=(unsigned)((ucell)(value*HASH1) >> (CELLBITS-bits));
+  unsigned bit2=(unsigned)((ucell)(value*HASH2) >> (CELLBITS-bits));
+  filter[bit1>>3] |= (unsigned char)(1 << (bit1 & 7));
+  filter[bit2>>3] |= (unsigned char)(1 << (bit2 & 7));
+}
+
+static int testfilter(const unsigned char *filter,int bits,ucell value)
+{
+  unsigned bit1=(unsigned)((ucell)(value*HASH1) >> (CELLBITS-bits));
+  unsigned bit2=(unsigned)((ucell)(value*HASH2) >> (CELLBITS-bits));
+  return (filter[bit1>>3] & (1 << (bit1 & 7)))!=0
+         && (filter[bit2>>3] & (1 << (bit2 & 7)))!=0;
+}
+
+static void addfilter(GCINFO *gc,cell value)
+{
+  setfilter(gc->filter,gc->filterbits,(ucell)value);
+  if ((ucell)value<gc->lowest)
+    gc->lowest=(ucell)value;
+  if ((ucell)value>gc->highest)
+    gc->highest=(ucell)value;
+}
+
+static void addnextfilter(GCINFO *gc,cell value)
+{
+  setfilter(gc->nextfilter,gc->filterbits,(ucell)value);
+  if ((ucell)value<gc->nextlowest)
+    gc->nextlowest=(ucell)value;
+  if ((ucell)value>gc->nexthighest)
+    gc->nexthighest=(ucell)value;
+}
+
+/* swapfilter() replaces the filters by the ones that a complete sweep built */
+static void swapfilter(GCINFO *gc)
+{
+  unsigned char *filter=gc->filter;
+  gc->filter=gc->nextfilter;
+  gc->nextfilter=filter;
+  memset(gc->nextfilter,0,(size_t)1 << (gc->filterbits-3));
+  gc->lowest=gc->nextlowest;
+  gc->highest=gc->nexthighest;
+  gc->nextlowest=~(ucell)0;
+  gc->nexthighest=0;
+}
+
+/* insert() adds a value to the table, which must have a free entry. It skips
+ * deleted entries while looking for a duplicate, but it re-uses the first
+ * deleted entry that it passed.
+ */
+static int insert(GCINFO *gc,cell value,int count)
+{
+  unsigned index,incr,incridx,mask;
+  int slot;
+  cell t;
+
+  assert(gc->table!=NULL);
+  assert(value!=0);
+  assert(gc->items+gc->deleted<(1U<<gc->exponent));
+  mask=MASK(gc->exponent);
+  index=firstslot(gc,value);
+  incridx=firstincrement(gc);
+  incr=increments[incridx];
+  slot=-1;
+  while ((t=gc->table[index].value)!=0 || gc->table[index].count==DELETED) {
+    if (t==value)
+      return GC_ERR_DUPLICATE;
+    if (t==0 && slot<0)
+      slot=(int)index;
+    assert(incr>0);
+    index=(index+incr) & mask;
+    if (incridx>0)
+      incr=increments[--incridx];
+  } /* while */
+
+  if (slot>=0) {
+    index=(unsigned)slot;
+    gc->deleted--;
+  } /* if */
+  gc->table[index].value=value;
+  gc->table[index].count=count;
+  gc->items++;
+  addfilter(gc,value);
+  if (gc->phase==PHASE_SWEEP)
+    addnextfilter(gc,value);
+  return GC_ERR_NONE;
+}
+
+static void sweep(GCINFO *gc,unsigned first,unsigned last)
+{
+  GCPAIR *item;
+
+  assert(gc->callback!=NULL);
+  for (item=gc->table+first; first<last; first++,item++) {
+    if (item->value!=0) {
+      if (item->count==0) {
+        gc->callback(item->value);
+        item->value=0;
+        item->count=DELETED;
+        gc->items--;
+        gc->deleted++;
+      } else {
+        item->count=0;
+        addnextfilter(gc,item->value);
+      } /* if */
+    } /* if */
+  } /* for */
+}
+
+/* rehash() moves all values to a new table, with their counts, and drops the
+ * deleted entries. A sweep that is in progress is completed first, because
+ * the values move to other positions.
+ */
+static int rehash(GCINFO *gc,int exponent)
 {
-  SharedGC.callback=callback;
+  unsigned size,oldsize,index;
+  GCPAIR *table,*oldtable;
+  unsigned char *filter,*nextfilter;
+  int filterbits;
+
+  if (exponent<7 || (1UL<<exponent)>INT_MAX)
+    return GC_ERR_PARAMS;
+  /* the hash table must keep at least one free entry */
+  size=(1<<exponent);
+  if (gc->items>=size)
+    return GC_ERR_PARAMS; /* new table is too small */
+  /* allocate the new table, and filters with 8 bits per entry */
+  filterbits=(exponent+3<CELLBITS) ? exponent+3 : CELLBITS;
+  table=malloc(size*sizeof(*table));
+  filter=malloc((size_t)1 << (filterbits-3));
+  nextfilter=malloc((size_t)1 << (filterbits-3));
+  if (table==NULL || filter==NULL || nextfilter==NULL) {
+    if (table!=NULL)
+      free(table);
+    if (filter!=NULL)
+      free(filter);
+    if (nextfilter!=NULL)
+      free(nextfilter);
+    return GC_ERR_MEMORY;
+  } /* if */
+  memset(table,0,size*sizeof(*table));
+  memset(filter,0,(size_t)1 << (filterbits-3));
+  memset(nextfilter,0,(size_t)1 << (filterbits-3));
+
+  if (gc->phase==PHASE_SWEEP) {
+    sweep(gc,(unsigned)gc->position,1U<<gc->exponent);
+    gc->phase=PHASE_IDLE;
+  } /* if */
+  if (gc->filter!=NULL)
+    free(gc->filter);
+  if (gc->nextfilter!=NULL)
+    free(gc->nextfilter);
+  gc->filter=filter;
+  gc->nextfilter=nextfilter;
+  gc->filterbits=filterbits;
+  gc->lowest=gc->nextlowest=~(ucell)0;
+  gc->highest=gc->nexthighest=0;
+  oldtable=gc->table;
+  oldsize=(1<<gc->exponent);
+  gc->table=table;
+  gc->exponent=exponent;
+  gc->items=0;
+  gc->deleted=0;
+  if (oldtable!=NULL) {
+    for (index=0; index<oldsize; index++)
+      if (oldtable[index].value!=0)
+        insert(gc,oldtable[index].value,oldtable[index].count);
+    free(oldtable);
+  } /* if */
+  return GC_ERR_NONE;
+}
+
+int gc_create(GCINFO **gc)
+{
+  if (gc==NULL)
+    return GC_ERR_PARAMS;
+  *gc=(GCINFO*)malloc(sizeof(GCINFO));
+  if (*gc==NULL)
+    return GC_ERR_MEMORY;
+  memset(*gc,0,sizeof(GCINFO));
   return GC_ERR_NONE;
 }
 
-int gc_settable(int exponent, int flags)
+int gc_delete(GCINFO *gc)
+{
+  if (gc==NULL)
+    return GC_ERR_PARAMS;
+  if (gc->callback!=NULL)
+    gc_clean_r(gc);     /* delete all "live" objects first */
+  if (gc->table!=NULL)
+    free(gc->table);
+  #if defined GC_PAGEGUARD
+    unguard(gc);
+    if (gc->dirty!=NULL)
+      free((void*)gc->dirty);
+  #endif
+  if (gc->sums!=NULL)
+    free(gc->sums);
+  if (gc->filter!=NULL)
+    free(gc->filter);
+  if (gc->nextfilter!=NULL)
+    free(gc->nextfilter);
+  free(gc);
+  return GC_ERR_NONE;
+}
+
+int gc_setcallback_r(GCINFO *gc,GC_FREE callback)
+{
+  gc->callback=callback;
+  return GC_ERR_NONE;
+}
+
+int gc_settable_r(GCINFO *gc,int exponent,int flags)
 {
   if (exponent==0) {
-    gc_clean();         /* delete all "live" objects first */
-    if (SharedGC.table!=NULL) {
-      free(SharedGC.table);
-      SharedGC.table=NULL;
+    gc_clean_r(gc);         /* delete all "live" objects first */
+    if (gc->table!=NULL) {
+      free(gc->table);
+      gc->table=NULL;
     } /* if */
-    SharedGC.exponent=0;
-    SharedGC.flags=0;
-  } else {
-    unsigned size,oldsize,total,index;
-    GCPAIR *table,*oldtable;
-
-    if (exponent<7 || (1UL<<exponent)>INT_MAX)
-      return GC_ERR_PARAMS;
-    /* save the statistics of the old table */
-    oldtable=SharedGC.table;
-    oldsize=(1<<SharedGC.exponent);
-    total=0;
-    if (oldtable!=NULL) {
-      for (index=0; index<oldsize; index++)
-        if (oldtable[index].value!=0 && oldtable[index].count!=0)
-          total+=1;
-    }
-    /* the hash table should not hold more elements than the new size */
-    size=(1<<exponent);
-    if (total>size)
-      return GC_ERR_PARAMS; /* new table is too small */
-    /* allocate the new table */
-    table=malloc(size*sizeof(*table));
-    if (table==NULL)
-      return GC_ERR_MEMORY;
-    /* clear and set the new table */
-    memset(table,0,size*sizeof(*table));
-    SharedGC.table=table;
-    SharedGC.exponent=exponent;
-    SharedGC.flags=flags;
-    /* re-mark all objects in the old table */
-    if (oldtable!=NULL) {
-      for (index=0; index<oldsize; index++)
-        if (oldtable[index].value!=0 && oldtable[index].count!=0)
-          gc_mark(oldtable[index].value);
-      free(oldtable);
+    if (gc->sums!=NULL) {
+      free(gc->sums);
+      gc->sums=NULL;
+    } /* if */
+    if (gc->filter!=NULL) {
+      free(gc->filter);
+      free(gc->nextfilter);
+      gc->filter=gc->nextfilter=NULL;
     } /* if */
+    gc->maxblocks=0;
+    gc->exponent=0;
+    gc->flags=0;
+    gc->items=0;
+    gc->deleted=0;
+    gc->phase=PHASE_IDLE;
+  } else {
+    int err=rehash(gc,exponent);
+    if (err!=GC_ERR_NONE)
+      return err;
+    gc->flags=flags;
   } /* if */
   return GC_ERR_NONE;
 }
 
-int gc_tablestat(int *exponent,int *percentage)
+int gc_tablestat_r(GCINFO *gc,int *exponent,int *percentage)
 {
   if (exponent!=NULL)
-    *exponent=SharedGC.exponent;
+    *exponent=gc->exponent;
   if (percentage!=NULL) {
-    unsigned size=(1L<<SharedGC.exponent);
-    /* calculate with floating point to avoid integer overflow */
-    unsigned total=0;
-    if (SharedGC.table!=NULL) {
-      unsigned index;
-      for (index=0; index<size; index++)
-        if (SharedGC.table[index].value!=0 && SharedGC.table[index].count!=0)
-          total+=1;
-    }
+    unsigned size=(gc->table!=NULL) ? (1U<<gc->exponent) : 0;
     if (size>0) {
-      double p = 100.0 * total / size;
+      /* calculate with floating point to avoid integer overflow */
+      double p = 100.0 * gc->items / size;
       *percentage=(int)(p+0.5);
     } else {
-      *percentage=0.0;
+      *percentage=0;
     }
   } /* if */
   return GC_ERR_NONE;
 }
 
-int gc_mark(cell value)
+int gc_mark_r(GCINFO *gc,cell value)
 {
-  unsigned size,total,index,incr,incridx,mask;
-  cell v,t;
-  unsigned char *minorbyte;
+  unsigned size,limit;
 
-  if (SharedGC.table==NULL)
+  if (gc->table==NULL)
     return GC_ERR_INIT;
-  size=1<<SharedGC.exponent;
-  total=0;
-  for (index=0; index<size; index++)
-    if (SharedGC.table[index].value!=0 && SharedGC.table[index].count!=0)
-      total+=1;
-  if (total>=size) {
+  if (value==0)
+    return GC_ERR_PARAMS;
+  size=1<<gc->exponent;
+  /* with GC_AUTOGROW, the table is resized before the chains get long */
+  limit=((gc->flags & GC_AUTOGROW)!=0) ? size-size/4 : size-1;
+  if (gc->items+gc->deleted>=limit) {
+    /* grow the table, or rebuild it at the same size if it holds many deleted
+     * entries (the table must always keep a free entry)
+     */
+    int exponent=gc->exponent;
     int err;
-    if ((SharedGC.flags & GC_AUTOGROW)==0)
+    if (gc->items>=size/2 && (gc->flags & GC_AUTOGROW)!=0)
+      exponent++;
+    else if (gc->items+1>=size)
       return GC_ERR_TABLEFULL;
-    err=gc_settable(SharedGC.exponent+1,SharedGC.flags);
+    err=rehash(gc,exponent);
     if (err!=GC_ERR_NONE)
       return err;
   } /* if */
-  assert(total<(1<<SharedGC.exponent));
 
-  /* first "fold" the value, to make maximum use of all bits */
-  v=value;
-  if (SharedGC.exponent<SHIFT1)
-    v=FOLD1(v);
-  if (SharedGC.exponent<SHIFT2)
-    v=FOLD2(v);
-  if (SharedGC.exponent<SHIFT3)
-    v=FOLD3(v);
-  /* swap the bits of the minor byte */
-  minorbyte=(unsigned char*)&v;
-  *minorbyte=inverse[*minorbyte];
-  /* truncate the value to the required number of bits */
-  mask=MASK(SharedGC.exponent);
-  index=(v & mask);
+  /* a value that is marked during a cycle may already have been stored in a
+   * part of the abstract machine that the cycle has scanned; it is kept
+   * until the next cycle
+   */
+  return insert(gc,value,(gc->phase!=PHASE_IDLE) ? 1 : 0);
+}
 
-  incridx= (SharedGC.exponent<sizeof increments / sizeof increments[0]) ?
-              SharedGC.exponent :
-              (sizeof increments / sizeof increments[0]) - 1;
-  assert(incridx<sizeof increments / sizeof increments[0]);
+/* probe() looks up a cell that passed the range filter, and increments its
+ * count if it is in the table
+ */
+static void probe(GCINFO *gc,cell value)
+{
+  unsigned index,incr,incridx,mask,tablesize;
+  cell t;
+
+  if (!testfilter(gc->filter,gc->filterbits,(ucell)value))
+    return;
+  index=firstslot(gc,value);
+  mask=MASK(gc->exponent);
+
+  /* find it in the table (skipping deleted entries) */
+  tablesize=1<<gc->exponent;
+  incridx=firstincrement(gc);
   incr=increments[incridx];
-  while ((t=SharedGC.table[index].value)!=0 && t!=value) {
+  while ((t=gc->table[index].value)!=value
+         && (t!=0 || gc->table[index].count==DELETED) && tablesize>0)
+  {
     assert(incr>0);
     index=(index+incr) & mask;
     if (incridx>0)
       incr=increments[--incridx];
+    tablesize--;
   } /* while */
 
-  if (t!=0) {
-    assert(t==value);
-    assert(SharedGC.table[index].value==value);
-    return GC_ERR_DUPLICATE;
-  } /* if */
+  /* if found, mark it */
+  if (t==value)
+    gc->table[index].count+=1;
+}
 
-  SharedGC.table[index].value=value;
-  assert(SharedGC.table[index].count==0);
+#if defined GC_AVX2 || defined GC_SSE2
+#if defined GC_AVX2
+  typedef __m256i VCELL;
+  #define VLOAD(p)      _mm256_loadu_si256((const __m256i*)(p))
+  #define VAND(a,b)     _mm256_and_si256((a),(b))
+  #define VXOR(a,b)     _mm256_xor_si256((a),(b))
+  #if PAWN_CELL_SIZE==64
+    #define VSET(c)     _mm256_set1_epi64x((long long)(c))
+    #define VSUB(a,b)   _mm256_sub_epi64((a),(b))
+    #define VGT(a,b)    _mm256_cmpgt_epi64((a),(b))
+    #define VMASK(a)    _mm256_movemask_pd(_mm256_castsi256_pd(a))
+  #else
+    #define VSET(c)     _mm256_set1_epi32((int)(c))
+    #define VSUB(a,b)   _mm256_sub_epi32((a),(b))
+    #define VGT(a,b)    _mm256_cmpgt_epi32((a),(b))
+    #define VMASK(a)    _mm256_movemask_ps(_mm256_castsi256_ps(a))
+  #endif
+#else
+  typedef __m128i VCELL;
+  #define VLOAD(p)      _mm_loadu_si128((const __m128i*)(p))
+  #define VAND(a,b)     _mm_and_si128((a),(b))
+  #define VXOR(a,b)     _mm_xor_si128((a),(b))
+  #define VSET(c)       _mm_set1_epi32((int)(c))
+  #define VSUB(a,b)     _mm_sub_epi32((a),(b))
+  #define VGT(a,b)      _mm_cmpgt_epi32((a),(b))
+  #define VMASK(a)      _mm_movemask_ps(_mm_castsi128_ps(a))
+#endif
+#define VLANES          (int)(sizeof(VCELL)/sizeof(cell))
 
-  return GC_ERR_NONE;
+/* scanvector() scans groups of four vectors; a cell is in range if
+ * (cell - lowest) <= (highest - lowest) as unsigned values, which is a signed
+ * compare after flipping the sign bits. It returns the number of cells that
+ * it scanned; the caller scans the remaining cells.
+ */
+static size_t scanvector(GCINFO *gc,const cell *start,size_t size)
+{
+  const VCELL bias=VSET(SIGNBIT);
+  const VCELL lowest=VSET(gc->lowest);
+  const VCELL span=VSET((gc->highest-gc->lowest)^SIGNBIT);
+  const int all=(1 << VLANES)-1;
+  VCELL out[4];
+  size_t i;
+  int k,lane,mask;
+
+  for (i=0; i+4*VLANES<=size; i+=4*VLANES) {
+    for (k=0; k<4; k++)
+      out[k]=VGT(VXOR(VSUB(VLOAD(start+i+k*VLANES),lowest),bias),span);
+    if (VMASK(VAND(VAND(out[0],out[1]),VAND(out[2],out[3])))==all)
+      continue;         /* all cells are out of range */
+    for (k=0; k<4; k++) {
+      mask=VMASK(out[k]);
+      for (lane=0; lane<VLANES; lane++)
+        if ((mask & (1 << lane))==0)
+          probe(gc,start[i+k*VLANES+lane]);
+    } /* for */
+  } /* for */
+  return i;
 }
+#endif
 
-static void scansection(cell *start,size_t size)
+static void scansection(GCINFO *gc,cell *start,size_t size)
 {
-  unsigned index,incr,incridx,incridx_org,mask,tablesize;
-  cell v,t;
-  unsigned char *minorbyte;
+  ucell lowest,span;
+  size_t i;
 
-  assert(SharedGC.table!=NULL);
+  assert(gc->table!=NULL);
   assert((size % sizeof(cell))==0);
   assert(start!=NULL);
   size/=sizeof(cell); /* from number of bytes to number of cells */
+  if (gc->items==0)
+    return;
 
-  incridx_org= (SharedGC.exponent<sizeof increments / sizeof increments[0]) ?
-                  SharedGC.exponent :
-                  (sizeof increments / sizeof increments[0]) - 1;
-  assert(incridx_org<sizeof increments / sizeof increments[0]);
-
-  minorbyte=(unsigned char*)&v;
-  mask=MASK(SharedGC.exponent);
-
-  while (size>0) {
-    v=*start;
-    /* first "fold" the value, to make maximum use of all bits */
-    if (SharedGC.exponent<SHIFT1)
-      v=FOLD1(v);
-    if (SharedGC.exponent<SHIFT2)
-      v=FOLD2(v);
-    if (SharedGC.exponent<SHIFT3)
-      v=FOLD3(v);
-    /* swap the bits of the minor byte */
-    assert(minorbyte==(unsigned char*)&v);
-    *minorbyte=inverse[*minorbyte];
-    /* truncate the value to the required number of bits */
-    index=(v & mask);
-
-    /* find it in the table */
-    tablesize=1<<SharedGC.exponent;
-    incridx=incridx_org;
-    incr=increments[incridx];
-    while ((t=SharedGC.table[index].value)!=*start && t!=0 && tablesize>0) {
-      assert(incr>0);
-      index=(index+incr) & mask;
-      if (incridx>0)
-        incr=increments[--incridx];
-      tablesize--;
-    } /* while */
-
-    /* if found, mark it */
-    if (t!=0) {
-      assert(t==*start);
-      assert(SharedGC.table[index].value==*start);
-      SharedGC.table[index].count+=1;
-    } /* if */
-
-    size--;
-    start++;
-  } /* while */
+  /* the range excludes zero, because zero is never a value in the table */
+  lowest=gc->lowest;
+  span=gc->highest-gc->lowest;
+  assert(lowest>0 && gc->highest>=lowest);
+  i=0;
+  #if defined GC_AVX2 || defined GC_SSE2
+    i=scanvector(gc,start,size);
+  #endif
+  for ( ; i<size; i++)
+    if ((ucell)start[i]-lowest<=span)
+      probe(gc,start[i]);
 }
 
-int gc_scan(AMX *amx)
+int gc_scan_r(GCINFO *gc,AMX *amx)
 {
   AMX_HEADER *hdr;
   unsigned char *data;
 
   if (amx==NULL)
     return GC_ERR_PARAMS;
-  if (SharedGC.table==NULL)
+  if (gc->table==NULL)
     return GC_ERR_INIT;
 
   hdr=(AMX_HEADER*)amx->base;
 
   /* scan data segment */
   data=amx->data ? amx->data : amx->base+(int)hdr->dat;
-  scansection((cell *)data, hdr->hea - hdr->dat);
-  /* scan stack */
-  scansection((cell *)(data + amx->hlw), amx->hea - amx->hlw);
+  scansection(gc,(cell *)data, hdr->hea - hdr->dat);
   /* scan heap */
-  scansection((cell *)(data + amx->stk), amx->stp - amx->stk);
+  scansection(gc,(cell *)(data + amx->hlw), amx->hea - amx->hlw);
+  /* scan stack */
+  scansection(gc,(cell *)(data + amx->stk), amx->stp - amx->stk);
 
   return GC_ERR_NONE;
 }
 
-int gc_clean(void)
+static GCSUM checksum(const cell *block,size_t size)
 {
-  int size;
-  GCPAIR *item;
+  GCSUM sum;
+
+  sum.a=(ucell)2166136261UL;
+  sum.b=0;
+  while (size-->0) {
+    sum.a=(sum.a ^ (ucell)*block)*(ucell)16777619UL;
+    sum.b=(sum.b+(ucell)*block)*(ucell)2654435761UL;
+    block++;
+  } /* while */
+  return sum;
+}
+
+#if defined GC_PAGEGUARD
+/* While a cycle is in progress, the pages of the data section that were
+ * scanned are write-protected. The first write to such a page raises SIGSEGV;
+ * the handler marks the block as dirty and lifts the protection of the page,
+ * after which the write is retried. The handler looks up the address in the
+ * cycles that have guarded pages; it passes faults at other addresses on to
+ * the handler that was installed before it.
+ */
+#define GUARDSLOTS      64
+
+static GCINFO *volatile guardlist[GUARDSLOTS];
+static volatile int guardstate; /* 0=handler not installed, 1=busy, 2=installed */
+static struct sigaction oldaction;
+static size_t pagesize;
+
+static void guardhandler(int sig,siginfo_t *info,void *context)
+{
+  unsigned char *addr=(unsigned char*)info->si_addr;
+  int slot,found=0;
+
+  for (slot=0; slot<GUARDSLOTS; slot++) {
+    GCINFO *gc=guardlist[slot];
+    if (gc!=NULL && addr>=gc->guardbase && addr<gc->guardbase+gc->guardsize) {
+      size_t page=(size_t)(addr-gc->guardbase)/pagesize;
+      gc->dirty[gc->guardblock+page]=1;
+      mprotect(gc->guardbase+page*pagesize,pagesize,PROT_READ|PROT_WRITE);
+      found=1;
+    } /* if */
+  } /* for */
+  if (found)
+    return;
+  if ((oldaction.sa_flags & SA_SIGINFO)!=0) {
+    oldaction.sa_sigaction(sig,info,context);
+  } else if (oldaction.sa_handler!=SIG_DFL && oldaction.sa_handler!=SIG_IGN) {
+    oldaction.sa_handler(sig);
+  } else {
+    /* restore the default action; the instruction faults again on return */
+    signal(sig,SIG_DFL);
+  } /* if */
+}
+
+/* guard() sets up the blocks of a new cycle so that the blocks that fill a
+ * page are write-protected after they are scanned; it returns 0 if the pages
+ * cannot be guarded (the cycle then uses checksums only)
+ */
+static int guard(GCINFO *gc)
+{
+  uintptr_t start,first,last;
+  size_t blockcells,skew,numblocks;
+  volatile unsigned char *dirty;
+  int slot;
+
+  if (guardstate!=2) {
+    if (__sync_bool_compare_and_swap(&guardstate,0,1)) {
+      struct sigaction action;
+      long size=sysconf(_SC_PAGESIZE);
+      memset(&action,0,sizeof action);
+      action.sa_sigaction=guardhandler;
+      action.sa_flags=SA_SIGINFO | SA_RESTART;
+      sigemptyset(&action.sa_mask);
+      if (size<=0 || (size % sizeof(cell))!=0 || sigaction(SIGSEGV,&action,&oldaction)!=0) {
+        guardstate=0;
+        return 0;
+      } /* if */
+      pagesize=(size_t)size;
+      __sync_synchronize();
+      guardstate=2;
+    } /* if */
+    if (guardstate!=2)
+      return 0;
+  } /* if */
+
+  start=(uintptr_t)gc->data;
+  if ((start % sizeof(cell))!=0)
+    return 0;
+  first=(start+pagesize-1) & ~(uintptr_t)(pagesize-1);
+  last=(start+gc->datasize*sizeof(cell)) & ~(uintptr_t)(pagesize-1);
+  if (last<=first)
+    return 0;             /* the data section does not fill a page */
+  blockcells=pagesize/sizeof(cell);
+  skew=(blockcells-(size_t)(first-start)/sizeof(cell)) % blockcells;
+  numblocks=(gc->datasize+skew+blockcells-1)/blockcells;
+  if ((dirty=(volatile unsigned char*)calloc(numblocks,1))==NULL)
+    return 0;
+  /* the handler may look at the fields as soon as the cycle is in the list */
+  gc->blockcells=blockcells;
+  gc->skew=skew;
+  gc->numblocks=numblocks;
+  gc->dirty=dirty;
+  gc->guardblock=(skew>0) ? 1 : 0;
+  gc->guardbase=(unsigned char*)first;
+  gc->guardsize=(size_t)(last-first);
+  gc->released=0;
+  __sync_synchronize();
+  for (slot=0; slot<GUARDSLOTS; slot++)
+    if (__sync_bool_compare_and_swap(&guardlist[slot],NULL,gc))
+      break;
+  if (slot>=GUARDSLOTS) {
+    free((void*)dirty);
+    gc->dirty=NULL;
+    return 0;
+  } /* if */
+  gc->guardslot=slot+1;
+  return 1;
+}
+
+/* release() lifts the write protection of the guarded pages below "limit";
+ * when the scan is complete, the sweep releases the pages in slices, because
+ * a single call for all pages is slow when the script wrote to many of them
+ * (the writable pages split the mapping)
+ */
+static void release(GCINFO *gc,size_t limit)
+{
+  if (gc->guardslot==0 || limit<=gc->released)
+    return;
+  mprotect(gc->guardbase+gc->released*pagesize,(limit-gc->released)*pagesize,PROT_READ|PROT_WRITE);
+  gc->released=limit;
+}
+
+/* unguard() lifts the write protection of the data section and removes the
+ * cycle from the list; the dirty flags remain valid until the next cycle
+ */
+static void unguard(GCINFO *gc)
+{
+  if (gc->guardslot==0)
+    return;
+  release(gc,gc->guardsize/pagesize);
+  __sync_synchronize();
+  guardlist[gc->guardslot-1]=NULL;
+  gc->guardslot=0;
+}
+
+static int isguarded(const GCINFO *gc,size_t block)
+{
+  return gc->dirty!=NULL && block>=gc->guardblock
+         && block<gc->guardblock+gc->guardsize/pagesize;
+}
+
+/* protect() write-protects the guarded blocks in the range; blocks of which
+ * the protection fails stay dirty
+ */
+static void protect(GCINFO *gc,size_t first,size_t last)
+{
+  size_t block,guardlast;
+
+  if (gc->guardslot==0)
+    return;
+  guardlast=gc->guardblock+gc->guardsize/pagesize;
+  if (first<gc->guardblock)
+    first=gc->guardblock;
+  if (last>guardlast)
+    last=guardlast;
+  if (first>=last)
+    return;
+  for (block=first; block<last; block++)
+    gc->dirty[block]=0;
+  __sync_synchronize();
+  if (mprotect(gc->guardbase+(first-gc->guardblock)*pagesize,(last-first)*pagesize,PROT_READ)!=0)
+    for (block=first; block<last; block++)
+      gc->dirty[block]=1;
+}
+#endif
 
-  if (SharedGC.table==NULL)
+static int guarding(const GCINFO *gc)
+{
+  #if defined GC_PAGEGUARD
+    return gc->guardslot!=0;
+  #else
+    (void)gc;
+    return 0;
+  #endif
+}
+
+/* dirtycells() returns the number of cells in the guarded blocks that must be
+ * scanned again */
+static size_t dirtycells(const GCINFO *gc)
+{
+  #if defined GC_PAGEGUARD
+    size_t block,count=0;
+    if (gc->dirty==NULL)
+      return 0;
+    for (block=0; block<gc->numblocks; block++)
+      if (gc->dirty[block])
+        count++;
+    return count*gc->blockcells;
+  #else
+    (void)gc;
+    return 0;
+  #endif
+}
+
+static size_t blockstart(const GCINFO *gc,size_t block)
+{
+  size_t start=block*gc->blockcells;
+  return (start>gc->skew) ? start-gc->skew : 0;
+}
+
+static size_t blockend(const GCINFO *gc,size_t block)
+{
+  size_t end=(block+1)*gc->blockcells-gc->skew;
+  return (end<gc->datasize) ? end : gc->datasize;
+}
+
+/* record() notes the state of a block right before it is scanned: a guarded
+ * block becomes read-only, the other blocks get a checksum
+ */
+static void record(GCINFO *gc,size_t block)
+{
+  #if defined GC_PAGEGUARD
+    if (isguarded(gc,block))
+      return;   /* protect() handles guarded blocks */
+  #endif
+  gc->sums[block]=checksum(gc->data+blockstart(gc,block),blockend(gc,block)-blockstart(gc,block));
+}
+
+/* changed() returns whether a block was (possibly) modified since its scan */
+static int changed(GCINFO *gc,size_t block)
+{
+  GCSUM sum;
+
+  #if defined GC_PAGEGUARD
+    if (isguarded(gc,block))
+      return gc->dirty[block]!=0;
+  #endif
+  sum=checksum(gc->data+blockstart(gc,block),blockend(gc,block)-blockstart(gc,block));
+  return sum.a!=gc->sums[block].a || sum.b!=gc->sums[block].b;
+}
+
+static void scanblock(GCINFO *gc,size_t block)
+{
+  size_t start=blockstart(gc,block);
+  scansection(gc,gc->data+start,(blockend(gc,block)-start)*sizeof(cell));
+}
+
+/* collect() continues the scan of an incremental cycle (see gc_step_r()) until
+ * it has used up the budget, or until the scan is complete; it returns the
+ * remaining budget
+ */
+static long collect(GCINFO *gc,long budget)
+{
+  AMX *amx=gc->amx;
+  long slice=budget;
+  size_t block,last,cost;
+
+  assert(gc->phase==PHASE_DATA || gc->phase==PHASE_RECHECK || gc->phase==PHASE_FINAL);
+  assert(amx!=NULL);
+
+  if (gc->phase==PHASE_DATA) {
+    /* find the blocks that fit in the budget, protect these, then scan them */
+    last=gc->position;
+    cost=0;
+    while (last<gc->numblocks && cost<(size_t)budget) {
+      cost+=blockend(gc,last)-blockstart(gc,last);
+      last++;
+    } /* while */
+    #if defined GC_PAGEGUARD
+      protect(gc,gc->position,last);
+    #endif
+    for (block=gc->position; block<last; block++) {
+      record(gc,block);
+      scanblock(gc,block);
+    } /* for */
+    gc->position=last;
+    budget=(cost<(size_t)budget) ? budget-(long)cost : 0;
+    if (gc->position<gc->numblocks)
+      return 0;
+    gc->position=0;
+    gc->passes=0;
+    gc->phase=PHASE_RECHECK;
+  } /* if */
+
+  while (gc->phase==PHASE_RECHECK) {
+    /* re-scan the blocks that changed since their scan, in passes, until the
+     * blocks that are left fit in a slice (or for a maximum number of passes;
+     * a script that writes to more pages in a slice than the budget can scan
+     * does not let the phase converge)
+     */
+    while (gc->position<gc->numblocks && budget>0) {
+      block=gc->position++;
+      cost=blockend(gc,block)-blockstart(gc,block);
+      if (changed(gc,block)) {
+        #if defined GC_PAGEGUARD
+          protect(gc,block,block+1);
+        #endif
+        record(gc,block);
+        scanblock(gc,block);
+        budget-=(long)cost;
+      } else {
+        #if defined GC_PAGEGUARD
+          if (isguarded(gc,block))
+            cost=1;       /* only the dirty flag was checked */
+        #endif
+        budget-=(long)cost;
+      } /* if */
+    } /* while */
+    if (gc->position<gc->numblocks)
+      return 0;
+    gc->passes++;
+    if (guarding(gc) && gc->passes<RECHECKPASSES && dirtycells(gc)>(size_t)slice) {
+      gc->position=0;
+    } else {
+      gc->phase=PHASE_FINAL;
+    } /* if */
+  } /* while */
+  if (budget<=0)
+    return 0;
+
+  /* scan the heap and the stack (these change on every call), and re-scan the
+   * blocks that changed since the last check; without the write protection,
+   * the changes can only be found from the checksums of all blocks
+   */
+  assert(gc->phase==PHASE_FINAL);
+  scansection(gc,(cell*)((unsigned char*)gc->data+amx->hlw),amx->hea-amx->hlw);
+  scansection(gc,(cell*)((unsigned char*)gc->data+amx->stk),amx->stp-amx->stk);
+  for (block=0; block<gc->numblocks; block++)
+    if (changed(gc,block))
+      scanblock(gc,block);
+  gc->position=0;
+  gc->phase=PHASE_SWEEP;
+  return budget;
+}
+
+int gc_clean_r(GCINFO *gc)
+{
+  if (gc->table==NULL)
     return GC_ERR_INIT;
-  if (SharedGC.callback==NULL)
+  if (gc->callback==NULL)
     return GC_ERR_CALLBACK;
 
-  size=(1<<SharedGC.exponent);
-  item=SharedGC.table;
-  while (size>0) {
-    if (item->value!=0) {
-      if (item->count==0) {
-        SharedGC.callback(item->value);
-        item->value=0;
+  /* this also ends an incremental cycle: a pending scan is completed first,
+   * and when that cycle is sweeping, the entries that it swept already must
+   * not be swept again */
+  if (gc->phase==PHASE_DATA || gc->phase==PHASE_RECHECK || gc->phase==PHASE_FINAL)
+    collect(gc,LONG_MAX);
+  sweep(gc,(gc->phase==PHASE_SWEEP) ? (unsigned)gc->position : 0,1U<<gc->exponent);
+  #if defined GC_PAGEGUARD
+    unguard(gc);
+  #endif
+  swapfilter(gc);
+  gc->phase=PHASE_IDLE;
+  return GC_ERR_NONE;
+}
+
+/* gc_step_r() runs a cycle of gc_scan_r() plus gc_clean_r() in slices, so
+ * that the script can run between the slices. A cycle has four phases:
+ *  o  The data section is scanned in blocks. Before a block is scanned, it is
+ *     write-protected (when it fills a page), or it gets a checksum.
+ *  o  The blocks that changed since they were scanned are scanned again,
+ *     because the script may have moved a value from a part that was not yet
+ *     scanned to a part that was. This phase runs in slices too, and with
+ *     write protection, it is repeated until the changed blocks that are left
+ *     fit in the budget of a slice (for up to RECHECKPASSES passes).
+ *  o  In a single slice, the function scans the heap and the stack (these
+ *     change on every call, and they are usually small) and re-scans the
+ *     blocks that changed after the previous phase. With write protection,
+ *     this slice handles only the pages that were written to; with checksums
+ *     only, it must compute the checksums of the entire data section, because
+ *     the abstract machine has no write barrier.
+ *  o  The table is swept in slices, and the write protection is lifted along
+ *     with it.
+ * Values that are marked while a cycle is in progress survive the cycle.
+ */
+int gc_step_r(GCINFO *gc,AMX *amx,long budget,int *done)
+{
+  AMX_HEADER *hdr;
+  size_t count;
+  unsigned size;
+
+  if (done!=NULL)
+    *done=0;
+  if (amx==NULL || budget<=0)
+    return GC_ERR_PARAMS;
+  if (gc->table==NULL)
+    return GC_ERR_INIT;
+  if (gc->callback==NULL)
+    return GC_ERR_CALLBACK;
+
+  if (gc->phase==PHASE_IDLE) {
+    /* start a new cycle */
+    hdr=(AMX_HEADER*)amx->base;
+    gc->amx=amx;
+    gc->data=(cell*)(amx->data ? amx->data : amx->base+(int)hdr->dat);
+    gc->datasize=(size_t)(hdr->hea - hdr->dat)/sizeof(cell);
+    gc->blockcells=BLOCKCELLS;
+    gc->skew=0;
+    gc->numblocks=(gc->datasize+BLOCKCELLS-1)/BLOCKCELLS;
+    #if defined GC_PAGEGUARD
+      if (gc->dirty!=NULL) {
+        free((void*)gc->dirty);
+        gc->dirty=NULL;
       } /* if */
-      item->count=0;
+      guard(gc);        /* on success, the blocks become pages */
+    #endif
+    if (gc->numblocks>gc->maxblocks || gc->sums==NULL) {
+      GCSUM *sums=(GCSUM*)malloc((gc->numblocks>0 ? gc->numblocks : 1)*sizeof(GCSUM));
+      if (sums==NULL) {
+        #if defined GC_PAGEGUARD
+          unguard(gc);
+        #endif
+        return GC_ERR_MEMORY;
+      } /* if */
+      if (gc->sums!=NULL)
+        free(gc->sums);
+      gc->sums=sums;
+      gc->maxblocks=gc->numblocks;
     } /* if */
-    size--;
-    item++;
-  } /* while */
+    gc->position=0;
+    gc->phase=PHASE_DATA;
+  } else if (gc->amx!=amx) {
+    return GC_ERR_PARAMS;     /* a cycle for another abstract machine is in progress */
+  } /* if */
+
+  if (gc->phase!=PHASE_SWEEP) {
+    budget=collect(gc,budget);
+    if (gc->phase!=PHASE_SWEEP)
+      return GC_ERR_NONE;
+  } /* if */
+
+  assert(gc->phase==PHASE_SWEEP);
+  size=1U<<gc->exponent;
+  count=size-gc->position;
+  if (count>(size_t)budget)
+    count=(size_t)budget;
+  if (count>0) {
+    sweep(gc,(unsigned)gc->position,(unsigned)(gc->position+count));
+    gc->position+=count;
+  } /* if */
+  #if defined GC_PAGEGUARD
+    if (gc->guardslot!=0) {
+      /* calculate with floating point to avoid integer overflow */
+      double pages=(double)(gc->guardsize/pagesize)*gc->position/size;
+      release(gc,(size_t)pages);
+    } /* if */
+  #endif
+  if (gc->position>=size) {
+    #if defined GC_PAGEGUARD
+      unguard(gc);
+    #endif
+    swapfilter(gc);
+    gc->phase=PHASE_IDLE;
+    if (done!=NULL)
+      *done=1;
+  } /* if */
   return GC_ERR_NONE;
 }
+
+/* The functions below are the original (non-re-entrant) interface, which
+ * uses a single static context.
+ */
+int gc_setcallback(GC_FREE callback)
+{
+  return gc_setcallback_r(&SharedGC,callback);
+}
+
+int gc_settable(int exponent,int flags)
+{
+  return gc_settable_r(&SharedGC,exponent,flags);
+}
+
+int gc_tablestat(int *exponent,int *percentage)
+{
+  return gc_tablestat_r(&SharedGC,exponent,percentage);
+}
+
+int gc_mark(cell value)
+{
+  return gc_mark_r(&SharedGC,value);
+}
+
+int gc_scan(AMX *amx)
+{
+  return gc_scan_r(&SharedGC,amx);
+}
+
+int gc_clean(void)
+{
+  return gc_clean_r(&SharedGC);
+}
+
+int gc_step(AMX *amx,long budget,int *done)
+{
+  return gc_step_r(&SharedGC,amx,budget,done);
+}
@@ -34,6 +34,25 @@ enum {
 /* flags */
 #define GC_AUTOGROW   1 /* gc_mark() may grow the hash table when it fills up */
 
+/* A GCINFO holds the hash table and the callback of one garbage collector.
+ * The functions with the "_r" suffix take the context as a parameter; each
+ * abstract machine (or each thread) may thus have its own collector. The
+ * functions without suffix work on a single static context, and they are
+ * not thread-safe.
+ */
+typedef struct tagGCINFO GCINFO;
+
+int gc_create(GCINFO **gc);
+int gc_delete(GCINFO *gc);
+
+int gc_setcallback_r(GCINFO *gc,GC_FREE callback);
+int gc_settable_r(GCINFO *gc,int exponent,int flags);
+int gc_tablestat_r(GCINFO *gc,int *exponent,int *percentage);
+int gc_mark_r(GCINFO *gc,cell value);
+int gc_scan_r(GCINFO *gc,AMX *amx);
+int gc_clean_r(GCINFO *gc);
+int gc_step_r(GCINFO *gc,AMX *amx,long budget,int *done);
+
 int gc_setcallback(GC_FREE callback);
 
 int gc_settable(int exponent,int flags);
@@ -46,5 +65,21 @@ int gc_tablestat(int *exponent,int *percentage);
 int gc_mark(cell value);
 int gc_scan(AMX *amx);
 int gc_clean(void);
+int gc_step(AMX *amx,long budget,int *done);
+        /* Does a part of a collection cycle, which is the same as gc_scan()
+         * followed by gc_clean(), with the script running between the parts.
+         * Each call scans roughly "budget" cells of the data section, or
+         * sweeps "budget" entries of the table. When the data section is
+         * done, the next calls re-scan the blocks of the data section that
+         * changed, and the call that finishes the scan also scans the heap
+         * and the stack. On Linux, macOS and the BSDs, the pages of the data
+         * section are write-protected while the cycle runs, so that the last
+         * call needs to check only the pages that the script wrote to (the
+         * host must not let a system call write into a protected page). Upon
+         * return, "done" is 1 if the cycle is complete (it may be NULL). A
+         * cycle works on a single abstract machine; to collect for several
+         * abstract machines at once, use gc_scan() and gc_clean(). A call of
+         * gc_clean() during a cycle completes the cycle.
+         */
 
 #endif /* AMXGC_H */
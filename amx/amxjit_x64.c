@@ -0,0 +1,1669 @@
+/*  Just-In-Time compiler for the Pawn Abstract Machine, for x86-64 hosts.
+ *
+ *  This JIT translates the P-code of a program with 64-bit cells to native
+ *  x86-64 code (System V calling convention, so Linux, BSD and macOS). Unlike
+ *  the JITs in assembler (AMXJITR.ASM and friends), it is written in C and it
+ *  supports the complete instruction set, including the macro instructions
+ *  and the packed opcodes. It runs side-by-side with the interpreter in AMX.C:
+ *  only abstract machines that have the AMX_FLAG_JITC flag set are compiled.
+ *
+ *  Copyright (c) CompuPhase, 2023
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxjit_x64.c $
+ */
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "osdefs.h"
+#include "amx.h"
+
+#if !defined AMX_JIT_X64
+  #error This file must be compiled with AMX_JIT defined, for an x86-64 target.
+#endif
+#if PAWN_CELL_SIZE!=64
+  #error The x86-64 JIT requires 64-bit cells.
+#endif
+
+#if !defined MAP_ANONYMOUS && defined MAP_ANON
+  #define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* The opcodes must be the same as in AMX.C (including the macro instructions
+ * and the packed opcodes, which the JIT always supports).
+ */
+typedef enum {
+  OP_NOP,
+  OP_LOAD_PRI,
+  OP_LOAD_ALT,
+  OP_LOAD_S_PRI,
+  OP_LOAD_S_ALT,
+  OP_LREF_S_PRI,
+  OP_LREF_S_ALT,
+  OP_LOAD_I,
+  OP_LODB_I,
+  OP_CONST_PRI,
+  OP_CONST_ALT,
+  OP_ADDR_PRI,
+  OP_ADDR_ALT,
+  OP_STOR,
+  OP_STOR_S,
+  OP_SREF_S,
+  OP_STOR_I,
+  OP_STRB_I,
+  OP_ALIGN_PRI,
+  OP_LCTRL,
+  OP_SCTRL,
+  OP_XCHG,
+  OP_PUSH_PRI,
+  OP_PUSH_ALT,
+  OP_PUSHR_PRI,
+  OP_POP_PRI,
+  OP_POP_ALT,
+  OP_PICK,
+  OP_STACK,
+  OP_HEAP,
+  OP_PROC,
+  OP_RET,
+  OP_RETN,
+  OP_CALL,
+  OP_JUMP,
+  OP_JZER,
+  OP_JNZ,
+  OP_SHL,
+  OP_SHR,
+  OP_SSHR,
+  OP_SHL_C_PRI,
+  OP_SHL_C_ALT,
+  OP_SMUL,
+  OP_SDIV,
+  OP_ADD,
+  OP_SUB,
+  OP_AND,
+  OP_OR,
+  OP_XOR,
+  OP_NOT,
+  OP_NEG,
+  OP_INVERT,
+  OP_EQ,
+  OP_NEQ,
+  OP_SLESS,
+  OP_SLEQ,
+  OP_SGRTR,
+  OP_SGEQ,
+  OP_INC_PRI,
+  OP_INC_ALT,
+  OP_INC_I,
+  OP_DEC_PRI,
+  OP_DEC_ALT,
+  OP_DEC_I,
+  OP_MOVS,
+  OP_CMPS,
+  OP_FILL,
+  OP_HALT,
+  OP_BOUNDS,
+  OP_SYSREQ,
+  OP_SWITCH,
+  OP_SWAP_PRI,
+  OP_SWAP_ALT,
+  OP_BREAK,
+  OP_CASETBL,
+  /* patched instructions */
+  OP_SYSREQ_D,
+  OP_SYSREQ_ND,
+  /* overlay instructions */
+  OP_CALL_OVL,
+  OP_RETN_OVL,
+  OP_SWITCH_OVL,
+  OP_CASETBL_OVL,
+  /* supplemental & macro instructions */
+  OP_LIDX,
+  OP_LIDX_B,
+  OP_IDXADDR,
+  OP_IDXADDR_B,
+  OP_PUSH_C,
+  OP_PUSH,
+  OP_PUSH_S,
+  OP_PUSH_ADR,
+  OP_PUSHR_C,
+  OP_PUSHR_S,
+  OP_PUSHR_ADR,
+  OP_JEQ,
+  OP_JNEQ,
+  OP_JSLESS,
+  OP_JSLEQ,
+  OP_JSGRTR,
+  OP_JSGEQ,
+  OP_SDIV_INV,
+  OP_SUB_INV,
+  OP_ADD_C,
+  OP_SMUL_C,
+  OP_ZERO_PRI,
+  OP_ZERO_ALT,
+  OP_ZERO,
+  OP_ZERO_S,
+  OP_EQ_C_PRI,
+  OP_EQ_C_ALT,
+  OP_INC,
+  OP_INC_S,
+  OP_DEC,
+  OP_DEC_S,
+  /* macro instructions */
+  OP_SYSREQ_N,
+  OP_PUSHM_C,
+  OP_PUSHM,
+  OP_PUSHM_S,
+  OP_PUSHM_ADR,
+  OP_PUSHRM_C,
+  OP_PUSHRM_S,
+  OP_PUSHRM_ADR,
+  OP_LOAD2,
+  OP_LOAD2_S,
+  OP_CONST,
+  OP_CONST_S,
+  /* packed instructions */
+  OP_LOAD_P_PRI,
+  OP_LOAD_P_ALT,
+  OP_LOAD_P_S_PRI,
+  OP_LOAD_P_S_ALT,
+  OP_LREF_P_S_PRI,
+  OP_LREF_P_S_ALT,
+  OP_LODB_P_I,
+  OP_CONST_P_PRI,
+  OP_CONST_P_ALT,
+  OP_ADDR_P_PRI,
+  OP_ADDR_P_ALT,
+  OP_STOR_P,
+  OP_STOR_P_S,
+  OP_SREF_P_S,
+  OP_STRB_P_I,
+  OP_LIDX_P_B,
+  OP_IDXADDR_P_B,
+  OP_ALIGN_P_PRI,
+  OP_PUSH_P_C,
+  OP_PUSH_P,
+  OP_PUSH_P_S,
+  OP_PUSH_P_ADR,
+  OP_PUSHR_P_C,
+  OP_PUSHR_P_S,
+  OP_PUSHR_P_ADR,
+  OP_PUSHM_P_C,
+  OP_PUSHM_P,
+  OP_PUSHM_P_S,
+  OP_PUSHM_P_ADR,
+  OP_PUSHRM_P_C,
+  OP_PUSHRM_P_S,
+  OP_PUSHRM_P_ADR,
+  OP_STACK_P,
+  OP_HEAP_P,
+  OP_SHL_P_C_PRI,
+  OP_SHL_P_C_ALT,
+  OP_ADD_P_C,
+  OP_SMUL_P_C,
+  OP_ZERO_P,
+  OP_ZERO_P_S,
+  OP_EQ_P_C_PRI,
+  OP_EQ_P_C_ALT,
+  OP_INC_P,
+  OP_INC_P_S,
+  OP_DEC_P,
+  OP_DEC_P_S,
+  OP_MOVS_P,
+  OP_CMPS_P,
+  OP_FILL_P,
+  OP_HALT_P,
+  OP_BOUNDS_P,
+  /* ----- */
+  OP_NUM_OPCODES
+} OPCODE;
+
+/* every packed opcode is compiled like its non-packed counterpart */
+static const unsigned char packed_base[] = {
+  OP_LOAD_PRI, OP_LOAD_ALT, OP_LOAD_S_PRI, OP_LOAD_S_ALT, OP_LREF_S_PRI,
+  OP_LREF_S_ALT, OP_LODB_I, OP_CONST_PRI, OP_CONST_ALT, OP_ADDR_PRI,
+  OP_ADDR_ALT, OP_STOR, OP_STOR_S, OP_SREF_S, OP_STRB_I, OP_LIDX_B,
+  OP_IDXADDR_B, OP_ALIGN_PRI, OP_PUSH_C, OP_PUSH, OP_PUSH_S, OP_PUSH_ADR,
+  OP_PUSHR_C, OP_PUSHR_S, OP_PUSHR_ADR, OP_PUSHM_C, OP_PUSHM, OP_PUSHM_S,
+  OP_PUSHM_ADR, OP_PUSHRM_C, OP_PUSHRM_S, OP_PUSHRM_ADR, OP_STACK, OP_HEAP,
+  OP_SHL_C_PRI, OP_SHL_C_ALT, OP_ADD_C, OP_SMUL_C, OP_ZERO, OP_ZERO_S,
+  OP_EQ_C_PRI, OP_EQ_C_ALT, OP_INC, OP_INC_S, OP_DEC, OP_DEC_S, OP_MOVS,
+  OP_CMPS, OP_FILL, OP_HALT, OP_BOUNDS
+};
+
+#define OPCODEMASK    (((ucell)1 << sizeof(cell)*4)-1)
+#define STKMARGIN     ((cell)(16*sizeof(cell)))   /* same as in AMX.C */
+
+/* x86-64 registers; the abstract machine registers are kept in callee-saved
+ * registers (so that they survive calls to native functions), PRI and ALT are
+ * in RAX and RCX, which allows for short encodings and for shifts by CL. FRM,
+ * STK and HEA stay relative to the data section (as in the interpreter), the
+ * base address of the data section is in RBX.
+ */
+#define RAX       0
+#define RCX       1
+#define RDX       2
+#define RBX       3
+#define RSP       4
+#define RBP       5
+#define RSI       6
+#define RDI       7
+#define R8        8
+#define R11       11
+#define R12       12
+#define R13       13
+#define R14       14
+#define R15       15
+
+#define PRI       RAX
+#define ALT       RCX
+#define TMP       RDX       /* scratch registers */
+#define TMP2      RSI
+#define ADR       R11       /* scratch for out-of-range displacements, error code on exit */
+#define DAT       RBX       /* start of the data section */
+#define HEA       RBP
+#define STK       R12
+#define FRM       R13
+#define AMXREG    R14       /* pointer to the AMX structure */
+#define STP       R15       /* top of the stack (constant) */
+
+/* condition codes */
+#define CC_E      0x4
+#define CC_NE     0x5
+#define CC_B      0x2
+#define CC_AE     0x3
+#define CC_A      0x7
+#define CC_S      0x8
+#define CC_NS     0x9
+#define CC_L      0xc
+#define CC_GE     0xd
+#define CC_LE     0xe
+#define CC_G      0xf
+
+/* arithmetic group, for instructions with an immediate operand */
+#define ALU_ADD   0
+#define ALU_OR    1
+#define ALU_AND   4
+#define ALU_SUB   5
+#define ALU_XOR   6
+#define ALU_CMP   7
+
+#define FITS8(v)  ((v)>=-128 && (v)<=127)
+#define FITS32(v) ((v)>=-(cell)0x80000000L && (v)<=(cell)0x7fffffffL)
+
+typedef int (*JIT_ENTRY)(AMX *amx,unsigned char *data,void *target,cell *retval);
+
+/* The memory block with the native code starts with this header; the entry
+ * code follows it directly. At the end of the block is the address map, with
+ * the native address for every cell in the P-code (this map is used for the
+ * return addresses on the stack, which are P-code addresses).
+ */
+typedef struct tagJITCODE {
+  size_t size;              /* size of the memory block */
+  cell codesize;            /* size of the P-code */
+  JIT_ENTRY entry;
+  unsigned char **map;
+} JITCODE;
+
+typedef struct tagMEMOP {
+  int base, index, scale;
+  cell disp;
+} MEMOP;
+
+typedef struct tagJITSTATE {
+  AMX *amx;
+  const unsigned char *pcode;
+  cell codesize;            /* size of the P-code */
+  cell *natofs;             /* native offsets for all P-code cells */
+  unsigned char *code;      /* output, NULL while sizing the code */
+  size_t pos;               /* output position */
+  size_t cold;              /* output position for the next error stub */
+  size_t map;               /* position of the address map */
+  size_t exit, exit_saved, fail, badjump;   /* common exit stubs */
+} JITSTATE;
+
+/* The JIT generates the code in two passes: the first pass only calculates
+ * the size of the code and the position of each instruction, the second pass
+ * writes the code. This works because the encoding of every instruction does
+ * not depend on the distance to a jump target (all jumps to P-code labels
+ * and to error stubs use 32-bit displacements).
+ */
+static void emit8(JITSTATE *st,int value)
+{
+  if (st->code!=NULL)
+    st->code[st->pos]=(unsigned char)value;
+  st->pos++;
+}
+
+static void emit32(JITSTATE *st,int32_t value)
+{
+  if (st->code!=NULL)
+    memcpy(st->code+st->pos,&value,sizeof value);
+  st->pos+=sizeof value;
+}
+
+static void emit64(JITSTATE *st,int64_t value)
+{
+  if (st->code!=NULL)
+    memcpy(st->code+st->pos,&value,sizeof value);
+  st->pos+=sizeof value;
+}
+
+static MEMOP mem(int base,int index,cell disp)
+{
+  MEMOP m;
+  m.base=base;
+  m.index=index;
+  m.scale=1;
+  m.disp=disp;
+  return m;
+}
+
+/* memory operand for "base + index*scale" */
+static MEMOP memidx(int base,int index,int scale)
+{
+  MEMOP m=mem(base,index,0);
+  m.scale=scale;
+  return m;
+}
+
+static void x_rex(JITSTATE *st,int wide,int reg,int index,int base)
+{
+  int rex=0x40;
+  if (wide)
+    rex|=0x08;
+  if ((reg & 8)!=0)
+    rex|=0x04;
+  if (index>=0 && (index & 8)!=0)
+    rex|=0x02;
+  if ((base & 8)!=0)
+    rex|=0x01;
+  if (rex!=0x40)
+    emit8(st,rex);
+}
+
+static void x_opcode(JITSTATE *st,int op)
+{
+  if (op>0xff)
+    emit8(st,op>>8);      /* two-byte opcode (0F xx) */
+  emit8(st,op & 0xff);
+}
+
+/* op reg, rm (both registers) */
+static void x_rr(JITSTATE *st,int wide,int op,int reg,int rm)
+{
+  x_rex(st,wide,reg,-1,rm);
+  x_opcode(st,op);
+  emit8(st,0xc0 | (reg & 7)<<3 | (rm & 7));
+}
+
+/* op reg, [mem] */
+static void x_rm(JITSTATE *st,int wide,int op,int reg,MEMOP m)
+{
+  int mod,base=m.base & 7;
+
+  assert(FITS32(m.disp));
+  x_rex(st,wide,reg,m.index,m.base);
+  x_opcode(st,op);
+  if (m.disp==0 && base!=RBP)
+    mod=0x00;
+  else if (FITS8(m.disp))
+    mod=0x40;
+  else
+    mod=0x80;
+  if (m.index<0 && base!=RSP) {
+    emit8(st,mod | (reg & 7)<<3 | base);
+  } else {
+    int ss=(m.scale==8) ? 3 : (m.scale==4) ? 2 : (m.scale==2) ? 1 : 0;
+    assert(m.index!=RSP);
+    emit8(st,mod | (reg & 7)<<3 | RSP);
+    emit8(st,ss<<6 | ((m.index<0) ? RSP : (m.index & 7))<<3 | base);
+  } /* if */
+  if (mod==0x40)
+    emit8(st,(int)m.disp);
+  else if (mod==0x80)
+    emit32(st,(int32_t)m.disp);
+}
+
+static void x_movri(JITSTATE *st,int reg,cell value)
+{
+  if (value==0) {
+    x_rr(st,0,0x31,reg,reg);            /* xor r32, r32 */
+  } else if (value>0 && value<=(cell)0xffffffffL) {
+    x_rex(st,0,0,-1,reg);               /* mov r32, imm32 (zero-extended) */
+    emit8(st,0xb8+(reg & 7));
+    emit32(st,(int32_t)value);
+  } else if (FITS32(value)) {
+    x_rr(st,1,0xc7,0,reg);              /* mov r64, imm32 (sign-extended) */
+    emit32(st,(int32_t)value);
+  } else {
+    x_rex(st,1,0,-1,reg);               /* mov r64, imm64 */
+    emit8(st,0xb8+(reg & 7));
+    emit64(st,value);
+  } /* if */
+}
+
+#define x_movrr(st,dst,src)   x_rr((st),1,0x89,(src),(dst))
+#define x_load(st,reg,m)      x_rm((st),1,0x8b,(reg),(m))
+#define x_store(st,m,reg)     x_rm((st),1,0x89,(reg),(m))
+#define x_lea(st,reg,m)       x_rm((st),1,0x8d,(reg),(m))
+#define x_alurr(st,alu,dst,src) x_rr((st),1,(alu)<<3 | 0x01,(src),(dst))
+
+static void x_alu_ri(JITSTATE *st,int alu,int reg,cell value)
+{
+  if (FITS8(value)) {
+    x_rr(st,1,0x83,alu,reg);
+    emit8(st,(int)value);
+  } else if (FITS32(value)) {
+    x_rr(st,1,0x81,alu,reg);
+    emit32(st,(int32_t)value);
+  } else {
+    assert(reg!=TMP2);
+    x_movri(st,TMP2,value);
+    x_alurr(st,alu,reg,TMP2);
+  } /* if */
+}
+
+static void x_alu_mi(JITSTATE *st,int alu,MEMOP m,cell value)
+{
+  assert(FITS8(value));
+  x_rm(st,1,0x83,alu,m);
+  emit8(st,(int)value);
+}
+
+static void x_movmi(JITSTATE *st,MEMOP m,cell value)
+{
+  if (FITS32(value)) {
+    x_rm(st,1,0xc7,0,m);
+    emit32(st,(int32_t)value);
+  } else {
+    x_movri(st,TMP2,value);
+    x_store(st,m,TMP2);
+  } /* if */
+}
+
+/* reg = reg + value (lea, does not change the flags) */
+static void x_addri(JITSTATE *st,int dst,int src,cell value)
+{
+  if (FITS32(value)) {
+    x_lea(st,dst,mem(src,-1,value));
+  } else {
+    x_movri(st,dst,value);
+    x_alurr(st,ALU_ADD,dst,src);
+  } /* if */
+}
+
+/* memory operand for "data + addr" */
+static MEMOP mem_data(JITSTATE *st,cell addr)
+{
+  if (FITS32(addr))
+    return mem(DAT,-1,addr);
+  x_movri(st,ADR,addr);
+  return mem(DAT,ADR,0);
+}
+
+/* memory operand for "data + frm + offs" */
+static MEMOP mem_frame(JITSTATE *st,cell offs)
+{
+  if (FITS32(offs))
+    return mem(DAT,FRM,offs);
+  x_movri(st,ADR,offs);
+  x_alurr(st,ALU_ADD,ADR,FRM);
+  return mem(DAT,ADR,0);
+}
+
+static void x_setcc(JITSTATE *st,int cc)
+{
+  x_rr(st,0,0x0f90+cc,0,PRI);           /* setcc al */
+  x_rr(st,0,0x0fb6,PRI,PRI);            /* movzx eax, al */
+}
+
+static void x_jmp(JITSTATE *st,size_t target)
+{
+  emit8(st,0xe9);
+  emit32(st,(int32_t)(target-(st->pos+4)));
+}
+
+static void x_jcc(JITSTATE *st,int cc,size_t target)
+{
+  emit8(st,0x0f);
+  emit8(st,0x80+cc);
+  emit32(st,(int32_t)(target-(st->pos+4)));
+}
+
+/* short forward jumps inside the code for a single instruction */
+static size_t x_jcc8(JITSTATE *st,int cc)
+{
+  emit8(st,0x70+cc);
+  emit8(st,0);
+  return st->pos;
+}
+
+static size_t x_jmp8(JITSTATE *st)
+{
+  emit8(st,0xeb);
+  emit8(st,0);
+  return st->pos;
+}
+
+static void x_label8(JITSTATE *st,size_t from)
+{
+  assert(st->pos-from<128);
+  if (st->code!=NULL)
+    st->code[from-1]=(unsigned char)(st->pos-from);
+}
+
+static void x_push(JITSTATE *st,int reg)
+{
+  x_alu_ri(st,ALU_SUB,STK,sizeof(cell));
+  x_store(st,mem(DAT,STK,0),reg);
+}
+
+/* The out-of-line error stubs are collected at the end of the code (so that
+ * the normal flow of the code does not contain jumps over them). A stub sets
+ * the instruction pointer of the abstract machine and the error code.
+ */
+static size_t x_errstub(JITSTATE *st,cell cip,int error)
+{
+  size_t pos=st->pos;
+  size_t stub=st->cold;
+  st->pos=st->cold;
+  x_movmi(st,mem(AMXREG,-1,offsetof(AMX,cip)),cip);
+  x_movri(st,ADR,error);
+  x_jmp(st,st->exit);
+  st->cold=st->pos;
+  st->pos=pos;
+  return stub;
+}
+
+/* verify that the address in "reg" is in the data section or the stack,
+ * but not in the gap between the heap and the stack
+ */
+static void x_chkaddr(JITSTATE *st,int reg,cell cip)
+{
+  size_t valid;
+  x_alurr(st,ALU_CMP,reg,STP);
+  x_jcc(st,CC_AE,x_errstub(st,cip,AMX_ERR_MEMACCESS));
+  x_alurr(st,ALU_CMP,reg,HEA);
+  valid=x_jcc8(st,CC_L);
+  x_alurr(st,ALU_CMP,reg,STK);
+  x_jcc(st,CC_L,x_errstub(st,cip,AMX_ERR_MEMACCESS));
+  x_label8(st,valid);
+}
+
+static void x_chkmargin(JITSTATE *st,cell cip)
+{
+  x_lea(st,TMP,mem(HEA,-1,STKMARGIN));
+  x_alurr(st,ALU_CMP,TMP,STK);
+  x_jcc(st,CC_G,x_errstub(st,cip,AMX_ERR_STACKERR));
+}
+
+/* jump to the P-code address in TMP, through the address map */
+static void x_dispatch(JITSTATE *st,cell cip)
+{
+  x_alu_ri(st,ALU_CMP,TMP,st->codesize);
+  x_jcc(st,CC_AE,x_errstub(st,cip,AMX_ERR_MEMACCESS));
+  emit8(st,0xf6);                       /* test dl, 7 */
+  emit8(st,0xc2);
+  emit8(st,sizeof(cell)-1);
+  x_jcc(st,CC_NE,x_errstub(st,cip,AMX_ERR_MEMACCESS));
+  x_rex(st,1,R8,-1,0);                  /* lea r8, [rip+map] */
+  emit8(st,0x8d);
+  emit8(st,0x05);
+  emit32(st,(int32_t)(st->map-(st->pos+4)));
+  x_rm(st,0,0xff,4,mem(R8,TMP,0));      /* jmp [r8+rdx] */
+}
+
+/* store the registers before calling a helper function (which may call a
+ * native function, which may in turn inspect the abstract machine)
+ */
+static void x_sync(JITSTATE *st,cell cip)
+{
+  x_store(st,mem(AMXREG,-1,offsetof(AMX,pri)),PRI);
+  x_store(st,mem(AMXREG,-1,offsetof(AMX,alt)),ALT);
+  x_store(st,mem(AMXREG,-1,offsetof(AMX,frm)),FRM);
+  x_store(st,mem(AMXREG,-1,offsetof(AMX,stk)),STK);
+  x_store(st,mem(AMXREG,-1,offsetof(AMX,hea)),HEA);
+  x_movmi(st,mem(AMXREG,-1,offsetof(AMX,cip)),cip);
+}
+
+/* call func(amx, data, p1, p2), the helper returns an error code; PRI and ALT
+ * are reloaded from the AMX structure
+ */
+static void x_call(JITSTATE *st,void *func,cell p1,cell p2,cell cip)
+{
+  x_sync(st,cip);
+  x_movrr(st,RDI,AMXREG);
+  x_movrr(st,RSI,DAT);
+  x_movri(st,RDX,p1);
+  x_movri(st,RCX,p2);
+  x_rex(st,1,0,-1,RAX);                 /* always a 64-bit immediate, so that */
+  emit8(st,0xb8);                       /* both passes have the same size */
+  emit64(st,(int64_t)(intptr_t)func);
+  x_rr(st,0,0xff,2,RAX);                /* call rax */
+  x_rr(st,0,0x85,RAX,RAX);              /* test eax, eax */
+  x_jcc(st,CC_NE,st->fail);
+  x_load(st,PRI,mem(AMXREG,-1,offsetof(AMX,pri)));
+  x_load(st,ALT,mem(AMXREG,-1,offsetof(AMX,alt)));
+}
+
+/* floored division, dividend in PRI, divisor in TMP2; quotient goes to PRI
+ * and the remainder to ALT
+ */
+static void x_sdiv(JITSTATE *st,cell cip)
+{
+  size_t minus1,done,fixed;
+  x_rr(st,1,0x85,TMP2,TMP2);
+  x_jcc(st,CC_E,x_errstub(st,cip,AMX_ERR_DIVIDE));
+  x_alu_ri(st,ALU_CMP,TMP2,-1);         /* avoid the overflow trap on MIN/-1 */
+  minus1=x_jcc8(st,CC_E);
+  emit8(st,0x48);                       /* cqo */
+  emit8(st,0x99);
+  x_rr(st,1,0xf7,7,TMP2);               /* idiv rsi */
+  x_rr(st,1,0x85,RDX,RDX);              /* truncated -> floored division */
+  fixed=x_jcc8(st,CC_E);
+  x_movrr(st,R8,RDX);
+  x_alurr(st,ALU_XOR,R8,TMP2);
+  done=x_jcc8(st,CC_NS);
+  x_alu_ri(st,ALU_SUB,PRI,1);
+  x_alurr(st,ALU_ADD,RDX,TMP2);
+  x_label8(st,fixed);
+  x_label8(st,done);
+  x_movrr(st,ALT,RDX);
+  done=x_jmp8(st);
+  x_label8(st,minus1);
+  x_rr(st,1,0xf7,3,PRI);                /* neg rax */
+  x_rr(st,0,0x31,ALT,ALT);              /* xor ecx, ecx */
+  x_label8(st,done);
+}
+
+static cell jumptarget(const JITSTATE *st,cell cip)
+{
+  return cip+*(const cell *)(st->pcode+(int)cip)-sizeof(cell);
+}
+
+static size_t nativeaddr(const JITSTATE *st,cell target)
+{
+  assert(target>=0 && target<=st->codesize);
+  return (size_t)st->natofs[target/sizeof(cell)];
+}
+
+/* helper functions that are called from the native code */
+#define CHKADDR(a)  (((a)>=hea && (a)<stk) || (ucell)(a)>=(ucell)amx->stp)
+#define CHKEND(a)   (((a)>hea && (a)<stk) || (ucell)(a)>(ucell)amx->stp)
+
+static int jit_sysreq(AMX *amx,unsigned char *data,cell index)
+{
+  cell result=amx->pri;
+  int err=amx->callback(amx,index,&result,(cell *)(data+(int)amx->stk));
+  amx->pri=result;
+  return err;
+}
+
+static int jit_sysreq_n(AMX *amx,unsigned char *data,cell index,cell nbytes)
+{
+  cell result=amx->pri;
+  int err;
+  amx->stk-=sizeof(cell);
+  *(cell *)(data+(int)amx->stk)=nbytes;
+  err=amx->callback(amx,index,&result,(cell *)(data+(int)amx->stk));
+  amx->stk+=nbytes+sizeof(cell);
+  amx->pri=result;
+  return err;
+}
+
+static int jit_movs(AMX *amx,unsigned char *data,cell size)
+{
+  cell pri=amx->pri,alt=amx->alt,hea=amx->hea,stk=amx->stk;
+  if (CHKADDR(pri) || CHKEND(pri+size) || CHKADDR(alt) || CHKEND(alt+size))
+    return AMX_ERR_MEMACCESS;
+  memcpy(data+(int)alt,data+(int)pri,(int)size);
+  return AMX_ERR_NONE;
+}
+
+static int jit_cmps(AMX *amx,unsigned char *data,cell size)
+{
+  cell pri=amx->pri,alt=amx->alt,hea=amx->hea,stk=amx->stk;
+  if (CHKADDR(pri) || CHKEND(pri+size) || CHKADDR(alt) || CHKEND(alt+size))
+    return AMX_ERR_MEMACCESS;
+  amx->pri=memcmp(data+(int)alt,data+(int)pri,(int)size);
+  return AMX_ERR_NONE;
+}
+
+static int jit_fill(AMX *amx,unsigned char *data,cell size)
+{
+  cell alt=amx->alt,hea=amx->hea,stk=amx->stk;
+  int i;
+  if (CHKADDR(alt) || CHKEND(alt+size))
+    return AMX_ERR_MEMACCESS;
+  for (i=(int)alt; (size_t)size>=sizeof(cell); i+=sizeof(cell), size-=sizeof(cell))
+    *(cell *)(data+i)=amx->pri;
+  return AMX_ERR_NONE;
+}
+
+static int jit_break(AMX *amx)
+{
+  return (amx->debug!=NULL) ? amx->debug(amx) : AMX_ERR_NONE;
+}
+
+/* the instruction budget is used up or amx_Interrupt() was called (this is
+ * preempt() in AMX.C); the helper returns the error code if the abstract
+ * machine must suspend
+ */
+static int jit_preempt(AMX *amx)
+{
+  if (amx->interrupt) {
+    amx->interrupt=0;
+    return AMX_ERR_INTERRUPT;
+  } /* if */
+  if (amx->budget>0)
+    return AMX_ERR_NONE;
+  if ((amx->flags & AMX_FLAG_BUDGET)!=0)
+    return AMX_ERR_BUDGET;
+  amx->usage+=(unsigned long)(AMX_BUDGET_REFILL-amx->budget);
+  amx->budget=AMX_BUDGET_REFILL;
+  return AMX_ERR_NONE;
+}
+
+/* Every call and every backward jump goes through a stub that charges one
+ * unit of the instruction budget and polls amx_Interrupt(), like CHARGE() in
+ * AMX.C. The stubs are out-of-line, like the error stubs. When the abstract
+ * machine suspends, "cip" is the jump target, so that AMX_EXEC_CONT enters
+ * the native code there.
+ */
+static size_t x_chargestub(JITSTATE *st,cell target)
+{
+  size_t pos=st->pos;
+  size_t stub=st->cold;
+  size_t suspend;
+  st->pos=st->cold;
+  x_alu_mi(st,ALU_SUB,mem(AMXREG,-1,offsetof(AMX,budget)),1);
+  suspend=x_jcc8(st,CC_LE);
+  x_rm(st,0,0x83,ALU_CMP,mem(AMXREG,-1,offsetof(AMX,interrupt)));  /* cmp dword [..], 0 */
+  emit8(st,0);
+  x_jcc(st,CC_E,nativeaddr(st,target));
+  x_label8(st,suspend);
+  x_call(st,(void*)jit_preempt,0,0,target);
+  x_jmp(st,nativeaddr(st,target));
+  st->cold=st->pos;
+  st->pos=pos;
+  return stub;
+}
+
+/* native address for a jump to "target" from the instruction at "cip": a
+ * backward jump goes through a charge stub
+ */
+static size_t jumpaddr(JITSTATE *st,cell cip,cell target)
+{
+  return (target<cip) ? x_chargestub(st,target) : nativeaddr(st,target);
+}
+
+/* push a value that is calculated from a parameter, "kind" is one of the
+ * PUSH opcodes with a parameter (and without the "R" variant, the "reloc"
+ * parameter selects whether the value is converted to a physical address)
+ */
+static void x_pushvalue(JITSTATE *st,OPCODE kind,cell value,int reloc,MEMOP dest)
+{
+  switch (kind) {
+  case OP_PUSH_C:
+    if (!reloc) {
+      x_movmi(st,dest,value);
+      return;
+    } /* if */
+    x_addri(st,TMP,DAT,value);
+    reloc=0;
+    break;
+  case OP_PUSH:
+    x_load(st,TMP,mem_data(st,value));
+    break;
+  case OP_PUSH_S:
+    x_load(st,TMP,mem_frame(st,value));
+    break;
+  case OP_PUSH_ADR:
+    x_addri(st,TMP,FRM,value);
+    break;
+  default:
+    assert(0);
+  } /* switch */
+  if (reloc)
+    x_alurr(st,ALU_ADD,TMP,DAT);
+  x_store(st,dest,TMP);
+}
+
+/* The "switch" instruction is translated to a jump table if the case values
+ * are (nearly) consecutive, and to a balanced tree of compares otherwise. In
+ * the functions below, "rec" is the P-code address of the first record in
+ * the case table; VerifyPcode() has sorted the records on the case value.
+ */
+#define CASEVALUE(st,rec,i) (*(const cell *)((st)->pcode+(int)(rec)+2*(int)(i)*sizeof(cell)))
+
+/* native address of the code for the record (for duplicate case values, the
+ * first record applies)
+ */
+static size_t casetarget(const JITSTATE *st,cell rec,cell i)
+{
+  while (i>0 && CASEVALUE(st,rec,i-1)==CASEVALUE(st,rec,i))
+    i--;
+  return nativeaddr(st,jumptarget(st,rec+(2*i+1)*sizeof(cell)));
+}
+
+/* compare PRI to the records lo..hi (inclusive) */
+static void x_casetree(JITSTATE *st,cell rec,cell lo,cell hi,size_t deflt)
+{
+  cell mid;
+  size_t fixup;
+
+  while (hi-lo>=4) {
+    mid=lo+(hi-lo)/2;
+    x_alu_ri(st,ALU_CMP,PRI,CASEVALUE(st,rec,mid));
+    x_jcc(st,CC_E,casetarget(st,rec,mid));
+    emit8(st,0x0f);                     /* jl rel32 (to the lower half) */
+    emit8(st,0x80+CC_L);
+    fixup=st->pos;
+    emit32(st,0);
+    x_casetree(st,rec,mid+1,hi,deflt);  /* the upper half directly follows */
+    if (st->code!=NULL) {
+      int32_t rel=(int32_t)(st->pos-(fixup+4));
+      memcpy(st->code+fixup,&rel,sizeof rel);
+    } /* if */
+    hi=mid-1;
+  } /* while */
+  for ( ; lo<=hi; lo++) {
+    x_alu_ri(st,ALU_CMP,PRI,CASEVALUE(st,rec,lo));
+    x_jcc(st,CC_E,casetarget(st,rec,lo));
+  } /* for */
+  x_jmp(st,deflt);
+}
+
+/* jump through a table with 32-bit offsets, indexed on PRI minus the lowest
+ * case value; gaps in the case values jump to the default
+ */
+static void x_casejump(JITSTATE *st,cell rec,cell num,size_t deflt)
+{
+  cell first=CASEVALUE(st,rec,0);
+  ucell range=(ucell)CASEVALUE(st,rec,num-1)-(ucell)first;
+  ucell k;
+  cell i;
+  size_t fixup,table;
+
+  x_movrr(st,TMP,PRI);
+  x_alu_ri(st,ALU_SUB,TMP,first);
+  x_alu_ri(st,ALU_CMP,TMP,(cell)range);
+  x_jcc(st,CC_A,deflt);                 /* unsigned compare, also catches PRI < first */
+  emit8(st,0x4c);                       /* lea r11, [rip+disp32] */
+  emit8(st,0x8d);
+  emit8(st,0x1d);
+  fixup=st->pos;
+  emit32(st,0);
+  x_rm(st,1,0x63,TMP,memidx(ADR,TMP,4)); /* movsxd rdx, [r11+rdx*4] */
+  x_alurr(st,ALU_ADD,TMP,ADR);
+  x_rr(st,0,0xff,4,TMP);                /* jmp rdx */
+  table=st->pos;
+  if (st->code!=NULL) {
+    int32_t rel=(int32_t)(table-(fixup+4));
+    memcpy(st->code+fixup,&rel,sizeof rel);
+  } /* if */
+  for (k=0,i=0; k<=range; k++) {
+    cell value=(cell)((ucell)first+k);
+    while (CASEVALUE(st,rec,i)<value)
+      i++;
+    emit32(st,(int32_t)(((CASEVALUE(st,rec,i)==value) ? casetarget(st,rec,i) : deflt)-table));
+  } /* for */
+}
+
+/* map the PUSHR, PUSHM and PUSHRM opcodes to the matching PUSH opcode */
+static OPCODE pushkind(OPCODE opc)
+{
+  switch (opc) {
+  case OP_PUSHR_C:
+  case OP_PUSHM_C:
+  case OP_PUSHRM_C:
+    return OP_PUSH_C;
+  case OP_PUSHM:
+    return OP_PUSH;
+  case OP_PUSHR_S:
+  case OP_PUSHM_S:
+  case OP_PUSHRM_S:
+    return OP_PUSH_S;
+  case OP_PUSHR_ADR:
+  case OP_PUSHM_ADR:
+  case OP_PUSHRM_ADR:
+    return OP_PUSH_ADR;
+  default:
+    assert(0);
+    return opc;
+  } /* switch */
+}
+
+static int jit_translate(JITSTATE *st)
+{
+  AMX_HEADER *hdr=(AMX_HEADER *)st->amx->base;
+  cell cip,op,param,tgt,num,i;
+  OPCODE opc;
+  int packed;
+  size_t skip;
+
+  /* entry code: int entry(AMX *amx, unsigned char *data, void *target, cell *retval) */
+  emit8(st,0x53);                       /* push rbx */
+  emit8(st,0x55);                       /* push rbp */
+  emit8(st,0x41); emit8(st,0x54);       /* push r12 */
+  emit8(st,0x41); emit8(st,0x55);       /* push r13 */
+  emit8(st,0x41); emit8(st,0x56);       /* push r14 */
+  emit8(st,0x41); emit8(st,0x57);       /* push r15 */
+  emit8(st,0x51);                       /* push rcx (retval, also aligns the stack) */
+  x_movrr(st,AMXREG,RDI);
+  x_movrr(st,DAT,RSI);
+  x_load(st,PRI,mem(AMXREG,-1,offsetof(AMX,pri)));
+  x_load(st,ALT,mem(AMXREG,-1,offsetof(AMX,alt)));
+  x_load(st,FRM,mem(AMXREG,-1,offsetof(AMX,frm)));
+  x_load(st,STK,mem(AMXREG,-1,offsetof(AMX,stk)));
+  x_load(st,HEA,mem(AMXREG,-1,offsetof(AMX,hea)));
+  x_load(st,STP,mem(AMXREG,-1,offsetof(AMX,stp)));
+  x_rr(st,0,0xff,4,RDX);                /* jmp rdx */
+
+  /* exit code, the error code is in R11 */
+  st->exit=st->pos;
+  x_store(st,mem(AMXREG,-1,offsetof(AMX,pri)),PRI);
+  x_store(st,mem(AMXREG,-1,offsetof(AMX,alt)),ALT);
+  x_store(st,mem(AMXREG,-1,offsetof(AMX,frm)),FRM);
+  x_store(st,mem(AMXREG,-1,offsetof(AMX,stk)),STK);
+  x_store(st,mem(AMXREG,-1,offsetof(AMX,hea)),HEA);
+  st->exit_saved=st->pos;               /* registers already stored */
+  x_rr(st,0,0x89,ADR,RAX);              /* mov eax, r11d */
+  emit8(st,0x59);                       /* pop rcx */
+  emit8(st,0x41); emit8(st,0x5f);       /* pop r15 */
+  emit8(st,0x41); emit8(st,0x5e);       /* pop r14 */
+  emit8(st,0x41); emit8(st,0x5d);       /* pop r13 */
+  emit8(st,0x41); emit8(st,0x5c);       /* pop r12 */
+  emit8(st,0x5d);                       /* pop rbp */
+  emit8(st,0x5b);                       /* pop rbx */
+  emit8(st,0xc3);                       /* ret */
+  st->fail=st->pos;                     /* a helper function returned an error */
+  x_rr(st,0,0x89,RAX,ADR);              /* mov r11d, eax */
+  x_jmp(st,st->exit_saved);
+  st->badjump=st->pos;                  /* jump to an address that is not an instruction */
+  x_movri(st,ADR,AMX_ERR_MEMACCESS);
+  x_jmp(st,st->exit);
+
+  for (cip=0; cip<st->codesize; ) {
+    st->natofs[cip/sizeof(cell)]=(cell)st->pos;
+    op=*(const cell *)(st->pcode+(int)cip);
+    cip+=sizeof(cell);
+    opc=(OPCODE)(op & OPCODEMASK);
+    packed=0;
+    param=0;
+    if (opc>=OP_LOAD_P_PRI && opc<=OP_BOUNDS_P) {
+      packed=1;
+      param=op>>(int)(sizeof(cell)*4);
+      opc=(OPCODE)packed_base[opc-OP_LOAD_P_PRI];
+    } /* if */
+    #define GETPARAM(v)   ( packed ? (v=param) : (v=*(const cell *)(st->pcode+(int)cip), cip+=sizeof(cell)) )
+    #define NEXTCELL(v)   ( v=*(const cell *)(st->pcode+(int)cip), cip+=sizeof(cell) )
+
+    switch (opc) {
+    case OP_NOP:
+      break;
+    case OP_LOAD_PRI:
+      GETPARAM(param);
+      x_load(st,PRI,mem_data(st,param));
+      break;
+    case OP_LOAD_ALT:
+      GETPARAM(param);
+      x_load(st,ALT,mem_data(st,param));
+      break;
+    case OP_LOAD_S_PRI:
+      GETPARAM(param);
+      x_load(st,PRI,mem_frame(st,param));
+      break;
+    case OP_LOAD_S_ALT:
+      GETPARAM(param);
+      x_load(st,ALT,mem_frame(st,param));
+      break;
+    case OP_LREF_S_PRI:
+      GETPARAM(param);
+      x_load(st,TMP,mem_frame(st,param));
+      x_load(st,PRI,mem(DAT,TMP,0));
+      break;
+    case OP_LREF_S_ALT:
+      GETPARAM(param);
+      x_load(st,TMP,mem_frame(st,param));
+      x_load(st,ALT,mem(DAT,TMP,0));
+      break;
+    case OP_LOAD_I:
+      x_chkaddr(st,PRI,cip);
+      x_load(st,PRI,mem(DAT,PRI,0));
+      break;
+    case OP_LODB_I:
+      GETPARAM(param);
+      x_chkaddr(st,PRI,cip);
+      switch ((int)param) {
+      case 1:
+        x_rm(st,0,0x0fb6,PRI,mem(DAT,PRI,0));   /* movzx eax, byte [] */
+        break;
+      case 2:
+        x_rm(st,0,0x0fb7,PRI,mem(DAT,PRI,0));   /* movzx eax, word [] */
+        break;
+      case 4:
+        x_rm(st,0,0x8b,PRI,mem(DAT,PRI,0));     /* mov eax, dword [] */
+        break;
+      } /* switch */
+      break;
+    case OP_CONST_PRI:
+      GETPARAM(param);
+      x_movri(st,PRI,param);
+      break;
+    case OP_CONST_ALT:
+      GETPARAM(param);
+      x_movri(st,ALT,param);
+      break;
+    case OP_ADDR_PRI:
+      GETPARAM(param);
+      x_addri(st,PRI,FRM,param);
+      break;
+    case OP_ADDR_ALT:
+      GETPARAM(param);
+      x_addri(st,ALT,FRM,param);
+      break;
+    case OP_STOR:
+      GETPARAM(param);
+      x_store(st,mem_data(st,param),PRI);
+      break;
+    case OP_STOR_S:
+      GETPARAM(param);
+      x_store(st,mem_frame(st,param),PRI);
+      break;
+    case OP_SREF_S:
+      GETPARAM(param);
+      x_load(st,TMP,mem_frame(st,param));
+      x_store(st,mem(DAT,TMP,0),PRI);
+      break;
+    case OP_STOR_I:
+      x_chkaddr(st,ALT,cip);
+      x_store(st,mem(DAT,ALT,0),PRI);
+      break;
+    case OP_STRB_I:
+      GETPARAM(param);
+      x_chkaddr(st,ALT,cip);
+      switch ((int)param) {
+      case 1:
+        x_rm(st,0,0x88,PRI,mem(DAT,ALT,0));     /* mov byte [], al */
+        break;
+      case 2:
+        emit8(st,0x66);                         /* mov word [], ax */
+        x_rm(st,0,0x89,PRI,mem(DAT,ALT,0));
+        break;
+      case 4:
+        x_rm(st,0,0x89,PRI,mem(DAT,ALT,0));     /* mov dword [], eax */
+        break;
+      } /* switch */
+      break;
+    case OP_ALIGN_PRI:
+      GETPARAM(param);
+      if ((size_t)param<sizeof(cell))
+        x_alu_ri(st,ALU_XOR,PRI,sizeof(cell)-param);
+      break;
+    case OP_LCTRL:
+      GETPARAM(param);
+      switch ((int)param) {
+      case 0:
+        x_movri(st,PRI,hdr->cod);
+        break;
+      case 1:
+        x_movri(st,PRI,hdr->dat);
+        break;
+      case 2:
+        x_movrr(st,PRI,HEA);
+        break;
+      case 3:
+        x_movrr(st,PRI,STP);
+        break;
+      case 4:
+        x_movrr(st,PRI,STK);
+        break;
+      case 5:
+        x_movrr(st,PRI,FRM);
+        break;
+      case 6:
+        x_movri(st,PRI,cip);
+        break;
+      } /* switch */
+      break;
+    case OP_SCTRL:
+      GETPARAM(param);
+      switch ((int)param) {
+      case 2:
+        x_movrr(st,HEA,PRI);
+        break;
+      case 4:
+        x_movrr(st,STK,PRI);
+        break;
+      case 5:
+        x_movrr(st,FRM,PRI);
+        break;
+      case 6:
+        x_movrr(st,TMP,PRI);
+        x_dispatch(st,cip);
+        break;
+      } /* switch */
+      break;
+    case OP_XCHG:
+      x_rr(st,1,0x87,PRI,ALT);
+      break;
+    case OP_PUSH_PRI:
+      x_push(st,PRI);
+      break;
+    case OP_PUSH_ALT:
+      x_push(st,ALT);
+      break;
+    case OP_PUSHR_PRI:
+      x_lea(st,TMP,mem(DAT,PRI,0));
+      x_push(st,TMP);
+      break;
+    case OP_POP_PRI:
+      x_load(st,PRI,mem(DAT,STK,0));
+      x_alu_ri(st,ALU_ADD,STK,sizeof(cell));
+      break;
+    case OP_POP_ALT:
+      x_load(st,ALT,mem(DAT,STK,0));
+      x_alu_ri(st,ALU_ADD,STK,sizeof(cell));
+      break;
+    case OP_PICK:
+      GETPARAM(param);
+      if (FITS32(param)) {
+        x_load(st,PRI,mem(DAT,STK,param));
+      } else {
+        x_addri(st,TMP,STK,param);
+        x_load(st,PRI,mem(DAT,TMP,0));
+      } /* if */
+      break;
+    case OP_STACK:
+      GETPARAM(param);
+      x_alu_ri(st,ALU_ADD,STK,param);
+      x_movrr(st,ALT,STK);
+      x_chkmargin(st,cip);
+      x_alurr(st,ALU_CMP,STK,STP);
+      x_jcc(st,CC_G,x_errstub(st,cip,AMX_ERR_STACKLOW));
+      break;
+    case OP_HEAP:
+      GETPARAM(param);
+      x_movrr(st,ALT,HEA);
+      x_alu_ri(st,ALU_ADD,HEA,param);
+      x_chkmargin(st,cip);
+      x_rm(st,1,0x3b,HEA,mem(AMXREG,-1,offsetof(AMX,hlw)));  /* cmp rbp, [hlw] */
+      x_jcc(st,CC_L,x_errstub(st,cip,AMX_ERR_HEAPLOW));
+      break;
+    case OP_PROC:
+      x_push(st,FRM);
+      x_movrr(st,FRM,STK);
+      x_chkmargin(st,cip);
+      break;
+    case OP_RET:
+    case OP_RETN:
+      x_load(st,FRM,mem(DAT,STK,0));
+      x_load(st,TMP,mem(DAT,STK,sizeof(cell)));
+      x_alu_ri(st,ALU_ADD,STK,2*sizeof(cell));
+      if (opc==OP_RETN) {
+        /* remove the parameters from the stack */
+        x_load(st,TMP2,mem(DAT,STK,0));
+        x_lea(st,STK,mem(STK,TMP2,sizeof(cell)));
+      } /* if */
+      x_dispatch(st,cip);
+      break;
+    case OP_CALL:
+      tgt=jumptarget(st,cip);
+      cip+=sizeof(cell);
+      x_alu_ri(st,ALU_SUB,STK,sizeof(cell));
+      x_movmi(st,mem(DAT,STK,0),cip);   /* return address */
+      x_jmp(st,x_chargestub(st,tgt));
+      break;
+    case OP_JUMP:
+      tgt=jumptarget(st,cip);
+      cip+=sizeof(cell);
+      x_jmp(st,jumpaddr(st,cip,tgt));
+      break;
+    case OP_JZER:
+    case OP_JNZ:
+      tgt=jumptarget(st,cip);
+      cip+=sizeof(cell);
+      x_rr(st,1,0x85,PRI,PRI);
+      x_jcc(st,(opc==OP_JZER) ? CC_E : CC_NE,jumpaddr(st,cip,tgt));
+      break;
+    case OP_SHL:
+      x_rr(st,1,0xd3,4,PRI);
+      break;
+    case OP_SHR:
+      x_rr(st,1,0xd3,5,PRI);
+      break;
+    case OP_SSHR:
+      x_rr(st,1,0xd3,7,PRI);
+      break;
+    case OP_SHL_C_PRI:
+    case OP_SHL_C_ALT:
+      GETPARAM(param);
+      x_rr(st,1,0xc1,4,(opc==OP_SHL_C_PRI) ? PRI : ALT);
+      emit8(st,(int)(param & 0x3f));
+      break;
+    case OP_SMUL:
+      x_rr(st,1,0x0faf,PRI,ALT);
+      break;
+    case OP_SDIV:
+      x_movrr(st,TMP2,PRI);
+      x_movrr(st,PRI,ALT);
+      x_sdiv(st,cip);
+      break;
+    case OP_ADD:
+      x_alurr(st,ALU_ADD,PRI,ALT);
+      break;
+    case OP_SUB:
+      x_rr(st,1,0xf7,3,PRI);            /* neg rax */
+      x_alurr(st,ALU_ADD,PRI,ALT);
+      break;
+    case OP_AND:
+      x_alurr(st,ALU_AND,PRI,ALT);
+      break;
+    case OP_OR:
+      x_alurr(st,ALU_OR,PRI,ALT);
+      break;
+    case OP_XOR:
+      x_alurr(st,ALU_XOR,PRI,ALT);
+      break;
+    case OP_NOT:
+      x_rr(st,1,0x85,PRI,PRI);
+      x_setcc(st,CC_E);
+      break;
+    case OP_NEG:
+      x_rr(st,1,0xf7,3,PRI);
+      break;
+    case OP_INVERT:
+      x_rr(st,1,0xf7,2,PRI);
+      break;
+    case OP_EQ:
+    case OP_NEQ:
+    case OP_SLESS:
+    case OP_SLEQ:
+    case OP_SGRTR:
+    case OP_SGEQ: {
+      static const unsigned char cc[] = { CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE };
+      x_alurr(st,ALU_CMP,PRI,ALT);
+      x_setcc(st,cc[opc-OP_EQ]);
+      break;
+    } /* case */
+    case OP_INC_PRI:
+      x_alu_ri(st,ALU_ADD,PRI,1);
+      break;
+    case OP_INC_ALT:
+      x_alu_ri(st,ALU_ADD,ALT,1);
+      break;
+    case OP_INC_I:
+      x_alu_mi(st,ALU_ADD,mem(DAT,PRI,0),1);
+      break;
+    case OP_DEC_PRI:
+      x_alu_ri(st,ALU_SUB,PRI,1);
+      break;
+    case OP_DEC_ALT:
+      x_alu_ri(st,ALU_SUB,ALT,1);
+      break;
+    case OP_DEC_I:
+      x_alu_mi(st,ALU_SUB,mem(DAT,PRI,0),1);
+      break;
+    case OP_MOVS:
+      GETPARAM(param);
+      x_call(st,(void*)jit_movs,param,0,cip);
+      break;
+    case OP_CMPS:
+      GETPARAM(param);
+      x_call(st,(void*)jit_cmps,param,0,cip);
+      break;
+    case OP_FILL:
+      GETPARAM(param);
+      x_call(st,(void*)jit_fill,param,0,cip);
+      break;
+    case OP_HALT:
+      GETPARAM(param);
+      x_load(st,TMP,mem(RSP,-1,0));     /* retval */
+      x_rr(st,1,0x85,TMP,TMP);
+      skip=x_jcc8(st,CC_E);
+      x_store(st,mem(TMP,-1,0),PRI);
+      x_label8(st,skip);
+      x_movmi(st,mem(AMXREG,-1,offsetof(AMX,cip)),cip);
+      x_movri(st,ADR,(int)param);
+      x_jmp(st,st->exit);
+      break;
+    case OP_BOUNDS:
+      GETPARAM(param);
+      x_alu_ri(st,ALU_CMP,PRI,param);
+      x_jcc(st,CC_A,x_errstub(st,cip,AMX_ERR_BOUNDS));
+      break;
+    case OP_SYSREQ:
+      GETPARAM(param);
+      x_call(st,(void*)jit_sysreq,param,0,cip);
+      break;
+    case OP_SWITCH: {
+      cell casetbl,rec;
+      size_t deflt;
+      tgt=jumptarget(st,cip);
+      cip+=sizeof(cell);
+      assert(*(const cell *)(st->pcode+(int)tgt)==OP_CASETBL);
+      casetbl=tgt+sizeof(cell);
+      num=*(const cell *)(st->pcode+(int)casetbl);
+      deflt=nativeaddr(st,jumptarget(st,casetbl+sizeof(cell)));
+      rec=casetbl+2*sizeof(cell);
+      if (num>=4 && ((ucell)CASEVALUE(st,rec,num-1)-(ucell)CASEVALUE(st,rec,0))/2<(ucell)num)
+        x_casejump(st,rec,num,deflt);
+      else
+        x_casetree(st,rec,0,num-1,deflt);
+      break;
+    } /* case */
+    case OP_SWAP_PRI:
+    case OP_SWAP_ALT: {
+      int reg=(opc==OP_SWAP_PRI) ? PRI : ALT;
+      x_load(st,TMP,mem(DAT,STK,0));
+      x_store(st,mem(DAT,STK,0),reg);
+      x_movrr(st,reg,TMP);
+      break;
+    } /* case */
+    case OP_BREAK:
+      /* only call out when a debug hook is installed (which may happen at any
+       * time, for example from a signal handler)
+       */
+      x_alu_mi(st,ALU_CMP,mem(AMXREG,-1,offsetof(AMX,debug)),0);
+      emit8(st,0x0f);                   /* je rel32 (to the next instruction) */
+      emit8(st,0x80+CC_E);
+      skip=st->pos;
+      emit32(st,0);
+      x_call(st,(void*)jit_break,0,0,cip);
+      if (st->code!=NULL) {
+        int32_t rel=(int32_t)(st->pos-(skip+4));
+        memcpy(st->code+skip,&rel,sizeof rel);
+      } /* if */
+      break;
+    case OP_CASETBL:
+      NEXTCELL(num);
+      cip+=(2*num+1)*sizeof(cell);
+      break;
+
+    /* supplemental & macro instructions */
+    case OP_LIDX:
+      x_lea(st,TMP,memidx(ALT,PRI,sizeof(cell)));
+      x_chkaddr(st,TMP,cip);
+      x_load(st,PRI,mem(DAT,TMP,0));
+      break;
+    case OP_LIDX_B:
+      GETPARAM(param);
+      x_movrr(st,TMP,PRI);
+      x_rr(st,1,0xc1,4,TMP);
+      emit8(st,(int)(param & 0x3f));
+      x_alurr(st,ALU_ADD,TMP,ALT);
+      x_chkaddr(st,TMP,cip);
+      x_load(st,PRI,mem(DAT,TMP,0));
+      break;
+    case OP_IDXADDR:
+      x_lea(st,PRI,memidx(ALT,PRI,sizeof(cell)));
+      break;
+    case OP_IDXADDR_B:
+      GETPARAM(param);
+      x_rr(st,1,0xc1,4,PRI);
+      emit8(st,(int)(param & 0x3f));
+      x_alurr(st,ALU_ADD,PRI,ALT);
+      break;
+    case OP_PUSH_C:
+    case OP_PUSH:
+    case OP_PUSH_S:
+    case OP_PUSH_ADR:
+      GETPARAM(param);
+      x_alu_ri(st,ALU_SUB,STK,sizeof(cell));
+      x_pushvalue(st,opc,param,0,mem(DAT,STK,0));
+      break;
+    case OP_PUSHR_C:
+    case OP_PUSHR_S:
+    case OP_PUSHR_ADR:
+      GETPARAM(param);
+      x_alu_ri(st,ALU_SUB,STK,sizeof(cell));
+      x_pushvalue(st,pushkind(opc),param,1,mem(DAT,STK,0));
+      break;
+    case OP_JEQ:
+    case OP_JNEQ:
+    case OP_JSLESS:
+    case OP_JSLEQ:
+    case OP_JSGRTR:
+    case OP_JSGEQ: {
+      static const unsigned char cc[] = { CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE };
+      tgt=jumptarget(st,cip);
+      cip+=sizeof(cell);
+      x_alurr(st,ALU_CMP,PRI,ALT);
+      x_jcc(st,cc[opc-OP_JEQ],jumpaddr(st,cip,tgt));
+      break;
+    } /* case */
+    case OP_SDIV_INV:
+      x_movrr(st,TMP2,ALT);
+      x_sdiv(st,cip);
+      break;
+    case OP_SUB_INV:
+      x_alurr(st,ALU_SUB,PRI,ALT);
+      break;
+    case OP_ADD_C:
+      GETPARAM(param);
+      x_alu_ri(st,ALU_ADD,PRI,param);
+      break;
+    case OP_SMUL_C:
+      GETPARAM(param);
+      if (FITS32(param)) {
+        x_rr(st,1,0x69,PRI,PRI);        /* imul rax, rax, imm32 */
+        emit32(st,(int32_t)param);
+      } else {
+        x_movri(st,TMP2,param);
+        x_rr(st,1,0x0faf,PRI,TMP2);
+      } /* if */
+      break;
+    case OP_ZERO_PRI:
+      x_rr(st,0,0x31,PRI,PRI);
+      break;
+    case OP_ZERO_ALT:
+      x_rr(st,0,0x31,ALT,ALT);
+      break;
+    case OP_ZERO:
+      GETPARAM(param);
+      x_movmi(st,mem_data(st,param),0);
+      break;
+    case OP_ZERO_S:
+      GETPARAM(param);
+      x_movmi(st,mem_frame(st,param),0);
+      break;
+    case OP_EQ_C_PRI:
+    case OP_EQ_C_ALT:
+      GETPARAM(param);
+      x_alu_ri(st,ALU_CMP,(opc==OP_EQ_C_PRI) ? PRI : ALT,param);
+      x_setcc(st,CC_E);
+      break;
+    case OP_INC:
+      GETPARAM(param);
+      x_alu_mi(st,ALU_ADD,mem_data(st,param),1);
+      break;
+    case OP_INC_S:
+      GETPARAM(param);
+      x_alu_mi(st,ALU_ADD,mem_frame(st,param),1);
+      break;
+    case OP_DEC:
+      GETPARAM(param);
+      x_alu_mi(st,ALU_SUB,mem_data(st,param),1);
+      break;
+    case OP_DEC_S:
+      GETPARAM(param);
+      x_alu_mi(st,ALU_SUB,mem_frame(st,param),1);
+      break;
+    case OP_SYSREQ_N:
+      NEXTCELL(param);
+      NEXTCELL(num);
+      x_call(st,(void*)jit_sysreq_n,param,num,cip);
+      x_load(st,STK,mem(AMXREG,-1,offsetof(AMX,stk)));
+      break;
+    case OP_PUSHM_C:
+    case OP_PUSHM:
+    case OP_PUSHM_S:
+    case OP_PUSHM_ADR:
+    case OP_PUSHRM_C:
+    case OP_PUSHRM_S:
+    case OP_PUSHRM_ADR: {
+      int reloc=(opc>=OP_PUSHRM_C);
+      OPCODE kind=pushkind(opc);
+      GETPARAM(num);
+      x_alu_ri(st,ALU_SUB,STK,num*sizeof(cell));
+      for (i=0; i<num; i++) {
+        NEXTCELL(param);
+        x_pushvalue(st,kind,param,reloc,mem(DAT,STK,(num-1-i)*sizeof(cell)));
+      } /* for */
+      break;
+    } /* case */
+    case OP_LOAD2:
+      NEXTCELL(param);
+      x_load(st,PRI,mem_data(st,param));
+      NEXTCELL(param);
+      x_load(st,ALT,mem_data(st,param));
+      break;
+    case OP_LOAD2_S:
+      NEXTCELL(param);
+      x_load(st,PRI,mem_frame(st,param));
+      NEXTCELL(param);
+      x_load(st,ALT,mem_frame(st,param));
+      break;
+    case OP_CONST:
+    case OP_CONST_S: {
+      MEMOP m;
+      NEXTCELL(tgt);
+      NEXTCELL(param);
+      m=(opc==OP_CONST) ? mem_data(st,tgt) : mem_frame(st,tgt);
+      x_movmi(st,m,param);
+      break;
+    } /* case */
+
+    default:
+      /* SYSREQ.D and SYSREQ.ND are never present in the P-code of a program
+       * that is JIT-compiled, and overlays are not supported
+       */
+      return AMX_ERR_INVINSTR;
+    } /* switch */
+    #undef GETPARAM
+    #undef NEXTCELL
+  } /* for */
+
+  /* running off the end of the code */
+  assert(cip==st->codesize);
+  st->natofs[cip/sizeof(cell)]=(cell)st->pos;
+  x_movri(st,ADR,AMX_ERR_MEMACCESS);
+  x_jmp(st,st->exit);
+  return AMX_ERR_NONE;
+}
+
+int amx_jit_list(const AMX *amx,const cell **opcodelist,int *numopcodes)
+{
+  (void)amx;
+  assert(opcodelist!=NULL);
+  *opcodelist=NULL;     /* the JIT reads the P-code as is, no relocation */
+  assert(numopcodes!=NULL);
+  *numopcodes=OP_NUM_OPCODES;
+  return 0;
+}
+
+/* amx_jit_compile()
+ * Translates the P-code of the abstract machine to native code. The
+ * "reloc_table" parameter must point to a block of (at least) amx->reloc_size
+ * bytes (as set by amx_Init()); it is only used during the compilation.
+ */
+int amx_jit_compile(AMX *amx,void *reloc_table)
+{
+  AMX_HEADER *hdr;
+  JITSTATE st;
+  JITCODE *jit;
+  size_t start,hotsize,coldsize,size;
+  unsigned char *block;
+  int err,i,numcells;
+
+  assert(amx!=NULL);
+  assert(reloc_table!=NULL);
+  hdr=(AMX_HEADER *)amx->base;
+  memset(&st,0,sizeof st);
+  st.amx=amx;
+  st.pcode=amx->code;
+  st.codesize=hdr->dat-hdr->cod;
+  st.natofs=(cell *)reloc_table;
+  numcells=(int)(st.codesize/sizeof(cell))+1;
+  for (i=0; i<numcells; i++)
+    st.natofs[i]=-1;
+  start=(sizeof(JITCODE)+15) & ~(size_t)15;
+
+  /* first pass: calculate the sizes */
+  st.pos=start;
+  st.cold=0;
+  if ((err=jit_translate(&st))!=AMX_ERR_NONE)
+    return err;
+  hotsize=st.pos;
+  coldsize=st.cold;
+  st.map=(hotsize+coldsize+sizeof(void*)-1) & ~(sizeof(void*)-1);
+  size=st.map+numcells*sizeof(void*);
+
+  block=(unsigned char *)mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+  if (block==MAP_FAILED)
+    return AMX_ERR_MEMORY;
+
+  /* second pass: generate the code */
+  st.code=block;
+  st.pos=start;
+  st.cold=hotsize;
+  err=jit_translate(&st);
+  assert(err==AMX_ERR_NONE);
+  assert(st.pos==hotsize && st.cold==hotsize+coldsize);
+
+  /* fill in the header and the address map */
+  jit=(JITCODE *)block;
+  jit->size=size;
+  jit->codesize=st.codesize;
+  jit->entry=(JIT_ENTRY)(void*)(block+start);
+  jit->map=(unsigned char **)(block+st.map);
+  for (i=0; i<numcells; i++)
+    jit->map[i]=block+(size_t)((st.natofs[i]>=0) ? st.natofs[i] : (cell)st.badjump);
+
+  if (mprotect(block,size,PROT_READ | PROT_EXEC)!=0) {
+    munmap(block,size);
+    return AMX_ERR_INIT_JIT;
+  } /* if */
+  amx->jit_code=block;
+  amx->codesize=(long)size;
+  return AMX_ERR_NONE;
+}
+
+cell amx_jit_run(AMX *amx,cell *retval,unsigned char *data)
+{
+  const JITCODE *jit;
+
+  assert(amx!=NULL);
+  jit=(const JITCODE *)amx->jit_code;
+  if (jit==NULL)
+    return AMX_ERR_INIT_JIT;
+  if ((ucell)amx->cip>=(ucell)jit->codesize || (amx->cip & (sizeof(cell)-1))!=0)
+    return AMX_ERR_MEMACCESS;
+  return jit->entry(amx,data,jit->map[amx->cip/sizeof(cell)],retval);
+}
+
+void amx_jit_free(AMX *amx)
+{
+  const JITCODE *jit;
+
+  assert(amx!=NULL);
+  jit=(const JITCODE *)amx->jit_code;
+  if (jit!=NULL) {
+    munmap((void *)jit,jit->size);
+    amx->jit_code=NULL;
+  } /* if */
+}
@@ -0,0 +1,519 @@
+/*  Mailbox module for the Pawn Abstract Machine
+ *
+ *  Mailboxes pass messages between abstract machines in the same process,
+ *  also when these run on different threads. Every abstract machine that has
+ *  a public function @receive() gets a mailbox: a bounded queue that many
+ *  senders may write into and that only its owner reads from. The queue is
+ *  lock-free: a sender claims a slot with a compare-and-swap on the head of
+ *  the queue, copies the message into the slot and then publishes the slot
+ *  through its sequence number. The host dispatches the messages to
+ *  @receive() from its idle function or from its event loop.
+ *
+ *  The message buffers of a mailbox are reserved in the data segment of its
+ *  owner (at the bottom of the heap), when the module is initialized. So a
+ *  sender copies a message straight from its own data segment into that of
+ *  the receiver, and @receive() gets the message in place.
+ *
+ *  The mailboxes are in a static table, so that a sender never accesses a
+ *  mailbox that was freed. A mailbox identifier includes a generation count,
+ *  so that messages for a mailbox that was closed do not arrive at a new
+ *  owner of the same slot.
+ *
+ *  Copyright (c) CompuPhase, 2026
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxmbox.c $
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "osdefs.h"
+#if defined __WIN32__ || defined _WIN32 || defined WIN32
+  #include <windows.h>
+#else
+  #include <sched.h>
+  #include <unistd.h>
+#endif
+#if defined __LINUX__
+  #include <sys/eventfd.h>
+#endif
+#include "amx.h"
+#include "amxevent.h"
+
+#if !defined MAILBOX_MAX
+  #define MAILBOX_MAX     64    /* number of mailboxes in the process */
+#endif
+#if !defined MAILBOX_SLOTS
+  #define MAILBOX_SLOTS   16    /* messages per mailbox, must be a power of 2 */
+#endif
+#if !defined MAILBOX_MSGSIZE
+  #define MAILBOX_MSGSIZE 32    /* maximum size of a message, in cells */
+#endif
+#define MAILBOX_NAMEMAX   31
+#define MAILBOX_GENMASK   0xfffffL /* keeps the identifiers in the range of a 32-bit cell */
+
+#if defined __GNUC__ || defined __clang__ || defined __ICC
+  #define ATOMIC_CAS(ptr,oldval,newval) __sync_bool_compare_and_swap((ptr),(oldval),(newval))
+  #define ATOMIC_ADD(ptr,value)         __sync_add_and_fetch((ptr),(value))
+  #define BARRIER()                     __sync_synchronize()
+#elif defined _MSC_VER
+  #define ATOMIC_CAS(ptr,oldval,newval) (InterlockedCompareExchange((volatile LONG*)(ptr),(LONG)(newval),(LONG)(oldval)) == (LONG)(oldval))
+  #define ATOMIC_ADD(ptr,value)         InterlockedExchangeAdd((volatile LONG*)(ptr),(LONG)(value))
+  #define BARRIER()                     MemoryBarrier()
+#else
+  #error Atomic operations are not defined for this compiler
+#endif
+
+#if defined __WIN32__ || defined _WIN32 || defined WIN32
+  #define YIELD()         Sleep(0)
+#else
+  #define YIELD()         sched_yield()
+#endif
+
+#define MBOX_TAG          AMX_USERTAG('M','b','o','x')
+
+enum {
+  MBOX_FREE,
+  MBOX_SETUP,           /* being opened */
+  MBOX_OPEN,
+  MBOX_CLOSING          /* waiting for the senders to finish */
+};
+
+typedef struct tagMSGSLOT {
+  volatile unsigned long seq; /* position + 1 when filled, position + MAILBOX_SLOTS when free */
+  cell source;          /* mailbox of the sender */
+  cell size;            /* size of the message, in cells */
+} MSGSLOT;
+
+typedef struct tagMAILBOX {
+  volatile long state;
+  volatile long senders;    /* senders that are copying into this mailbox */
+  volatile unsigned long head; /* next position to fill (senders) */
+  unsigned long tail;       /* next position to read (owner) */
+  volatile long signalled;  /* "wakefd" was written, but not yet read */
+  volatile long named;
+  long generation;
+  int wakefd;               /* eventfd, when the host runs an event loop */
+  AMX *amx;
+  cell buffer;              /* MAILBOX_SLOTS messages, address in the data segment of "amx" */
+  int idxReceive;
+  AMX_IDLE PrevIdle;
+  AMX_EVENTHOOK PrevEvents;
+  AMX_EVENTS *events;
+  char name[MAILBOX_NAMEMAX+1];
+  MSGSLOT slot[MAILBOX_SLOTS];
+} MAILBOX;
+
+static MAILBOX mailboxes[MAILBOX_MAX];
+
+static cell mbox_id(const MAILBOX *mb)
+{
+  return (cell)mb->generation * MAILBOX_MAX + (cell)(mb - mailboxes) + 1;
+}
+
+/* mbox_acquire() looks up a mailbox for a sender and registers the sender,
+ * so that the mailbox cannot be closed while the sender copies a message;
+ * the sender must call mbox_unacquire() when it is done
+ */
+static MAILBOX *mbox_acquire(cell id)
+{
+  MAILBOX *mb;
+
+  if (id <= 0)
+    return NULL;
+  mb = &mailboxes[(id - 1) % MAILBOX_MAX];
+  ATOMIC_ADD(&mb->senders, 1);
+  if (mb->state != MBOX_OPEN || mbox_id(mb) != id) {
+    ATOMIC_ADD(&mb->senders, -1);
+    return NULL;
+  } /* if */
+  return mb;
+}
+
+static void mbox_unacquire(MAILBOX *mb)
+{
+  ATOMIC_ADD(&mb->senders, -1);
+}
+
+/* mbox_buffer() returns a pointer to the buffer of a slot; the buffers are
+ * kept as an address in the data segment of the receiver, because its data
+ * moves when the host calls amx_InitJIT() (after amx_MailboxInit())
+ */
+static cell *mbox_buffer(const MAILBOX *mb, unsigned long pos)
+{
+  AMX *amx = mb->amx;
+  AMX_HEADER *hdr = (AMX_HEADER *)amx->base;
+  unsigned char *data;
+
+  data = (amx->data != NULL) ? amx->data : amx->base + (int)hdr->dat;
+  return (cell *)(data + (int)mb->buffer) + (pos & (MAILBOX_SLOTS - 1)) * MAILBOX_MSGSIZE;
+}
+
+/* mbox_claim() reserves a slot for a message and returns a pointer to the
+ * buffer of that slot (in the data segment of the receiver), or NULL if the
+ * mailbox is full
+ */
+static cell *mbox_claim(MAILBOX *mb, unsigned long *pos)
+{
+  unsigned long p;
+  long diff;
+
+  for ( ;; ) {
+    p = mb->head;
+    diff = (long)(mb->slot[p & (MAILBOX_SLOTS - 1)].seq - p);
+    if (diff == 0) {
+      if (ATOMIC_CAS(&mb->head, p, p + 1))
+        break;
+    } else if (diff < 0) {
+      return NULL;          /* the owner has not yet read this slot */
+    } /* if */
+    /* another sender claimed the slot, try again */
+  } /* for */
+  *pos = p;
+  return mbox_buffer(mb, p);
+}
+
+static void mbox_publish(MAILBOX *mb, unsigned long pos, cell source, cell size)
+{
+  MSGSLOT *slot = &mb->slot[pos & (MAILBOX_SLOTS - 1)];
+
+  slot->source = source;
+  slot->size = size;
+  BARRIER();                /* the message must be complete before it is published */
+  slot->seq = pos + 1;
+  #if defined __LINUX__
+    if (mb->wakefd >= 0 && ATOMIC_CAS(&mb->signalled, 0, 1)) {
+      uint64_t one = 1;
+      if (write(mb->wakefd, &one, sizeof one) < 0)
+        mb->signalled = 0;
+    } /* if */
+  #endif
+}
+
+static MAILBOX *mbox_open(AMX *amx, int index)
+{
+  MAILBOX *mb;
+  cell size;
+  int i;
+
+  /* reserve the buffers at the bottom of the heap (before the program runs) */
+  size = MAILBOX_SLOTS * MAILBOX_MSGSIZE * sizeof(cell);
+  if (amx->stp - amx->hea < 2 * size)
+    return NULL;
+  for (i = 0; i < MAILBOX_MAX; i++)
+    if (mailboxes[i].state == MBOX_FREE && ATOMIC_CAS(&mailboxes[i].state, MBOX_FREE, MBOX_SETUP))
+      break;
+  if (i >= MAILBOX_MAX)
+    return NULL;
+  mb = &mailboxes[i];
+  mb->buffer = amx->hea;
+  amx->hea += size;
+  mb->amx = amx;
+  mb->idxReceive = index;
+  mb->head = 0;
+  mb->tail = 0;
+  mb->signalled = 0;
+  mb->wakefd = -1;
+  mb->events = NULL;
+  for (i = 0; i < MAILBOX_SLOTS; i++)
+    mb->slot[i].seq = i;
+  BARRIER();
+  mb->state = MBOX_OPEN;
+  return mb;
+}
+
+static void AMXAPI mbox_release(AMX *amx, void *state)
+{
+  MAILBOX *mb = (MAILBOX*)state;
+
+  (void)amx;
+  mb->state = MBOX_CLOSING;
+  BARRIER();
+  while (mb->senders != 0)
+    YIELD();
+  if (mb->events != NULL)
+    mb->events->RemoveFile(mb->events, mb->wakefd);
+  #if defined __LINUX__
+    if (mb->wakefd >= 0)
+      close(mb->wakefd);
+  #endif
+  mb->named = 0;
+  mb->generation = (mb->generation + 1) & MAILBOX_GENMASK;
+  mb->amx = NULL;
+  mb->buffer = 0;
+  BARRIER();
+  mb->state = MBOX_FREE;
+}
+
+/* mbox_receive() runs @receive() for all messages in the mailbox */
+static int mbox_receive(AMX *amx, MAILBOX *mb, int AMXAPI Exec(AMX *, cell *, int))
+{
+  MSGSLOT *slot;
+  unsigned long pos;
+  int err = AMX_ERR_NONE;
+
+  while (err == AMX_ERR_NONE) {
+    pos = mb->tail;
+    slot = &mb->slot[pos & (MAILBOX_SLOTS - 1)];
+    if (slot->seq != pos + 1)
+      break;                /* empty, or a sender is still copying */
+    BARRIER();
+    amx_Push(amx, slot->size);
+    amx_PushAddress(amx, mbox_buffer(mb, pos));
+    amx_Push(amx, slot->source);
+    err = Exec(amx, NULL, mb->idxReceive);
+    while (err == AMX_ERR_SLEEP)
+      err = Exec(amx, NULL, AMX_EXEC_CONT);
+    BARRIER();              /* the slot may be reused after this point */
+    slot->seq = pos + MAILBOX_SLOTS;
+    mb->tail = pos + 1;
+  } /* while */
+  return err;
+}
+
+static int AMXAPI amx_MailboxIdle(AMX *amx, int AMXAPI Exec(AMX *, cell *, int))
+{
+  MAILBOX *mb;
+
+  if (amx_GetExtState(amx, MBOX_TAG, (void**)&mb) != AMX_ERR_NONE)
+    return AMX_ERR_NONE;
+  if (mb->PrevIdle != NULL)
+    mb->PrevIdle(amx, Exec);
+  return mbox_receive(amx, mb, Exec);
+}
+
+#if defined __LINUX__
+/* the event handler for the eventfd, for hosts with an event loop */
+static int AMXAPI mbox_event(AMX *amx, int AMXAPI Exec(AMX *, cell *, int), void *data)
+{
+  MAILBOX *mb = (MAILBOX*)data;
+  uint64_t count;
+
+  if (read(mb->wakefd, &count, sizeof count) < 0)
+    return AMX_ERR_NONE;
+  mb->signalled = 0;
+  BARRIER();                /* a message that arrives from here on signals again */
+  return mbox_receive(amx, mb, Exec);
+}
+#endif
+
+static int AMXAPI amx_MailboxEvents(AMX *amx, AMX_EVENTS *events)
+{
+  MAILBOX *mb;
+  int err;
+
+  if (amx_GetExtState(amx, MBOX_TAG, (void**)&mb) != AMX_ERR_NONE)
+    return AMX_ERR_NONE;
+  if (mb->PrevEvents != NULL && (err = mb->PrevEvents(amx, events)) != AMX_ERR_NONE)
+    return err;
+
+  #if defined __LINUX__
+    if ((mb->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+      return AMX_ERR_GENERAL;
+    if ((err = events->AddFile(events, amx, mb->wakefd, mbox_event, mb)) != AMX_ERR_NONE)
+      return err;
+    mb->events = events;
+  #else
+    (void)events;
+  #endif
+  return AMX_ERR_NONE;
+}
+
+static cell mbox_source(AMX *amx)
+{
+  MAILBOX *mb;
+
+  if (amx_GetExtState(amx, MBOX_TAG, (void**)&mb) != AMX_ERR_NONE)
+    return 0;
+  return mbox_id(mb);
+}
+
+/* mailbox_id()
+ * Returns the mailbox of the script, or 0 if the script has no @receive()
+ * function.
+ */
+static cell AMX_NATIVE_CALL n_mailbox_id(AMX *amx, const cell *params)
+{
+  (void)params;
+  return mbox_source(amx);
+}
+
+/* bool: mailbox_name(const name[])
+ * Gives the mailbox of the script a name, for mailbox_find(). A mailbox can
+ * be named only once.
+ */
+static cell AMX_NATIVE_CALL n_mailbox_name(AMX *amx, const cell *params)
+{
+  MAILBOX *mb;
+  cell *cstr;
+
+  if (amx_GetExtState(amx, MBOX_TAG, (void**)&mb) != AMX_ERR_NONE || mb->named)
+    return 0;
+  cstr = amx_Address(amx, params[1]);
+  amx_GetString(mb->name, cstr, 0, sizeof mb->name);
+  if (mb->name[0] == '\0')
+    return 0;
+  BARRIER();
+  mb->named = 1;
+  return 1;
+}
+
+/* mailbox_find(const name[])
+ * Returns the mailbox with the name, or 0 if there is none.
+ */
+static cell AMX_NATIVE_CALL n_mailbox_find(AMX *amx, const cell *params)
+{
+  char name[MAILBOX_NAMEMAX+1];
+  cell *cstr;
+  cell id;
+  int i;
+
+  cstr = amx_Address(amx, params[1]);
+  amx_GetString(name, cstr, 0, sizeof name);
+  for (i = 0; i < MAILBOX_MAX; i++) {
+    MAILBOX *mb = &mailboxes[i];
+    if (mb->state == MBOX_OPEN && mb->named) {
+      id = mbox_id(mb);
+      if (strcmp(mb->name, name) == 0 && mb->state == MBOX_OPEN && mbox_id(mb) == id)
+        return id;
+    } /* if */
+  } /* for */
+  return 0;
+}
+
+/* mbox_verify() checks that an array of "size" cells lies in the data of
+ * the abstract machine (it checks the first and the last cell)
+ */
+static int mbox_verify(AMX *amx, cell *cptr, cell size)
+{
+  if (cptr == NULL || !amx_VerifyAddress(amx, cptr))
+    return 0;
+  return size <= 1 || amx_VerifyAddress(amx, cptr + size - 1);
+}
+
+/* bool: mailbox_send(mailbox, const message[], size=sizeof message)
+ * Returns false if the mailbox does not exist, if it is full, if the
+ * message is larger than MAILBOX_MSGSIZE cells, or if the message does not
+ * lie in the memory of the script.
+ */
+static cell AMX_NATIVE_CALL n_mailbox_send(AMX *amx, const cell *params)
+{
+  MAILBOX *mb;
+  cell *cptr, *buffer;
+  cell size = params[3];
+  unsigned long pos;
+
+  if (size < 0 || size > MAILBOX_MSGSIZE)
+    return 0;
+  cptr = amx_Address(amx, params[2]);
+  if (!mbox_verify(amx, cptr, size))
+    return 0;
+  if ((mb = mbox_acquire(params[1])) == NULL)
+    return 0;
+  if ((buffer = mbox_claim(mb, &pos)) != NULL) {
+    memcpy(buffer, cptr, size * sizeof(cell));
+    mbox_publish(mb, pos, mbox_source(amx), size);
+  } /* if */
+  mbox_unacquire(mb);
+  return buffer != NULL;
+}
+
+/* bool: mailbox_sendstring(mailbox, const string[])
+ * The string arrives as a packed string; an unpacked string is packed while
+ * it is copied.
+ */
+static cell AMX_NATIVE_CALL n_mailbox_sendstring(AMX *amx, const cell *params)
+{
+  MAILBOX *mb;
+  cell *cstr, *buffer;
+  cell size;
+  unsigned long pos;
+  int length, i;
+
+  cstr = amx_Address(amx, params[2]);
+  if (!mbox_verify(amx, cstr, 1))
+    return 0;
+  amx_StrLen(cstr, &length);
+  size = length / sizeof(cell) + 1;
+  if (size > MAILBOX_MSGSIZE)
+    return 0;
+  if (!mbox_verify(amx, cstr, ((ucell)*cstr > UNPACKEDMAX) ? size : length))
+    return 0;
+  if ((mb = mbox_acquire(params[1])) == NULL)
+    return 0;
+  if ((buffer = mbox_claim(mb, &pos)) != NULL) {
+    if ((ucell)*cstr > UNPACKEDMAX) {
+      memcpy(buffer, cstr, size * sizeof(cell));
+    } else {
+      /* pack the characters, the first character goes in the highest byte */
+      memset(buffer, 0, size * sizeof(cell));
+      for (i = 0; i < length; i++)
+        buffer[i / sizeof(cell)] |= (cstr[i] & 0xff) << ((sizeof(cell) - 1 - i % sizeof(cell)) * 8);
+    } /* if */
+    mbox_publish(mb, pos, mbox_source(amx), size);
+  } /* if */
+  mbox_unacquire(mb);
+  return buffer != NULL;
+}
+
+#if defined __cplusplus
+  extern "C"
+#endif
+AMX_NATIVE_INFO mailbox_Natives[] = {
+  { "mailbox_id",         n_mailbox_id },
+  { "mailbox_name",       n_mailbox_name },
+  { "mailbox_find",       n_mailbox_find },
+  { "mailbox_send",       n_mailbox_send },
+  { "mailbox_sendstring", n_mailbox_sendstring },
+  { NULL, NULL }        /* terminator */
+};
+
+int AMXEXPORT AMXAPI amx_MailboxInit(AMX *amx)
+{
+  MAILBOX *mb;
+  int index;
+
+  /* only a script with an @receive() function gets a mailbox; other scripts
+   * can send messages, but not receive them
+   */
+  if (amx_GetExtState(amx, MBOX_TAG, (void**)&mb) != AMX_ERR_NONE
+      && amx_FindPublic(amx, "@receive", &index) == AMX_ERR_NONE)
+  {
+    if ((mb = mbox_open(amx, index)) == NULL)
+      return AMX_ERR_MEMORY;
+    if (amx_SetExtState(amx, MBOX_TAG, mb, mbox_release) != AMX_ERR_NONE) {
+      mbox_release(amx, mb);
+      return AMX_ERR_MEMORY;
+    } /* if */
+    if (amx_GetUserData(amx, AMX_USERTAG('I','d','l','e'), (void**)&mb->PrevIdle) != AMX_ERR_NONE)
+      mb->PrevIdle = NULL;
+    amx_SetUserData(amx, AMX_USERTAG('I','d','l','e'), amx_MailboxIdle);
+    if (amx_GetUserData(amx, AMX_EVENTTAG, (void**)&mb->PrevEvents) != AMX_ERR_NONE)
+      mb->PrevEvents = NULL;
+    amx_SetUserData(amx, AMX_EVENTTAG, amx_MailboxEvents);
+  } /* if */
+
+  return amx_Register(amx, mailbox_Natives, -1);
+}
+
+int AMXEXPORT AMXAPI amx_MailboxCleanup(AMX *amx)
+{
+  void *state;
+
+  if (amx_GetExtState(amx, MBOX_TAG, &state) == AMX_ERR_NONE) {
+    amx_SetExtState(amx, MBOX_TAG, NULL, NULL);
+    mbox_release(amx, state);
+  } /* if */
+  return AMX_ERR_NONE;
+}
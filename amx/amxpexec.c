@@ -0,0 +1,226 @@
+/*  Data-parallel calls of a public function, on worker threads
+ *
+ *  amx_ParallelExec() calls the same public function for every item in an
+ *  array of argument tuples, like a loop of amx_Push() and amx_Exec() calls
+ *  would, but it spreads the calls over a number of worker threads. Every
+ *  worker runs its own clone of the abstract machine (see amx_Clone()), which
+ *  is made before the first call, so the calls do not share the data, the
+ *  stack or the heap. The workers take the items in chunks, from a shared
+ *  counter, so that a worker that gets the quick items takes more chunks.
+ *
+ *  The calls must be independent of each other: changes that a call makes to
+ *  global variables stay in the clone of the worker that made the call, and
+ *  are not seen by the calls that run on other workers, nor by the original
+ *  abstract machine. Native functions must be safe to call from multiple
+ *  threads at the same time.
+ *
+ *  This module uses POSIX threads.
+ *
+ *  Copyright (c) CompuPhase, 2026
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxpexec.c $
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "amx.h"
+#include "amxpexec.h"
+
+#if !defined PEXEC_MAXWORKERS
+  #define PEXEC_MAXWORKERS  64
+#endif
+#define PEXEC_CHUNKS        8   /* chunks per worker, for load balancing */
+
+typedef struct tagBATCH {
+  pthread_mutex_t lock; /* protects "next" and "error" */
+  int index;            /* the public function */
+  const cell *args;
+  int numargs;
+  int count;
+  cell *retvals;
+  int chunk;            /* number of items that a worker takes at a time */
+  int next;             /* first item that no worker has taken yet */
+  int error;            /* error of the failed call with the lowest item number */
+  int erroritem;
+} BATCH;
+
+typedef struct tagWORKER {
+  AMX amx;              /* the clone */
+  void *data;           /* data, stack and heap of the clone */
+  BATCH *batch;
+  pthread_t thread;
+} WORKER;
+
+static int run_item(AMX *amx, const BATCH *batch, int item, cell *retval)
+{
+  const cell *args = batch->args + (size_t)item * batch->numargs;
+  int i, err = AMX_ERR_NONE;
+
+  for (i = batch->numargs - 1; i >= 0 && err == AMX_ERR_NONE; i--)
+    err = amx_Push(amx, args[i]);
+  if (err != AMX_ERR_NONE) {
+    /* drop the arguments that were pushed (amx_Exec() drops them otherwise) */
+    amx->stk += amx->paramcount * sizeof(cell);
+    amx->paramcount = 0;
+    return err;
+  } /* if */
+  err = amx_Exec(amx, retval, batch->index);
+  while (err == AMX_ERR_SLEEP)
+    err = amx_Exec(amx, retval, AMX_EXEC_CONT);
+  return err;
+}
+
+static void *worker(void *arg)
+{
+  WORKER *w = (WORKER*)arg;
+  BATCH *batch = w->batch;
+  int first, last, item, err;
+  cell retval;
+
+  for ( ;; ) {
+    /* take the next chunk; stop taking chunks after a call failed */
+    pthread_mutex_lock(&batch->lock);
+    first = batch->next;
+    if (batch->error != AMX_ERR_NONE)
+      first = batch->count;
+    last = first + batch->chunk;
+    if (last > batch->count)
+      last = batch->count;
+    batch->next = last;
+    pthread_mutex_unlock(&batch->lock);
+    if (first >= last)
+      break;
+
+    for (item = first; item < last; item++) {
+      retval = 0;
+      if ((err = run_item(&w->amx, batch, item, &retval)) != AMX_ERR_NONE) {
+        pthread_mutex_lock(&batch->lock);
+        if (batch->error == AMX_ERR_NONE || item < batch->erroritem) {
+          batch->error = err;
+          batch->erroritem = item;
+        } /* if */
+        pthread_mutex_unlock(&batch->lock);
+      } /* if */
+      if (batch->retvals != NULL)
+        batch->retvals[item] = retval;
+    } /* for */
+  } /* for */
+  return NULL;
+}
+
+static int make_clone(WORKER *w, AMX *amx)
+{
+  long datasize, stackheap;
+  int err;
+
+  if ((err = amx_MemInfo(amx, NULL, &datasize, &stackheap)) != AMX_ERR_NONE)
+    return err;
+  if ((w->data = malloc((size_t)(datasize + stackheap))) == NULL)
+    return AMX_ERR_MEMORY;
+  if ((amx->flags & AMX_FLAG_SEALED) != 0) {
+    err = amx_InitInstance(&w->amx, amx, w->data);
+  } else {
+    /* a clone that does not patch SYSREQ into SYSREQ.D, because the clones
+     * share the P-code
+     */
+    memset(&w->amx, 0, sizeof(AMX));
+    err = amx_Clone(&w->amx, amx, w->data);
+  } /* if */
+  if (err != AMX_ERR_NONE) {
+    free(w->data);
+    w->data = NULL;
+  } /* if */
+  return err;
+}
+
+/* amx_ParallelExec() returns AMX_ERR_NONE when all calls succeed. When a
+ * call fails, the workers take no further chunks, and the function returns
+ * the error code of the call with the lowest item number (the return values
+ * of the items after that call are undefined). The abstract machine itself
+ * is not modified; it must not run while amx_ParallelExec() runs.
+ */
+int AMXAPI amx_ParallelExec(AMX *amx, int index, const cell *args, int numargs,
+                            int count, cell *retvals, int workers)
+{
+  BATCH batch;
+  WORKER *pool;
+  int i, started, err;
+
+  if (amx == NULL || count < 0 || numargs < 0 || (numargs > 0 && args == NULL))
+    return AMX_ERR_PARAMS;
+  if ((amx->flags & AMX_FLAG_INIT) == 0)
+    return AMX_ERR_INIT;
+  if (count == 0)
+    return AMX_ERR_NONE;
+  if (workers <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = (cpus > 0) ? (int)cpus : 1;
+  } /* if */
+  if (workers > PEXEC_MAXWORKERS)
+    workers = PEXEC_MAXWORKERS;
+  if (workers > count)
+    workers = count;
+
+  memset(&batch, 0, sizeof batch);
+  batch.index = index;
+  batch.args = args;
+  batch.numargs = numargs;
+  batch.count = count;
+  batch.retvals = retvals;
+  batch.chunk = count / (workers * PEXEC_CHUNKS);
+  if (batch.chunk < 1)
+    batch.chunk = 1;
+  batch.error = AMX_ERR_NONE;
+
+  if ((pool = (WORKER*)malloc(workers * sizeof(WORKER))) == NULL)
+    return AMX_ERR_MEMORY;
+  memset(pool, 0, workers * sizeof(WORKER));
+  /* make all clones before the first call, so that they all start from the
+   * same data
+   */
+  err = AMX_ERR_NONE;
+  for (i = 0; i < workers && err == AMX_ERR_NONE; i++)
+    err = make_clone(&pool[i], amx);
+  if (err != AMX_ERR_NONE) {
+    while (i-- > 0)
+      free(pool[i].data);
+    free(pool);
+    return err;
+  } /* if */
+
+  pthread_mutex_init(&batch.lock, NULL);
+  /* the calling thread is the first worker; start the others */
+  for (started = 1; started < workers; started++) {
+    pool[started].batch = &batch;
+    if (pthread_create(&pool[started].thread, NULL, worker, &pool[started]) != 0)
+      break;    /* continue with fewer workers */
+  } /* for */
+  pool[0].batch = &batch;
+  worker(&pool[0]);
+  for (i = 1; i < started; i++)
+    pthread_join(pool[i].thread, NULL);
+  pthread_mutex_destroy(&batch.lock);
+
+  for (i = 0; i < workers; i++) {
+    if (pool[i].data != NULL) {
+      amx_Cleanup(&pool[i].amx);
+      free(pool[i].data);
+    } /* if */
+  } /* for */
+  free(pool);
+  return batch.error;
+}
@@ -0,0 +1,40 @@
+/*  Data-parallel calls of a public function, on worker threads
+ *
+ *  Copyright (c) CompuPhase, 2026
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxpexec.h $
+ */
+#ifndef AMXPEXEC_H_INCLUDED
+#define AMXPEXEC_H_INCLUDED
+
+#include "amx.h"
+
+#ifdef  __cplusplus
+extern  "C" {
+#endif
+
+/* "args" holds "count" tuples of "numargs" cells each; every tuple is one
+ * call of the public function, with the cells as arguments (by value). The
+ * return values are stored in "retvals" in the order of the tuples. With
+ * "workers" set to zero, there is a worker for every processor.
+ */
+int AMXAPI amx_ParallelExec(AMX *amx, int index, const cell *args, int numargs,
+                            int count, cell *retvals, int workers);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* AMXPEXEC_H_INCLUDED */
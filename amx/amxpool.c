@@ -1,15 +1,27 @@
 /*  Simple allocation from a memory pool, with automatic release of
  *  least-recently used blocks (LRU blocks).
  *
- *  These routines are as simple as possible, and they are neither re-entrant
- *  nor thread-safe. Their purpose is to have a standard implementation for
- *  systems where overlays are used and malloc() is not available.
+ *  These routines are as simple as possible. Their purpose is to have a
+ *  standard implementation for systems where overlays are used and malloc() is
+ *  not available.
  *
- *  The algorithm uses a first-fit strategy. It keeps all blocks in a single
- *  list (both used blocks and free blocks are in the same list). Every memory
- *  block must have a unique number that identifies the block. This unique
- *  number allows to search for the presence of the block in the pool and for
- *  "conditional allocation".
+ *  All state of a pool is in an AMX_POOL structure. The functions with the
+ *  "_r" suffix take this structure as an explicit parameter, so that each
+ *  abstract machine (or each thread) can have a pool of its own; these are
+ *  re-entrant, but a single pool must not be used by two threads at the same
+ *  time. The functions without suffix work on a single static pool, and they
+ *  are therefore not thread-safe.
+ *
+ *  Every block has a header and a footer that both hold the size of the
+ *  block ("boundary tags"), so that a block that is freed is merged with its
+ *  free neighbours in constant time, without walking through the pool. Free
+ *  blocks are kept in lists per size class (powers of two); an allocation
+ *  takes the first block that fits from the list of its size class, or any
+ *  block from the list of a larger class. Used blocks are in a list in the
+ *  order of their use, so that the least-recently used block is at the head,
+ *  and in a hash table on their number. Every memory block must have a unique
+ *  number that identifies the block. This unique number allows to search for
+ *  the presence of the block in the pool and for "conditional allocation".
  *
  *
  *  Copyright (c) CompuPhase, 2007-2020
@@ -37,36 +49,131 @@
 #endif
 
 #define MIN_BLOCKSIZE 32
-#define PROTECT_LRU   0xffff
+#define PROTECTED     0x0001  /* block is never released to make room */
 
 typedef struct tagARENA {
-  unsigned blocksize;
-  short index;      /* overlay index, -1 if free */
-  unsigned short lru;
+  unsigned blocksize;   /* size of the block, without header and footer */
+  short index;          /* overlay index, -1 if free */
+  unsigned short flags;
+  struct tagARENA *prev, *next; /* free block: list of its size class; used block: LRU list */
+  struct tagARENA *hnext;       /* used block: chain in the hash table */
 } ARENA;
 
-static void *pool_base;
-static unsigned pool_size;
-static unsigned short pool_lru;
+/* blocks are aligned to cells and to pointers (for the arena header) */
+#define BLOCKALIGN    (sizeof(cell)>sizeof(void*) ? sizeof(cell) : sizeof(void*))
+#define ALIGNUP(n)    ((((n)+BLOCKALIGN-1)/BLOCKALIGN)*BLOCKALIGN)
+#define HDRSIZE       ALIGNUP(sizeof(ARENA))
+#define FOOTSIZE      ALIGNUP(sizeof(unsigned))
+#define OVERHEAD      (HDRSIZE+FOOTSIZE)
+
+#define FOOTER(h)     (*(unsigned*)((char*)(h)+HDRSIZE+(h)->blocksize))
+#define NEXTBLOCK(h)  ((ARENA*)((char*)(h)+OVERHEAD+(h)->blocksize))
+#define PREVBLOCK(h)  ((ARENA*)((char*)(h)-OVERHEAD-*(unsigned*)((char*)(h)-FOOTSIZE)))
+#define POOLEND(p)    ((char*)(p)->base+(p)->size)
+
+static AMX_POOL defpool;   /* pool for the non-re-entrant functions */
 
-static void touchblock(ARENA *hdr);
-static ARENA *findblock(int index);
+static void touchblock(AMX_POOL *pool, ARENA *hdr);
+static ARENA *findblock(AMX_POOL *pool, int index);
+
+/* sizeclass() returns the list for a free block: class k holds the blocks of
+ * 2^k up to 2^(k+1) units of BLOCKALIGN bytes; the last class holds all
+ * larger blocks as well
+ */
+static int sizeclass(unsigned size)
+{
+  unsigned units=size/BLOCKALIGN;
+  int c=0;
+  while (units>1 && c<AMX_POOLCLASSES-1) {
+    units>>=1;
+    c++;
+  } /* while */
+  return c;
+}
+
+static void link_free(AMX_POOL *pool, ARENA *hdr)
+{
+  int c=sizeclass(hdr->blocksize);
+  hdr->index=-1;
+  hdr->flags=0;
+  FOOTER(hdr)=hdr->blocksize;
+  hdr->prev=NULL;
+  hdr->next=(ARENA*)pool->freelist[c];
+  if (hdr->next!=NULL)
+    hdr->next->prev=hdr;
+  pool->freelist[c]=hdr;
+}
+
+static void unlink_free(AMX_POOL *pool, ARENA *hdr)
+{
+  assert(hdr->index==-1);
+  if (hdr->prev!=NULL)
+    hdr->prev->next=hdr->next;
+  else
+    pool->freelist[sizeclass(hdr->blocksize)]=hdr->next;
+  if (hdr->next!=NULL)
+    hdr->next->prev=hdr->prev;
+}
+
+/* the LRU list holds the used blocks that are not protected; the most
+ * recently used block is at the tail
+ */
+static void link_lru(AMX_POOL *pool, ARENA *hdr)
+{
+  hdr->next=NULL;
+  hdr->prev=(ARENA*)pool->lrutail;
+  if (hdr->prev!=NULL)
+    hdr->prev->next=hdr;
+  else
+    pool->lruhead=hdr;
+  pool->lrutail=hdr;
+}
+
+static void unlink_lru(AMX_POOL *pool, ARENA *hdr)
+{
+  if (hdr->prev!=NULL)
+    hdr->prev->next=hdr->next;
+  else
+    pool->lruhead=hdr->next;
+  if (hdr->next!=NULL)
+    hdr->next->prev=hdr->prev;
+  else
+    pool->lrutail=hdr->prev;
+}
 
-/* amx_poolinit() initializes the memory pool for the allocated blocks.
- * If parameter pool is NULL, the existing pool is cleared (without changing
+static void link_hash(AMX_POOL *pool, ARENA *hdr)
+{
+  int bucket=hdr->index & (AMX_POOLHASH-1);
+  hdr->hnext=(ARENA*)pool->hash[bucket];
+  pool->hash[bucket]=hdr;
+}
+
+static void unlink_hash(AMX_POOL *pool, ARENA *hdr)
+{
+  ARENA **ptr=(ARENA**)&pool->hash[hdr->index & (AMX_POOLHASH-1)];
+  while (*ptr!=hdr) {
+    assert(*ptr!=NULL);
+    ptr=&(*ptr)->hnext;
+  } /* while */
+  *ptr=hdr->hnext;
+}
+
+/* amx_poolinit_r() initializes the memory pool for the allocated blocks.
+ * If parameter base is NULL, the existing pool is cleared (without changing
  * its position or size).
  */
-void amx_poolinit(void *pool, unsigned size)
+void amx_poolinit_r(AMX_POOL *pool, void *base, unsigned size)
 {
-  assert(pool!=NULL || pool_base!=NULL);
-  if (pool!=NULL) {
-    assert(size>sizeof(ARENA));
-    /* save parameters in global variables, then "free" the entire pool */
-    pool_base=pool;
-    pool_size=size;
+  assert(pool!=NULL);
+  assert(base!=NULL || pool->base!=NULL);
+  if (base!=NULL) {
+    /* save parameters in the pool structure, then "free" the entire pool */
+    unsigned skip=(unsigned)(ALIGNUP((size_t)base)-(size_t)base);
+    assert(size>skip+OVERHEAD+MIN_BLOCKSIZE);
+    pool->base=(char*)base+skip;
+    pool->size=((size-skip)/BLOCKALIGN)*BLOCKALIGN;
   } /* if */
-  pool_lru=0;
-  amx_poolfree(NULL);
+  amx_poolfree_r(pool, NULL);
 }
 
 /* amx_poolfree() releases a block allocated earlier. The parameter must have
@@ -76,48 +183,72 @@ void amx_poolinit(void *pool, unsigned size)
  * When parameter "block" is NULL, the pool is re-initialized (meaning that
  * all blocks are freed).
  */
-void amx_poolfree(void *block)
+void amx_poolfree_r(AMX_POOL *pool, void *block)
 {
   ARENA *hdr,*hdr2;
-  unsigned sz;
+  int i;
 
-  assert(pool_base!=NULL);
-  assert(pool_size>sizeof(ARENA));
+  assert(pool!=NULL);
+  assert(pool->base!=NULL);
+  assert(pool->size>OVERHEAD);
 
   /* special case: if "block" is NULL, create a single free space */
   if (block==NULL) {
-    /* store an arena header at the start of the pool */
-    hdr=(ARENA*)pool_base;
-    hdr->blocksize=pool_size-sizeof(ARENA);
-    hdr->index=-1;
-    hdr->lru=0;
-  } else {
-    hdr=(ARENA*)((char*)block-sizeof(ARENA));
-    assert((char*)hdr>=(char*)pool_base && (char*)hdr<(char*)pool_base+pool_size);
-    assert(hdr->blocksize<pool_size);
-
-    /* free this block */
-    hdr->index=-1;
-
-    /* try to coalesce with the next block */
-    hdr2=(ARENA*)((char*)hdr+hdr->blocksize+sizeof(ARENA));
-    if (hdr2->index==-1)
-      hdr->blocksize+=hdr2->blocksize+sizeof(ARENA);
-
-    /* try to coalesce with the previous block */
-    if ((void*)hdr!=pool_base) {
-      sz=pool_size;
-      hdr2=(ARENA*)pool_base;
-      while (sz>0 && (char*)hdr2+hdr2->blocksize+sizeof(ARENA)!=(char*)hdr) {
-        assert(sz<=pool_size);
-        sz-=hdr2->blocksize+sizeof(ARENA);
-        hdr2=(ARENA*)((char*)hdr2+hdr2->blocksize+sizeof(ARENA));
-      } /* while */
-      assert((char*)hdr2+hdr2->blocksize+sizeof(ARENA)==(char*)hdr);
-      if (hdr2->index==-1)
-        hdr2->blocksize+=hdr->blocksize+sizeof(ARENA);
+    for (i=0; i<AMX_POOLCLASSES; i++)
+      pool->freelist[i]=NULL;
+    for (i=0; i<AMX_POOLHASH; i++)
+      pool->hash[i]=NULL;
+    pool->lruhead=pool->lrutail=NULL;
+    hdr=(ARENA*)pool->base;
+    hdr->blocksize=pool->size-OVERHEAD;
+    link_free(pool,hdr);
+    return;
+  } /* if */
+
+  hdr=(ARENA*)((char*)block-HDRSIZE);
+  assert((char*)hdr>=(char*)pool->base && (char*)hdr<POOLEND(pool));
+  assert(hdr->blocksize<pool->size);
+  assert(hdr->index!=-1);
+  unlink_hash(pool,hdr);
+  if ((hdr->flags & PROTECTED)==0)
+    unlink_lru(pool,hdr);
+
+  /* try to coalesce with the next block */
+  hdr2=NEXTBLOCK(hdr);
+  if ((char*)hdr2<POOLEND(pool) && hdr2->index==-1) {
+    unlink_free(pool,hdr2);
+    hdr->blocksize+=hdr2->blocksize+OVERHEAD;
+  } /* if */
+
+  /* try to coalesce with the previous block, found through its footer */
+  if ((void*)hdr!=pool->base) {
+    hdr2=PREVBLOCK(hdr);
+    assert((char*)hdr2>=(char*)pool->base && NEXTBLOCK(hdr2)==hdr);
+    if (hdr2->index==-1) {
+      unlink_free(pool,hdr2);
+      hdr2->blocksize+=hdr->blocksize+OVERHEAD;
+      hdr=hdr2;
     } /* if */
   } /* if */
+
+  link_free(pool,hdr);
+}
+
+/* findfree() returns a free block of at least "size" bytes, or NULL */
+static ARENA *findfree(AMX_POOL *pool, unsigned size)
+{
+  ARENA *hdr;
+  int c=sizeclass(size);
+
+  /* in the class of the requested size, a block may still be too small */
+  for (hdr=(ARENA*)pool->freelist[c]; hdr!=NULL && hdr->blocksize<size; hdr=hdr->next)
+    /* nothing */;
+  /* any block in a larger class is big enough (except in the last class) */
+  while (hdr==NULL && ++c<AMX_POOLCLASSES) {
+    for (hdr=(ARENA*)pool->freelist[c]; hdr!=NULL && hdr->blocksize<size; hdr=hdr->next)
+      /* nothing */;
+  } /* while */
+  return hdr;
 }
 
 /* amx_poolalloc() allocates the requested number of bytes from the pool and
@@ -134,135 +265,138 @@ void amx_poolfree(void *block)
  * the requested amount of memory can be allocated. There is no intelligent
  * algorithm involved: the routine just frees the least-recently used block at
  * every iteration (without considering the size of the block or whether that
- * block is adjacent to a free block).
+ * block is adjacent to a free block). When only protected blocks remain and
+ * the requested size still does not fit, the function returns NULL.
  */
-void *amx_poolalloc(unsigned size,int index)
+void *amx_poolalloc_r(AMX_POOL *pool, unsigned size, int index)
 {
-  ARENA *hdr,*hdrlru;
-  unsigned sz;
-  unsigned short minlru;
+  ARENA *hdr;
 
   assert(size>0);
   assert(index>=0 && index<=SHRT_MAX);
-  assert(findblock(index)==NULL);
+  assert(findblock(pool,index)==NULL);
 
-  /* align the size to a cell boundary */
-  if ((size % sizeof(cell))!=0)
-    size+=sizeof(cell)-(size % sizeof(cell));
-  if (size+sizeof(ARENA)>pool_size)
+  /* align the size to a cell boundary (and to a pointer boundary) */
+  size=(unsigned)ALIGNUP(size);
+  if (size+OVERHEAD>pool->size)
     return NULL;  /* requested block does not fit in the pool */
 
-  /* find a block large enough to get the size plus an arena header; at
-   * the same time, detect the block with the lowest LRU
-   * if no block of sufficient size can be found, the routine then frees
-   * the block with the lowest LRU count and tries again
+  /* find a free block large enough for the size; if there is none, free the
+   * least-recently used block and try again
    */
-  do {
-    sz=pool_size;
-    hdr=(ARENA*)pool_base;
-    hdrlru=hdr;
-    minlru=USHRT_MAX;
-    while (sz>0) {
-      assert(sz<=pool_size);
-      assert((char*)hdr>=(char*)pool_base && (char*)hdr<(char*)pool_base+pool_size);
-      if (hdr->index==-1 && hdr->blocksize>=size)
-        break;
-      if (hdr->index!=-1 && hdr->lru<minlru) {
-        minlru=hdr->lru;
-        hdrlru=hdr;
-      } /* if */
-      sz-=hdr->blocksize+sizeof(ARENA);
-      hdr=(ARENA*)((char*)hdr+hdr->blocksize+sizeof(ARENA));
-    } /* while */
-    assert(sz<=pool_size);
-    if (sz==0) {
-      /* free up memory and try again */
-      assert(hdrlru->index!=-1);
-      amx_poolfree((char*)hdrlru+sizeof(ARENA));
-    } /* if */
-  } while (sz==0);
+  while ((hdr=findfree(pool,size))==NULL) {
+    if (pool->lruhead==NULL)
+      return NULL;
+    amx_poolfree_r(pool,(char*)pool->lruhead+HDRSIZE);
+  } /* while */
+  unlink_free(pool,hdr);
 
   /* see whether to allocate the entire free block, or to cut it in two blocks */
-  if (hdr->blocksize>size+MIN_BLOCKSIZE+sizeof(ARENA)) {
+  if (hdr->blocksize>=size+OVERHEAD+MIN_BLOCKSIZE) {
     /* cut the block in two */
-    ARENA *next=(ARENA*)((char*)hdr+size+sizeof(ARENA));
-    next->blocksize=hdr->blocksize-size-sizeof(ARENA);
-    next->index=-1;
-    next->lru=0;
-  } else {
-    size=hdr->blocksize;
+    ARENA *next=(ARENA*)((char*)hdr+OVERHEAD+size);
+    next->blocksize=hdr->blocksize-size-OVERHEAD;
+    link_free(pool,next);
+    hdr->blocksize=size;
   } /* if */
-  hdr->blocksize=size;
+  FOOTER(hdr)=hdr->blocksize;
   hdr->index=(short)index;
-  touchblock(hdr);    /* set LRU field */
+  hdr->flags=0;
+  link_hash(pool,hdr);
+  link_lru(pool,hdr);
 
-  return (void*)((char*)hdr+sizeof(ARENA));
+  return (void*)((char*)hdr+HDRSIZE);
 }
 
 /* amx_poolfind() returns the address of the memory block with the given index,
  * or NULL if no such block exists. Parameter "index" should not be -1, because
  * -1 represents a free block (actually, only positive values are valid).
- * When amx_poolfind() finds the block, it increments its LRU count.
+ * When amx_poolfind() finds the block, it marks it as the most recently used.
  */
-void *amx_poolfind(int index)
+void *amx_poolfind_r(AMX_POOL *pool, int index)
 {
-  ARENA *hdr=findblock(index);
+  ARENA *hdr=findblock(pool,index);
   if (hdr==NULL)
     return NULL;
-  touchblock(hdr);
-  return (void*)((char*)hdr+sizeof(ARENA));
+  touchblock(pool,hdr);
+  return (void*)((char*)hdr+HDRSIZE);
 }
 
-int amx_poolprotect(int index)
+int amx_poolprotect_r(AMX_POOL *pool, int index)
 {
-  ARENA *hdr=findblock(index);
+  ARENA *hdr=findblock(pool,index);
   if (hdr==NULL)
     return AMX_ERR_GENERAL;
-  hdr->lru=PROTECT_LRU;
+  if ((hdr->flags & PROTECTED)==0) {
+    unlink_lru(pool,hdr);
+    hdr->flags|=PROTECTED;
+  } /* if */
   return AMX_ERR_NONE;
 }
 
-static ARENA *findblock(int index)
+/* amx_poolunprotect() puts a protected block back in the list of blocks that
+ * may be released, as the most recently used block.
+ */
+int amx_poolunprotect_r(AMX_POOL *pool, int index)
+{
+  ARENA *hdr=findblock(pool,index);
+  if (hdr==NULL)
+    return AMX_ERR_GENERAL;
+  if ((hdr->flags & PROTECTED)!=0) {
+    hdr->flags&=~PROTECTED;
+    link_lru(pool,hdr);
+  } /* if */
+  return AMX_ERR_NONE;
+}
+
+static ARENA *findblock(AMX_POOL *pool, int index)
 {
   ARENA *hdr;
-  unsigned sz;
 
   assert(index>=0);
-  sz=pool_size;
-  hdr=(ARENA*)pool_base;
-  while (sz>0 && hdr->index!=index) {
-    assert(sz<=pool_size);
-    assert((char*)hdr>=(char*)pool_base && (char*)hdr<(char*)pool_base+pool_size);
-    sz-=hdr->blocksize+sizeof(ARENA);
-    hdr=(ARENA*)((char*)hdr+hdr->blocksize+sizeof(ARENA));
-  } /* while */
-  assert(sz<=pool_size);
-  return (sz>0 && hdr->index==index) ? hdr : NULL;
+  for (hdr=(ARENA*)pool->hash[index & (AMX_POOLHASH-1)]; hdr!=NULL && hdr->index!=index; hdr=hdr->hnext)
+    /* nothing */;
+  return hdr;
 }
 
-static void touchblock(ARENA *hdr)
+static void touchblock(AMX_POOL *pool, ARENA *hdr)
 {
   assert(hdr!=NULL);
-  if (++pool_lru >= PROTECT_LRU)
-    pool_lru=0;
-  hdr->lru=pool_lru;
-
-  /* special case: if the overlay LRU count wrapped back to zero, set the
-   * LRU count of all blocks to zero, but set the count of the block just
-   * touched to 1 (skip blocks marked as protected, too)
-   */
-  if (pool_lru==0) {
-    ARENA *hdr2;
-    unsigned sz=pool_size;
-    hdr2=(ARENA*)pool_base;
-    while (sz>0) {
-      assert(sz<=pool_size);
-      if (hdr2->lru!=PROTECT_LRU)
-        hdr2->lru=0;
-      sz-=hdr2->blocksize+sizeof(ARENA);
-      hdr2=(ARENA*)((char*)hdr2+hdr2->blocksize+sizeof(ARENA));
-    } /* while */
-    assert(sz==0);
-    hdr->lru=++pool_lru;
+  if ((hdr->flags & PROTECTED)==0 && pool->lrutail!=hdr) {
+    unlink_lru(pool,hdr);
+    link_lru(pool,hdr);
   } /* if */
 }
+
+/* The functions below are the original (non-re-entrant) interface, which
+ * uses a single static pool.
+ */
+void amx_poolinit(void *pool, unsigned size)
+{
+  amx_poolinit_r(&defpool, pool, size);
+}
+
+void amx_poolfree(void *block)
+{
+  amx_poolfree_r(&defpool, block);
+}
+
+void *amx_poolalloc(unsigned size, int index)
+{
+  return amx_poolalloc_r(&defpool, size, index);
+}
+
+void *amx_poolfind(int index)
+{
+  return amx_poolfind_r(&defpool, index);
+}
+
+int amx_poolprotect(int index)
+{
+  return amx_poolprotect_r(&defpool, index);
+}
+
+int amx_poolunprotect(int index)
+{
+  return amx_poolunprotect_r(&defpool, index);
+}
@@ -20,11 +20,34 @@
 #ifndef AMXPOOL_H_INCLUDED
 #define AMXPOOL_H_INCLUDED
 
+#if !defined AMX_POOLCLASSES
+  #define AMX_POOLCLASSES 16  /* lists of free blocks, per power of 2 */
+#endif
+#if !defined AMX_POOLHASH
+  #define AMX_POOLHASH    32  /* buckets for finding blocks, must be a power of 2 */
+#endif
+
+typedef struct tagAMX_POOL {
+  void *base;
+  unsigned size;
+  void *freelist[AMX_POOLCLASSES];
+  void *lruhead, *lrutail;  /* used blocks, least-recently used first */
+  void *hash[AMX_POOLHASH];
+} AMX_POOL;
+
+void  amx_poolinit_r(AMX_POOL *pool, void *base, unsigned size);
+void *amx_poolalloc_r(AMX_POOL *pool, unsigned size, int index);
+void  amx_poolfree_r(AMX_POOL *pool, void *block);
+void *amx_poolfind_r(AMX_POOL *pool, int index);
+int   amx_poolprotect_r(AMX_POOL *pool, int index);
+int   amx_poolunprotect_r(AMX_POOL *pool, int index);
+
 void  amx_poolinit(void *pool, unsigned size);
 void *amx_poolalloc(unsigned size, int index);
 void  amx_poolfree(void *block);
 void *amx_poolfind(int index);
 int   amx_poolprotect(int index);
+int   amx_poolunprotect(int index);
 
 
 #endif /* AMXPOOL_H_INCLUDED */
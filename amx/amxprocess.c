@@ -850,68 +850,123 @@ static cell AMX_NATIVE_CALL n_procwrite(AMX *amx, const cell *params)
   return 1;
 }
 
-/* bool: procread(line[], size=sizeof line, bool:striplf=false, bool:packed=false)
+/* procread() and procwait() block until the child process produces output
+ * or exits, so they pass the wait to amx_Async(); the jobs run while the
+ * abstract machine is suspended, and they free their own data.
  */
-static cell AMX_NATIVE_CALL n_procread(AMX *amx, const cell *params)
+typedef struct tagREADJOB {
+  #if defined __WIN32__ || defined _WIN32 || defined WIN32
+    HANDLE pipe;
+  #else
+    int pipe;
+  #endif
+  cell *cptr;
+  cell size;
+  int striplf;
+  int packed;
+} READJOB;
+
+static cell AMXAPI job_procread(void *data)
 {
+  READJOB *job=(READJOB*)data;
   TCHAR line[128];
-  cell *cptr;
   unsigned long num;
   int index;
 
   index=0;
   #if defined __WIN32__ || defined _WIN32 || defined WIN32
-    if (read_stdout==NULL)
-      return 0;
     do {
-      if (!ReadFile(read_stdout,line+index,1,&num,NULL))
+      if (!ReadFile(job->pipe,line+index,1,&num,NULL))
         break;
       index++;
     } while (index<sizeof(line)/sizeof(line[0])-1 && line[index-1]!=__T('\n'));
   #elif defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
-    if (pipe_from[0]<0)
-      return 0;
+    (void)num;
     do {
-      if (read(pipe_from[0],line+index,1)<0)
+      if (read(job->pipe,line+index,1)<=0)
         break;
       index++;
     } while (index<sizeof(line)/sizeof(line[0])-1 && line[index-1]!=__T('\n'));
+  #else
+    (void)num;
   #endif
 
-  if (params[3])
+  if (job->striplf)
     while (index>0 && (line[index-1]==__T('\r') || line[index-1]==__T('\n')))
       index--;
   line[index]=__T('\0');
 
-  cptr=amx_Address(amx,params[1]);
-  amx_SetString(cptr,line,params[4],sizeof(TCHAR)>1,params[2]);
+  amx_SetString(job->cptr,line,job->packed,sizeof(TCHAR)>1,job->size);
+  free(job);
   return 1;
 }
 
-/* procwait(PID:pid)
- * Waits until the process has terminated.
+/* bool: procread(line[], size=sizeof line, bool:striplf=false, bool:packed=false)
  */
-static cell AMX_NATIVE_CALL n_procwait(AMX *amx, const cell *params)
+static cell AMX_NATIVE_CALL n_procread(AMX *amx, const cell *params)
+{
+  READJOB *job;
+
+  #if defined __WIN32__ || defined _WIN32 || defined WIN32
+    if (read_stdout==NULL)
+      return 0;
+  #elif defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
+    if (pipe_from[0]<0)
+      return 0;
+  #endif
+  if ((job=(READJOB*)malloc(sizeof(READJOB)))==NULL)
+    return 0;
+  #if defined __WIN32__ || defined _WIN32 || defined WIN32
+    job->pipe=read_stdout;
+  #elif defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
+    job->pipe=pipe_from[0];
+  #else
+    job->pipe=0;
+  #endif
+  job->cptr=amx_Address(amx,params[1]);
+  job->size=params[2];
+  job->striplf=(int)params[3];
+  job->packed=(int)params[4];
+  return amx_Async(amx,job_procread,job);
+}
+
+static cell AMXAPI job_procwait(void *data)
 {
   #if defined __WIN32__ || defined _WIN32 || defined WIN32
     HANDLE hProcess;
     DWORD exitcode;
   #endif
+  cell pid=*(cell*)data;
 
-  (void)amx;
+  free(data);
   #if defined __WIN32__ || defined _WIN32 || defined WIN32
-    hProcess = OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, (DWORD)params[1]);
+    hProcess = OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, (DWORD)pid);
     if (hProcess != NULL) {
       while (GetExitCodeProcess(hProcess,&exitcode) && exitcode==STILL_ACTIVE)
         Sleep(100);
       CloseHandle(hProcess);
     } /* if */
   #elif defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
-    waitpid((pid_t)params[1],NULL,WNOHANG);
+    waitpid((pid_t)pid,NULL,0);
+  #else
+    (void)pid;
   #endif
   return 0;
 }
 
+/* procwait(PID:pid)
+ * Waits until the process has terminated.
+ */
+static cell AMX_NATIVE_CALL n_procwait(AMX *amx, const cell *params)
+{
+  cell *pid;
+
+  if ((pid=(cell*)malloc(sizeof(cell)))==NULL)
+    return 0;
+  *pid=params[1];
+  return amx_Async(amx,job_procwait,pid);
+}
+
 
 #if defined __cplusplus
   extern "C"
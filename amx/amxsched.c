@@ -0,0 +1,794 @@
+/*  Multi-threaded scheduler for abstract machines that sleep
+ *
+ *  The scheduler runs many abstract machines ("tasks") on a fixed pool of
+ *  worker threads. It builds on the "sleep" mechanism of the abstract
+ *  machine: when amx_Exec() returns with AMX_ERR_SLEEP, the task is parked
+ *  and a worker later resumes it with AMX_EXEC_CONT. The sleep operand (which
+ *  the abstract machine returns in the "pri" register) selects how long the
+ *  task is parked:
+ *    > 0   wake up after this many milliseconds
+ *    = 0   yield, the task is queued again at once
+ *    < 0   wait until some other thread calls sched_Wake() on the task
+ *  Native functions that return AMX_ERR_SLEEP (see amx_RaiseError()) put
+ *  their return value in "pri", so they choose the delay in the same way.
+ *  The scheduler sets the user value "Slep" (AMX_ASYNCTAG) on the abstract
+ *  machines that it runs, to tell natives (like delay() of the amxTime module)
+ *  that they may sleep instead of blocking the worker.
+ *
+ *  The user value points to an AMX_ASYNC structure, so that natives that wait
+ *  on I/O can pass the blocking part to amx_Async(). The scheduler runs these
+ *  jobs on a separate pool of I/O threads (started when the first job
+ *  arrives); the task waits until its job completes and then resumes with the
+ *  result of the job as the return value of the native function. A task that
+ *  waits for a job ignores sched_Wake(), but it keeps the wakeup for later.
+ *
+ *  With a time slice (see sched_SetTimeslice()), a task that runs for longer
+ *  than its slice is preempted (amx_Exec() returns AMX_ERR_BUDGET) and it is
+ *  handled like a task that yields. This needs a core that checks the
+ *  instruction budget (the ANSI-C core, the GNU GCC core or the x86-64 JIT).
+ *
+ *  Every worker has a run queue of its own. A worker takes tasks from the
+ *  head of its own queue, so that tasks that yield or that are preempted run
+ *  in turn, and when that queue is empty, it steals tasks from the tail of
+ *  the queues of other workers. Tasks with a timed wakeup are in
+ *  a heap that is shared by all workers. Workers that find no work block
+ *  until a task becomes ready or the earliest timed wakeup expires.
+ *
+ *  A task must be the only user of its abstract machine while it is in the
+ *  scheduler. The abstract machines do not share state (see
+ *  amx_SetExtState()), so they may run concurrently on different workers.
+ *
+ *  This module uses POSIX threads.
+ *
+ *  Copyright (c) CompuPhase, 2026
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxsched.c $
+ */
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "amx.h"
+#include "amxsched.h"
+
+#if !defined SCHED_MAXWORKERS
+  #define SCHED_MAXWORKERS  64
+#endif
+#if !defined SCHED_IOTHREADS
+  #define SCHED_IOTHREADS   4   /* threads that run jobs from amx_Async() */
+#endif
+#define SCHED_TAG           AMX_USERTAG('S','c','h','d')
+#define TIMERCHECK          32  /* check timed wakeups after this many runs */
+
+#define ATOMIC_LOAD(ptr)    __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define ATOMIC_ADD(ptr,value) __atomic_add_fetch((ptr), (value), __ATOMIC_SEQ_CST)
+
+#if defined CLOCK_MONOTONIC && !defined __APPLE__
+  #define SCHED_CLOCK       CLOCK_MONOTONIC
+#else
+  #define SCHED_CLOCK       CLOCK_REALTIME
+#endif
+
+enum {
+  TASK_READY,           /* in a run queue */
+  TASK_RUNNING,         /* being run by a worker */
+  TASK_TIMED,           /* in the timer heap */
+  TASK_WAITING,         /* waiting for sched_Wake() or for a job */
+};
+
+enum {
+  JOB_NONE,
+  JOB_PENDING,          /* submitted with amx_Async(), not completed */
+  JOB_DONE,             /* completed, the result must still go into "pri" */
+};
+
+struct tagAMX_TASK {
+  AMX_SCHED *sched;
+  AMX *amx;
+  int index;            /* public function to start; AMX_EXEC_CONT after the first run */
+  int state;
+  int wakeup;           /* sched_Wake() was called while the task was not sleeping */
+  int worker;           /* worker that ran it last */
+  int heapidx;          /* position in the timer heap */
+  long long deadline;   /* time of the timed wakeup, in microseconds */
+  long timeslice;       /* instruction budget per run, 0 for none */
+  int job;              /* JOB_xxx */
+  cell result;          /* result of the job */
+  SCHED_DONE done;
+  void *userdata;
+  AMX_TASK *prev, *next;/* list of all tasks */
+};
+
+typedef struct tagRUNQUEUE {
+  pthread_mutex_t lock;
+  AMX_TASK **items;     /* circular buffer */
+  int size;             /* always a power of 2 */
+  int head, count;
+} RUNQUEUE;
+
+typedef struct tagWORKER {
+  AMX_SCHED *sched;
+  pthread_t thread;
+  RUNQUEUE queue;
+  unsigned seed;        /* for picking a victim to steal from */
+  int number;
+  int timerstamp;       /* copy of "timerstamp" of the scheduler */
+  long long deadline;   /* earliest timed wakeup at the last timer check */
+} WORKER;
+
+typedef struct tagJOB {
+  AMX_TASK *task;
+  AMX_ASYNCFUNC func;
+  void *data;
+  struct tagJOB *next;
+} JOB;
+
+struct tagAMX_SCHED {
+  pthread_mutex_t lock; /* protects the fields below, and the state of tasks */
+  pthread_cond_t ready; /* signalled when there is work for idle workers */
+  pthread_cond_t empty; /* signalled when the last task finishes */
+  AMX_TASK **heap;      /* timed wakeups, ordered on deadline */
+  int heapsize, heapcount;
+  AMX_TASK *tasks;      /* list of all tasks that have not finished */
+  int taskcount;
+  int idle;             /* number of workers waiting on "ready" (atomic) */
+  int timerstamp;       /* incremented when the earliest timed wakeup changes (atomic) */
+  int stop;
+  int submitted;        /* for distributing new tasks over the workers */
+  long timeslice;       /* for new tasks */
+  int numworkers;
+  int numthreads;       /* number of workers whose thread was started */
+  WORKER *workers;
+  AMX_ASYNC async;      /* user value AMX_ASYNCTAG of all tasks */
+  pthread_cond_t jobready;  /* signalled when a job is queued */
+  JOB *jobhead, *jobtail;
+  int numiothreads;
+  pthread_t iothreads[SCHED_IOTHREADS];
+};
+
+/* the time in microseconds; a delay in milliseconds would wake a task up
+ * early by the rounding of the current time
+ */
+static long long now(void)
+{
+  struct timespec ts;
+  clock_gettime(SCHED_CLOCK, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* ----- run queues ----- */
+
+static int queue_init(RUNQUEUE *queue)
+{
+  queue->size = 64;
+  queue->head = queue->count = 0;
+  if ((queue->items = (AMX_TASK**)malloc(queue->size * sizeof(AMX_TASK*))) == NULL)
+    return 0;
+  pthread_mutex_init(&queue->lock, NULL);
+  return 1;
+}
+
+static void queue_free(RUNQUEUE *queue)
+{
+  pthread_mutex_destroy(&queue->lock);
+  free(queue->items);
+}
+
+static int queue_push(RUNQUEUE *queue, AMX_TASK *task)
+{
+  pthread_mutex_lock(&queue->lock);
+  if (queue->count == queue->size) {
+    AMX_TASK **items = (AMX_TASK**)malloc(2 * queue->size * sizeof(AMX_TASK*));
+    int i;
+    if (items == NULL) {
+      pthread_mutex_unlock(&queue->lock);
+      return 0;
+    } /* if */
+    for (i = 0; i < queue->count; i++)
+      items[i] = queue->items[(queue->head + i) & (queue->size - 1)];
+    free(queue->items);
+    queue->items = items;
+    queue->size *= 2;
+    queue->head = 0;
+  } /* if */
+  queue->items[(queue->head + queue->count) & (queue->size - 1)] = task;
+  queue->count++;
+  pthread_mutex_unlock(&queue->lock);
+  return 1;
+}
+
+static int queue_count(RUNQUEUE *queue)
+{
+  int count;
+  pthread_mutex_lock(&queue->lock);
+  count = queue->count;
+  pthread_mutex_unlock(&queue->lock);
+  return count;
+}
+
+/* the owner takes tasks from the head, thieves take tasks from the tail */
+static AMX_TASK *queue_pop(RUNQUEUE *queue, int steal)
+{
+  AMX_TASK *task = NULL;
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->count > 0) {
+    queue->count--;
+    if (steal) {
+      task = queue->items[(queue->head + queue->count) & (queue->size - 1)];
+    } else {
+      task = queue->items[queue->head];
+      queue->head = (queue->head + 1) & (queue->size - 1);
+    } /* if */
+  } /* if */
+  pthread_mutex_unlock(&queue->lock);
+  return task;
+}
+
+/* ----- timer heap (all functions must be called with the scheduler locked) ----- */
+
+static void heap_swap(AMX_SCHED *sched, int a, int b)
+{
+  AMX_TASK *t = sched->heap[a];
+  sched->heap[a] = sched->heap[b];
+  sched->heap[b] = t;
+  sched->heap[a]->heapidx = a;
+  sched->heap[b]->heapidx = b;
+}
+
+static void heap_siftup(AMX_SCHED *sched, int idx)
+{
+  while (idx > 0 && sched->heap[(idx - 1) / 2]->deadline > sched->heap[idx]->deadline) {
+    heap_swap(sched, idx, (idx - 1) / 2);
+    idx = (idx - 1) / 2;
+  } /* while */
+}
+
+static void heap_siftdown(AMX_SCHED *sched, int idx)
+{
+  for ( ;; ) {
+    int child = 2 * idx + 1;
+    if (child >= sched->heapcount)
+      break;
+    if (child + 1 < sched->heapcount && sched->heap[child + 1]->deadline < sched->heap[child]->deadline)
+      child++;
+    if (sched->heap[idx]->deadline <= sched->heap[child]->deadline)
+      break;
+    heap_swap(sched, idx, child);
+    idx = child;
+  } /* for */
+}
+
+static int heap_insert(AMX_SCHED *sched, AMX_TASK *task)
+{
+  if (sched->heapcount == sched->heapsize) {
+    int size = (sched->heapsize == 0) ? 64 : 2 * sched->heapsize;
+    AMX_TASK **heap = (AMX_TASK**)realloc(sched->heap, size * sizeof(AMX_TASK*));
+    if (heap == NULL)
+      return 0;
+    sched->heap = heap;
+    sched->heapsize = size;
+  } /* if */
+  task->heapidx = sched->heapcount++;
+  sched->heap[task->heapidx] = task;
+  heap_siftup(sched, task->heapidx);
+  if (task->heapidx == 0) {
+    /* the earliest wakeup changed: idle workers must wait for a shorter time,
+     * and busy workers must check the timers before TIMERCHECK runs
+     */
+    ATOMIC_ADD(&sched->timerstamp, 1);
+    pthread_cond_signal(&sched->ready);
+  } /* if */
+  return 1;
+}
+
+static void heap_remove(AMX_SCHED *sched, AMX_TASK *task)
+{
+  int idx = task->heapidx;
+  assert(idx >= 0 && idx < sched->heapcount && sched->heap[idx] == task);
+  sched->heapcount--;
+  if (idx != sched->heapcount) {
+    sched->heap[idx] = sched->heap[sched->heapcount];
+    sched->heap[idx]->heapidx = idx;
+    heap_siftup(sched, idx);
+    heap_siftdown(sched, idx);
+  } /* if */
+  task->heapidx = -1;
+}
+
+/* ----- workers ----- */
+
+static void makeready(AMX_SCHED *sched, AMX_TASK *task, int worker)
+{
+  task->state = TASK_READY;
+  if (!queue_push(&sched->workers[worker].queue, task)) {
+    /* out of memory for the run queue; retry on the next timer check */
+    task->state = TASK_TIMED;
+    task->deadline = now();
+    heap_insert(sched, task);
+  } /* if */
+}
+
+/* notify() wakes up an idle worker, if there is one; the scheduler must not
+ * be locked by the caller. The count of idle workers is read without lock
+ * (but atomically): a worker increments it before it scans the run queues for
+ * the last time, so a task that was pushed before the read cannot be missed.
+ */
+static void notify(AMX_SCHED *sched)
+{
+  if (ATOMIC_LOAD(&sched->idle) > 0) {
+    pthread_mutex_lock(&sched->lock);
+    pthread_cond_signal(&sched->ready);
+    pthread_mutex_unlock(&sched->lock);
+  } /* if */
+}
+
+/* expire() moves tasks whose timed wakeup has passed to the run queue of the
+ * worker; the scheduler must be locked
+ */
+static int expire(AMX_SCHED *sched, int worker)
+{
+  long long stamp;
+  int count = 0;
+
+  if (sched->heapcount == 0)
+    return 0;
+  stamp = now();
+  while (sched->heapcount > 0 && sched->heap[0]->deadline <= stamp) {
+    AMX_TASK *task = sched->heap[0];
+    heap_remove(sched, task);
+    makeready(sched, task, worker);
+    count++;
+  } /* while */
+  return count;
+}
+
+static AMX_TASK *findtask(WORKER *w)
+{
+  AMX_SCHED *sched = w->sched;
+  AMX_TASK *task;
+  int i, victim;
+
+  if ((task = queue_pop(&w->queue, 0)) != NULL)
+    return task;
+  if (sched->numworkers > 1) {
+    w->seed = w->seed * 1103515245 + 12345;
+    victim = (int)((w->seed >> 16) % (unsigned)sched->numworkers);
+    for (i = 0; i < sched->numworkers; i++, victim = (victim + 1) % sched->numworkers)
+      if (victim != w->number && (task = queue_pop(&sched->workers[victim].queue, 1)) != NULL)
+        return task;
+  } /* if */
+  return NULL;
+}
+
+static void finish(AMX_SCHED *sched, AMX_TASK *task, int error, cell retval)
+{
+  AMX_TASK **ptr;
+
+  amx_SetExtState(task->amx, SCHED_TAG, NULL, NULL);
+  amx_SetUserData(task->amx, AMX_ASYNCTAG, NULL);
+  if (task->timeslice > 0)
+    amx_SetBudget(task->amx, 0);
+  if (task->done != NULL)
+    task->done(task, task->amx, error, retval, task->userdata);
+
+  pthread_mutex_lock(&sched->lock);
+  ptr = (task->prev != NULL) ? &task->prev->next : &sched->tasks;
+  *ptr = task->next;
+  if (task->next != NULL)
+    task->next->prev = task->prev;
+  if (--sched->taskcount == 0)
+    pthread_cond_broadcast(&sched->empty);
+  pthread_mutex_unlock(&sched->lock);
+  free(task);
+}
+
+static void run(WORKER *w, AMX_TASK *task)
+{
+  AMX_SCHED *sched = w->sched;
+  cell retval = 0;
+  int err, index;
+
+  assert(task->state == TASK_READY);
+  task->state = TASK_RUNNING;
+  task->worker = w->number;
+  index = task->index;
+  task->index = AMX_EXEC_CONT;
+  if (task->timeslice > 0)
+    amx_SetBudget(task->amx, task->timeslice);
+  if (task->job == JOB_DONE) {
+    task->amx->pri = task->result;      /* return value of the native function */
+    task->job = JOB_NONE;
+  } /* if */
+  err = amx_Exec(task->amx, &retval, index);
+  if (err != AMX_ERR_SLEEP && err != AMX_ERR_BUDGET) {
+    finish(sched, task, err, retval);
+    return;
+  } /* if */
+
+  pthread_mutex_lock(&sched->lock);
+  if (task->job == JOB_PENDING) {
+    task->state = TASK_WAITING;         /* the job makes it ready */
+  } else if (task->job == JOB_DONE) {
+    makeready(sched, task, w->number);  /* the job completed already */
+  } else if (err == AMX_ERR_BUDGET || task->amx->pri == 0) {
+    makeready(sched, task, w->number);  /* yield, keep any pending wakeup */
+  } else if (task->wakeup) {
+    task->wakeup = 0;
+    makeready(sched, task, w->number);
+  } else if (task->amx->pri > 0) {
+    task->state = TASK_TIMED;
+    task->deadline = now() + (long long)task->amx->pri * 1000;
+    if (!heap_insert(sched, task))
+      makeready(sched, task, w->number);
+  } else {
+    task->state = TASK_WAITING;
+  } /* if */
+  pthread_mutex_unlock(&sched->lock);
+}
+
+static void *worker(void *arg)
+{
+  WORKER *w = (WORKER*)arg;
+  AMX_SCHED *sched = w->sched;
+  AMX_TASK *task;
+  int runs = 0, stop = 0;
+
+  w->deadline = LLONG_MAX;
+  while (!stop) {
+    if (++runs >= TIMERCHECK || ATOMIC_LOAD(&sched->timerstamp) != w->timerstamp
+        || (w->deadline != LLONG_MAX && now() >= w->deadline))
+    {
+      runs = 0;
+      pthread_mutex_lock(&sched->lock);
+      expire(sched, w->number);
+      w->timerstamp = ATOMIC_LOAD(&sched->timerstamp);
+      w->deadline = (sched->heapcount > 0) ? sched->heap[0]->deadline : LLONG_MAX;
+      stop = sched->stop;
+      pthread_mutex_unlock(&sched->lock);
+    } /* if */
+    if ((task = findtask(w)) != NULL) {
+      run(w, task);
+      if (queue_count(&w->queue) > 0)
+        notify(sched);  /* there is work that idle workers may steal */
+      continue;
+    } /* if */
+
+    /* no work was found: check the timers, rescan the queues with the lock
+     * held (so that a task that is queued now, cannot be missed), then wait
+     */
+    pthread_mutex_lock(&sched->lock);
+    ATOMIC_ADD(&sched->idle, 1);
+    while (!sched->stop && expire(sched, w->number) == 0) {
+      int i, found = 0;
+      for (i = 0; i < sched->numworkers && !found; i++)
+        found = (queue_count(&sched->workers[i].queue) > 0);
+      if (found)
+        break;
+      if (sched->heapcount > 0) {
+        struct timespec ts;
+        long long deadline = sched->heap[0]->deadline;
+        ts.tv_sec = (time_t)(deadline / 1000000);
+        ts.tv_nsec = (long)(deadline % 1000000) * 1000L;
+        pthread_cond_timedwait(&sched->ready, &sched->lock, &ts);
+      } else {
+        pthread_cond_wait(&sched->ready, &sched->lock);
+      } /* if */
+    } /* while */
+    ATOMIC_ADD(&sched->idle, -1);
+    stop = sched->stop;
+    pthread_mutex_unlock(&sched->lock);
+  } /* while */
+  return NULL;
+}
+
+/* ----- I/O threads ----- */
+
+static void *iothread(void *arg)
+{
+  AMX_SCHED *sched = (AMX_SCHED*)arg;
+  JOB *job;
+  cell result;
+
+  pthread_mutex_lock(&sched->lock);
+  for ( ;; ) {
+    while (!sched->stop && sched->jobhead == NULL)
+      pthread_cond_wait(&sched->jobready, &sched->lock);
+    if (sched->stop)
+      break;
+    job = sched->jobhead;
+    if ((sched->jobhead = job->next) == NULL)
+      sched->jobtail = NULL;
+    pthread_mutex_unlock(&sched->lock);
+
+    result = job->func(job->data);
+
+    pthread_mutex_lock(&sched->lock);
+    job->task->result = result;
+    job->task->job = JOB_DONE;
+    if (job->task->state == TASK_WAITING) {
+      makeready(sched, job->task, job->task->worker);
+      pthread_cond_signal(&sched->ready);
+    } /* if */
+    free(job);
+  } /* for */
+  pthread_mutex_unlock(&sched->lock);
+  return NULL;
+}
+
+/* submitjob() is the Submit() function of the AMX_ASYNC structure; it runs
+ * on the worker, from within the native function that calls amx_Async()
+ */
+static int AMXAPI submitjob(AMX_ASYNC *async, AMX *amx, AMX_ASYNCFUNC func, void *data)
+{
+  AMX_TASK *task;
+  AMX_SCHED *sched;
+  JOB *job;
+
+  (void)async;
+  if (amx_GetExtState(amx, SCHED_TAG, (void**)&task) != AMX_ERR_NONE || task == NULL)
+    return AMX_ERR_PARAMS;
+  assert(task->state == TASK_RUNNING && task->job == JOB_NONE);
+  sched = task->sched;
+  if ((job = (JOB*)malloc(sizeof(JOB))) == NULL)
+    return AMX_ERR_MEMORY;
+  job->task = task;
+  job->func = func;
+  job->data = data;
+  job->next = NULL;
+
+  pthread_mutex_lock(&sched->lock);
+  while (sched->numiothreads < SCHED_IOTHREADS
+         && pthread_create(&sched->iothreads[sched->numiothreads], NULL, iothread, sched) == 0)
+    sched->numiothreads++;
+  if (sched->numiothreads == 0) {
+    pthread_mutex_unlock(&sched->lock);
+    free(job);
+    return AMX_ERR_MEMORY;  /* the native function runs the job itself */
+  } /* if */
+  if (sched->jobtail != NULL)
+    sched->jobtail->next = job;
+  else
+    sched->jobhead = job;
+  sched->jobtail = job;
+  task->job = JOB_PENDING;
+  pthread_cond_signal(&sched->jobready);
+  pthread_mutex_unlock(&sched->lock);
+  return AMX_ERR_NONE;
+}
+
+/* ----- public interface ----- */
+
+/* sched_Create() starts a scheduler with the given number of worker threads;
+ * if "workers" is zero, it starts one worker per processor.
+ */
+int AMXAPI sched_Create(AMX_SCHED **sched, int workers)
+{
+  AMX_SCHED *s;
+  pthread_condattr_t attr;
+  int i;
+
+  if (sched == NULL || workers < 0 || workers > SCHED_MAXWORKERS)
+    return AMX_ERR_PARAMS;
+  #if defined _SC_NPROCESSORS_ONLN
+    if (workers == 0)
+      workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  #endif
+  if (workers <= 0)
+    workers = 1;
+  else if (workers > SCHED_MAXWORKERS)
+    workers = SCHED_MAXWORKERS;
+
+  if ((s = (AMX_SCHED*)malloc(sizeof(AMX_SCHED))) == NULL)
+    return AMX_ERR_MEMORY;
+  memset(s, 0, sizeof(AMX_SCHED));
+  if ((s->workers = (WORKER*)malloc(workers * sizeof(WORKER))) == NULL) {
+    free(s);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  memset(s->workers, 0, workers * sizeof(WORKER));
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_condattr_init(&attr);
+  #if SCHED_CLOCK != CLOCK_REALTIME
+    pthread_condattr_setclock(&attr, SCHED_CLOCK);
+  #endif
+  pthread_cond_init(&s->ready, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&s->empty, NULL);
+  pthread_cond_init(&s->jobready, NULL);
+  s->async.Submit = submitjob;
+
+  /* set up all run queues before starting any thread, because the workers
+   * steal from each other's queues
+   */
+  for (i = 0; i < workers; i++) {
+    WORKER *w = &s->workers[i];
+    w->sched = s;
+    w->number = i;
+    w->seed = (unsigned)i * 2654435761u + 1;
+    if (!queue_init(&w->queue))
+      break;
+    s->numworkers = i + 1;
+  } /* for */
+  if (s->numworkers == workers) {
+    while (s->numthreads < workers
+           && pthread_create(&s->workers[s->numthreads].thread, NULL, worker, &s->workers[s->numthreads]) == 0)
+      s->numthreads++;
+  } /* if */
+  if (s->numthreads < workers) {
+    sched_Delete(s);
+    return AMX_ERR_MEMORY;
+  } /* if */
+
+  *sched = s;
+  return AMX_ERR_NONE;
+}
+
+/* sched_Delete() stops the workers (after they finish the task that they are
+ * running) and frees the scheduler. Tasks that have not finished are dropped
+ * without calling their "done" callback; their abstract machines are left as
+ * they are. Jobs (see amx_Async()) that are running are waited for; queued
+ * jobs are dropped without running them.
+ */
+int AMXAPI sched_Delete(AMX_SCHED *sched)
+{
+  AMX_TASK *task;
+  JOB *job;
+  int i;
+
+  if (sched == NULL)
+    return AMX_ERR_PARAMS;
+  pthread_mutex_lock(&sched->lock);
+  sched->stop = 1;
+  pthread_cond_broadcast(&sched->ready);
+  pthread_cond_broadcast(&sched->jobready);
+  pthread_mutex_unlock(&sched->lock);
+  for (i = 0; i < sched->numthreads; i++)
+    pthread_join(sched->workers[i].thread, NULL);
+  for (i = 0; i < sched->numiothreads; i++)
+    pthread_join(sched->iothreads[i], NULL);
+  while ((job = sched->jobhead) != NULL) {
+    sched->jobhead = job->next;
+    free(job);
+  } /* while */
+  for (i = 0; i < sched->numworkers; i++)
+    queue_free(&sched->workers[i].queue);
+  while ((task = sched->tasks) != NULL) {
+    sched->tasks = task->next;
+    amx_SetExtState(task->amx, SCHED_TAG, NULL, NULL);
+    free(task);
+  } /* while */
+  pthread_cond_destroy(&sched->ready);
+  pthread_cond_destroy(&sched->empty);
+  pthread_cond_destroy(&sched->jobready);
+  pthread_mutex_destroy(&sched->lock);
+  free(sched->heap);
+  free(sched->workers);
+  free(sched);
+  return AMX_ERR_NONE;
+}
+
+/* sched_Submit() adds a task that runs the public function "index" (or
+ * AMX_EXEC_MAIN) of the abstract machine. Any parameters for the function
+ * must have been pushed (with amx_Push() and friends) before the call.
+ * Parameter "task" may be NULL; if not, it receives the handle of the task,
+ * which stays valid until the "done" callback returns.
+ * If "index" is AMX_EXEC_CONT, the abstract machine must have been put to
+ * sleep earlier; the scheduler then resumes it.
+ */
+int AMXAPI sched_Submit(AMX_SCHED *sched, AMX_TASK **task, AMX *amx, int index,
+                        SCHED_DONE done, void *userdata)
+{
+  AMX_TASK *t;
+  int worker, err;
+
+  if (sched == NULL || amx == NULL)
+    return AMX_ERR_PARAMS;
+  if ((t = (AMX_TASK*)malloc(sizeof(AMX_TASK))) == NULL)
+    return AMX_ERR_MEMORY;
+  memset(t, 0, sizeof(AMX_TASK));
+  t->sched = sched;
+  t->amx = amx;
+  t->index = index;
+  t->heapidx = -1;
+  t->done = done;
+  t->userdata = userdata;
+  if ((err = amx_SetExtState(amx, SCHED_TAG, t, NULL)) != AMX_ERR_NONE) {
+    free(t);
+    return err;
+  } /* if */
+  amx_SetUserData(amx, AMX_ASYNCTAG, &sched->async);  /* when all slots are taken, natives block */
+  if (task != NULL)
+    *task = t;
+
+  pthread_mutex_lock(&sched->lock);
+  t->next = sched->tasks;
+  if (t->next != NULL)
+    t->next->prev = t;
+  sched->tasks = t;
+  sched->taskcount++;
+  t->timeslice = sched->timeslice;
+  worker = sched->submitted++ % sched->numworkers;
+  t->worker = worker;
+  makeready(sched, t, worker);
+  pthread_cond_signal(&sched->ready);
+  pthread_mutex_unlock(&sched->lock);
+  return AMX_ERR_NONE;
+}
+
+/* sched_Wake() makes a sleeping task ready to run, regardless of the delay
+ * that it was sleeping on. If the task is not sleeping, the wakeup is kept
+ * until the next time that it goes to sleep (with a non-zero delay), so that
+ * a wakeup is never lost. This function may be
+ * called from any thread, including from a native function of another task.
+ */
+int AMXAPI sched_Wake(AMX_TASK *task)
+{
+  AMX_SCHED *sched;
+
+  if (task == NULL)
+    return AMX_ERR_PARAMS;
+  sched = task->sched;
+  pthread_mutex_lock(&sched->lock);
+  if (task->state == TASK_RUNNING || task->state == TASK_READY || task->job != JOB_NONE) {
+    task->wakeup = 1;
+  } else if (task->state == TASK_TIMED || task->state == TASK_WAITING) {
+    if (task->state == TASK_TIMED)
+      heap_remove(sched, task);
+    makeready(sched, task, task->worker);
+    pthread_cond_signal(&sched->ready);
+  } /* if */
+  pthread_mutex_unlock(&sched->lock);
+  return AMX_ERR_NONE;
+}
+
+/* sched_SetTimeslice() sets the instruction budget (see amx_SetBudget()) that
+ * a task may use before it is preempted, for the tasks that are submitted
+ * after the call; zero runs every task until it sleeps or finishes.
+ */
+int AMXAPI sched_SetTimeslice(AMX_SCHED *sched, long units)
+{
+  if (sched == NULL)
+    return AMX_ERR_PARAMS;
+  pthread_mutex_lock(&sched->lock);
+  sched->timeslice = (units > 0) ? units : 0;
+  pthread_mutex_unlock(&sched->lock);
+  return AMX_ERR_NONE;
+}
+
+/* sched_GetTask() returns the task that runs the abstract machine; native
+ * functions use it to find the handle to pass to sched_Wake() later.
+ */
+int AMXAPI sched_GetTask(AMX *amx, AMX_TASK **task)
+{
+  return amx_GetExtState(amx, SCHED_TAG, (void**)task);
+}
+
+/* sched_Wait() blocks until all tasks have finished. Tasks that wait for
+ * sched_Wake() count as not finished.
+ */
+int AMXAPI sched_Wait(AMX_SCHED *sched)
+{
+  if (sched == NULL)
+    return AMX_ERR_PARAMS;
+  pthread_mutex_lock(&sched->lock);
+  while (sched->taskcount > 0)
+    pthread_cond_wait(&sched->empty, &sched->lock);
+  pthread_mutex_unlock(&sched->lock);
+  return AMX_ERR_NONE;
+}
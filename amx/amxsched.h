@@ -0,0 +1,49 @@
+/*  Multi-threaded scheduler for abstract machines that sleep
+ *
+ *  Copyright (c) CompuPhase, 2026
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxsched.h $
+ */
+#ifndef AMXSCHED_H_INCLUDED
+#define AMXSCHED_H_INCLUDED
+
+#include "amx.h"
+
+#ifdef  __cplusplus
+extern  "C" {
+#endif
+
+typedef struct tagAMX_SCHED AMX_SCHED;
+typedef struct tagAMX_TASK AMX_TASK;
+
+/* The "done" callback runs on the worker thread that completed the task. The
+ * task handle is released when the callback returns.
+ */
+typedef void (AMXAPI *SCHED_DONE)(AMX_TASK *task, AMX *amx, int error, cell retval, void *userdata);
+
+int AMXAPI sched_Create(AMX_SCHED **sched, int workers);
+int AMXAPI sched_Delete(AMX_SCHED *sched);
+int AMXAPI sched_Submit(AMX_SCHED *sched, AMX_TASK **task, AMX *amx, int index,
+                        SCHED_DONE done, void *userdata);
+int AMXAPI sched_SetTimeslice(AMX_SCHED *sched, long units);
+int AMXAPI sched_Wake(AMX_TASK *task);
+int AMXAPI sched_GetTask(AMX *amx, AMX_TASK **task);
+int AMXAPI sched_Wait(AMX_SCHED *sched);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* AMXSCHED_H_INCLUDED */
@@ -18,7 +18,10 @@
  */
 #include <time.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include "amx.h"
+#include "amxevent.h"
 #if defined __WIN32__ || defined _WIN32 || defined _Windows
   #include <windows.h>
   #include <mmsystem.h>
@@ -53,9 +56,76 @@
 #else
   #define INIT_TIMER()
 #endif
-static unsigned long timestamp;
-static unsigned long timelimit;
-static int timerepeat;
+
+/* localtime() returns a pointer to a static structure; use the re-entrant
+ * version where it is available
+ */
+#if defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
+  #define LOCALTIME(t,tm)   localtime_r((t),(tm))
+#else
+  #define LOCALTIME(t,tm)   (*(tm)=*localtime(t))
+#endif
+
+/* The timer is kept per abstract machine (in the extension state), so that
+ * abstract machines in different threads each have their own timer. The state
+ * is created on first use, or by amx_TimeInit().
+ */
+#define TIME_TAG  AMX_USERTAG('T','i','m','e')
+
+#if !defined AMXTIME_NOIDLE
+/* The timers of settimerex() are kept in a hierarchical timing wheel with a
+ * resolution of one millisecond. Each level has 64 slots, and each slot of a
+ * level spans the full range of the level below it; so five levels cover 2^30
+ * milliseconds (12 days), and timers that are further away are cascaded down
+ * when that range comes by. Adding and removing a timer are O(1): the slot
+ * follows from the expiry time and each slot is a doubly-linked list. The
+ * timers are in a table that grows on demand, so the links are indices. The
+ * handle of a timer holds the table index and a generation count, so that a
+ * stale handle does not kill a timer that re-used the table entry.
+ */
+#define WHEEL_BITS      6
+#define WHEEL_SLOTS     (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS    5
+#define WHEEL_RANGE     (1UL << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define TIMER_IDXBITS   20      /* up to 1M timers per abstract machine */
+#define TIMER_IDXMASK   ((1L << TIMER_IDXBITS) - 1)
+#define TIMER_GENMASK   0x3ff   /* keeps the handle positive for 32-bit cells */
+
+typedef struct tagTIMER {
+  unsigned long expires;
+  unsigned long interval; /* 0 for a single-shot timer */
+  cell payload;
+  int index;              /* public function to call */
+  int slot;               /* level * WHEEL_SLOTS + slot, or -1 if free */
+  int next, prev;         /* links in the slot (or in the free list) */
+  int generation;
+} TIMER;
+#endif
+
+typedef struct tagTIMESTATE {
+  uint64_t timestamp;     /* start of the settimer() interval, in microseconds */
+  unsigned long timelimit;
+  int timerepeat;
+  #if !defined AMXTIME_NOIDLE
+    AMX_IDLE PrevIdle;
+    AMX_EVENTHOOK PrevEvents;
+    AMX_EVENTS *events;     /* set when the host runs an event loop */
+    void *timer;
+    int idxTimer;
+    /* the timers of settimerex() */
+    TIMER *timers;
+    int numtimers;        /* size of the table */
+    int freetimer;        /* head of the free list */
+    int activetimers;
+    int wheel[WHEEL_LEVELS * WHEEL_SLOTS];  /* heads of the slots */
+    unsigned long wheeltime;/* the next tick to handle */
+    void *wheeltimer;     /* when running in an event loop */
+    unsigned long wheelarmed;
+    int wheelisarmed;
+  #endif
+} TIMESTATE;
 
 static const unsigned char monthdays[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
 
@@ -68,29 +138,88 @@ static int wrap(int value, int min, int max)
   return value;
 }
 
-static unsigned long gettimestamp(void)
+static void AMXAPI time_release(AMX *amx, void *state)
+{
+  #if !defined AMXTIME_NOIDLE
+    TIMESTATE *ts = (TIMESTATE*)state;
+    if (ts->events != NULL && ts->timer != NULL)
+      ts->events->RemoveTimer(ts->events, ts->timer);
+    if (ts->events != NULL && ts->wheeltimer != NULL)
+      ts->events->RemoveTimer(ts->events, ts->wheeltimer);
+    if (ts->timers != NULL)
+      free(ts->timers);
+  #endif
+  (void)amx;
+  free(state);
+}
+
+static TIMESTATE *time_state(AMX *amx)
+{
+  TIMESTATE *ts;
+
+  if (amx_GetExtState(amx, TIME_TAG, (void**)&ts) == AMX_ERR_NONE)
+    return ts;
+  if ((ts = (TIMESTATE*)malloc(sizeof(TIMESTATE))) == NULL)
+    return NULL;
+  memset(ts, 0, sizeof(TIMESTATE));
+  #if !defined AMXTIME_NOIDLE
+    ts->idxTimer = -1;
+    ts->freetimer = -1;
+    {
+      int i;
+      for (i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++)
+        ts->wheel[i] = -1;
+    }
+  #endif
+  if (amx_SetExtState(amx, TIME_TAG, ts, time_release) != AMX_ERR_NONE) {
+    free(ts);
+    return NULL;
+  } /* if */
+  return ts;
+}
+
+/* getmicroseconds() reads a monotonic clock at microsecond resolution; the
+ * timers use it, so that they do not expire early by the rounding of the
+ * current time to a whole millisecond
+ */
+static uint64_t getmicroseconds(void)
 {
-  unsigned long value;
+  uint64_t value;
 
   #if defined __WIN32__ || defined _WIN32 || defined WIN32
-    value=timeGetTime();        /* this value is already in milliseconds */
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart==0)
+      QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    /* split the conversion, so that it does not overflow */
+    value=(uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000
+          + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000 / (uint64_t)frequency.QuadPart;
+  #elif defined CLOCK_MONOTONIC
+    /* a monotonic clock does not jump when the system time is set (and
+     * settime()/setdate() set the system time)
+     */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    value = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)(ts.tv_nsec / 1000);
   #elif defined __linux || defined __linux__ || defined __LINUX__ || defined __APPLE__
     struct timeval tv;
     gettimeofday(&tv, NULL);
-    value = ((tv.tv_sec * 1000) + (tv.tv_usec / 1000));
+    value = (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
   #else
-    value=clock();
-    #if CLOCKS_PER_SEC<1000
-      /* convert to milliseconds */
-      value=(cell)((1000L * value) / CLOCKS_PER_SEC);
-    #elif CLOCKS_PER_SEC>1000
-      /* convert to milliseconds */
-      value=(cell)(value/(CLOCKS_PER_SEC/1000));
-    #endif
+    value=(uint64_t)clock() * 1000000 / CLOCKS_PER_SEC;
   #endif
   return value;
 }
 
+/* gettimestamp() returns the time in milliseconds, which is the unit of the
+ * timer functions of the script (and the tick of the timer wheel)
+ */
+static unsigned long gettimestamp(void)
+{
+  return (unsigned long)(getmicroseconds() / 1000);
+}
+
 void stamp2datetime(unsigned long sec1970,
                     int *year, int *month, int *day,
                     int *hour, int *minute, int *second)
@@ -162,7 +291,7 @@ static void settime(cell hour,cell minute,cell second)
     #endif
 
     time(&sec1970);
-    gtm=*localtime(&sec1970);
+    LOCALTIME(&sec1970,&gtm);
     if (hour!=CELLMIN)
       gtm.tm_hour=wrap((int)hour,0,23);
     if (minute!=CELLMIN)
@@ -210,7 +339,7 @@ static void setdate(cell year,cell month,cell day)
     #endif
 
     time(&sec1970);
-    gtm=*localtime(&sec1970);
+    LOCALTIME(&sec1970,&gtm);
     if (year!=CELLMIN)
       gtm.tm_year=year-1900;
     if (month!=CELLMIN)
@@ -256,7 +385,7 @@ static cell AMX_NATIVE_CALL n_gettime(AMX *amx, const cell *params)
   /* on DOS/Windows, the timezone is usually not set for the C run-time
    * library; in that case gmtime() and localtime() return the same value
    */
-  gtm=*localtime(&sec1970);
+  LOCALTIME(&sec1970,&gtm);
   cptr=amx_Address(amx,params[1]);
   *cptr=gtm.tm_hour;
   cptr=amx_Address(amx,params[2]);
@@ -294,7 +423,7 @@ static cell AMX_NATIVE_CALL n_getdate(AMX *amx, const cell *params)
 
   time(&sec1970);
 
-  gtm=*localtime(&sec1970);
+  LOCALTIME(&sec1970,&gtm);
   cptr=amx_Address(amx,params[1]);
   *cptr=gtm.tm_year+1900;
   cptr=amx_Address(amx,params[2]);
@@ -317,7 +446,7 @@ static cell AMX_NATIVE_CALL n_tickcount(AMX *amx, const cell *params)
 
   INIT_TIMER();
   cptr=amx_Address(amx,params[1]);
-  #if defined __WIN32__ || defined _WIN32 || defined WIN32
+  #if defined __WIN32__ || defined _WIN32 || defined WIN32 || defined CLOCK_MONOTONIC
     *cptr=1000;               	/* granularity = 1 ms */
   #else
     *cptr=(cell)CLOCKS_PER_SEC;	/* in Unix/Linux, this is often 100 */
@@ -325,20 +454,72 @@ static cell AMX_NATIVE_CALL n_tickcount(AMX *amx, const cell *params)
   return gettimestamp() & 0x7fffffff;
 }
 
+/* the interval at which a blocking delay() checks for amx_Interrupt(), in
+ * milliseconds
+ */
+#if !defined AMX_SLEEPSLICE
+  #define AMX_SLEEPSLICE  10
+#endif
+
+static int interrupted(AMX *amx)
+{
+  int pending;
+  amx_Interrupted(amx, &pending, 0);
+  return pending;
+}
+
+/* block the thread for the number of milliseconds, or until amx_Interrupt()
+ * is called on the abstract machine; amx_Interrupt() only sets a flag (it
+ * does not signal the thread), so the thread sleeps in short slices and
+ * checks the flag after every slice
+ */
+static void sleep_ms(AMX *amx, cell milliseconds)
+{
+  uint64_t deadline, now, slice;
+  #if defined __linux || defined __linux__ || defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ \
+        || defined __APPLE__
+    struct timespec req;
+  #endif
+
+  deadline = getmicroseconds() + (uint64_t)milliseconds * 1000;
+  while (!interrupted(amx) && (now = getmicroseconds()) < deadline) {
+    slice = deadline - now;
+    if (slice > AMX_SLEEPSLICE * 1000)
+      slice = AMX_SLEEPSLICE * 1000;
+    #if defined __WIN32__ || defined _WIN32 || defined WIN32
+      Sleep((DWORD)((slice + 999) / 1000));
+    #elif defined __linux || defined __linux__ || defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ \
+          || defined __APPLE__
+      req.tv_sec = 0;
+      req.tv_nsec = (long)slice * 1000L;
+      nanosleep(&req, NULL);  /* a signal ends the slice early, the loop continues */
+    #else
+      (void)slice;            /* no sleep function: busy-wait */
+    #endif
+  } /* while */
+}
+
 /* delay(milliseconds)
- * Pauses for (at least) the requested number of milliseconds.
+ * Pauses for (at least) the requested number of milliseconds. If the host
+ * has set the user value "Slep" (to a non-NULL value) on the abstract
+ * machine, it resumes the abstract machine after the delay that it finds in
+ * "pri" when amx_Exec() returns AMX_ERR_SLEEP (like the scheduler does); then
+ * delay() puts the abstract machine to sleep, so that the thread is free to
+ * run other scripts. Otherwise, delay() blocks the thread.
  */
 static cell AMX_NATIVE_CALL n_delay(AMX *amx, const cell *params)
 {
-  unsigned long stamp;
+  void *resumes;
 
-  (void)amx;
   assert(params[0]==(int)sizeof(cell));
 
   INIT_TIMER();
-  stamp=gettimestamp();
-  while (gettimestamp()-stamp < (unsigned long)params[1])
-    /* nothing */;
+  if (amx_GetUserData(amx, AMX_ASYNCTAG, &resumes) == AMX_ERR_NONE && resumes != NULL) {
+    amx_RaiseError(amx, AMX_ERR_SLEEP);
+    return (params[1] > 0) ? params[1] : 0;
+  } /* if */
+  if (params[1] > 0)
+    sleep_ms(amx, params[1]);
   return 0;
 }
 
@@ -348,11 +529,20 @@ static cell AMX_NATIVE_CALL n_delay(AMX *amx, const cell *params)
  */
 static cell AMX_NATIVE_CALL n_settimer(AMX *amx, const cell *params)
 {
-  (void)amx;
+  TIMESTATE *ts;
+
   assert(params[0]==(int)(2*sizeof(cell)));
-  timestamp=gettimestamp();
-  timelimit=params[1];
-  timerepeat=(int)(params[2]==0);
+  if ((ts=time_state(amx))==NULL) {
+    amx_RaiseError(amx, AMX_ERR_MEMORY);
+    return 0;
+  } /* if */
+  ts->timestamp=getmicroseconds();
+  ts->timelimit=params[1];
+  ts->timerepeat=(int)(params[2]==0);
+  #if !defined AMXTIME_NOIDLE
+    if (ts->events!=NULL && ts->timer!=NULL)
+      ts->events->SetTimer(ts->events,ts->timer,ts->timelimit,ts->timerepeat);
+  #endif
   return 0;
 }
 
@@ -362,16 +552,248 @@ static cell AMX_NATIVE_CALL n_settimer(AMX *amx, const cell *params)
  */
 static cell AMX_NATIVE_CALL n_gettimer(AMX *amx, const cell *params)
 {
+  TIMESTATE *ts;
   cell *cptr;
 
   assert(params[0]==(int)(2*sizeof(cell)));
+  if (amx_GetExtState(amx, TIME_TAG, (void**)&ts) != AMX_ERR_NONE)
+    ts=NULL;                  /* no timer was set */
   cptr=amx_Address(amx,params[1]);
-  *cptr=timelimit;
+  *cptr=(ts!=NULL) ? ts->timelimit : 0;
   cptr=amx_Address(amx,params[2]);
-  *cptr=timerepeat;
-  return timelimit>0;
+  *cptr=(ts!=NULL) ? ts->timerepeat : 0;
+  return ts!=NULL && ts->timelimit>0;
 }
 
+#if !defined AMXTIME_NOIDLE
+static void wheel_link(TIMESTATE *ts, int idx)
+{
+  TIMER *t = &ts->timers[idx];
+  long delta = (long)(t->expires - ts->wheeltime);
+  unsigned long expires = t->expires;
+  int level, slot;
+
+  if (delta < 0) {
+    /* already expired: handle it on the next tick */
+    level = 0;
+    expires = ts->wheeltime;
+  } else if ((unsigned long)delta >= WHEEL_RANGE) {
+    /* beyond the wheel: park it in the top level, it gets cascaded down */
+    level = WHEEL_LEVELS - 1;
+    expires = ts->wheeltime + WHEEL_RANGE - 1;
+  } else {
+    for (level = 0; (unsigned long)delta >= (1UL << (WHEEL_BITS * (level + 1))); level++)
+      /* nothing */;
+  } /* if */
+  slot = level * WHEEL_SLOTS + (int)((expires >> (WHEEL_BITS * level)) & WHEEL_MASK);
+
+  t->slot = slot;
+  t->prev = -1;
+  t->next = ts->wheel[slot];
+  if (t->next >= 0)
+    ts->timers[t->next].prev = idx;
+  ts->wheel[slot] = idx;
+}
+
+static void wheel_unlink(TIMESTATE *ts, int idx)
+{
+  TIMER *t = &ts->timers[idx];
+
+  assert(t->slot >= 0);
+  if (t->prev >= 0)
+    ts->timers[t->prev].next = t->next;
+  else
+    ts->wheel[t->slot] = t->next;
+  if (t->next >= 0)
+    ts->timers[t->next].prev = t->prev;
+  t->slot = -1;
+}
+
+static int timer_alloc(TIMESTATE *ts)
+{
+  int idx;
+
+  if (ts->freetimer < 0) {
+    /* grow the table, and put the new entries in the free list */
+    int num = (ts->numtimers == 0) ? 16 : 2 * ts->numtimers;
+    TIMER *table;
+    if (num > TIMER_IDXMASK)
+      num = TIMER_IDXMASK;
+    if (num <= ts->numtimers
+        || (table = (TIMER*)realloc(ts->timers, num * sizeof(TIMER))) == NULL)
+      return -1;
+    memset(table + ts->numtimers, 0, (num - ts->numtimers) * sizeof(TIMER));
+    for (idx = num - 1; idx >= ts->numtimers; idx--) {
+      table[idx].slot = -1;
+      table[idx].next = ts->freetimer;
+      ts->freetimer = idx;
+    } /* for */
+    ts->timers = table;
+    ts->numtimers = num;
+  } /* if */
+  idx = ts->freetimer;
+  ts->freetimer = ts->timers[idx].next;
+  ts->activetimers++;
+  return idx;
+}
+
+static void timer_free(TIMESTATE *ts, int idx)
+{
+  TIMER *t = &ts->timers[idx];
+
+  if (t->slot >= 0)
+    wheel_unlink(ts, idx);
+  t->generation = (t->generation + 1) & TIMER_GENMASK;
+  t->next = ts->freetimer;
+  ts->freetimer = idx;
+  ts->activetimers--;
+}
+
+static cell timer_handle(TIMESTATE *ts, int idx)
+{
+  return ((cell)ts->timers[idx].generation << TIMER_IDXBITS) | (idx + 1);
+}
+
+/* returns the table index for a handle, or -1 if the handle is not valid */
+static int timer_lookup(TIMESTATE *ts, cell handle)
+{
+  int idx = (int)(handle & TIMER_IDXMASK) - 1;
+
+  if (handle <= 0 || idx < 0 || idx >= ts->numtimers)
+    return -1;
+  if (ts->timers[idx].slot < 0
+      || ts->timers[idx].generation != (int)((handle >> TIMER_IDXBITS) & TIMER_GENMASK))
+    return -1;
+  return idx;
+}
+
+/* wheel_next() returns the tick at which the wheel must run next: the expiry
+ * of the first timer in the lowest level, or the tick at which a slot in a
+ * higher level cascades down, whichever comes first.
+ */
+static int wheel_next(TIMESTATE *ts, unsigned long *tick)
+{
+  unsigned long first = 0, block;
+  int found = 0;
+  int level, d;
+
+  if (ts->activetimers == 0)
+    return 0;
+  for (d = 0; d < WHEEL_SLOTS; d++) {
+    if (ts->wheel[(ts->wheeltime + d) & WHEEL_MASK] >= 0) {
+      first = ts->wheeltime + d;
+      found = 1;
+      break;
+    } /* if */
+  } /* for */
+  for (level = 1; level < WHEEL_LEVELS; level++) {
+    /* when the wheel is at the start of a block, the cascade of the current
+     * slot is still to come
+     */
+    block = ts->wheeltime >> (WHEEL_BITS * level);
+    d = ((ts->wheeltime & ((1UL << (WHEEL_BITS * level)) - 1)) == 0) ? 0 : 1;
+    for ( ; d <= WHEEL_SLOTS; d++) {
+      if (ts->wheel[level * WHEEL_SLOTS + (int)((block + d) & WHEEL_MASK)] >= 0) {
+        unsigned long cascade = (block + d) << (WHEEL_BITS * level);
+        if (!found || (long)(cascade - first) < 0)
+          first = cascade;
+        found = 1;
+        break;
+      } /* if */
+    } /* for */
+  } /* for */
+  *tick = first;
+  return found;
+}
+
+/* wheel_arm() sets the timer of the event loop (if any) for the next tick at
+ * which the wheel must run; it only moves an armed timer forward in time
+ * if "force" is set
+ */
+static void wheel_arm(TIMESTATE *ts, int force)
+{
+  unsigned long tick, now;
+  long delay;
+
+  if (ts->events == NULL || ts->wheeltimer == NULL)
+    return;
+  if (!wheel_next(ts, &tick)) {
+    if (force && ts->wheelisarmed)
+      ts->events->SetTimer(ts->events, ts->wheeltimer, 0, 0);
+    ts->wheelisarmed = 0;
+    return;
+  } /* if */
+  if (!force && ts->wheelisarmed && (long)(tick - ts->wheelarmed) >= 0)
+    return;
+  now = gettimestamp();
+  delay = (long)(tick - now);
+  if (delay < 1)
+    delay = 1;          /* an interval of zero would disarm the timer */
+  ts->events->SetTimer(ts->events, ts->wheeltimer, (unsigned long)delay, 0);
+  ts->wheelarmed = tick;
+  ts->wheelisarmed = 1;
+}
+
+/* settimerex(milliseconds, const function[], bool: singleshot = false, payload = 0)
+ * Starts a timer that calls the public function with the timer handle and the
+ * payload as parameters. Any number of timers may run at the same time. The
+ * return value is the handle of the timer, or 0 if the public function does
+ * not exist.
+ */
+static cell AMX_NATIVE_CALL n_settimerex(AMX *amx, const cell *params)
+{
+  TIMESTATE *ts;
+  TIMER *t;
+  char name[sNAMEMAX + 1];
+  uint64_t now;
+  int index, idx;
+
+  assert(params[0]==(int)(4*sizeof(cell)));
+  amx_GetString(name, amx_Address(amx,params[2]), 0, sizeof name);
+  if (amx_FindPublic(amx, name, &index) != AMX_ERR_NONE)
+    return 0;
+  if ((ts=time_state(amx))==NULL || (idx=timer_alloc(ts))<0) {
+    amx_RaiseError(amx, AMX_ERR_MEMORY);
+    return 0;
+  } /* if */
+
+  INIT_TIMER();
+  now=getmicroseconds();
+  if (ts->activetimers==1)
+    ts->wheeltime=(unsigned long)(now/1000);  /* the wheel is empty, so it may jump ahead */
+  t=&ts->timers[idx];
+  t->interval=(params[1]>0) ? (unsigned long)params[1] : 1;
+  /* round the expiry up to the next tick, so that the timer does not expire
+   * before the full interval has passed
+   */
+  t->expires=(unsigned long)((now+(uint64_t)t->interval*1000+999)/1000);
+  if (params[3]!=0)
+    t->interval=0;      /* single-shot */
+  t->payload=params[4];
+  t->index=index;
+  wheel_link(ts,idx);
+  wheel_arm(ts,0);
+  return timer_handle(ts,idx);
+}
+
+/* bool: killtimer(timer)
+ * Stops a timer that was started with settimerex(). Returns false if the
+ * timer does not exist (anymore).
+ */
+static cell AMX_NATIVE_CALL n_killtimer(AMX *amx, const cell *params)
+{
+  TIMESTATE *ts;
+  int idx;
+
+  assert(params[0]==(int)sizeof(cell));
+  if (amx_GetExtState(amx, TIME_TAG, (void**)&ts) != AMX_ERR_NONE
+      || (idx=timer_lookup(ts,params[1]))<0)
+    return 0;
+  timer_free(ts,idx);
+  return 1;
+}
+#endif
+
 /* settimestamp(seconds1970) sets the date and time from a single parameter: the
  * number of seconds since 1 January 1970.
  */
@@ -420,30 +842,152 @@ static cell AMX_NATIVE_CALL n_cvttimestamp(AMX *amx, const cell *params)
 
 
 #if !defined AMXTIME_NOIDLE
-static AMX_IDLE PrevIdle = NULL;
-static int idxTimer = -1;
+/* move the timers in the slot of a higher level down */
+static void wheel_cascade(TIMESTATE *ts)
+{
+  int level, slot, idx;
+
+  for (level = 1; level < WHEEL_LEVELS; level++) {
+    slot = (int)((ts->wheeltime >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    idx = ts->wheel[level * WHEEL_SLOTS + slot];
+    ts->wheel[level * WHEEL_SLOTS + slot] = -1;
+    while (idx >= 0) {
+      int next = ts->timers[idx].next;
+      wheel_link(ts, idx);
+      idx = next;
+    } /* while */
+    if (slot != 0)
+      break;
+  } /* for */
+}
+
+/* wheel_run() handles all ticks up to the current time, and calls the public
+ * functions of the timers that expire. A public function may start and kill
+ * timers (including its own).
+ */
+static int wheel_run(AMX *amx, TIMESTATE *ts, int AMXAPI Exec(AMX *, cell *, int))
+{
+  unsigned long now = gettimestamp();
+  unsigned long tick;
+  int err = AMX_ERR_NONE;
+  int idx;
+
+  /* after a long pause, skip the ticks at which nothing happens */
+  if ((long)(now - ts->wheeltime) > WHEEL_SLOTS && wheel_next(ts, &tick)
+      && (long)(tick - ts->wheeltime) > 0)
+    ts->wheeltime = ((long)(tick - now) > 0) ? now + 1 : tick;
+
+  while (err == AMX_ERR_NONE && (long)(now - ts->wheeltime) >= 0) {
+    if (ts->activetimers == 0) {
+      ts->wheeltime = now + 1;
+      break;
+    } /* if */
+    if ((ts->wheeltime & WHEEL_MASK) == 0)
+      wheel_cascade(ts);
+    while (err == AMX_ERR_NONE && (idx = ts->wheel[ts->wheeltime & WHEEL_MASK]) >= 0) {
+      TIMER *t = &ts->timers[idx];
+      cell handle = timer_handle(ts, idx);
+      cell payload = t->payload;
+      int index = t->index;
+      if (t->interval > 0) {
+        wheel_unlink(ts, idx);
+        t->expires += t->interval;
+        if ((long)(t->expires - ts->wheeltime) <= 0)
+          t->expires = ts->wheeltime + 1;
+        wheel_link(ts, idx);
+      } else {
+        timer_free(ts, idx);
+      } /* if */
+      amx_Push(amx, payload);
+      amx_Push(amx, handle);
+      err = Exec(amx, NULL, index);
+      while (err == AMX_ERR_SLEEP)
+        err = Exec(amx, NULL, AMX_EXEC_CONT);
+    } /* while */
+    if (err == AMX_ERR_NONE)
+      ts->wheeltime++;
+  } /* while */
+  return err;
+}
 
 static int AMXAPI amx_TimeIdle(AMX *amx, int AMXAPI Exec(AMX *, cell *, int))
 {
+  TIMESTATE *ts;
   int err=0;
 
-  assert(idxTimer >= 0);
+  if (amx_GetExtState(amx, TIME_TAG, (void**)&ts) != AMX_ERR_NONE)
+    return AMX_ERR_NONE;
+
+  if (ts->PrevIdle != NULL)
+    ts->PrevIdle(amx, Exec);
 
-  if (PrevIdle != NULL)
-    PrevIdle(amx, Exec);
+  if (ts->activetimers > 0 && (err = wheel_run(amx, ts, Exec)) != AMX_ERR_NONE)
+    return err;
 
-  if (timelimit>0 && (gettimestamp()-timestamp)>=timelimit) {
-    if (timerepeat)
-      timestamp+=timelimit;
+  if (ts->idxTimer >= 0 && ts->timelimit>0 && getmicroseconds()-ts->timestamp>=(uint64_t)ts->timelimit*1000) {
+    if (ts->timerepeat)
+      ts->timestamp+=(uint64_t)ts->timelimit*1000;
     else
-      timelimit=0;      /* do not repeat single-shot timer */
-    err = Exec(amx, NULL, idxTimer);
+      ts->timelimit=0;  /* do not repeat single-shot timer */
+    err = Exec(amx, NULL, ts->idxTimer);
     while (err == AMX_ERR_SLEEP)
       err = Exec(amx, NULL, AMX_EXEC_CONT);
   } /* if */
 
   return err;
 }
+
+/* the event handler for the timer, for hosts with an event loop */
+static int AMXAPI time_event(AMX *amx, int AMXAPI Exec(AMX *, cell *, int), void *data)
+{
+  TIMESTATE *ts = (TIMESTATE*)data;
+  int err;
+
+  if (ts->timerepeat)
+    ts->timestamp+=(uint64_t)ts->timelimit*1000;
+  else
+    ts->timelimit=0;    /* the event loop disarmed the single-shot timer */
+  err = Exec(amx, NULL, ts->idxTimer);
+  while (err == AMX_ERR_SLEEP)
+    err = Exec(amx, NULL, AMX_EXEC_CONT);
+  return err;
+}
+
+/* the event handler for the timer wheel */
+static int AMXAPI time_wheelevent(AMX *amx, int AMXAPI Exec(AMX *, cell *, int), void *data)
+{
+  TIMESTATE *ts = (TIMESTATE*)data;
+  int err;
+
+  ts->wheelisarmed = 0;   /* the single-shot timer of the event loop expired */
+  err = wheel_run(amx, ts, Exec);
+  wheel_arm(ts, 1);
+  return err;
+}
+
+static int AMXAPI amx_TimeEvents(AMX *amx, AMX_EVENTS *events)
+{
+  TIMESTATE *ts;
+  int err;
+
+  if (amx_GetExtState(amx, TIME_TAG, (void**)&ts) != AMX_ERR_NONE)
+    return AMX_ERR_NONE;
+  if (ts->PrevEvents != NULL && (err = ts->PrevEvents(amx, events)) != AMX_ERR_NONE)
+    return err;
+
+  if (ts->idxTimer >= 0) {
+    if ((err = events->AddTimer(events, amx, time_event, ts, &ts->timer)) != AMX_ERR_NONE)
+      return err;
+    if (ts->timelimit > 0       /* settimer() may have been called already */
+        && (err = events->SetTimer(events, ts->timer, ts->timelimit, ts->timerepeat)) != AMX_ERR_NONE)
+      return err;
+  } /* if */
+  if ((err = events->AddTimer(events, amx, time_wheelevent, ts, &ts->wheeltimer)) != AMX_ERR_NONE)
+    return err;
+  ts->events = events;
+  wheel_arm(ts, 1);     /* settimerex() may have been called already */
+  return AMX_ERR_NONE;
+}
 #endif
 
 
@@ -458,6 +1002,10 @@ const AMX_NATIVE_INFO time_Natives[] = {
   { "tickcount",    n_tickcount },
   { "settimer",     n_settimer },
   { "gettimer",     n_gettimer },
+#if !defined AMXTIME_NOIDLE
+  { "settimerex",   n_settimerex },
+  { "killtimer",    n_killtimer },
+#endif
   { "delay",        n_delay },
   { "settimestamp", n_settimestamp },
   { "cvttimestamp", n_cvttimestamp },
@@ -467,11 +1015,24 @@ const AMX_NATIVE_INFO time_Natives[] = {
 int AMXEXPORT AMXAPI amx_TimeInit(AMX *amx)
 {
   #if !defined AMXTIME_NOIDLE
-    /* see whether there is a @timer() function */
-    if (amx_FindPublic(amx,"@timer",&idxTimer) == AMX_ERR_NONE) {
-      if (amx_GetUserData(amx, AMX_USERTAG('I','d','l','e'), (void**)&PrevIdle) != AMX_ERR_NONE)
-        PrevIdle = NULL;
+    TIMESTATE *ts;
+    int index, dummy;
+
+    /* see whether there is a @timer() function, or whether the script uses
+     * settimerex()
+     */
+    if (amx_FindPublic(amx,"@timer",&index) != AMX_ERR_NONE)
+      index = -1;
+    if (index >= 0 || amx_FindNative(amx,"settimerex",&dummy) == AMX_ERR_NONE) {
+      if ((ts = time_state(amx)) == NULL)
+        return AMX_ERR_MEMORY;
+      ts->idxTimer = index;
+      if (amx_GetUserData(amx, AMX_USERTAG('I','d','l','e'), (void**)&ts->PrevIdle) != AMX_ERR_NONE)
+        ts->PrevIdle = NULL;
       amx_SetUserData(amx, AMX_USERTAG('I','d','l','e'), amx_TimeIdle);
+      if (amx_GetUserData(amx, AMX_EVENTTAG, (void**)&ts->PrevEvents) != AMX_ERR_NONE)
+        ts->PrevEvents = NULL;
+      amx_SetUserData(amx, AMX_EVENTTAG, amx_TimeEvents);
     } /* if */
   #endif
 
@@ -480,9 +1041,11 @@ int AMXEXPORT AMXAPI amx_TimeInit(AMX *amx)
 
 int AMXEXPORT AMXAPI amx_TimeCleanup(AMX *amx)
 {
-  (void)amx;
-  #if !defined AMXTIME_NOIDLE
-    PrevIdle = NULL;
-  #endif
+  void *state;
+
+  if (amx_GetExtState(amx, TIME_TAG, &state) == AMX_ERR_NONE) {
+    amx_SetExtState(amx, TIME_TAG, NULL, NULL);
+    time_release(amx, state);
+  } /* if */
   return AMX_ERR_NONE;
 }
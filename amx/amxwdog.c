@@ -0,0 +1,208 @@
+/*  Watchdog that puts a time limit on calls to amx_Exec()
+ *
+ *  wdog_Exec() runs amx_Exec() with a deadline. A single watchdog thread
+ *  keeps the pending deadlines (of all threads that call wdog_Exec()) and
+ *  calls amx_Interrupt() on an abstract machine whose deadline expires. The
+ *  abstract machine then stops at the next function call or backward jump,
+ *  and wdog_Exec() aborts the call. So the cost of the watchdog is only in
+ *  setting up and removing the deadline, not in running the script.
+ *
+ *  The abstract machine must run on a core that checks for the interrupt
+ *  (the ANSI-C core, the GNU GCC core or the x86-64 JIT); on other cores,
+ *  the deadline has no effect.
+ *
+ *  This module uses POSIX threads.
+ *
+ *  Copyright (c) CompuPhase, 2026
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxwdog.c $
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "amx.h"
+#include "amxwdog.h"
+
+#if defined CLOCK_MONOTONIC && !defined __APPLE__
+  #define WDOG_CLOCK        CLOCK_MONOTONIC
+#else
+  #define WDOG_CLOCK        CLOCK_REALTIME
+#endif
+
+typedef struct tagDEADLINE {
+  AMX *amx;
+  long long time;       /* in milliseconds */
+  int expired;          /* set by the watchdog thread */
+  struct tagDEADLINE *prev, *next;
+} DEADLINE;
+
+struct tagAMX_WATCHDOG {
+  pthread_mutex_t lock; /* protects the fields below and the deadlines */
+  pthread_cond_t change;/* signalled when the earliest deadline changes */
+  pthread_t thread;
+  DEADLINE *list;       /* pending deadlines, ordered on time */
+  int stop;
+};
+
+static long long now(void)
+{
+  struct timespec ts;
+  clock_gettime(WDOG_CLOCK, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void unlink_deadline(AMX_WATCHDOG *wdog, DEADLINE *item)
+{
+  if (item->prev != NULL)
+    item->prev->next = item->next;
+  else
+    wdog->list = item->next;
+  if (item->next != NULL)
+    item->next->prev = item->prev;
+}
+
+static void *watchdog(void *arg)
+{
+  AMX_WATCHDOG *wdog = (AMX_WATCHDOG*)arg;
+  DEADLINE *item;
+
+  pthread_mutex_lock(&wdog->lock);
+  while (!wdog->stop) {
+    if ((item = wdog->list) == NULL) {
+      pthread_cond_wait(&wdog->change, &wdog->lock);
+    } else if (item->time <= now()) {
+      unlink_deadline(wdog, item);
+      item->expired = 1;
+      amx_Interrupt(item->amx);
+    } else {
+      struct timespec ts;
+      ts.tv_sec = (time_t)(item->time / 1000);
+      ts.tv_nsec = (long)(item->time % 1000) * 1000000L;
+      pthread_cond_timedwait(&wdog->change, &wdog->lock, &ts);
+    } /* if */
+  } /* while */
+  pthread_mutex_unlock(&wdog->lock);
+  return NULL;
+}
+
+/* wdog_Create() starts the watchdog thread. A single watchdog serves any
+ * number of threads and abstract machines.
+ */
+int AMXAPI wdog_Create(AMX_WATCHDOG **wdog)
+{
+  AMX_WATCHDOG *w;
+  pthread_condattr_t attr;
+
+  if (wdog == NULL)
+    return AMX_ERR_PARAMS;
+  if ((w = (AMX_WATCHDOG*)malloc(sizeof(AMX_WATCHDOG))) == NULL)
+    return AMX_ERR_MEMORY;
+  memset(w, 0, sizeof(AMX_WATCHDOG));
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_condattr_init(&attr);
+  #if WDOG_CLOCK != CLOCK_REALTIME
+    pthread_condattr_setclock(&attr, WDOG_CLOCK);
+  #endif
+  pthread_cond_init(&w->change, &attr);
+  pthread_condattr_destroy(&attr);
+  if (pthread_create(&w->thread, NULL, watchdog, w) != 0) {
+    pthread_cond_destroy(&w->change);
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  *wdog = w;
+  return AMX_ERR_NONE;
+}
+
+/* wdog_Delete() stops the watchdog thread; no call to wdog_Exec() may be
+ * pending.
+ */
+int AMXAPI wdog_Delete(AMX_WATCHDOG *wdog)
+{
+  if (wdog == NULL)
+    return AMX_ERR_PARAMS;
+  pthread_mutex_lock(&wdog->lock);
+  assert(wdog->list == NULL);
+  wdog->stop = 1;
+  pthread_cond_signal(&wdog->change);
+  pthread_mutex_unlock(&wdog->lock);
+  pthread_join(wdog->thread, NULL);
+  pthread_cond_destroy(&wdog->change);
+  pthread_mutex_destroy(&wdog->lock);
+  free(wdog);
+  return AMX_ERR_NONE;
+}
+
+/* wdog_Exec() calls amx_Exec() and aborts it if it has not returned after
+ * "timeout" milliseconds; it then returns AMX_ERR_INTERRUPT and the abstract
+ * machine is ready for the next call. The time limit is per call: when the
+ * abstract machine goes to sleep, the next call (with AMX_EXEC_CONT) gets a
+ * new time limit. If "timeout" is zero or negative, there is no time limit.
+ */
+int AMXAPI wdog_Exec(AMX_WATCHDOG *wdog, AMX *amx, cell *retval, int index, long timeout)
+{
+  DEADLINE item, *ptr;
+  int err;
+
+  if (wdog == NULL || amx == NULL)
+    return AMX_ERR_PARAMS;
+  if (timeout <= 0)
+    return amx_Exec(amx, retval, index);
+
+  /* insert the deadline in the sorted list */
+  memset(&item, 0, sizeof item);
+  item.amx = amx;
+  item.time = now() + timeout;
+  pthread_mutex_lock(&wdog->lock);
+  if (wdog->list == NULL || wdog->list->time > item.time) {
+    item.next = wdog->list;
+    wdog->list = &item;
+    pthread_cond_signal(&wdog->change);   /* new earliest deadline */
+  } else {
+    for (ptr = wdog->list; ptr->next != NULL && ptr->next->time <= item.time; ptr = ptr->next)
+      /* nothing */;
+    item.prev = ptr;
+    item.next = ptr->next;
+    ptr->next = &item;
+  } /* if */
+  if (item.next != NULL)
+    item.next->prev = &item;
+  pthread_mutex_unlock(&wdog->lock);
+
+  err = amx_Exec(amx, retval, index);
+
+  /* remove the deadline, unless the watchdog already did so */
+  pthread_mutex_lock(&wdog->lock);
+  if (!item.expired)
+    unlink_deadline(wdog, &item);
+  pthread_mutex_unlock(&wdog->lock);
+
+  if (item.expired) {
+    if (err == AMX_ERR_INTERRUPT) {
+      /* abort the call: drop the stack frames of the interrupted function */
+      amx->stk = amx->reset_stk;
+      amx->hea = amx->reset_hea;
+    } else {
+      /* amx_Exec() returned before it saw the interrupt; clear the flag, so
+       * that it does not stop the next call
+       */
+      amx_Interrupted(amx, NULL, 1);
+    } /* if */
+  } /* if */
+  return err;
+}
@@ -0,0 +1,38 @@
+/*  Watchdog that puts a time limit on calls to amx_Exec()
+ *
+ *  Copyright (c) CompuPhase, 2026
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxwdog.h $
+ */
+#ifndef AMXWDOG_H_INCLUDED
+#define AMXWDOG_H_INCLUDED
+
+#include "amx.h"
+
+#ifdef  __cplusplus
+extern  "C" {
+#endif
+
+typedef struct tagAMX_WATCHDOG AMX_WATCHDOG;
+
+int AMXAPI wdog_Create(AMX_WATCHDOG **wdog);
+int AMXAPI wdog_Delete(AMX_WATCHDOG *wdog);
+int AMXAPI wdog_Exec(AMX_WATCHDOG *wdog, AMX *amx, cell *retval, int index, long timeout);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* AMXWDOG_H_INCLUDED */
@@ -0,0 +1,141 @@
+/*  Benchmark for the scan of the garbage collector (amxgc.c)
+ *
+ *  The program sets up a synthetic data segment of 16 MiB, which is mostly
+ *  zeros, small integers and random bit patterns (like packed strings and
+ *  floating point values). It marks a set of objects, and scans the data
+ *  segment a number of times, first without references to the objects, and
+ *  then with references to half of the objects. It prints the scan throughput
+ *  in GB/s, and it checks that gc_clean() releases exactly the objects that
+ *  are not referenced.
+ *
+ *  Build with:
+ *      gcc -O2 -I.. -I../../linux gcbench.c ../amxgc.c
+ *  Add -mavx2 to use AVX2 instructions for the scan, or -DGC_NO_SIMD to use
+ *  plain C only.
+ *
+ *  Copyright (c) CompuPhase, 2026
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: gcbench.c $
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "amx.h"
+#include "amxgc.h"
+
+#define DATASIZE      (16L * 1024 * 1024)  /* bytes */
+#define NUM_OBJECTS   65536L
+#define NUM_SCANS     20
+#define OBJECT_BASE   0x10000000L       /* objects look like heap addresses */
+#define OBJECT_SIZE   48
+
+static unsigned long seed = 1;
+static long released;
+static int checking;
+
+static unsigned long random_next(void)
+{
+  /* a linear congruential generator, so that every run is the same */
+  seed = seed * 1103515245UL + 12345UL;
+  return (seed >> 8) & 0xffffffUL;
+}
+
+static cell object(long index)
+{
+  return (cell)(OBJECT_BASE + index * OBJECT_SIZE);
+}
+
+static void release(cell value)
+{
+  long index = (long)((value - OBJECT_BASE) / OBJECT_SIZE);
+  if (checking) {
+    if (index % 2 == 0)
+      printf("released referenced object %ld\n", index);
+    released++;
+  } /* if */
+}
+
+static void measure(GCINFO *gc, AMX *amx, const char *label)
+{
+  clock_t start, stop;
+  double seconds;
+  int scan;
+
+  start = clock();
+  for (scan = 0; scan < NUM_SCANS; scan++)
+    gc_scan_r(gc, amx);
+  stop = clock();
+  seconds = (double)(stop - start) / CLOCKS_PER_SEC;
+  printf("%d-bit cells, %s: %.2f ms per scan, %.2f GB/s\n",
+         (int)(8 * sizeof(cell)), label, seconds * 1000.0 / NUM_SCANS,
+         (double)DATASIZE * NUM_SCANS / seconds / 1e9);
+}
+
+int main(void)
+{
+  AMX amx;
+  AMX_HEADER hdr;
+  GCINFO *gc;
+  cell *data;
+  long i, spacing, count = DATASIZE / sizeof(cell);
+  unsigned long r;
+
+  if ((data = (cell*)malloc(DATASIZE)) == NULL)
+    return 1;
+  for (i = 0; i < count; i++) {
+    r = random_next() % 100;
+    if (r < 70)
+      data[i] = 0;
+    else if (r < 85)
+      data[i] = (cell)(random_next() % 1000);
+    else
+      data[i] = (cell)((random_next() << 8) ^ random_next());
+    if (data[i] >= object(0) && data[i] < object(NUM_OBJECTS))
+      data[i] = 1;                /* no accidental references */
+  } /* for */
+  memset(&hdr, 0, sizeof hdr);
+  hdr.dat = 0;
+  hdr.hea = DATASIZE;
+  memset(&amx, 0, sizeof amx);
+  amx.base = (unsigned char*)&hdr;
+  amx.data = (unsigned char*)data;
+  amx.hlw = amx.hea = DATASIZE;   /* empty heap and stack */
+  amx.stk = amx.stp = DATASIZE;
+
+  gc_create(&gc);
+  gc_setcallback_r(gc, release);
+  gc_settable_r(gc, 17, GC_AUTOGROW);
+  for (i = 0; i < NUM_OBJECTS; i++)
+    gc_mark_r(gc, object(i));
+
+  /* the scan cost is in the filter when no cell refers to an object, and in
+   * the table look-ups when many cells do */
+  measure(gc, &amx, "no references");
+  /* refer to the objects with an even index, one in every "spacing" cells */
+  spacing = count / (NUM_OBJECTS / 2);
+  for (i = 0; i < NUM_OBJECTS; i += 2)
+    data[(i / 2) * spacing + (long)(random_next() % spacing)] = object(i);
+  measure(gc, &amx, "with references");
+
+  checking = 1;
+  gc_clean_r(gc);
+  checking = 0;
+  printf("released %ld of %ld objects (expected %ld)\n",
+         released, NUM_OBJECTS, NUM_OBJECTS / 2);
+  gc_delete(gc);
+  free(data);
+  return released == NUM_OBJECTS / 2 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+/*  Benchmark for the memory pool of the overlay manager (amxpool.c)
+ *
+ *  The program simulates the overlay manager of a host: for every call of a
+ *  function in an overlay, the host looks up the overlay in the pool, and on a
+ *  miss it allocates a block (which may release the least-recently used
+ *  blocks) and loads the overlay into it. The functions are picked at random,
+ *  with a skew towards a set of "hot" functions, and the overlays have
+ *  random sizes, so that the pool gets fragmented. The program checks the
+ *  contents of every block that it finds, and prints the time per call and
+ *  the hit rate for a few pool sizes.
+ *
+ *  Build with:
+ *      gcc -O2 -I.. -I../../linux poolbench.c ../amxpool.c
+ *
+ *  Copyright (c) CompuPhase, 2026
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: poolbench.c $
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "amx.h"
+#include "amxpool.h"
+
+#define NUM_OVERLAYS  2000
+#define NUM_CALLS     2000000L
+#define HOT_OVERLAYS  50        /* overlays that get half of the calls */
+#define MIN_SIZE      16
+#define MAX_SIZE      2048
+
+static unsigned ovlsize[NUM_OVERLAYS];
+static unsigned long seed = 1;
+
+static unsigned long random_next(void)
+{
+  /* a linear congruential generator, so that every run is the same */
+  seed = seed * 1103515245UL + 12345UL;
+  return (seed >> 8) & 0xffffffUL;
+}
+
+static void fill(cell *block, int index)
+{
+  unsigned i;
+  for (i = 0; i < ovlsize[index] / sizeof(cell); i++)
+    block[i] = (cell)(index * 7919 + i);
+}
+
+static int check(const cell *block, int index)
+{
+  /* check only the first and the last cell, to keep the cost of a hit low */
+  unsigned last = ovlsize[index] / sizeof(cell) - 1;
+  return block[0] == (cell)(index * 7919) && block[last] == (cell)(index * 7919 + last);
+}
+
+static int run(unsigned poolsize)
+{
+  AMX_POOL pool;
+  void *base;
+  cell *block;
+  long call, hits = 0, failed = 0;
+  int index;
+  clock_t start, stop;
+
+  if ((base = malloc(poolsize)) == NULL)
+    return 0;
+  memset(&pool, 0, sizeof pool);
+  amx_poolinit_r(&pool, base, poolsize);
+  seed = 1;
+  start = clock();
+  for (call = 0; call < NUM_CALLS; call++) {
+    if (random_next() & 1)
+      index = (int)(random_next() % HOT_OVERLAYS);
+    else
+      index = (int)(random_next() % NUM_OVERLAYS);
+    if ((block = (cell*)amx_poolfind_r(&pool, index)) != NULL) {
+      hits++;
+      if (!check(block, index)) {
+        printf("corrupted block %d\n", index);
+        free(base);
+        return 0;
+      } /* if */
+    } else if ((block = (cell*)amx_poolalloc_r(&pool, ovlsize[index], index)) != NULL) {
+      fill(block, index);   /* "load" the overlay */
+    } else {
+      failed++;
+    } /* if */
+  } /* for */
+  stop = clock();
+  printf("pool %7u bytes: %6.1f ns per call, %5.1f%% hits, %ld failed\n",
+         poolsize, (double)(stop - start) * 1e9 / CLOCKS_PER_SEC / NUM_CALLS,
+         100.0 * hits / NUM_CALLS, failed);
+  free(base);
+  return 1;
+}
+
+int main(void)
+{
+  unsigned poolsize;
+  int i;
+
+  for (i = 0; i < NUM_OVERLAYS; i++) {
+    ovlsize[i] = MIN_SIZE + (unsigned)(random_next() % (MAX_SIZE - MIN_SIZE));
+    ovlsize[i] -= ovlsize[i] % sizeof(cell);
+  } /* for */
+  for (poolsize = 16 * 1024; poolsize <= 1024 * 1024; poolsize *= 4)
+    if (!run(poolsize))
+      return 1;
+  return 0;
+}
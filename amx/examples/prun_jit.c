@@ -192,8 +192,8 @@ static char *messages[] = {
       /* AMX_ERR_DIVIDE    */ "Divide by zero",
       /* AMX_ERR_SLEEP     */ "(sleep mode)",
       /* AMX_ERR_INVSTATE  */ "Invalid state",
-      /* 14 */                "(reserved)",
-      /* 15 */                "(reserved)",
+      /* AMX_ERR_BUDGET    */ "Instruction budget used up",
+      /* AMX_ERR_INTERRUPT */ "Interrupted",
       /* AMX_ERR_MEMORY    */ "Out of memory",
       /* AMX_ERR_FORMAT    */ "Invalid/unsupported P-code file format",
       /* AMX_ERR_VERSION   */ "File is for a newer version of the AMX",
@@ -207,6 +207,7 @@ static char *messages[] = {
       /* AMX_ERR_DOMAIN    */ "Domain error, expression result does not fit in range",
       /* AMX_ERR_GENERAL   */ "General error (unknown or unspecific error)",
       /* AMX_ERR_OVERLAY   */ "Overlays are unsupported (JIT) or uninitialized",
+      /* AMX_ERR_SWITCH    */ "Fibers are unsupported by this abstract machine core",
     };
   if (errnum < 0 || errnum >= sizeof messages / sizeof messages[0])
     return "(unknown)";
@@ -0,0 +1,148 @@
+/*  Multi-threaded shell for the "Pawn" Abstract Machine.
+ *
+ *  Every thread loads its own copy of the script and runs main() a number of
+ *  times. The run is repeated with 1, 2, 4, ... threads up to the requested
+ *  count, and the throughput of each run is printed. Since the abstract
+ *  machines do not share any state, the throughput should grow (nearly)
+ *  linearly with the number of threads, up to the number of processor cores.
+ *
+ *  Every run of main() must return the same value, in all threads; the
+ *  program stops with an error if it does not. The test script "threads.p"
+ *  (in the "test" directory) uses this to check that the abstract machines
+ *  do not share the state of the core module.
+ *
+ *  The script should not do console input, and preferably no output either:
+ *  output from several threads is interleaved and the console is a shared
+ *  resource that limits the scaling.
+ *
+ *  This example uses POSIX threads.
+ *
+ *  Copyright (c) ITB CompuPhase, 2001-2010
+ *
+ *  This file may be freely used. No warranties of any kind.
+ */
+#include <stdio.h>
+#include <stdlib.h>     /* for exit() */
+#include <string.h>     /* for memset() (on some compilers) */
+#include <time.h>
+#include <pthread.h>
+#include "amx.h"
+#include "amxaux.c"
+
+#define MAXTHREADS  64
+
+typedef struct tagWORKER {
+  pthread_t thread;
+  const char *filename;
+  int runs;
+  int err;
+  cell ret;
+  int mismatch;         /* number of runs that returned another value than the first */
+} WORKER;
+
+void ErrorExit(AMX *amx, int errorcode)
+{
+  printf("Run time error %d: \"%s\" on address %ld\n",
+         errorcode, aux_StrError(errorcode),
+         (amx != NULL) ? amx->cip : 0);
+  exit(1);
+}
+
+void PrintUsage(char *program)
+{
+  printf("Usage: %s <filename> [threads [runs]]\n"
+         "<filename> is a compiled script.\n"
+         "[threads] is the maximum number of threads (default 4).\n"
+         "[runs] is the number of times that each thread runs main() (default 100).\n",
+         program);
+  exit(1);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg)
+{
+  extern int AMXEXPORT AMXAPI amx_CoreInit(AMX *amx);
+  extern int AMXEXPORT AMXAPI amx_CoreCleanup(AMX *amx);
+
+  WORKER *w = (WORKER*)arg;
+  AMX amx;
+  cell ret;
+  int run;
+
+  w->err = aux_LoadProgram(&amx, w->filename, NULL);
+  if (w->err != AMX_ERR_NONE)
+    return NULL;
+  w->err = amx_CoreInit(&amx);
+  for (run = 0; run < w->runs && w->err == AMX_ERR_NONE; run++) {
+    w->err = amx_Exec(&amx, &ret, AMX_EXEC_MAIN);
+    if (run == 0)
+      w->ret = ret;
+    else if (ret != w->ret)
+      w->mismatch++;
+  } /* for */
+  amx_CoreCleanup(&amx);
+  aux_FreeProgram(&amx);
+  return NULL;
+}
+
+int main(int argc,char *argv[])
+{
+  static WORKER workers[MAXTHREADS];
+  int maxthreads = 4, runs = 100;
+  int count, i;
+  double start, elapsed, base = 0;
+  cell expected = 0;
+
+  if (argc < 2 || argc > 4)
+    PrintUsage(argv[0]);
+  if (argc > 2)
+    maxthreads = atoi(argv[2]);
+  if (argc > 3)
+    runs = atoi(argv[3]);
+  if (maxthreads < 1 || maxthreads > MAXTHREADS || runs < 1)
+    PrintUsage(argv[0]);
+
+  for (count = 1; count <= maxthreads; count = (count < maxthreads && count * 2 > maxthreads) ? maxthreads : count * 2) {
+    start = now();
+    for (i = 0; i < count; i++) {
+      memset(&workers[i], 0, sizeof(WORKER));
+      workers[i].filename = argv[1];
+      workers[i].runs = runs;
+      if (pthread_create(&workers[i].thread, NULL, worker, &workers[i]) != 0) {
+        printf("Failed to create thread %d\n", i);
+        exit(1);
+      } /* if */
+    } /* for */
+    for (i = 0; i < count; i++)
+      pthread_join(workers[i].thread, NULL);
+    elapsed = now() - start;
+    for (i = 0; i < count; i++)
+      if (workers[i].err != AMX_ERR_NONE)
+        ErrorExit(NULL, workers[i].err);
+    if (count == 1)
+      expected = workers[0].ret;
+    for (i = 0; i < count; i++) {
+      if (workers[i].ret != expected || workers[i].mismatch != 0) {
+        printf("Thread %d of %d: main() returned %ld (and another value in %d runs), expected %ld\n",
+               i, count, (long)workers[i].ret, workers[i].mismatch, (long)expected);
+        exit(1);
+      } /* if */
+    } /* for */
+    if (count == 1)
+      base = elapsed;
+    printf("%2d thread(s): %8.3f s, %10.1f runs/s, speed-up %.2f\n",
+           count, elapsed, count * runs / elapsed,
+           (elapsed > 0) ? count * base / elapsed : 0.0);
+    if (count == maxthreads)
+      break;
+  } /* for */
+  printf("main() returned %ld\n", (long)expected);
+
+  return 0;
+}
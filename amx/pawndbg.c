@@ -2862,6 +2862,11 @@ static void *loadprogram(AMX *amx,const char *filename)
       fclose(fp);
 
       memset(amx, 0, sizeof *amx);
+      /* the debugger must see the P-code as the compiler generated it (it
+       * disassembles it and it puts breakpoints on it), so the abstract
+       * machine must not create superinstructions
+       */
+      amx->flags |= AMX_FLAG_NOFUSE;
       if ((hdr.flags & AMX_FLAG_OVERLAY) != 0) {
         amx->data = (unsigned char*)program + hdr.cod;
         amx->overlay = prun_Overlay;
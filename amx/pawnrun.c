@@ -40,6 +40,10 @@
 #if defined AMXDBG
   #include "amxdbg.h"
 #endif
+#if defined __LINUX__
+  #include "amxevent.h"
+  #define PRUN_EVENTLOOP
+#endif
 static char g_filename[_MAX_PATH];      /* for loading the debug or information
                                          * or for loading overlays */
 
@@ -52,13 +56,23 @@ extern int AMXAPI amx_ConsoleInit(AMX *amx);
 extern int AMXAPI amx_CoreInit(AMX *amx);
 
 AMX *global_amx;
+#if defined PRUN_EVENTLOOP
+  AMX_EVENTLOOP *global_loop;
+#endif
 int AMXAPI prun_Monitor(AMX *amx);
 
 static int abortflagged = 0;
 void sigabort(int sig)
 {
-  /* install the debug hook procedure if this was not done already */
-  amx_SetDebugHook(global_amx,prun_Monitor);
+  /* amx_Interrupt() only sets a flag, which the abstract machine checks on
+   * calls and backward jumps; so this works without debug information (and
+   * without a debug hook)
+   */
+  amx_Interrupt(global_amx);
+  #if defined PRUN_EVENTLOOP
+    if (global_loop != NULL)
+      evloop_Stop(global_loop); /* for when the program waits for an event */
+  #endif
   abortflagged=1;
   signal(sig,sigabort); /* re-install the signal handler */
 }
@@ -200,8 +214,38 @@ int AMXAPI aux_LoadProgram(AMX *amx, char *filename)
       amx->overlay = prun_Overlay;
     } /* if */
   #endif
+  #if defined AMX_JIT
+    /* compile programs without overlays to native code */
+    if ((hdr.flags & AMX_FLAG_OVERLAY) == 0)
+      amx->flags = AMX_FLAG_JITC;
+  #endif
   result = amx_Init(amx, datablock);
 
+  #if defined AMX_JIT
+    /* amx_Init() has calculated the sizes of the blocks that the JIT needs;
+     * the program is moved to the new block, so the old one can be freed
+     */
+    if (result == AMX_ERR_NONE && (amx->flags & AMX_FLAG_JITC) != 0) {
+      unsigned char *native_code;
+      void *reloc_table;
+      native_code = (unsigned char*)malloc(amx->codesize);
+      reloc_table = malloc(amx->reloc_size);
+      if (native_code != NULL && reloc_table != NULL) {
+        result = amx_InitJIT(amx, reloc_table, native_code);
+      } else {
+        result = AMX_ERR_MEMORY;
+      } /* if */
+      free(reloc_table);
+      if (result == AMX_ERR_NONE) {
+        free(datablock);
+        datablock = native_code;
+      } else {
+        amx_Cleanup(amx);
+        free(native_code);
+      } /* if */
+    } /* if */
+  #endif
+
   /* free the memory block on error, if it was allocated here */
   if (result != AMX_ERR_NONE) {
     free(datablock);
@@ -246,8 +290,8 @@ static char *messages[] = {
       /* AMX_ERR_DIVIDE    */ "Divide by zero",
       /* AMX_ERR_SLEEP     */ "(sleep mode)",
       /* AMX_ERR_INVSTATE  */ "Invalid state",
-      /* 14 */                "(reserved)",
-      /* 15 */                "(reserved)",
+      /* AMX_ERR_BUDGET    */ "Instruction budget used up",
+      /* AMX_ERR_INTERRUPT */ "Interrupted",
       /* AMX_ERR_MEMORY    */ "Out of memory",
       /* AMX_ERR_FORMAT    */ "Invalid/unsupported P-code file format",
       /* AMX_ERR_VERSION   */ "File is for a newer version of the AMX",
@@ -261,6 +305,7 @@ static char *messages[] = {
       /* AMX_ERR_DOMAIN    */ "Domain error, expression result does not fit in range",
       /* AMX_ERR_GENERAL   */ "General error (unknown or unspecific error)",
       /* AMX_ERR_OVERLAY   */ "Overlays are unsupported (JIT) or uninitialized",
+      /* AMX_ERR_SWITCH    */ "Fibers are unsupported by this abstract machine core",
     };
   if (errnum < 0 || errnum >= sizeof messages / sizeof messages[0])
     return "(unknown)";
@@ -316,6 +361,9 @@ int main(int argc,char *argv[])
   clock_t start = 0, end = 0;
   STACKINFO stackinfo = { 0 };
   AMX_IDLE idlefunc;
+  #if defined PRUN_EVENTLOOP
+    AMX_EVENTLOOP *loop = NULL;
+  #endif
 
   if (argc < 2)
     PrintUsage(argv[0]);        /* function "usage" aborts the program */
@@ -341,9 +389,9 @@ int main(int argc,char *argv[])
       PrintUsage(argv[0]);
   } /* if */
 
-  /* To install the debug hook "just-in-time", the signal function needs
-   * a pointer to the abstract machine(s) to abort. There are various ways
-   * to implement this; here I have done so with a simple global variable.
+  /* To interrupt the script, the signal function needs a pointer to the
+   * abstract machine(s) to abort. There are various ways to implement this;
+   * here I have done so with a simple global variable.
    */
   global_amx = &amx;
   signal(SIGINT, sigabort);
@@ -359,6 +407,22 @@ int main(int argc,char *argv[])
   if (amx_GetUserData(&amx, AMX_USERTAG('I','d','l','e'), (void**)&idlefunc) != AMX_ERR_NONE)
     idlefunc = NULL;
 
+  #if defined PRUN_EVENTLOOP
+    /* if any of the extension modules handles events, wait for these events
+     * in an event loop, instead of polling the idle function(s)
+     */
+    {
+      AMX_EVENTHOOK hook;
+      if (amx_GetUserData(&amx, AMX_EVENTTAG, (void**)&hook) == AMX_ERR_NONE && hook != NULL
+          && evloop_Create(&loop) == AMX_ERR_NONE) {
+        err = evloop_Attach(loop, &amx);
+        ExitOnError(&amx, err);
+        global_loop = loop;
+        idlefunc = NULL;
+      } /* if */
+    }
+  #endif
+
   for (i = 2; i < argc; i++) {
     if (strcmp(argv[i],"-stack") == 0) {
       uint16_t flags;
@@ -393,6 +457,15 @@ int main(int argc,char *argv[])
    */
   err = amx_Exec(&amx, &ret, AMX_EXEC_MAIN);
   while (err == AMX_ERR_SLEEP) {
+    #if defined PRUN_EVENTLOOP
+      if (loop != NULL) {
+        /* the event loop runs the event functions (on a copy of the registers)
+         * while the main program sleeps
+         */
+        err = evloop_Run(loop, (long)amx.pri);
+        ExitOnError(&amx, err);
+      } /* if */
+    #endif
     if (idlefunc != NULL) {
       /* If the abstract machine was put to sleep, we can handle events during
        * that time. To save the "restart point", we must make a copy of the AMX
@@ -412,14 +485,26 @@ int main(int argc,char *argv[])
     } /* if */
     err = amx_Exec(&amx, &ret, AMX_EXEC_CONT);
   } /* while */
-  if (idlefunc == NULL || err != AMX_ERR_INDEX)
-    ExitOnError(&amx, err);     /* event-driven programs may not have main() */
+  #if defined PRUN_EVENTLOOP
+    if ((idlefunc == NULL && loop == NULL) || err != AMX_ERR_INDEX)
+      ExitOnError(&amx, err);   /* event-driven programs may not have main() */
+  #else
+    if (idlefunc == NULL || err != AMX_ERR_INDEX)
+      ExitOnError(&amx, err);   /* event-driven programs may not have main() */
+  #endif
 
   /* For event-driven programs, we also need to loop over the idle/monitor
    * function that some extension module installed (this could be the console
    * module, for example). We did this if the main program was put to "sleep",
    * but we do that here too.
    */
+  #if defined PRUN_EVENTLOOP
+    if (loop != NULL) {
+      /* run until no event sources are left, or until an error */
+      err = evloop_Run(loop, -1);
+      ExitOnError(&amx, err);
+    } /* if */
+  #endif
   if (idlefunc != NULL) {
     while ((err = idlefunc(&amx,amx_Exec)) == AMX_ERR_NONE)
       /* nothing */;
@@ -433,6 +518,12 @@ int main(int argc,char *argv[])
    * shared libraries that were registered automatically by amx_Init().
    */
   aux_FreeProgram(&amx);
+  #if defined PRUN_EVENTLOOP
+    if (loop != NULL) {
+      global_loop = NULL;
+      evloop_Delete(loop);
+    } /* if */
+  #endif
 
   /* Print the return code of the compiled script (often not very useful),
    * its run time, and its stack usage.
@@ -449,6 +540,24 @@ int main(int argc,char *argv[])
            stackinfo.maxheap / sizeof(cell), stackinfo.maxheap);
   } /* if */
 
+  #if defined AMX_PAIRCOUNT
+    /* Dump the histogram of executed opcode pairs on stderr, one pair per
+     * line: the two opcodes (as numbers, see the OPCODE enumeration in AMX.C)
+     * and the count. To add up the counts of several runs and list the most
+     * frequent pairs, use for example:
+     *   awk '{ n[$1" "$2]+=$3 } END { for (p in n) print n[p], p }' *.pairs | sort -rn
+     */
+    {
+      const unsigned long *counts;
+      int numopcodes, op1, op2;
+      amx_PairCount(&counts, &numopcodes);
+      for (op1 = 0; op1 < numopcodes; op1++)
+        for (op2 = 0; op2 < numopcodes; op2++)
+          if (counts[op1 * numopcodes + op2] != 0)
+            fprintf(stderr, "%d %d %lu\n", op1, op2, counts[op1 * numopcodes + op2]);
+    }
+  #endif
+
   #if defined AMX_TERMINAL
     /* This is likely a graphical terminal, which should not be closed
      * automatically
@@ -650,13 +650,94 @@ static int findopcode(char *instr,int maxlen)
   return 0;             /* not found, return special index */
 }
 
+#define MAX_OVLHINTS  8   /* number of "likely callees" per overlay */
+
+static int is_ovlfunc(const symbol *sym)
+{
+  return sym->ident==iFUNCTN
+         && (sym->usage & uNATIVE)==0 && (sym->usage & (uREAD | uPUBLIC))!=0
+         && (sym->usage & uDEFINE)!=0;
+}
+
+static void add_ovlhint(uint16_t *slots,int ovl,int callee)
+{
+  uint16_t *list=slots+ovl*MAX_OVLHINTS;
+  int i;
+
+  if (ovl==callee)
+    return;
+  for (i=0; i<MAX_OVLHINTS && list[i]!=0xffff && list[i]!=(uint16_t)callee; i++)
+    /* nothing */;
+  if (i<MAX_OVLHINTS)
+    list[i]=(uint16_t)callee;
+}
+
+/* make_ovlhints() builds the table with the "likely callees" of every overlay
+ * (see AMX_OVLHINTS_MAGIC), from the referrer lists of the functions (which
+ * hold the functions that call it). The stub of a function with states calls
+ * the implementations of the function. The table is allocated; its size in
+ * bytes is stored in "size".
+ */
+static uint16_t *make_ovlhints(int numoverlays,long *size)
+{
+  uint16_t *slots,*table;
+  symbol *sym,*caller;
+  statelist *stlist;
+  int i,j,ovl,count;
+
+  assert(numoverlays>0 && numoverlays<0xffff);
+  slots=(uint16_t*)malloc(numoverlays*MAX_OVLHINTS*sizeof(uint16_t));
+  if (slots==NULL)
+    error(103);                 /* insufficient memory */
+  memset(slots,0xff,numoverlays*MAX_OVLHINTS*sizeof(uint16_t));
+  for (sym=glbtab.next; sym!=NULL; sym=sym->next) {
+    if (!is_ovlfunc(sym) || strcmp(sym->name,_ENTRYFUNC)==0)
+      continue;                 /* state entry functions are not called */
+    if (sym->states!=NULL)
+      for (stlist=sym->states->next; stlist!=NULL; stlist=stlist->next)
+        add_ovlhint(slots,(int)sym->index,stlist->label);
+    for (i=0; i<sym->numrefers; i++) {
+      caller=sym->refer[i];
+      if (caller==NULL || caller==sym || !is_ovlfunc(caller))
+        continue;
+      if (caller->states==NULL) {
+        add_ovlhint(slots,(int)caller->index,(int)sym->index);
+      } else {
+        for (stlist=caller->states->next; stlist!=NULL; stlist=stlist->next)
+          add_ovlhint(slots,stlist->label,(int)sym->index);
+      } /* if */
+    } /* for */
+  } /* for */
+
+  count=0;
+  for (i=0; i<numoverlays*MAX_OVLHINTS; i++)
+    if (slots[i]!=0xffff)
+      count++;
+  table=(uint16_t*)malloc((3+numoverlays+count)*sizeof(uint16_t));
+  if (table==NULL)
+    error(103);                 /* insufficient memory */
+  table[0]=AMX_OVLHINTS_MAGIC;
+  table[1]=(uint16_t)numoverlays;
+  count=0;
+  for (ovl=0; ovl<numoverlays; ovl++) {
+    table[2+ovl]=(uint16_t)count;
+    for (j=0; j<MAX_OVLHINTS && slots[ovl*MAX_OVLHINTS+j]!=0xffff; j++)
+      table[3+numoverlays+count++]=slots[ovl*MAX_OVLHINTS+j];
+  } /* for */
+  table[2+numoverlays]=(uint16_t)count;
+  free(slots);
+  *size=(3+numoverlays+count)*sizeof(uint16_t);
+  return table;
+}
+
 SC_FUNC int assemble(FILE *fout,FILE *fin)
 {
   AMX_HEADER hdr;
   AMX_FUNCSTUB func;
   int numpublics,numnatives,numoverlays,numlibraries,numpubvars,numtags;
   int padding;
-  long nametablesize,nameofs;
+  long nametablesize,nameofs,hintsize;
+  uint16_t *ovlhints;
   char line[512];
   char *instr,*params;
   int i,pass,size;
@@ -762,6 +843,16 @@ SC_FUNC int assemble(FILE *fout,FILE *fin)
       if (pc_ovl0size[i][1]!=0)
         numoverlays++;
 
+  /* the table with the "likely callees" of the overlays goes in front of the
+   * names in the name table
+   */
+  ovlhints=NULL;
+  hintsize=0;
+  if (pc_overlays>0) {
+    ovlhints=make_ovlhints(numoverlays,&hintsize);
+    nametablesize+=hintsize;
+  } /* if */
+
   /* pad the header to sc_dataalign
    * => thereby the code segment is aligned
    * => since the code segment is padded to a sc_dataalign boundary, the data segment is aligned
@@ -811,7 +902,7 @@ SC_FUNC int assemble(FILE *fout,FILE *fin)
   nullchar='\0';
   for (nameofs=sizeof hdr; nameofs<hdr.cod; nameofs++)
     pc_writebin(fout,&nullchar,1);
-  nameofs=hdr.nametable+sizeof(int16_t);
+  nameofs=hdr.nametable+sizeof(int16_t)+hintsize;
 
   /* write the public functions table */
   count=0;
@@ -957,6 +1048,14 @@ SC_FUNC int assemble(FILE *fout,FILE *fin)
     align16(&count);
   #endif
   pc_writebin(fout,&count,sizeof count);
+  if (ovlhints!=NULL) {
+    #if BYTE_ORDER==BIG_ENDIAN
+      for (i=0; i<hintsize/(long)sizeof(uint16_t); i++)
+        align16(&ovlhints[i]);
+    #endif
+    pc_writebin(fout,ovlhints,(int)hintsize);
+    free(ovlhints);
+  } /* if */
 
   /* write the overlay table */
   if (pc_overlays>0) {
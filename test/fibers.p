@@ -0,0 +1,36 @@
+/* Fibers: spawn, yield and join */
+#include <console>
+#include <fiber>
+
+new trace[16]
+new count = 0
+
+forward worker(id, rounds)
+public worker(id, rounds)
+    {
+    for (new i = 0; i < rounds; i++)
+        {
+        trace[count++] = id * 10 + i
+        fiber_yield()
+        }
+    fiber_exit(id * 100)
+    }
+
+main()
+    {
+    new a = fiber_spawn("worker", 1, 3)
+    new b = fiber_spawn("worker", 2, 2)
+    trace[count++] = 0
+    fiber_yield()
+    trace[count++] = 0
+
+    new value_a, value_b
+    new bool: joined_a = fiber_join(a, value_a)
+    new bool: joined_b = fiber_join(b, value_b)
+    new bool: again = fiber_join(a)
+
+    print "order:"
+    for (new i = 0; i < count; i++)
+        printf " %d", trace[i]
+    printf "\njoin: %d %d, values: %d %d, join again: %d\n", joined_a, joined_b, value_a, value_b, again
+    }
@@ -0,0 +1,49 @@
+#include <console>
+
+sum(a, b, c)
+    return a + b + c
+
+addto(&target, value)
+    target += value
+
+main()
+    {
+    new values[10]
+    new total = 0
+    new i
+
+    /* compare + jzer, array indexing */
+    for (i = 0; i < 10; i++)
+        values[i] = i * i
+    for (i = 0; i <= 9; i++)
+        total += values[i]
+    printf "squares: %d\n", total
+
+    /* const + push, load.s + push, addr + push */
+    new a = 3, b = 4
+    addto(total, sum(a, b, 5))
+    printf "sum: %d\n", total
+
+    /* the other compare + jzer pairs */
+    new flags = 0
+    if (a == 3)
+        flags |= 1
+    if (a != b)
+        flags |= 2
+    if (b > a)
+        flags |= 4
+    if (b >= a)
+        flags |= 8
+    if (a == b)
+        flags |= 16
+    if (b < a)
+        flags |= 32
+    printf "flags: %d\n", flags
+
+    /* a jump into the middle of a fused sequence */
+    new count = 0
+    for (i = 10; i > 0; i--)
+        if (i % 3 == 0)
+            count++
+    printf "count: %d\n", count
+    }
@@ -0,0 +1,38 @@
+#include <console>
+#include <mailbox>
+
+new received = 0
+
+main()
+    {
+    new id = mailbox_id()
+    new first[3] = [11, 22, 33]
+    new second[1] = [44]
+    new bool: ok
+    ok = mailbox_send(id, first)
+    printf "send: %d\n", ok
+    ok = mailbox_send(id, second)
+    printf "send: %d\n", ok
+    ok = mailbox_sendstring(id, "hello")
+    printf "sendstring: %d\n", ok
+    ok = mailbox_send(id, first, 100000)
+    printf "oversized: %d\n", ok
+    ok = mailbox_send(-1, first)
+    printf "invalid mailbox: %d\n", ok
+    }
+
+@receive(source, const message[], size)
+    {
+    if (++received < 3)
+        {
+        printf "received %d cells:", size
+        for (new i = 0; i < size; i++)
+            printf " %d", message[i]
+        printf "\n"
+        }
+    else
+        {
+        printf "received \"%s\"\n", message
+        exit
+        }
+    }
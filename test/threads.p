@@ -0,0 +1,44 @@
+/* Per-machine state under concurrent execution: run it with prun_mt, which
+ * runs main() in several threads at the same time. Every abstract machine has
+ * its own property list and its own fibers; if any state were shared between
+ * the abstract machines, the threads would see each other's properties and
+ * main() would return a different value (or fail).
+ */
+#include <core>
+#include <fiber>
+
+const Workers = 4
+const Rounds = 10
+
+forward worker(id)
+public worker(id)
+    {
+    for (new i = 0; i < Rounds; i++)
+        {
+        setproperty(id, "count", getproperty(id, "count") + i)
+        fiber_yield()
+        }
+    fiber_exit(getproperty(id, "count"))
+    }
+
+main()
+    {
+    new fibers[Workers]
+    for (new id = 1; id <= Workers; id++)
+        {
+        setproperty(id, "count", (id - 1) * 1000)
+        fibers[id - 1] = fiber_spawn("worker", id)
+        }
+
+    new sum = 0
+    for (new id = 1; id <= Workers; id++)
+        {
+        new value
+        if (!fiber_join(fibers[id - 1], value))
+            return -1
+        if (deleteproperty(id, "count") != value)
+            return -2
+        sum += value
+        }
+    return sum
+    }
@@ -0,0 +1,44 @@
+#include <console>
+#include <time>
+
+new start
+new fired = 0
+new ticks = 0
+new killed
+
+main()
+    {
+    start = tickcount()
+    settimerex(450, "single", true, 450)
+    settimerex(100, "single", true, 100)
+    killed = settimerex(200, "single", true, 200)
+    settimerex(350, "single", true, 350)
+    settimerex(130, "repeat", false, 130)
+    settimer(200, true)
+    new bool: ok = killtimer(killed)
+    printf "kill: %d\n", ok
+    ok = killtimer(killed)
+    printf "kill again: %d\n", ok
+    }
+
+@timer()
+    {
+    printf "settimer 200%s\n", tickcount() - start < 200 ? " EARLY" : ""
+    }
+
+forward single(timer, payload)
+public single(timer, payload)
+    {
+    printf "single %d%s\n", payload, tickcount() - start < payload ? " EARLY" : ""
+    if (++fired == 3)
+        exit
+    }
+
+forward repeat(timer, payload)
+public repeat(timer, payload)
+    {
+    ticks++
+    printf "repeat %d (%d)%s\n", payload, ticks, tickcount() - start < payload * ticks ? " EARLY" : ""
+    if (ticks == 2)
+        killtimer(timer)
+    }